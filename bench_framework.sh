@@ -0,0 +1,121 @@
+#!/bin/bash
+# Measure what lil_test itself costs as suites get big
+# By Joel Savitz <jsavitz@redhat.com>
+#
+# Usage: bench_framework.sh [CASES]...
+#
+# For each size (default 1000 10000 100000 1000000) a suite is generated,
+# built and run, and one CSV row is printed with:
+#
+#   compile_s             Time to build the generated suite
+#   startup_us            exec() to the first test set, mostly the loader
+#   define_ms             TEST_SET_CONSTRUCTOR plus every TEST_CASE
+#                         registration, TEST_CHECK_SPACE's reallocs included
+#   define_ns_per_case
+#   execute_ms            The executor, including each case's name strcpy,
+#                         capture and PASS line (to /dev/null)
+#   dispatch_ns_per_case
+#   destroy_ms            TEST_SET_DESTRUCTOR
+#   peak_rss_kb           High water mark of the whole process
+#
+# Suites bigger than 1000 cases reuse 1000 distinct TEST_CASEs in a loop,
+# since a million nested functions won't compile in any reasonable time.
+# Registration and dispatch don't care whether a case is unique. The loop
+# count comes from the environment, so one build serves every size and
+# compile_s is only reported for the run that built it.
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" >/dev/null 2>&1 && pwd )"
+OUT="$DIR/bench_framework"
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:-"-g -Wall -Werror -std=gnu11 -pthread"}
+UNIQUE=1000
+
+SIZES=("$@")
+[ ${#SIZES[@]} -eq 0 ] && SIZES=(1000 10000 100000 1000000)
+
+mkdir -p "$OUT"
+
+# Write a suite of $1 distinct cases, run LIL_TEST_BENCH_REPEAT times over
+generate() {
+	local unique=$1
+
+	cat <<-HEADER
+	#define TEST_OPTION_TIMING
+	#include "lil_test.h"
+	#include <sys/resource.h>
+	#include <time.h>
+
+	// Runs before any TEST_SET, LIL_TEST_LAUNCH_US is when we were exec'd
+	static void __attribute__((constructor(101))) bench_started(void)
+	{
+		struct timespec ts ;
+		const char * launch = getenv("LIL_TEST_LAUNCH_US") ;
+
+		clock_gettime(CLOCK_REALTIME, &ts) ;
+		if (launch) fprintf(stderr, "STARTUP us=%lld\n",
+			ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 - atoll(launch)) ;
+	}
+
+	TEST_SET(bench,
+		int one = 1 ;
+		long repeat = atol(getenv("LIL_TEST_BENCH_REPEAT") ?: "1") ;
+		for (long rep = 0; rep < repeat; ++rep) {
+	HEADER
+
+	for ((i = 0; i < unique; ++i)); do
+		echo "		TEST_CASE(case_$i, ASSERT(one == 1)) ;"
+	done
+
+	cat <<-FOOTER
+		}
+	)
+
+	int main(void)
+	{
+		struct rusage usage ;
+
+		getrusage(RUSAGE_SELF, &usage) ;
+		fprintf(stderr, "RSS kb=%ld\n", usage.ru_maxrss) ;
+
+		return 0 ;
+	}
+	FOOTER
+}
+
+echo "cases,compile_s,startup_us,define_ms,define_ns_per_case,execute_ms," \
+     "dispatch_ns_per_case,destroy_ms,peak_rss_kb" | tr -d ' '
+
+for cases in "${SIZES[@]}"; do
+	unique=$(( cases < UNIQUE ? cases : UNIQUE ))
+	src="$OUT/suite_$unique.c"
+	bin="$OUT/suite_$unique"
+	compile_us=0
+
+	if [ ! -x "$bin" ] || [ "$bin" -ot "$DIR/src/lil_test.h" ]; then
+		generate "$unique" > "$src"
+
+		began=${EPOCHREALTIME/./}
+		$CC $CFLAGS -I"$DIR/src" "$src" -o "$bin" 2>/dev/null || {
+			echo "failed to build $src" >&2
+			exit 1
+		}
+		compile_us=$(( ${EPOCHREALTIME/./} - began ))
+	fi
+
+	report=$(LIL_TEST_BENCH_REPEAT=$(( cases / unique )) \
+		 LIL_TEST_LAUNCH_US=${EPOCHREALTIME/./} "$bin" 2>&1 >/dev/null)
+
+	echo "$report" | awk -v cases="$cases" -v compile_us="$compile_us" '
+		/^STARTUP/ { split($2, kv, "=") ; startup = kv[2] }
+		/^TIMING/  { for (i = 3; i <= NF; ++i) {
+				split($i, kv, "=") ; t[kv[1]] = kv[2] } }
+		/^RSS/     { split($2, kv, "=") ; rss = kv[2] }
+		END {
+			n = t["cases"] ? t["cases"] : 1
+			printf "%d,%.2f,%d,%.3f,%.1f,%.3f,%.1f,%.3f,%d\n",
+				t["cases"], compile_us / 1e6, startup,
+				t["define_ns"] / 1e6, t["define_ns"] / n,
+				t["execute_ns"] / 1e6, t["execute_ns"] / n,
+				t["destroy_ns"] / 1e6, rss
+		}'
+done
@@ -23,11 +23,69 @@
  */
 
 #include "lil_db.h"
+#include <errno.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 // The data object for this library. Sorta private-ish
 static lil_db_data_t db_data = {{ 0 }} ;
 
+// Everything needed to hand out durability, kept apart from db_data so that
+// lil_db_init doesn't powerwash it
+typedef struct lil_db_durability_data {
+	// What we promise about entries once they are written
+	lil_db_durability mode ;
+
+	// How often the syncer thread runs in LIL_DB_DURABILITY_PERIODIC
+	unsigned int period_ms ;
+
+	// Entries handed to the backend so far, doubles as a ticket counter
+	uint64_t appended ;
+
+	// Entries covered by a finished sync. Always <= appended
+	uint64_t synced ;
+
+	// Number of syncs actually issued
+	uint64_t syncs ;
+
+	// Nonzero while some thread is off in fdatasync()
+	int syncing ;
+
+	// Nonzero when the syncer thread should go home
+	int stopping ;
+
+	// Nonzero if syncer below is running
+	int has_syncer ;
+	pthread_t syncer ;
+} lil_db_durability_data_t ;
+
+static lil_db_durability_data_t db_durability = { 0 } ;
+
+// Entries held back by lil_db_capture_begin. Static, like everything else
+// in here, so capturing never allocates
+typedef struct lil_db_capture_data {
+	// Nonzero while entries should come here instead of the backend
+	int active ;
+
+	// Bytes captured so far. The newest LIL_DB_CAPTURE_SIZE of them are
+	// in buff, ending just before head % LIL_DB_CAPTURE_SIZE
+	uint64_t head ;
+
+	char buff[LIL_DB_CAPTURE_SIZE] ;
+} lil_db_capture_data_t ;
+
+static lil_db_capture_data_t db_capture = { 0 } ;
+
+// One entry at a time. Also guards db_durability and db_capture
+static pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER ;
+
+// Broadcast whenever a sync finishes or the syncer is told to stop
+static pthread_cond_t db_synced = PTHREAD_COND_INITIALIZER ;
+
 /* RETURN MACROS woo what fun */
 
 typedef enum lil_db_return_code {
@@ -112,6 +170,9 @@ int lil_db_init(char * filename, size_t string_length)
 	// Begin counting entries in the file at 0
 	db_data.entry_number = 0 ;
 
+	// Figure out how fast the TSC ticks so timestamps are cheap later
+	lil_db_clock_calibrate(&db_data.clock) ;
+
 	// There is nothing in the buffer, so it is 0 characters long
 	db_data.buff_length = 0 ;
 	
@@ -126,38 +187,626 @@ int lil_db_init(char * filename, size_t string_length)
 
 }
 
+// Initialize buffer and output ring
+int lil_db_init_ring(char * filename, size_t string_length, size_t ring_size)
+{
+	// Same powerwash and clock calibration as lil_db_init
+	memset(&db_data, 0, sizeof(db_data)) ;
+	strncpy(db_data.output_filename, filename, string_length) ;
+	lil_db_clock_calibrate(&db_data.clock) ;
+
+	// Map the ring. After this, writing an entry never enters the kernel
+	if (lil_db_ring_open(&db_data.output_ring, db_data.output_filename,
+			     ring_size)) {
+		return LIL_DB_RETURN_FILE_OPEN_ERROR(db_data.output_filename) ;
+	}
+
+	db_data.backend = LIL_DB_BACKEND_RING ;
+	db_data.is_valid = 1 ;
+
+	return LIL_DB_RETURN_SUCCESS ;
+}
+
+// Initialize buffer and batched output
+int lil_db_init_batched(char * filename, size_t string_length,
+			const lil_db_batch_config_t * config)
+{
+	// Same powerwash and clock calibration as lil_db_init
+	memset(&db_data, 0, sizeof(db_data)) ;
+	strncpy(db_data.output_filename, filename, string_length) ;
+	lil_db_clock_calibrate(&db_data.clock) ;
+
+	// Opens the file O_APPEND and tries to bring up io_uring
+	if (lil_db_batch_open(&db_data.output_batch, db_data.output_filename,
+			      config)) {
+		return LIL_DB_RETURN_FILE_OPEN_ERROR(db_data.output_filename) ;
+	}
+
+	db_data.backend = LIL_DB_BACKEND_BATCH ;
+	db_data.is_valid = 1 ;
+
+	return LIL_DB_RETURN_SUCCESS ;
+}
+
+// Make sure any entries a backend is holding on to have been written out
+// Caller holds db_lock
+static int lil_db_flush_unlocked(void)
+{
+	// Check validity of library state
+	if(!db_data.is_valid) return LIL_DB_RETURN_INVALID_STATE_ERROR
+		(__FUNCTION__) ;
+
+	switch (db_data.backend) {
+	case LIL_DB_BACKEND_BATCH:
+		if (lil_db_batch_flush(&db_data.output_batch)) {
+			return LIL_DB_RETURN_FILE_WRITE_ERROR
+				(db_data.output_filename) ;
+		}
+		break ;
+
+	case LIL_DB_BACKEND_RING:
+		// Every entry is already in the mapping
+		break ;
+
+	case LIL_DB_BACKEND_STDIO:
+	default:
+		if (fflush(db_data.output_filestream)) {
+			return LIL_DB_RETURN_FILE_WRITE_ERROR
+				(db_data.output_filename) ;
+		}
+		break ;
+	}
+
+	// Records for entries that are out should be out too
+	if (lil_db_index_flush(&db_data.index)) {
+		return LIL_DB_RETURN_FILE_WRITE_ERROR(db_data.output_filename) ;
+	}
+
+	return LIL_DB_RETURN_SUCCESS ;
+}
+
+// Make sure any entries a backend is holding on to have been written out
+int lil_db_flush(void)
+{
+	int ret ;
+
+	pthread_mutex_lock(&db_lock) ;
+	ret = lil_db_flush_unlocked() ;
+	pthread_mutex_unlock(&db_lock) ;
+
+	return ret ;
+}
+
+/* ROTATION */
+
+// Wait out a sync in flight. Its leader runs fdatasync outside db_lock on
+// an fd it copied, so that fd mustn't be closed under it. Caller holds
+// db_lock, which is let go while waiting
+static void lil_db_sync_wait_unlocked(void)
+{
+	while (db_durability.syncing) pthread_cond_wait(&db_synced, &db_lock) ;
+}
+
+// Move the output file aside and open a fresh one. Holding db_lock the
+// whole time means no entry can slip in between. Caller holds db_lock
+static int lil_db_rotate_files_unlocked(void)
+{
+	long segment ;
+	int ret, fd ;
+
+	// Case: A ring is a fixed size. There's nothing to rotate
+	if (db_data.is_valid && db_data.backend == LIL_DB_BACKEND_RING)
+		return INVALID_STATE_ERROR ;
+
+	lil_db_sync_wait_unlocked() ;
+
+	if (!db_data.is_valid) return LIL_DB_RETURN_INVALID_STATE_ERROR
+		("lil_db_rotate") ;
+
+	// Everything written so far belongs to the old segment
+	if ((ret = lil_db_flush_unlocked())) return ret ;
+
+	// And is the old segment's to make durable. Once it's closed, syncing
+	// the new one does nothing for the entries it holds
+	if (db_durability.mode != LIL_DB_DURABILITY_NONE) {
+		fd = db_data.backend == LIL_DB_BACKEND_BATCH
+		     ? db_data.output_batch.fd
+		     : fileno(db_data.output_filestream) ;
+		if (fdatasync(fd)) {
+			return LIL_DB_RETURN_FILE_WRITE_ERROR
+				(db_data.output_filename) ;
+		}
+		if (db_durability.appended > db_durability.synced)
+			db_durability.synced = db_durability.appended ;
+		db_durability.syncs++ ;
+		pthread_cond_broadcast(&db_synced) ;
+	}
+
+	segment = lil_db_rotate_rename(db_data.output_filename,
+				       &db_data.next_segment) ;
+	if (segment < 0) {
+		return LIL_DB_RETURN_FILE_WRITE_ERROR(db_data.output_filename) ;
+	}
+
+	// FILENAME.idx describes the segment now, so it follows it to .N.idx
+	if (db_data.index.stream
+	    && lil_db_index_rotate(&db_data.index, db_data.output_filename,
+				   segment)) {
+		return LIL_DB_RETURN_FILE_WRITE_ERROR(db_data.output_filename) ;
+	}
+
+	if (db_data.backend == LIL_DB_BACKEND_BATCH) {
+		if (lil_db_batch_reopen(&db_data.output_batch,
+					db_data.output_filename)) {
+			return LIL_DB_RETURN_FILE_OPEN_ERROR
+				(db_data.output_filename) ;
+		}
+	} else {
+		fclose(db_data.output_filestream) ;
+		db_data.output_filestream = fopen(db_data.output_filename,"a+") ;
+		if (!db_data.output_filestream) {
+			return LIL_DB_RETURN_FILE_OPEN_ERROR
+				(db_data.output_filename) ;
+		}
+	}
+
+	db_data.output_bytes = 0 ;
+	db_data.opened_ns = lil_db_clock_now_ns(&db_data.clock) ;
+
+	// The compressor thread does the heavy lifting, not us
+	if (db_data.rotation.compress)
+		lil_db_rotate_compress_enqueue(db_data.output_filename, segment) ;
+
+	return LIL_DB_RETURN_SUCCESS ;
+}
+
+// The above, as one span however it returns. Caller holds db_lock
+static int lil_db_rotate_unlocked(void)
+{
+	int ret ;
+
+	LIL_DB_SPAN_BEGIN("lil_db_rotate") ;
+	ret = lil_db_rotate_files_unlocked() ;
+	LIL_DB_SPAN_END() ;
+
+	return ret ;
+}
+
+// Rotate if the current output file has outgrown the rotation config.
+// Caller holds db_lock
+static int lil_db_maybe_rotate_unlocked(void)
+{
+	if (db_data.rotation.max_bytes
+	    && db_data.output_bytes >= db_data.rotation.max_bytes)
+		return lil_db_rotate_unlocked() ;
+
+	if (db_data.rotation.max_age_sec
+	    && lil_db_clock_now_ns(&db_data.clock) - db_data.opened_ns
+	       >= db_data.rotation.max_age_sec * 1000000000ULL)
+		return lil_db_rotate_unlocked() ;
+
+	return LIL_DB_RETURN_SUCCESS ;
+}
+
+// Rotate the output file when it gets too big or too old
+int lil_db_set_rotation(const lil_db_rotate_config_t * config)
+{
+	struct stat st ;
+	int ret = LIL_DB_RETURN_SUCCESS ;
+
+	pthread_mutex_lock(&db_lock) ;
+
+	if (!db_data.is_valid) {
+		ret = (LIL_DB_RETURN_INVALID_STATE_ERROR(__FUNCTION__)) ;
+	} else if (db_data.backend == LIL_DB_BACKEND_RING) {
+		ret = INVALID_STATE_ERROR ;
+	} else {
+		memset(&db_data.rotation, 0, sizeof(db_data.rotation)) ;
+		if (config) db_data.rotation = *config ;
+
+		// Whatever is already in the file counts towards max_bytes
+		db_data.output_bytes = stat(db_data.output_filename, &st)
+			? 0 : st.st_size ;
+		db_data.opened_ns = lil_db_clock_now_ns(&db_data.clock) ;
+	}
+
+	pthread_mutex_unlock(&db_lock) ;
+
+	if (!ret && config && config->compress
+	    && lil_db_rotate_compress_start()) {
+		ret = INVALID_STATE_ERROR ;
+	}
+
+	return ret ;
+}
+
+// Rotate the output file right now
+int lil_db_rotate(void)
+{
+	int ret ;
+
+	pthread_mutex_lock(&db_lock) ;
+	ret = lil_db_rotate_unlocked() ;
+	pthread_mutex_unlock(&db_lock) ;
+
+	return ret ;
+}
+
+/* INDEX */
+
+// Start writing FILENAME.idx for lil_db_query
+int lil_db_set_index(unsigned int interval)
+{
+	struct stat st ;
+	int ret = LIL_DB_RETURN_SUCCESS ;
+
+	pthread_mutex_lock(&db_lock) ;
+
+	if (!db_data.is_valid) {
+		ret = (LIL_DB_RETURN_INVALID_STATE_ERROR(__FUNCTION__)) ;
+	} else if (db_data.backend == LIL_DB_BACKEND_RING) {
+		ret = INVALID_STATE_ERROR ;
+	} else if (!(ret = lil_db_flush_unlocked())) {
+		// We append, so the first entry we index goes after whatever
+		// the file already holds
+		lil_db_index_close(&db_data.index) ;
+		if (lil_db_index_open(&db_data.index, db_data.output_filename,
+				      stat(db_data.output_filename, &st)
+				      ? 0 : st.st_size, interval)) {
+			ret = (LIL_DB_RETURN_FILE_OPEN_ERROR
+				(db_data.output_filename)) ;
+		}
+	}
+
+	pthread_mutex_unlock(&db_lock) ;
+
+	return ret ;
+}
+
+/* DURABILITY */
+
+// Wait until the first `ticket` entries are on disk. If lead is nonzero and
+// nobody else is syncing, do the sync ourselves, covering everything that
+// has been appended by anyone so far. Everyone who appended before we got
+// here rides along for free: that's the whole group commit trick.
+static int lil_db_sync_through(uint64_t ticket, int lead)
+{
+	int ret = 0, fd ;
+	uint64_t target ;
+	void * map ;
+	size_t map_size ;
+
+	pthread_mutex_lock(&db_lock) ;
+
+	while (db_durability.synced < ticket && !ret) {
+		// Case: A sync is in flight. It might cover us, wait and see
+		// Case: Not our job to start one, wait for the syncer thread
+		if (db_durability.syncing || (!lead && db_durability.has_syncer
+					      && !db_durability.stopping)) {
+			pthread_cond_wait(&db_synced, &db_lock) ;
+			continue ;
+		}
+
+		if (!db_data.is_valid) {
+			ret = INVALID_STATE_ERROR ;
+			break ;
+		}
+
+		// We're the leader for this round
+		db_durability.syncing = 1 ;
+		target = db_durability.appended ;
+
+		// Get anything the backend is sitting on into the kernel first
+		ret = lil_db_flush_unlocked() ;
+
+		fd = -1 ;
+		map = NULL ;
+		map_size = 0 ;
+		switch (db_data.backend) {
+		case LIL_DB_BACKEND_RING:
+			map = db_data.output_ring.map ;
+			map_size = db_data.output_ring.map_size ;
+			break ;
+		case LIL_DB_BACKEND_BATCH:
+			fd = db_data.output_batch.fd ;
+			break ;
+		case LIL_DB_BACKEND_STDIO:
+		default:
+			fd = fileno(db_data.output_filestream) ;
+			break ;
+		}
+
+		// The slow part happens without the lock, so other threads can
+		// keep appending and queue up for the next round
+		pthread_mutex_unlock(&db_lock) ;
+		LIL_DB_SPAN_BEGIN("lil_db_sync") ;
+		if (!ret && (map ? msync(map, map_size, MS_SYNC)
+				 : fdatasync(fd))) {
+			ret = (LIL_DB_RETURN_FILE_WRITE_ERROR
+				(db_data.output_filename)) ;
+		}
+		LIL_DB_SPAN_END() ;
+		pthread_mutex_lock(&db_lock) ;
+
+		db_durability.syncing = 0 ;
+		if (!ret) {
+			if (target > db_durability.synced)
+				db_durability.synced = target ;
+			db_durability.syncs++ ;
+		}
+		pthread_cond_broadcast(&db_synced) ;
+	}
+
+	pthread_mutex_unlock(&db_lock) ;
+
+	return ret ;
+}
+
+// Body of the syncer thread used by LIL_DB_DURABILITY_PERIODIC
+static void * lil_db_syncer(void * unused)
+{
+	struct timespec deadline ;
+	uint64_t ticket ;
+
+	pthread_mutex_lock(&db_lock) ;
+
+	while (!db_durability.stopping) {
+		clock_gettime(CLOCK_REALTIME, &deadline) ;
+		deadline.tv_sec += db_durability.period_ms / 1000 ;
+		deadline.tv_nsec += (db_durability.period_ms % 1000) * 1000000L ;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++ ;
+			deadline.tv_nsec -= 1000000000L ;
+		}
+
+		// Other syncs finishing wake us up too, so sleep until the
+		// deadline for real
+		while (!db_durability.stopping
+		       && pthread_cond_timedwait(&db_synced, &db_lock,
+						 &deadline) != ETIMEDOUT) ;
+
+		ticket = db_durability.appended ;
+		if (db_durability.stopping || !db_data.is_valid
+		    || db_durability.synced >= ticket)
+			continue ;
+
+		pthread_mutex_unlock(&db_lock) ;
+		lil_db_sync_through(ticket, 1) ;
+		pthread_mutex_lock(&db_lock) ;
+	}
+
+	pthread_mutex_unlock(&db_lock) ;
+
+	return unused ;
+}
+
+// Send the syncer thread home, if there is one. Caller must not hold db_lock
+static void lil_db_stop_syncer(void)
+{
+	pthread_mutex_lock(&db_lock) ;
+	if (!db_durability.has_syncer) {
+		pthread_mutex_unlock(&db_lock) ;
+		return ;
+	}
+	db_durability.stopping = 1 ;
+	pthread_cond_broadcast(&db_synced) ;
+	pthread_mutex_unlock(&db_lock) ;
+
+	pthread_join(db_durability.syncer, NULL) ;
+
+	pthread_mutex_lock(&db_lock) ;
+	db_durability.has_syncer = 0 ;
+	db_durability.stopping = 0 ;
+	pthread_cond_broadcast(&db_synced) ; // Periodic waiters must re-check
+	pthread_mutex_unlock(&db_lock) ;
+}
+
+// Choose what lil_db promises about entries once they are written
+int lil_db_set_durability(lil_db_durability mode, unsigned int period_ms)
+{
+	lil_db_stop_syncer() ;
+
+	pthread_mutex_lock(&db_lock) ;
+	db_durability.mode = mode ;
+	db_durability.period_ms = period_ms ? period_ms
+		: LIL_DB_DEFAULT_SYNC_PERIOD_MS ;
+
+	if (mode == LIL_DB_DURABILITY_PERIODIC) {
+		if (pthread_create(&db_durability.syncer, NULL,
+				   lil_db_syncer, NULL)) {
+			db_durability.mode = LIL_DB_DURABILITY_NONE ;
+			pthread_mutex_unlock(&db_lock) ;
+			return INVALID_STATE_ERROR ;
+		}
+		db_durability.has_syncer = 1 ;
+	}
+	pthread_mutex_unlock(&db_lock) ;
+
+	return LIL_DB_RETURN_SUCCESS ;
+}
+
+// Make every entry written so far durable, sharing a sync if one is running
+int lil_db_sync(void)
+{
+	uint64_t ticket ;
+
+	pthread_mutex_lock(&db_lock) ;
+	ticket = db_durability.appended ;
+	pthread_mutex_unlock(&db_lock) ;
+
+	return lil_db_sync_through(ticket, 1) ;
+}
+
+// Copy the durability counters into stats
+int lil_db_get_durability_stats(lil_db_durability_stats_t * stats)
+{
+	pthread_mutex_lock(&db_lock) ;
+	stats->appended = db_durability.appended ;
+	stats->synced = db_durability.synced ;
+	stats->syncs = db_durability.syncs ;
+	pthread_mutex_unlock(&db_lock) ;
+
+	return LIL_DB_RETURN_SUCCESS ;
+}
+
+// Copy the batching counters into stats
+int lil_db_get_batch_stats(lil_db_batch_stats_t * stats)
+{
+	// Check validity of library state
+	if(!db_data.is_valid) return LIL_DB_RETURN_INVALID_STATE_ERROR
+		(__FUNCTION__) ;
+
+	if (db_data.backend != LIL_DB_BACKEND_BATCH) return INVALID_STATE_ERROR ;
+
+	*stats = db_data.output_batch.stats ;
+
+	return LIL_DB_RETURN_SUCCESS ;
+}
+
+/* CAPTURE */
+
+// Copy the buffer into the capture ring and clear it. Caller holds db_lock
+static int lil_db_capture_unlocked(int number_chars_not_copied)
+{
+	size_t length = strnlen(db_data.buff, LIL_DB_DEFAULT_BUFFSZ), chunk,
+	       at = db_capture.head % LIL_DB_CAPTURE_SIZE ;
+
+	// At most two pieces, either side of the wrap
+	chunk = LIL_DB_CAPTURE_SIZE - at < length ? LIL_DB_CAPTURE_SIZE - at
+						  : length ;
+	memcpy(db_capture.buff + at, db_data.buff, chunk) ;
+	memcpy(db_capture.buff, db_data.buff + chunk, length - chunk) ;
+	db_capture.head += length ;
+
+	memset(db_data.buff,0,LIL_DB_DEFAULT_BUFFSZ) ;
+	db_data.buff_length = 0 ;
+
+	return LIL_DB_RETURN_SUCCESS_DATA(number_chars_not_copied) ;
+}
+
+// Hold entries in memory until lil_db_capture_end
+int lil_db_capture_begin(void)
+{
+	pthread_mutex_lock(&db_lock) ;
+	db_capture.active = 1 ;
+	db_capture.head = 0 ;
+	pthread_mutex_unlock(&db_lock) ;
+
+	return LIL_DB_RETURN_SUCCESS ;
+}
+
+// Stop capturing, writing what we got to dump if there is one
+long lil_db_capture_end(FILE * dump)
+{
+	uint64_t head ;
+	size_t at ;
+
+	pthread_mutex_lock(&db_lock) ;
+	db_capture.active = 0 ;
+	head = db_capture.head ;
+	at = head % LIL_DB_CAPTURE_SIZE ;
+
+	if (dump && head > LIL_DB_CAPTURE_SIZE) {
+		// Wrapped, so the oldest surviving byte is right at head
+		fprintf(dump, "[lil_db: %llu older bytes dropped]\n",
+			(unsigned long long)(head - LIL_DB_CAPTURE_SIZE)) ;
+		fwrite(db_capture.buff + at, 1, LIL_DB_CAPTURE_SIZE - at, dump) ;
+		fwrite(db_capture.buff, 1, at, dump) ;
+	} else if (dump) {
+		fwrite(db_capture.buff, 1, head, dump) ;
+	}
+
+	db_capture.head = 0 ;
+	pthread_mutex_unlock(&db_lock) ;
+
+	return head ;
+}
+
 // Append contents of buffer to file, clear buffer (fill with 0s)
-int lil_db_flush_buffer(int number_chars_not_copied)
+// Caller holds db_lock
+static int lil_db_flush_buffer_unlocked(int number_chars_not_copied)
 {
 	// Check validity of library state
 	if(!db_data.is_valid) return LIL_DB_RETURN_INVALID_STATE_ERROR
 		(__FUNCTION__) ;
 	
+	// Case: Somebody is capturing, the entry stays in memory for now
+	if (db_capture.active) return lil_db_capture_unlocked
+		(number_chars_not_copied) ;
+
 	// Write contents of buffer to output file
-	if (fprintf(db_data.output_filestream, "%s", db_data.buff ) < 0 ) {
-		// Case: There was an error writing to the file
-		return LIL_DB_RETURN_FILE_WRITE_ERROR(db_data.output_filename) ;
-	}	
+	switch (db_data.backend) {
+	case LIL_DB_BACKEND_RING:
+		// Just a memcpy into the mapping, the kernel does the rest
+		if (lil_db_ring_append(&db_data.output_ring, db_data.buff,
+				strnlen(db_data.buff, LIL_DB_DEFAULT_BUFFSZ))) {
+			return LIL_DB_RETURN_FILE_WRITE_ERROR
+				(db_data.output_filename) ;
+		}
+		break ;
+
+	case LIL_DB_BACKEND_BATCH:
+		// Staged now, written whenever the batch fills up or gets old
+		if (lil_db_batch_append(&db_data.output_batch, db_data.buff,
+				strnlen(db_data.buff, LIL_DB_DEFAULT_BUFFSZ))) {
+			return LIL_DB_RETURN_FILE_WRITE_ERROR
+				(db_data.output_filename) ;
+		}
+		break ;
+
+	case LIL_DB_BACKEND_STDIO:
+	default:
+		if (fprintf(db_data.output_filestream, "%s", db_data.buff ) < 0 ) {
+			// Case: There was an error writing to the file
+			return LIL_DB_RETURN_FILE_WRITE_ERROR
+				(db_data.output_filename) ;
+		}
+		break ;
+	}
+
+	// Count it towards rotation
+	db_data.output_bytes += strnlen(db_data.buff, LIL_DB_DEFAULT_BUFFSZ) ;
 
 	// Wipe buffer
 	memset(db_data.buff,0,LIL_DB_DEFAULT_BUFFSZ) ;
 	// It now contains 0 characters :)
 	db_data.buff_length = 0 ;
 
+	// Case: That entry made the file too big (or it was already too old)
+	if ((db_data.rotation.max_bytes || db_data.rotation.max_age_sec)
+	    && lil_db_maybe_rotate_unlocked()) {
+		return FILE_WRITE_ERROR ;
+	}
+
 	return LIL_DB_RETURN_SUCCESS_DATA(number_chars_not_copied) ;
 }
 
-// Perform the actions of lil_db_enqueue and subsequently lil_db_flush,
-// but as a new entry
-int lil_db_printf(lil_db_option options, char * format, ...)
+// Append contents of buffer to file, clear buffer (fill with 0s)
+int lil_db_flush_buffer(int number_chars_not_copied)
+{
+	int ret ;
+
+	pthread_mutex_lock(&db_lock) ;
+	ret = lil_db_flush_buffer_unlocked(number_chars_not_copied) ;
+	pthread_mutex_unlock(&db_lock) ;
+
+	return ret ;
+}
+
+// Format a new entry into the buffer and flush it. If tag isn't NULL it
+// goes right before the user's text. Caller holds db_lock
+static int lil_db_vprintf_unlocked(lil_db_option options, const char * tag,
+				   char * format, va_list va_args)
 {
 	// Check validity of library state
 	if(!db_data.is_valid) return LIL_DB_RETURN_INVALID_STATE_ERROR
-		(__FUNCTION__) ;
+		("lil_db_printf") ;
 
 	int number_chars_copied, number_chars_not_copied,
 	    complete_string_length, available_buffer_space ;
-	va_list va_args ;
+
+	// The number this entry gets if it's NUMBERED, for the index
+	unsigned int entry = db_data.entry_number ;
 
 
 	// Case: The user requests __EMPHASIS__
@@ -184,12 +833,36 @@ int lil_db_printf(lil_db_option options, char * format, ...)
 			"[%d]. ",			// A formatted int
 			db_data.entry_number++		// From internal data
 		) ;
+		available_buffer_space = LIL_DB_DEFAULT_BUFFSZ + 1
+			- db_data.buff_length ;
+	}
+
+	// Case: The user wants to know when this happened
+	if (options & LIL_DB_OPTION_TIMESTAMP) {
+		// No clock_gettime or strftime here, just rdtsc and some math.
+		// Left out if it won't fit
+		db_data.buff_length += lil_db_clock_format(
+			lil_db_clock_now_ns(&db_data.clock),
+			db_data.buff + db_data.buff_length,
+			available_buffer_space
+		) ;
 	}
 
 	// Recalculate this value, as buff_length has changed
 	available_buffer_space = LIL_DB_DEFAULT_BUFFSZ + 1 - db_data.buff_length ;
 
-	va_start(va_args,format) ;
+	// Case: The entry came through a call site with a level
+	if (tag) {
+		db_data.buff_length += snprintf(
+			db_data.buff			// Write to primary buffer
+				+ db_data.buff_length,  // Offset by length
+			available_buffer_space,		// Don't overflow
+			"%s",				// Just a string
+			tag				// e.g. "[WARN] "
+		) ;
+		available_buffer_space = LIL_DB_DEFAULT_BUFFSZ + 1
+			- db_data.buff_length ;
+	}
 
 	// TODO: force newline?
 
@@ -201,8 +874,6 @@ int lil_db_printf(lil_db_option options, char * format, ...)
 			format,				// with this fmt string
 			va_args				// and the corresponding args
 		) ;
-
-	va_end(va_args) ;
 	
 	// Case: vsnprintf failed. Something is wrong with the object
 	if (complete_string_length < 0) {
@@ -215,19 +886,95 @@ int lil_db_printf(lil_db_option options, char * format, ...)
 	// Complement the above
 	number_chars_not_copied = complete_string_length - number_chars_copied ;
 
+	// Case: Somebody wants to find this entry again later
+	if (db_data.index.stream && !db_capture.active
+	    && lil_db_index_add(&db_data.index, entry,
+				lil_db_index_due(&db_data.index)
+				? lil_db_clock_now_ns(&db_data.clock) : 0,
+				strnlen(db_data.buff, LIL_DB_DEFAULT_BUFFSZ))) {
+		return LIL_DB_RETURN_FILE_WRITE_ERROR(db_data.output_filename) ;
+	}
+
 	// Append buffer to file, clear it, and return result of that operation
 	// Report on leftover uncopied chars
-	return lil_db_flush_buffer(number_chars_not_copied) ;
+	return lil_db_flush_buffer_unlocked(number_chars_not_copied) ;
 }
 
-int lil_db_kill(void)
+
+// Format and write one entry, then wait for it to hit the disk if it asked
+// to be durable. Shared by lil_db_printf and lil_db_log
+static int lil_db_vwrite(lil_db_option options, const char * tag,
+			 char * format, va_list va_args)
+{
+	uint64_t ticket ;
+	int ret ;
+
+	// The gap before lil_db_append is time spent waiting for the lock
+	LIL_DB_SPAN_BEGIN("lil_db_write") ;
+
+	// One entry at a time, please
+	pthread_mutex_lock(&db_lock) ;
+	LIL_DB_SPAN_BEGIN("lil_db_append") ;
+	ret = lil_db_vprintf_unlocked(options, tag, format, va_args) ;
+	LIL_DB_SPAN_END() ;
+	ticket = ++db_durability.appended ; // This entry's place in line
+	pthread_mutex_unlock(&db_lock) ;
+
+	// Case: The user wants this one to survive a power cut. Outside the
+	// lock, so that other threads can pile in behind us and share the sync
+	if ((options & LIL_DB_OPTION_DURABLE)
+	    && db_durability.mode != LIL_DB_DURABILITY_NONE
+	    && lil_db_sync_through(ticket, db_durability.mode
+				   == LIL_DB_DURABILITY_GROUP_COMMIT)) {
+		ret = FILE_WRITE_ERROR ;
+	}
+
+	LIL_DB_SPAN_END() ;
+
+	return ret ;
+}
+
+// Perform the actions of lil_db_enqueue and subsequently lil_db_flush,
+// but as a new entry
+int lil_db_printf(lil_db_option options, char * format, ...)
+{
+	va_list va_args ;
+	int ret ;
+
+	va_start(va_args,format) ;
+	ret = lil_db_vwrite(options, NULL, format, va_args) ;
+	va_end(va_args) ;
+
+	return ret ;
+}
+
+// Close whatever the backend has open. Caller holds db_lock
+static int lil_db_kill_unlocked(void)
 {
 	// Check validity of library state
 	if(!db_data.is_valid) return LIL_DB_RETURN_INVALID_STATE_ERROR
 		("You cannot kill what is already dead") ;
 
+	// Not while a leader is syncing what we're about to close
+	lil_db_sync_wait_unlocked() ;
+	if(!db_data.is_valid) return LIL_DB_RETURN_INVALID_STATE_ERROR
+		("You cannot kill what is already dead") ;
+
 	// This is really all I need to clean up
-	fclose(db_data.output_filestream) ; 
+	switch (db_data.backend) {
+	case LIL_DB_BACKEND_RING:
+		lil_db_ring_close(&db_data.output_ring) ;
+		break ;
+	case LIL_DB_BACKEND_BATCH:
+		// Writes out whatever is still staged
+		lil_db_batch_close(&db_data.output_batch) ;
+		break ;
+	case LIL_DB_BACKEND_STDIO:
+	default:
+		fclose(db_data.output_filestream) ; 
+		break ;
+	}
+	lil_db_index_close(&db_data.index) ;
 	
 	// Without an active output filestream, the library is in an invalid state
 	db_data.is_valid = 0 ;
@@ -235,6 +982,151 @@ int lil_db_kill(void)
 	return LIL_DB_RETURN_SUCCESS ;
 }
 
+/* LEVELS AND CALL SITES */
+
+// Every LIL_DB_<LEVEL>() site in the program, courtesy of the linker. Weak,
+// since a program without any sites won't have the section at all
+extern lil_db_site_t __start_lil_db_sites[] __attribute__((weak)) ;
+extern lil_db_site_t __stop_lil_db_sites[] __attribute__((weak)) ;
+
+// Indexed by level, what goes in front of the entry
+static const char * const lil_db_level_tags[] = {
+	"[TRACE] ", "[DEBUG] ", "[INFO] ", "[WARN] ", "[ERROR] ", "[FATAL] "
+} ;
+
+// Write an entry tagged with the level of its call site
+int lil_db_log(lil_db_site_t * site, int options, char * format, ...)
+{
+	va_list va_args ;
+	int ret ;
+
+	va_start(va_args,format) ;
+	ret = lil_db_vwrite(options,
+		(unsigned int)site->level <= LIL_DB_LEVEL_FATAL
+			? lil_db_level_tags[site->level] : NULL,
+		format, va_args) ;
+	va_end(va_args) ;
+
+	return ret ;
+}
+
+// Take a token out of the site's bucket if there is one. The bucket is the
+// time it will be full again, see lil_db_site_t, so a single compare and
+// swap both refills it and takes the token
+int lil_db_site_take_token(lil_db_site_t * site)
+{
+	struct timespec ts ;
+	uint32_t rate = __atomic_load_n(&site->rate_per_sec, __ATOMIC_RELAXED),
+		 burst = __atomic_load_n(&site->burst, __ATOMIC_RELAXED) ;
+	uint64_t now, cost, depth, full, next ;
+
+	if (!rate) return 1 ;
+
+	// Coarse is plenty for a rate limit and comes straight from the vDSO
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) ;
+	now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec ;
+
+	// What one token takes to come back, and a full bucket's worth
+	cost = 1000000000ULL / rate ;
+	depth = (uint64_t)(burst ? burst : 1) * cost ;
+
+	full = __atomic_load_n(&site->full_ns, __ATOMIC_RELAXED) ;
+	do {
+		// Anything before now was refilled while nobody was looking
+		next = (full > now ? full : now) + cost ;
+		if (next - now > depth) {
+			__atomic_fetch_add(&site->dropped, 1, __ATOMIC_RELAXED) ;
+			return 0 ;
+		}
+	} while (!__atomic_compare_exchange_n(&site->full_ns, &full, next, 1,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED)) ;
+
+	return 1 ;
+}
+
+// Enable sites at or above level and disable the rest
+int lil_db_set_level(int level)
+{
+	int count = 0 ;
+
+	for (lil_db_site_t * site = __start_lil_db_sites;
+	     site && site < __stop_lil_db_sites; ++site) {
+		__atomic_store_n(&site->enabled, site->level >= level,
+				 __ATOMIC_RELAXED) ;
+		count += site->enabled ;
+	}
+
+	return count ;
+}
+
+// Nonzero if site is in file (any file if NULL) on line (any line if 0)
+static int lil_db_site_matches(const lil_db_site_t * site, const char * file,
+			       int line)
+{
+	return (!file || !strcmp(site->file, file))
+		&& (!line || site->line == line) ;
+}
+
+// Enable or disable matching sites
+int lil_db_site_enable(const char * file, int line, int enabled)
+{
+	int count = 0 ;
+
+	for (lil_db_site_t * site = __start_lil_db_sites;
+	     site && site < __stop_lil_db_sites; ++site) {
+		if (!lil_db_site_matches(site, file, line)) continue ;
+		__atomic_store_n(&site->enabled, !!enabled, __ATOMIC_RELAXED) ;
+		count++ ;
+	}
+
+	return count ;
+}
+
+// Change the rate limit and sampling of matching sites
+int lil_db_site_limit(const char * file, int line, uint32_t rate_per_sec,
+		      uint32_t burst, uint32_t sample_every)
+{
+	int count = 0 ;
+
+	pthread_mutex_lock(&db_lock) ;
+	for (lil_db_site_t * site = __start_lil_db_sites;
+	     site && site < __stop_lil_db_sites; ++site) {
+		if (!lil_db_site_matches(site, file, line)) continue ;
+		site->rate_per_sec = rate_per_sec ;
+		site->burst = burst ;
+		site->sample_every = sample_every ;
+		// Start with a full bucket
+		__atomic_store_n(&site->full_ns, 0, __ATOMIC_RELAXED) ;
+		count++ ;
+	}
+	pthread_mutex_unlock(&db_lock) ;
+
+	return count ;
+}
+
+int lil_db_kill(void)
+{
+	int ret ;
+
+	// Metrics get one last dump, and durable modes one last sync, before
+	// the lights go out
+	lil_db_metrics_stop() ;
+	lil_db_stop_syncer() ;
+	if (db_durability.mode != LIL_DB_DURABILITY_NONE && db_data.is_valid)
+		lil_db_sync() ;
+	lil_db_set_durability(LIL_DB_DURABILITY_NONE, 0) ;
+
+	pthread_mutex_lock(&db_lock) ;
+	ret = lil_db_kill_unlocked() ;
+	pthread_mutex_unlock(&db_lock) ;
+
+	// Finish squashing any rotated segments before we go
+	lil_db_rotate_compress_stop() ;
+
+	return ret ;
+}
+
 int lil_db_is_not_valid(void)
 {
 	// Extremely straightforward function
@@ -26,7 +26,16 @@
 #define LIL_DB_H
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include "lil_db_ring.h"
+#include "lil_db_batch.h"
+#include "lil_db_clock.h"
+#include "lil_db_level.h"
+#include "lil_db_rotate.h"
+#include "lil_db_index.h"
+#include "lil_db_metrics.h"
+#include "lil_db_trace.h"
 
 #define LIL_DB_DEFAULT_BUFFSZ 247
 
@@ -35,6 +44,13 @@
 
 // Note to self: Keep it simple and don't dynamically allocate any memory
 
+// Where entries go once they leave the buffer
+typedef enum lil_db_backend {
+	LIL_DB_BACKEND_STDIO = 0,		// plain old fprintf to a FILE *
+	LIL_DB_BACKEND_RING,			// mmap'd ring, survives crashes
+	LIL_DB_BACKEND_BATCH			// io_uring/writev in batches
+} lil_db_backend ;
+
 // Library data format
 typedef struct lil_db_data {
 	// Name of output file, can be long if that's what you're in the mood for
@@ -46,6 +62,30 @@ typedef struct lil_db_data {
 	// The filestream to write output to
 	FILE * output_filestream ;
 
+	// The ring to write output to when backend is LIL_DB_BACKEND_RING
+	lil_db_ring_t output_ring ;
+
+	// The batcher to write output to when backend is LIL_DB_BACKEND_BATCH
+	lil_db_batch_t output_batch ;
+
+	// Which of the above entries are written to
+	lil_db_backend backend ;
+
+	// Calibrated at init, turns TSC readings into LIL_DB_OPTION_TIMESTAMPs
+	lil_db_clock_t clock ;
+
+	// When to move the output file aside and start a new one
+	lil_db_rotate_config_t rotation ;
+
+	// Bytes in the current output file, and when we started writing it
+	uint64_t output_bytes, opened_ns ;
+
+	// Where to start looking for a free FILENAME.N on the next rotation
+	unsigned long next_segment ;
+
+	// Sparse FILENAME.idx for lil_db_query, off unless lil_db_set_index
+	lil_db_index_t index ;
+
 	// Entry number in output file
 	unsigned int entry_number ; 
 
@@ -63,15 +103,51 @@ typedef struct lil_db_data {
 typedef enum lil_db_option {
 	LIL_DB_OPTION_DEFAULT  = 0x0, 		// raw vsnprintfing
 	LIL_DB_OPTION_EMPHASIS = 0x1,		// enhanced vsnprintfing
-	LIL_DB_OPTION_NUMBERED = 0x2      	// slap a nice looking number in the front
+	LIL_DB_OPTION_NUMBERED = 0x2,      	// slap a nice looking number in the front
+	LIL_DB_OPTION_DURABLE  = 0x4,		// don't return until it's on disk
+	LIL_DB_OPTION_TIMESTAMP = 0x8		// [seconds.nanoseconds] since epoch
 } lil_db_option ;
 
+// How hard lil_db tries to get entries onto the disk
+typedef enum lil_db_durability {
+	LIL_DB_DURABILITY_NONE = 0,		// whenever the kernel feels like it
+	LIL_DB_DURABILITY_PERIODIC,		// a thread syncs every period_ms,
+						// DURABLE entries wait for it
+	LIL_DB_DURABILITY_GROUP_COMMIT		// DURABLE entries share one sync
+						// with everyone queued before it
+} lil_db_durability ;
+
+#define LIL_DB_DEFAULT_SYNC_PERIOD_MS 1000
+
+// How much lil_db_capture_begin holds on to. Past this, the oldest
+// captured bytes are dropped
+#define LIL_DB_CAPTURE_SIZE (64 << 10)
+
+// Counters for checking how well group commit is working
+typedef struct lil_db_durability_stats {
+	uint64_t appended ;	// entries written by lil_db_printf
+	uint64_t synced ;	// entries known to be on disk
+	uint64_t syncs ;	// fdatasync()/msync() calls made
+} lil_db_durability_stats_t ;
+
 // All functions return 0 on success and nonzero on failure unless otherwise specified
 // See implementation for details
+//
+// Entries are serialized internally, so lil_db_printf, lil_db_flush and
+// lil_db_sync may be called from any number of threads at once
  
 // Initialize buffer and output filestream, may fix an invalid library state
 int lil_db_init(char * filename, size_t string_length) ;
 
+// Like lil_db_init, but entries go to a crash-resilient ring file of
+// ring_size bytes. Use lil_db_recover to read the ring back out.
+int lil_db_init_ring(char * filename, size_t string_length, size_t ring_size) ;
+
+// Like lil_db_init, but entries are gathered into batches and written with
+// one io_uring submission (or one writev) per batch. config may be NULL.
+int lil_db_init_batched(char * filename, size_t string_length,
+			const lil_db_batch_config_t * config) ;
+
 // Clean up before the program terminates
 int lil_db_kill(void) ;
 
@@ -82,6 +158,45 @@ int lil_db_is_not_valid(void) ;
 // Append contents of buffer to file, clear buffer (fill with 0s)
 int lil_db_flush_buffer(int number_chars_not_copied) ;
 
+// Make sure any entries a backend is holding on to have been written out
+int lil_db_flush(void) ;
+
+// Rotate the output file when it gets too big or too old, see
+// lil_db_rotate.h. Call after lil_db_init, NULL turns rotation off.
+// Not supported by the ring backend, which never grows anyway
+int lil_db_set_rotation(const lil_db_rotate_config_t * config) ;
+
+// Rotate the output file right now
+int lil_db_rotate(void) ;
+
+// Write a record to FILENAME.idx every interval entries (0 for the default)
+// so lil_db_query can seek instead of scanning, see lil_db_index.h. Call
+// after lil_db_init. Not supported by the ring backend, which wraps anyway
+int lil_db_set_index(unsigned int interval) ;
+
+// Copy the batching counters into stats, fails unless the backend is batched
+int lil_db_get_batch_stats(lil_db_batch_stats_t * stats) ;
+
+// Choose what LIL_DB_OPTION_DURABLE means, see lil_db_durability. Call it
+// after lil_db_init, since lil_db_kill goes back to LIL_DB_DURABILITY_NONE.
+// period_ms is only used by LIL_DB_DURABILITY_PERIODIC, 0 for the default.
+int lil_db_set_durability(lil_db_durability mode, unsigned int period_ms) ;
+
+// Get every entry written so far onto the disk, joining a sync in progress
+int lil_db_sync(void) ;
+
+// Copy the durability counters into stats
+int lil_db_get_durability_stats(lil_db_durability_stats_t * stats) ;
+
+// Until lil_db_capture_end, entries go to an in-memory ring of
+// LIL_DB_CAPTURE_SIZE bytes instead of the output file. lil_test uses this
+// to keep quiet about cases that pass
+int lil_db_capture_begin(void) ;
+
+// Stop capturing. If dump isn't NULL, write what was captured to it,
+// otherwise just drop it. Returns the number of bytes captured
+long lil_db_capture_end(FILE * dump) ;
+
 // Perform the actions of lil_db_enqueue and subsequently lil_db_flush, but as a new entry
 int lil_db_printf(lil_db_option options, char * format, ...) ;
 
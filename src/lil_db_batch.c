@@ -0,0 +1,377 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_batch.c source file
+ * Batched output backend for lil_db: io_uring with a writev fallback
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#include "lil_db_batch.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// No liburing here, just the raw syscalls
+#define lil_db_io_uring_setup(entries, params) 				       \
+		((int)syscall(__NR_io_uring_setup, (entries), (params)))
+#define lil_db_io_uring_enter(fd, to_submit, min_complete, flags) 	       \
+		((int)syscall(__NR_io_uring_enter, (fd), (to_submit),	       \
+			      (min_complete), (flags), NULL, 0))
+#define lil_db_io_uring_register(fd, opcode, arg, nr_args) 		       \
+		((int)syscall(__NR_io_uring_register, (fd), (opcode), (arg),   \
+			      (nr_args)))
+
+// A batch is written and reaped before the next one, so this is plenty
+#define LIL_DB_BATCH_RING_ENTRIES 4
+
+// Cheap clock for batch age, served by the vDSO
+static uint64_t lil_db_batch_now_ms(void)
+{
+	struct timespec ts ;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) ;
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 ;
+}
+
+// Tear down whatever part of io_uring has been set up and fall back to writev()
+static void lil_db_batch_uring_teardown(lil_db_batch_t * batch)
+{
+	if (batch->sqes) munmap(batch->sqes, batch->sqes_size) ;
+	if (batch->cq_map && batch->cq_map != batch->sq_map)
+		munmap(batch->cq_map, batch->cq_map_size) ;
+	if (batch->sq_map) munmap(batch->sq_map, batch->sq_map_size) ;
+	if (batch->ring_fd >= 0) close(batch->ring_fd) ;
+
+	batch->sqes = NULL ;
+	batch->sq_map = batch->cq_map = NULL ;
+	batch->ring_fd = -1 ;
+	batch->registered = 0 ;
+	batch->stats.using_io_uring = 0 ;
+}
+
+// Set up an io_uring and register the staging area with it. On any failure
+// the batch is left on the writev() path, which always works.
+static void lil_db_batch_uring_setup(lil_db_batch_t * batch)
+{
+	struct io_uring_params params ;
+	struct iovec staging = { batch->staging, batch->config.max_bytes } ;
+
+	memset(&params, 0, sizeof(params)) ;
+
+	batch->ring_fd = lil_db_io_uring_setup(LIL_DB_BATCH_RING_ENTRIES, &params) ;
+	if (batch->ring_fd < 0) {
+		batch->ring_fd = -1 ;
+		return ;
+	}
+
+	batch->sq_map_size = params.sq_off.array
+		+ params.sq_entries * sizeof(unsigned int) ;
+	batch->cq_map_size = params.cq_off.cqes
+		+ params.cq_entries * sizeof(struct io_uring_cqe) ;
+
+	// Newer kernels let both rings share one mapping
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (batch->cq_map_size > batch->sq_map_size)
+			batch->sq_map_size = batch->cq_map_size ;
+		batch->cq_map_size = batch->sq_map_size ;
+	}
+
+	batch->sq_map = mmap(NULL, batch->sq_map_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, batch->ring_fd,
+			     IORING_OFF_SQ_RING) ;
+	if (batch->sq_map == MAP_FAILED) {
+		batch->sq_map = NULL ;
+		lil_db_batch_uring_teardown(batch) ;
+		return ;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		batch->cq_map = batch->sq_map ;
+	} else {
+		batch->cq_map = mmap(NULL, batch->cq_map_size,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, batch->ring_fd,
+				     IORING_OFF_CQ_RING) ;
+		if (batch->cq_map == MAP_FAILED) {
+			batch->cq_map = NULL ;
+			lil_db_batch_uring_teardown(batch) ;
+			return ;
+		}
+	}
+
+	batch->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe) ;
+	batch->sqes = mmap(NULL, batch->sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, batch->ring_fd,
+			   IORING_OFF_SQES) ;
+	if (batch->sqes == MAP_FAILED) {
+		batch->sqes = NULL ;
+		lil_db_batch_uring_teardown(batch) ;
+		return ;
+	}
+
+	batch->sq_head  = (unsigned int *)(batch->sq_map + params.sq_off.head) ;
+	batch->sq_tail  = (unsigned int *)(batch->sq_map + params.sq_off.tail) ;
+	batch->sq_mask  = (unsigned int *)(batch->sq_map + params.sq_off.ring_mask) ;
+	batch->sq_array = (unsigned int *)(batch->sq_map + params.sq_off.array) ;
+	batch->cq_head  = (unsigned int *)(batch->cq_map + params.cq_off.head) ;
+	batch->cq_tail  = (unsigned int *)(batch->cq_map + params.cq_off.tail) ;
+	batch->cq_mask  = (unsigned int *)(batch->cq_map + params.cq_off.ring_mask) ;
+	batch->cqes = (struct io_uring_cqe *)(batch->cq_map + params.cq_off.cqes) ;
+
+	// The file is O_APPEND so the offset is ignored, but kernels that know
+	// about -1 get told to use the file position anyway
+	batch->write_offset = (params.features & IORING_FEAT_RW_CUR_POS)
+		? (uint64_t)-1 : 0 ;
+
+	// Registered buffers skip the page pinning on every write. This can
+	// fail on a low RLIMIT_MEMLOCK, in which case we use IORING_OP_WRITEV
+	batch->registered = !lil_db_io_uring_register(batch->ring_fd,
+		IORING_REGISTER_BUFFERS, &staging, 1) ;
+
+	batch->stats.using_io_uring = 1 ;
+}
+
+// Push one batch through io_uring and wait for it. Returns bytes written
+// or a negative errno, same as the CQE. *submitted is nonzero if the kernel
+// took the SQE, in which case nothing else may write the batch until its
+// CQE is reaped: it could still land.
+static long lil_db_batch_uring_write(lil_db_batch_t * batch, int * submitted)
+{
+	unsigned int tail = *batch->sq_tail, head, index ;
+	struct io_uring_sqe * sqe ;
+	long res ;
+
+	index = tail & *batch->sq_mask ;
+	sqe = &batch->sqes[index] ;
+	memset(sqe, 0, sizeof(*sqe)) ;
+
+	sqe->fd = batch->fd ;
+	sqe->off = batch->write_offset ;
+	if (batch->registered) {
+		// Everything staged is contiguous, so one fixed write covers it
+		sqe->opcode = IORING_OP_WRITE_FIXED ;
+		sqe->addr = (uint64_t)(uintptr_t)batch->staging ;
+		sqe->len = batch->staged_bytes ;
+		sqe->buf_index = 0 ;
+	} else {
+		sqe->opcode = IORING_OP_WRITEV ;
+		sqe->addr = (uint64_t)(uintptr_t)batch->iov ;
+		sqe->len = batch->staged_entries ;
+	}
+
+	batch->sq_array[index] = index ;
+	__atomic_store_n(batch->sq_tail, tail + 1, __ATOMIC_RELEASE) ;
+
+	// Submit and wait in the same syscall, as often as it takes. The
+	// kernel moves sq_head past the SQE once it has taken it, so a retry
+	// after a signal only submits it if it wasn't already
+	for (;;) {
+		*submitted = __atomic_load_n(batch->sq_head, __ATOMIC_ACQUIRE)
+			     != tail ;
+
+		head = *batch->cq_head ;
+		if (head != __atomic_load_n(batch->cq_tail, __ATOMIC_ACQUIRE))
+			break ;
+
+		batch->stats.syscalls++ ;
+		if (lil_db_io_uring_enter(batch->ring_fd, !*submitted, 1,
+					  IORING_ENTER_GETEVENTS) >= 0
+		    || errno == EINTR || errno == EAGAIN)
+			continue ;
+
+		// Case: Never taken. Take it back, so it can't go out later
+		// behind whatever writes the batch instead
+		if (!*submitted) {
+			__atomic_store_n(batch->sq_tail, tail, __ATOMIC_RELEASE) ;
+			return -errno ;
+		}
+
+		// Case: Taken, and there's no waiting for it. Anything could
+		// have made it out
+		return -errno ;
+	}
+
+	res = batch->cqes[head & *batch->cq_mask].res ;
+	__atomic_store_n(batch->cq_head, head + 1, __ATOMIC_RELEASE) ;
+
+	// A write that failed wrote nothing, so the batch is free to go again
+	if (res < 0) *submitted = 0 ;
+
+	return res ;
+}
+
+int lil_db_batch_open(lil_db_batch_t * batch, const char * filename,
+		      const lil_db_batch_config_t * config)
+{
+	memset(batch, 0, sizeof(*batch)) ;
+	batch->ring_fd = -1 ;
+
+	if (config) batch->config = *config ;
+	if (!batch->config.max_entries)
+		batch->config.max_entries = LIL_DB_BATCH_DEFAULT_ENTRIES ;
+	if (batch->config.max_entries > LIL_DB_BATCH_MAX_ENTRIES)
+		batch->config.max_entries = LIL_DB_BATCH_MAX_ENTRIES ;
+	if (!batch->config.max_bytes)
+		batch->config.max_bytes = LIL_DB_BATCH_DEFAULT_BYTES ;
+	if (!batch->config.max_age_ms)
+		batch->config.max_age_ms = LIL_DB_BATCH_DEFAULT_AGE_MS ;
+
+	batch->fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+			 0644) ;
+	if (batch->fd < 0) return 1 ;
+
+	batch->staging = mmap(NULL, batch->config.max_bytes,
+			      PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) ;
+	if (batch->staging == MAP_FAILED) {
+		close(batch->fd) ;
+		return 1 ;
+	}
+
+	if (!batch->config.disable_io_uring) lil_db_batch_uring_setup(batch) ;
+
+	return 0 ;
+}
+
+int lil_db_batch_flush(lil_db_batch_t * batch)
+{
+	unsigned int first = 0, n = batch->staged_entries ;
+	size_t written = 0 ;
+	int submitted = 0 ;
+	long res ;
+
+	if (!batch->staged_entries) return 0 ;
+
+	if (batch->ring_fd >= 0) {
+		res = lil_db_batch_uring_write(batch, &submitted) ;
+
+		if (res >= 0) {
+			written = res ;
+		} else if (submitted) {
+			// Case: In flight with nobody to reap it. Writing it
+			// again could write it twice, so the batch is lost
+			lil_db_batch_uring_teardown(batch) ;
+			batch->staged_entries = 0 ;
+			batch->staged_bytes = 0 ;
+			return 1 ;
+		} else if (res != -EINTR && res != -EAGAIN) {
+			// Broken ring? Give up on it for good and let writev()
+			// finish
+			lil_db_batch_uring_teardown(batch) ;
+		}
+	}
+
+	// writev() path, which also mops up after a short io_uring write.
+	// written is what went out since the cursor last moved
+	for (;;) {
+		// Move the cursor past whatever made it out
+		while (first < n && written >= batch->iov[first].iov_len) {
+			written -= batch->iov[first].iov_len ;
+			first++ ;
+		}
+		if (first == n) break ;
+		batch->iov[first].iov_base = (char *)batch->iov[first].iov_base
+					     + written ;
+		batch->iov[first].iov_len -= written ;
+		written = 0 ;
+
+		batch->stats.syscalls++ ;
+		res = writev(batch->fd, batch->iov + first, n - first) ;
+		if (res < 0) {
+			if (errno == EINTR) continue ;
+			return 1 ;
+		}
+		written = res ;
+	}
+
+	batch->stats.entries += batch->staged_entries ;
+	batch->stats.bytes += batch->staged_bytes ;
+	batch->stats.batches++ ;
+
+	batch->staged_entries = 0 ;
+	batch->staged_bytes = 0 ;
+
+	return 0 ;
+}
+
+int lil_db_batch_append(lil_db_batch_t * batch, const char * text, size_t length)
+{
+	uint64_t now ;
+
+	if (length > batch->config.max_bytes) return 1 ;
+
+	// Make room if this entry won't fit behind what's already staged
+	if (batch->staged_bytes + length > batch->config.max_bytes
+	    && lil_db_batch_flush(batch))
+		return 1 ;
+
+	now = lil_db_batch_now_ms() ;
+	if (!batch->staged_entries) batch->oldest_ms = now ;
+
+	memcpy(batch->staging + batch->staged_bytes, text, length) ;
+	batch->iov[batch->staged_entries].iov_base =
+		batch->staging + batch->staged_bytes ;
+	batch->iov[batch->staged_entries].iov_len = length ;
+	batch->staged_bytes += length ;
+	batch->staged_entries++ ;
+
+	// Any threshold will do
+	if (batch->staged_entries >= batch->config.max_entries
+	    || batch->staged_bytes >= batch->config.max_bytes
+	    || now - batch->oldest_ms >= batch->config.max_age_ms)
+		return lil_db_batch_flush(batch) ;
+
+	return 0 ;
+}
+
+int lil_db_batch_reopen(lil_db_batch_t * batch, const char * filename)
+{
+	int fd ;
+
+	if (lil_db_batch_flush(batch)) return 1 ;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) ;
+	if (fd < 0) return 1 ;
+
+	// The fd goes in each SQE, so io_uring doesn't care that it changed
+	close(batch->fd) ;
+	batch->fd = fd ;
+
+	return 0 ;
+}
+
+int lil_db_batch_close(lil_db_batch_t * batch)
+{
+	int ret = lil_db_batch_flush(batch) ;
+
+	lil_db_batch_uring_teardown(batch) ;
+	if (batch->staging) munmap(batch->staging, batch->config.max_bytes) ;
+	if (close(batch->fd)) ret = 1 ;
+
+	batch->staging = NULL ;
+	batch->fd = -1 ;
+
+	return ret ;
+}
@@ -0,0 +1,130 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_batch.h header file
+ * Batched output backend for lil_db: io_uring with a writev fallback
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#ifndef LIL_DB_BATCH_H
+#define LIL_DB_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Entries are copied into a staging area and written out together once
+// any threshold below is crossed. The staging area is registered with
+// io_uring so a batch is a single IORING_OP_WRITE_FIXED. Without io_uring
+// (old kernel, seccomp, etc.) the batch goes out with one writev() instead.
+
+#define LIL_DB_BATCH_MAX_ENTRIES 	1024	   // Hard cap, also IOV_MAX
+#define LIL_DB_BATCH_DEFAULT_ENTRIES 	256
+#define LIL_DB_BATCH_DEFAULT_BYTES 	(64 << 10)
+#define LIL_DB_BATCH_DEFAULT_AGE_MS 	100
+
+// Thresholds, any of which being reached sends the batch to the file.
+// Zero in any field means "use the default".
+typedef struct lil_db_batch_config {
+	// Entries per batch, no more than LIL_DB_BATCH_MAX_ENTRIES
+	unsigned int max_entries ;
+
+	// Size of the staging area in bytes
+	size_t max_bytes ;
+
+	// Oldest an entry can get before its batch is written. Age is only
+	// checked when an entry is added or lil_db_flush() is called
+	unsigned int max_age_ms ;
+
+	// Nonzero to skip io_uring and always use writev()
+	int disable_io_uring ;
+} lil_db_batch_config_t ;
+
+// Counters, so you can see whether batching is actually buying you anything
+typedef struct lil_db_batch_stats {
+	// Entries written to the file
+	uint64_t entries ;
+
+	// Batches written to the file
+	uint64_t batches ;
+
+	// Syscalls made to write those batches
+	uint64_t syscalls ;
+
+	// Bytes written to the file
+	uint64_t bytes ;
+
+	// Nonzero if batches are going through io_uring
+	int using_io_uring ;
+} lil_db_batch_stats_t ;
+
+// A batching backend, all of it lives in lil_db_data_t
+typedef struct lil_db_batch {
+	// Output file, opened O_APPEND
+	int fd ;
+
+	// Copy of the thresholds with defaults filled in
+	lil_db_batch_config_t config ;
+
+	// Pending entry text, mmap'd so it can be registered with io_uring
+	unsigned char * staging ;
+	size_t staged_bytes ;
+
+	// One iovec per pending entry, pointing into staging
+	struct iovec iov[LIL_DB_BATCH_MAX_ENTRIES] ;
+	unsigned int staged_entries ;
+
+	// CLOCK_MONOTONIC_COARSE time in ms when the oldest pending entry came in
+	uint64_t oldest_ms ;
+
+	// io_uring state, ring_fd is -1 when we're using writev()
+	int ring_fd ;
+	int registered ;
+	unsigned char * sq_map, * cq_map ;
+	size_t sq_map_size, cq_map_size ;
+	struct io_uring_sqe * sqes ;
+	size_t sqes_size ;
+	unsigned int * sq_head, * sq_tail, * sq_mask, * sq_array ;
+	unsigned int * cq_head, * cq_tail, * cq_mask ;
+	struct io_uring_cqe * cqes ;
+	uint64_t write_offset ;
+
+	lil_db_batch_stats_t stats ;
+} lil_db_batch_t ;
+
+// All functions return 0 on success and nonzero on failure unless otherwise specified
+
+// Open filename for appending and set up the staging area and io_uring.
+// config may be NULL for all defaults.
+int lil_db_batch_open(lil_db_batch_t * batch, const char * filename,
+		      const lil_db_batch_config_t * config) ;
+
+// Add an entry to the batch, writing the batch out if a threshold is hit
+int lil_db_batch_append(lil_db_batch_t * batch, const char * text, size_t length) ;
+
+// Write out any pending entries now
+int lil_db_batch_flush(lil_db_batch_t * batch) ;
+
+// Write out anything pending, then start appending to filename instead
+int lil_db_batch_reopen(lil_db_batch_t * batch, const char * filename) ;
+
+// Flush, then release everything
+int lil_db_batch_close(lil_db_batch_t * batch) ;
+
+#endif // LIL_DB_BATCH_H
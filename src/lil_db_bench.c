@@ -0,0 +1,322 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_bench.c source file
+ * Throughput and tail latency of lil_db_printf, as CSV
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Usage: lil_db_bench [-n OPS] [-t MAX_THREADS] [-d DIR]
+ *
+ * Sweeps backend x target x producer threads x message size x options.
+ * Every run makes OPS calls in total (default 20000), split between the
+ * threads, and times each call with CLOCK_MONOTONIC. Threads go 1, 2, 4...
+ * and then MAX_THREADS itself (default: one per CPU, at least 2). The "file" target
+ * lives in DIR (default .), "tmpfs" in /dev/shm, and "null" is /dev/null.
+ * A ring on /dev/null is skipped, as is tmpfs if /dev/shm isn't one.
+ *
+ * Run it through "make bench" to get lil_db_bench.csv.
+ */
+
+#include "lil_db.h"
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/statfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LIL_DB_BENCH_TMPFS_MAGIC 0x01021994	// From linux/magic.h
+#define LIL_DB_BENCH_RING_SIZE 	 (16 << 20)
+
+static const size_t lil_db_bench_sizes[] = {
+	16, 64, 128, LIL_DB_DEFAULT_BUFFSZ, 2 * LIL_DB_DEFAULT_BUFFSZ
+} ;
+
+static const lil_db_option lil_db_bench_options[] = {
+	LIL_DB_OPTION_DEFAULT,
+	LIL_DB_OPTION_EMPHASIS,
+	LIL_DB_OPTION_NUMBERED,
+	LIL_DB_OPTION_EMPHASIS | LIL_DB_OPTION_NUMBERED
+} ;
+
+static const char * const lil_db_bench_backends[] = {
+	"stdio", "batch", "ring"
+} ;
+
+// What every producer thread in a run shares
+typedef struct lil_db_bench_run {
+	// Producers wait for go to be 1 to start, or -1 to give up because
+	// not all of them could be created
+	pthread_mutex_t lock ;
+	pthread_cond_t start ;
+	int go ;
+
+	lil_db_option options ;
+	const char * message ;
+
+	// Each thread's calls, and where it writes their latencies
+	size_t ops_per_thread ;
+	uint64_t * latencies ;
+} lil_db_bench_run_t ;
+
+// One producer and its slice of the latency array
+typedef struct lil_db_bench_thread {
+	lil_db_bench_run_t * run ;
+	uint64_t * latencies ;
+
+	// When it made its first call and finished its last. Kept per thread
+	// since, with fewer CPUs than threads, main may not run until after
+	uint64_t began, finished ;
+
+	pthread_t thread ;
+} lil_db_bench_thread_t ;
+
+static uint64_t lil_db_bench_now_ns(void)
+{
+	struct timespec ts ;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts) ;
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec ;
+}
+
+static void * lil_db_bench_producer(void * arg)
+{
+	lil_db_bench_thread_t * self = arg ;
+	lil_db_bench_run_t * run = self->run ;
+	uint64_t before ;
+	int go ;
+
+	pthread_mutex_lock(&run->lock) ;
+	while (!(go = run->go)) pthread_cond_wait(&run->start, &run->lock) ;
+	pthread_mutex_unlock(&run->lock) ;
+	if (go < 0) return NULL ;
+
+	self->began = lil_db_bench_now_ns() ;
+	for (size_t i = 0; i < run->ops_per_thread; ++i) {
+		before = lil_db_bench_now_ns() ;
+		lil_db_printf(run->options, "%s", run->message) ;
+		self->latencies[i] = lil_db_bench_now_ns() - before ;
+	}
+
+	// Anything a backend is still holding counts towards the run
+	lil_db_flush() ;
+	self->finished = lil_db_bench_now_ns() ;
+
+	return NULL ;
+}
+
+static int lil_db_bench_compare(const void * a, const void * b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b ;
+
+	return (x > y) - (x < y) ;
+}
+
+// The p-th percentile of n sorted latencies
+static uint64_t lil_db_bench_percentile(const uint64_t * sorted, size_t n,
+					double p)
+{
+	size_t at = p / 100.0 * n ;
+
+	return sorted[at < n ? at : n - 1] ;
+}
+
+// Options the way the CSV spells them
+static const char * lil_db_bench_option_name(lil_db_option options)
+{
+	switch (options & (LIL_DB_OPTION_EMPHASIS | LIL_DB_OPTION_NUMBERED)) {
+	case LIL_DB_OPTION_EMPHASIS: return "EMPHASIS" ;
+	case LIL_DB_OPTION_NUMBERED: return "NUMBERED" ;
+	case LIL_DB_OPTION_EMPHASIS | LIL_DB_OPTION_NUMBERED:
+		return "EMPHASIS|NUMBERED" ;
+	default: return "DEFAULT" ;
+	}
+}
+
+// Threads in the run after one with threads, doubling but never skipping
+// max. 0 once max has been run
+static int lil_db_bench_next_threads(int threads, long max)
+{
+	if (threads >= max) return 0 ;
+
+	return threads * 2 < max ? threads * 2 : max ;
+}
+
+// Open lil_db on path with the given backend
+static int lil_db_bench_open(const char * backend, char * path)
+{
+	if (!strcmp(backend, "batch"))
+		return lil_db_init_batched(path, strlen(path) + 1, NULL) ;
+	if (!strcmp(backend, "ring"))
+		return lil_db_init_ring(path, strlen(path) + 1,
+					LIL_DB_BENCH_RING_SIZE) ;
+
+	return lil_db_init(path, strlen(path) + 1) ;
+}
+
+// One row of the CSV
+static void lil_db_bench_one(const char * backend, const char * target,
+			     char * path, int threads, size_t size,
+			     lil_db_option options, size_t ops)
+{
+	lil_db_bench_thread_t producers[threads] ;
+	lil_db_bench_run_t run ;
+	char message[size + 1] ;
+	uint64_t began = UINT64_MAX, finished = 0, elapsed ;
+	size_t total ;
+	int created, failed = 0 ;
+
+	// size bytes of text in all, counting the newline
+	memset(message, 'x', size - 1) ;
+	message[size - 1] = '\n' ;
+	message[size] = '\0' ;
+
+	run.options = options ;
+	run.message = message ;
+	run.ops_per_thread = ops / threads ;
+	total = run.ops_per_thread * threads ;
+	if (!total || !(run.latencies = malloc(total * sizeof(uint64_t))))
+		return ;
+
+	if (lil_db_bench_open(backend, path)) {
+		free(run.latencies) ;
+		return ;
+	}
+
+	pthread_mutex_init(&run.lock, NULL) ;
+	pthread_cond_init(&run.start, NULL) ;
+	run.go = 0 ;
+	for (created = 0; created < threads && !failed; ++created) {
+		producers[created].run = &run ;
+		producers[created].latencies = run.latencies
+					       + created * run.ops_per_thread ;
+		failed = pthread_create(&producers[created].thread, NULL,
+					lil_db_bench_producer,
+					&producers[created]) ;
+	}
+	created -= !!failed ;
+
+	// Case: A run short of threads would be mislabeled, so there's none
+	pthread_mutex_lock(&run.lock) ;
+	run.go = failed ? -1 : 1 ;
+	pthread_cond_broadcast(&run.start) ;
+	pthread_mutex_unlock(&run.lock) ;
+
+	for (int i = 0; i < created; ++i) {
+		pthread_join(producers[i].thread, NULL) ;
+		if (producers[i].began < began) began = producers[i].began ;
+		if (producers[i].finished > finished)
+			finished = producers[i].finished ;
+	}
+	elapsed = finished - began ;
+	lil_db_kill() ;
+	pthread_cond_destroy(&run.start) ;
+	pthread_mutex_destroy(&run.lock) ;
+
+	if (strcmp(target, "null")) unlink(path) ;
+
+	if (failed) {
+		fprintf(stderr, "lil_db_bench: skipping %s %s with %d "
+			"threads, only %d could be created: %s\n", backend,
+			target, threads, created, strerror(failed)) ;
+		free(run.latencies) ;
+		return ;
+	}
+
+	qsort(run.latencies, total, sizeof(uint64_t), lil_db_bench_compare) ;
+	printf("%s,%s,%d,%zu,%s,%zu,%.6f,%.0f,%llu,%llu,%llu\n",
+	       backend, target, threads, size,
+	       lil_db_bench_option_name(options), total, elapsed / 1e9, total / (elapsed / 1e9),
+	       (unsigned long long)lil_db_bench_percentile(run.latencies,
+							   total, 50),
+	       (unsigned long long)lil_db_bench_percentile(run.latencies,
+							   total, 99),
+	       (unsigned long long)lil_db_bench_percentile(run.latencies,
+							   total, 99.9)) ;
+	fflush(stdout) ;
+
+	free(run.latencies) ;
+}
+
+int main(int argc, char ** argv)
+{
+	char file_path[LIL_DB_DEFAULT_BUFFSZ], tmpfs_path[] =
+		"/dev/shm/lil_db_bench.log", null_path[] = "/dev/null" ;
+	const char * dir = "." ;
+	size_t ops = 20000 ;
+	long max_threads = sysconf(_SC_NPROCESSORS_ONLN) ;
+	struct statfs fs ;
+	int opt, have_tmpfs ;
+
+	if (max_threads < 2) max_threads = 2 ;
+
+	while ((opt = getopt(argc, argv, "n:t:d:")) != -1) {
+		switch (opt) {
+		case 'n': ops = strtoul(optarg, NULL, 0) ; break ;
+		case 't': max_threads = strtol(optarg, NULL, 0) ; break ;
+		case 'd': dir = optarg ; break ;
+		default: goto usage ;
+		}
+	}
+	if (max_threads < 1 || max_threads > INT_MAX / 2) goto usage ;
+
+	snprintf(file_path, sizeof(file_path), "%s/lil_db_bench.log", dir) ;
+	have_tmpfs = !statfs("/dev/shm", &fs)
+		&& fs.f_type == LIL_DB_BENCH_TMPFS_MAGIC ;
+
+	// Something to compare the nanoseconds against
+	fprintf(stderr, "lil_db_bench: %zu ops per run, up to %ld threads, "
+		"%ld CPUs\n", ops, max_threads, sysconf(_SC_NPROCESSORS_ONLN)) ;
+
+	printf("backend,target,threads,msg_bytes,options,ops,seconds,"
+	       "ops_per_sec,p50_ns,p99_ns,p999_ns\n") ;
+
+	for (size_t b = 0; b < sizeof(lil_db_bench_backends)
+			       / sizeof(*lil_db_bench_backends); ++b)
+	for (int target = 0; target < 3; ++target)
+	for (int threads = 1; threads;
+	     threads = lil_db_bench_next_threads(threads, max_threads))
+	for (size_t s = 0; s < sizeof(lil_db_bench_sizes)
+			       / sizeof(*lil_db_bench_sizes); ++s)
+	for (size_t o = 0; o < sizeof(lil_db_bench_options)
+			       / sizeof(*lil_db_bench_options); ++o) {
+		// A ring has to be mmap'd, which /dev/null won't do
+		if ((target == 1 && !have_tmpfs)
+		    || (target == 2 && !strcmp(lil_db_bench_backends[b], "ring")))
+			continue ;
+
+		lil_db_bench_one(lil_db_bench_backends[b],
+				 target == 0 ? "file"
+				 : target == 1 ? "tmpfs" : "null",
+				 target == 0 ? file_path
+				 : target == 1 ? tmpfs_path : null_path,
+				 threads, lil_db_bench_sizes[s],
+				 lil_db_bench_options[o], ops) ;
+	}
+
+	return 0 ;
+
+usage:
+	fprintf(stderr, "usage: %s [-n OPS] [-t MAX_THREADS] [-d DIR]\n",
+		argv[0]) ;
+	return 2 ;
+}
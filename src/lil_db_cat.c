@@ -0,0 +1,79 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_cat.c source file
+ * Print lil_db segments, decompressing any that lil_db_lz squashed
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Usage: lil_db_cat [FILE]...
+ *
+ * With no FILE, reads standard input. Give it the segments oldest first,
+ * e.g. "lil_db_cat log.1.lz log.2.lz log" to get the whole log in order.
+ */
+
+#include "lil_db_lz.h"
+#include <string.h>
+
+// Stream one file to stdout, decompressing it if it starts with the magic
+static int lil_db_cat(FILE * in, const char * name)
+{
+	char buff[1 << 16] ;
+	size_t n ;
+
+	// Can't seek back on a pipe, so whatever we peek at goes out by hand
+	n = fread(buff, 1, LIL_DB_LZ_MAGIC_SIZE, in) ;
+	if (n == LIL_DB_LZ_MAGIC_SIZE
+	    && !memcmp(buff, LIL_DB_LZ_MAGIC, LIL_DB_LZ_MAGIC_SIZE)) {
+		if (lil_db_lz_decompress_blocks(in, stdout)) {
+			fprintf(stderr, "%s: corrupt compressed segment\n", name) ;
+			return 1 ;
+		}
+		return 0 ;
+	}
+
+	if (fwrite(buff, 1, n, stdout) != n) return 1 ;
+
+	while ((n = fread(buff, 1, sizeof(buff), in)) > 0) {
+		if (fwrite(buff, 1, n, stdout) != n) return 1 ;
+	}
+
+	return ferror(in) ;
+}
+
+int main(int argc, char ** argv)
+{
+	int failed = 0 ;
+
+	if (argc < 2) return lil_db_cat(stdin, "-") ;
+
+	for (int i = 1; i < argc; ++i) {
+		FILE * in = strcmp(argv[i], "-") ? fopen(argv[i], "r") : stdin ;
+
+		if (!in) {
+			perror(argv[i]) ;
+			failed = 1 ;
+			continue ;
+		}
+
+		failed |= lil_db_cat(in, argv[i]) ;
+		if (in != stdin) fclose(in) ;
+	}
+
+	return failed ;
+}
@@ -0,0 +1,187 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_clock.c source file
+ * Cheap wall clock timestamps for lil_db, courtesy of the TSC
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#include "lil_db_clock.h"
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define LIL_DB_CLOCK_HAVE_TSC 1
+#else
+#define LIL_DB_CLOCK_HAVE_TSC 0
+#endif
+
+// Read a clock_gettime() clock in nanoseconds
+static uint64_t lil_db_clock_gettime_ns(clockid_t id)
+{
+	struct timespec ts ;
+
+	clock_gettime(id, &ts) ;
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec ;
+}
+
+// Read the TSC, or 0 if there isn't one
+static uint64_t lil_db_clock_rdtsc(void)
+{
+#if LIL_DB_CLOCK_HAVE_TSC
+	return __rdtsc() ;
+#else
+	return 0 ;
+#endif
+}
+
+// The TSC is only worth anything if it ticks at a constant rate through
+// frequency changes and sleep states, which CPUID calls "invariant"
+static int lil_db_clock_tsc_is_invariant(void)
+{
+#if LIL_DB_CLOCK_HAVE_TSC
+	unsigned int eax, ebx, ecx, edx ;
+
+	if (__get_cpuid_max(0x80000000, NULL) < 0x80000007) return 0 ;
+	__cpuid(0x80000007, eax, ebx, ecx, edx) ;
+
+	return !!(edx & (1U << 8)) ;
+#else
+	return 0 ;
+#endif
+}
+
+// Take a TSC reading and a CLOCK_MONOTONIC_RAW reading as close together as
+// we can, and where CLOCK_REALTIME stands relative to the latter
+static void lil_db_clock_sample(uint64_t * tsc, uint64_t * raw_ns,
+				int64_t * offset_ns)
+{
+	uint64_t before = lil_db_clock_rdtsc() ;
+
+	*raw_ns = lil_db_clock_gettime_ns(CLOCK_MONOTONIC_RAW) ;
+	*tsc = before + (lil_db_clock_rdtsc() - before) / 2 ;
+	*offset_ns = lil_db_clock_gettime_ns(CLOCK_REALTIME) - *raw_ns ;
+}
+
+// Recompute the rate from the origin to the current anchor
+static void lil_db_clock_set_rate(lil_db_clock_t * clock)
+{
+	uint64_t ticks = clock->anchor_tsc - clock->origin_tsc,
+		 ns = clock->anchor_raw_ns - clock->origin_raw_ns ;
+
+	// The raw clock never goes back, so the TSC is lying. Give up on it
+	if (!ticks || clock->anchor_tsc < clock->origin_tsc
+	    || clock->anchor_raw_ns < clock->origin_raw_ns) {
+		clock->use_tsc = 0 ;
+		return ;
+	}
+
+	clock->mult = (uint64_t)(((unsigned __int128)ns << 32) / ticks) ;
+	if (!clock->mult) {
+		clock->use_tsc = 0 ;
+		return ;
+	}
+
+	clock->reanchor_ticks = ((uint64_t)LIL_DB_CLOCK_REANCHOR_NS << 32)
+		/ clock->mult ;
+}
+
+void lil_db_clock_calibrate(lil_db_clock_t * clock)
+{
+	uint64_t start ;
+
+	memset(clock, 0, sizeof(*clock)) ;
+
+	clock->use_tsc = lil_db_clock_tsc_is_invariant() ;
+	if (!clock->use_tsc) return ;
+
+	lil_db_clock_sample(&clock->origin_tsc, &clock->origin_raw_ns,
+			    &clock->offset_ns) ;
+
+	// Spin instead of sleeping, a sleep would give us a worse second sample
+	start = lil_db_clock_gettime_ns(CLOCK_MONOTONIC_RAW) ;
+	while (lil_db_clock_gettime_ns(CLOCK_MONOTONIC_RAW) - start
+	       < LIL_DB_CLOCK_CALIBRATE_NS) ;
+
+	lil_db_clock_sample(&clock->anchor_tsc, &clock->anchor_raw_ns,
+			    &clock->offset_ns) ;
+	lil_db_clock_set_rate(clock) ;
+}
+
+uint64_t lil_db_clock_now_ns(lil_db_clock_t * clock)
+{
+	uint64_t ticks, ns ;
+
+	if (!clock->use_tsc) return lil_db_clock_gettime_ns(CLOCK_REALTIME) ;
+
+	ticks = lil_db_clock_rdtsc() - clock->anchor_tsc ;
+
+	// Once a second or so, pay for two clock_gettime()s to keep the anchor
+	// fresh and pick up any change to the wall clock. The rate gets better
+	// every time since the baseline grows.
+	if (ticks >= clock->reanchor_ticks) {
+		lil_db_clock_sample(&clock->anchor_tsc, &clock->anchor_raw_ns,
+				    &clock->offset_ns) ;
+		lil_db_clock_set_rate(clock) ;
+		ticks = 0 ;
+	}
+
+	ns = clock->anchor_raw_ns + clock->offset_ns
+	     + (uint64_t)(((unsigned __int128)ticks * clock->mult) >> 32) ;
+
+	// Case: The wall clock was set back, or the new anchor landed a hair
+	// behind the old estimate. Hold still until time catches up
+	if (ns < clock->last_ns) return clock->last_ns ;
+
+	return clock->last_ns = ns ;
+}
+
+int lil_db_clock_format(uint64_t ns, char * out, size_t size)
+{
+	char digits[24] ;
+	uint64_t sec = ns / 1000000000ULL ;
+	uint32_t frac = ns % 1000000000ULL ;
+	int n = 0, length = 0 ;
+
+	// Hand rolled, this runs for every entry and snprintf is not cheap
+	do {
+		digits[n++] = '0' + sec % 10 ;
+		sec /= 10 ;
+	} while (sec) ;
+
+	// "[", the seconds, ".", 9 digits, "] " and a \0
+	if ((size_t)n + 14 > size) return 0 ;
+
+	out[length++] = '[' ;
+	while (n) out[length++] = digits[--n] ;
+	out[length++] = '.' ;
+	for (int i = 8; i >= 0; --i) {
+		out[length + i] = '0' + frac % 10 ;
+		frac /= 10 ;
+	}
+	length += 9 ;
+	out[length++] = ']' ;
+	out[length++] = ' ' ;
+	out[length] = '\0' ;
+
+	return length ;
+}
@@ -0,0 +1,82 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_clock.h header file
+ * Cheap wall clock timestamps for lil_db, courtesy of the TSC
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#ifndef LIL_DB_CLOCK_H
+#define LIL_DB_CLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// How long lil_db_clock_calibrate spins to get a first guess at the TSC rate
+#define LIL_DB_CLOCK_CALIBRATE_NS 	2000000
+
+// How often (in TSC time) the clock goes back to clock_gettime to fix its
+// anchor, pick up wall clock changes, and refine the rate over a longer
+// baseline
+#define LIL_DB_CLOCK_REANCHOR_NS 	1000000000
+
+// Enough for "[18446744073.999999999] " and a \0
+#define LIL_DB_CLOCK_PREFIX_MAX 	32
+
+// Maps TSC readings onto CLOCK_REALTIME. The rate is measured against
+// CLOCK_MONOTONIC_RAW, which nothing steps or slews, so that NTP or an admin
+// setting the wall clock only moves the offset, never the rate
+typedef struct lil_db_clock {
+	// Nonzero if the TSC is invariant and we can use it at all. If not,
+	// every timestamp is a (vDSO, so still not terrible) clock_gettime
+	int use_tsc ;
+
+	// Reading taken at calibration, the long baseline for the rate
+	uint64_t origin_tsc, origin_raw_ns ;
+
+	// Most recent pairing of TSC and CLOCK_MONOTONIC_RAW
+	uint64_t anchor_tsc, anchor_raw_ns ;
+
+	// CLOCK_REALTIME minus CLOCK_MONOTONIC_RAW as of the anchor
+	int64_t offset_ns ;
+
+	// The last timestamp handed out, so a reanchor never goes back
+	uint64_t last_ns ;
+
+	// Nanoseconds per tick, as a 32.32 fixed point number
+	uint64_t mult ;
+
+	// Ticks after the anchor at which we re-anchor
+	uint64_t reanchor_ticks ;
+} lil_db_clock_t ;
+
+// Decide whether the TSC is usable and measure its rate against
+// CLOCK_MONOTONIC_RAW. Takes about LIL_DB_CLOCK_CALIBRATE_NS.
+void lil_db_clock_calibrate(lil_db_clock_t * clock) ;
+
+// Nanoseconds since the epoch. Usually just rdtsc and a multiply. With the
+// TSC, never less than the last one, even if the wall clock was set back
+uint64_t lil_db_clock_now_ns(lil_db_clock_t * clock) ;
+
+// Write "[seconds.nanoseconds] " for ns into out, which holds size bytes.
+// LIL_DB_CLOCK_PREFIX_MAX is always enough. Returns the length, or 0 with
+// nothing written if it doesn't fit
+int lil_db_clock_format(uint64_t ns, char * out, size_t size) ;
+
+#endif // LIL_DB_CLOCK_H
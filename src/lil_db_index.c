@@ -0,0 +1,162 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_index.c source file
+ * Sparse sidecar index for seeking around big lil_db logs
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#include "lil_db_index.h"
+#include <string.h>
+#include <sys/stat.h>
+
+// Long enough for a full lil_db filename plus ".N.idx"
+#define LIL_DB_INDEX_PATH_MAX 512
+
+int lil_db_index_open(lil_db_index_t * index, const char * filename,
+		      uint64_t offset, unsigned int interval)
+{
+	char path[LIL_DB_INDEX_PATH_MAX] ;
+	lil_db_index_header_t header = {
+		.magic = LIL_DB_INDEX_MAGIC,
+		.version = LIL_DB_INDEX_VERSION,
+	} ;
+	struct stat st ;
+
+	memset(index, 0, sizeof(*index)) ;
+	index->interval = interval ? interval : LIL_DB_INDEX_DEFAULT_INTERVAL ;
+	index->offset = offset ;
+	header.interval = index->interval ;
+
+	snprintf(path, sizeof(path), "%s" LIL_DB_INDEX_SUFFIX, filename) ;
+	if (!(index->stream = fopen(path, "a"))) return 1 ;
+
+	// Case: Brand new index, it needs a header
+	if (!fstat(fileno(index->stream), &st) && st.st_size == 0
+	    && fwrite(&header, sizeof(header), 1, index->stream) != 1) {
+		fclose(index->stream) ;
+		index->stream = NULL ;
+		return 1 ;
+	}
+
+	return 0 ;
+}
+
+int lil_db_index_add(lil_db_index_t * index, uint64_t entry,
+		     uint64_t timestamp_ns, size_t length)
+{
+	lil_db_index_record_t record = {
+		.entry = entry,
+		.timestamp_ns = timestamp_ns,
+		.offset = index->offset,
+	} ;
+	int ret = 0 ;
+
+	if (lil_db_index_due(index))
+		ret = fwrite(&record, sizeof(record), 1, index->stream) != 1 ;
+
+	index->count++ ;
+	index->offset += length ;
+
+	return ret ;
+}
+
+int lil_db_index_flush(lil_db_index_t * index)
+{
+	return index->stream && fflush(index->stream) ;
+}
+
+int lil_db_index_rotate(lil_db_index_t * index, const char * filename,
+			long segment)
+{
+	char path[LIL_DB_INDEX_PATH_MAX], rotated[LIL_DB_INDEX_PATH_MAX] ;
+	unsigned int interval = index->interval ;
+
+	if (lil_db_index_close(index)) return 1 ;
+
+	snprintf(path, sizeof(path), "%s" LIL_DB_INDEX_SUFFIX, filename) ;
+	snprintf(rotated, sizeof(rotated), "%s.%ld" LIL_DB_INDEX_SUFFIX,
+		 filename, segment) ;
+	if (rename(path, rotated)) return 1 ;
+
+	// The new log is empty, so the new index starts at the top
+	return lil_db_index_open(index, filename, 0, interval) ;
+}
+
+int lil_db_index_close(lil_db_index_t * index)
+{
+	int ret = 0 ;
+
+	if (index->stream) ret = fclose(index->stream) ;
+	index->stream = NULL ;
+
+	return ret ;
+}
+
+/* READING */
+
+long lil_db_index_records(const void * map, size_t size,
+			  const lil_db_index_record_t ** records)
+{
+	const lil_db_index_header_t * header = map ;
+
+	if (size < sizeof(*header) || header->magic != LIL_DB_INDEX_MAGIC
+	    || header->version != LIL_DB_INDEX_VERSION)
+		return -1 ;
+
+	*records = (const lil_db_index_record_t *)(header + 1) ;
+
+	// A torn last record from a crash just gets left off
+	return (size - sizeof(*header)) / sizeof(lil_db_index_record_t) ;
+}
+
+// Binary search for the last record whose field at `field` is <= key
+static long lil_db_index_find(const lil_db_index_record_t * records,
+			      long count, size_t field, uint64_t key)
+{
+	long lo = 0, hi = count ;
+
+	if (count <= 0) return -1 ;
+
+	// Invariant: everything before lo is <= key, everything from hi on isn't
+	while (lo < hi) {
+		long mid = lo + (hi - lo) / 2 ;
+		uint64_t value ;
+
+		memcpy(&value, (const char *)&records[mid] + field, sizeof(value)) ;
+		if (value <= key) lo = mid + 1 ;
+		else hi = mid ;
+	}
+
+	return lo ? lo - 1 : 0 ;
+}
+
+long lil_db_index_find_entry(const lil_db_index_record_t * records,
+			     long count, uint64_t entry)
+{
+	return lil_db_index_find(records, count,
+		offsetof(lil_db_index_record_t, entry), entry) ;
+}
+
+long lil_db_index_find_time(const lil_db_index_record_t * records,
+			    long count, uint64_t timestamp_ns)
+{
+	return lil_db_index_find(records, count,
+		offsetof(lil_db_index_record_t, timestamp_ns), timestamp_ns) ;
+}
@@ -0,0 +1,126 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_index.h header file
+ * Sparse sidecar index for seeking around big lil_db logs
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Every interval entries, lil_db appends a record to FILENAME.idx saying
+ * where that entry starts in FILENAME, what its entry number is (the N in
+ * LIL_DB_OPTION_NUMBERED's "[N]. ") and when it was written. lil_db_query
+ * binary searches the records to jump to an entry or a time window, then
+ * finishes the job by scanning at most interval entries of the log.
+ *
+ * The file is a lil_db_index_header_t followed by lil_db_index_record_t's,
+ * native endian, since the reader runs on the machine that wrote it. When
+ * the log rotates to FILENAME.N its index goes along to FILENAME.N.idx.
+ * Offsets are into the uncompressed log, so run a .lz segment through
+ * lil_db_cat before querying it.
+ *
+ * Entry numbers start over at 0 with each lil_db_init. Keep one run per
+ * file if you want to seek by number; time windows don't care.
+ */
+
+#ifndef LIL_DB_INDEX_H
+#define LIL_DB_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LIL_DB_INDEX_MAGIC 		0x3158444942444c4cULL	// "LLDBIDX1"
+#define LIL_DB_INDEX_VERSION 		1
+#define LIL_DB_INDEX_SUFFIX 		".idx"
+#define LIL_DB_INDEX_DEFAULT_INTERVAL 	1024
+
+// At the very start of FILENAME.idx
+typedef struct lil_db_index_header {
+	uint64_t magic ;
+	uint32_t version ;
+	uint32_t interval ;	// What the writer was asked for, informational
+} lil_db_index_header_t ;
+
+// One per interval entries
+typedef struct lil_db_index_record {
+	uint64_t entry ;	// Entry number when this entry was written
+	uint64_t timestamp_ns ;	// Nanoseconds since the epoch, ditto
+	uint64_t offset ;	// Where the entry starts in the log
+} lil_db_index_record_t ;
+
+// The writing side, all of it lives in lil_db_data_t
+typedef struct lil_db_index {
+	// FILENAME.idx, NULL when there is no index. Buffered, so a record
+	// costs a memcpy until lil_db_flush or the buffer fills up
+	FILE * stream ;
+
+	// Entries between records
+	unsigned int interval ;
+
+	// Where the next entry will start in the log
+	uint64_t offset ;
+
+	// Entries written since the index was opened
+	uint64_t count ;
+} lil_db_index_t ;
+
+// All functions return 0 on success and nonzero on failure unless otherwise specified
+
+// Start indexing filename, whose next entry will land at offset. Appends to
+// an existing index, as lil_db does with the log itself. 0 for the default
+// interval
+int lil_db_index_open(lil_db_index_t * index, const char * filename,
+		      uint64_t offset, unsigned int interval) ;
+
+// Note an entry of length bytes about to go to the log. Writes a record if
+// it's this entry's turn
+int lil_db_index_add(lil_db_index_t * index, uint64_t entry,
+		     uint64_t timestamp_ns, size_t length) ;
+
+// Nonzero if the next lil_db_index_add will write a record, so the caller
+// only reads the clock when it has to
+#define lil_db_index_due(index) ((index)->count % (index)->interval == 0)
+
+// Hand any buffered records to the kernel
+int lil_db_index_flush(lil_db_index_t * index) ;
+
+// The log was just renamed to filename.segment. Move the index along with
+// it and start a new one for the fresh log
+int lil_db_index_rotate(lil_db_index_t * index, const char * filename,
+			long segment) ;
+
+// Flush and close
+int lil_db_index_close(lil_db_index_t * index) ;
+
+/* READING */
+
+// Check the header of a mapped index. Returns the number of records after
+// it, or -1 if it isn't an index
+long lil_db_index_records(const void * map, size_t size,
+			  const lil_db_index_record_t ** records) ;
+
+// Of the count records, the last one with entry <= entry, or the first if
+// there is none. Returns its position, -1 if count is 0
+long lil_db_index_find_entry(const lil_db_index_record_t * records,
+			     long count, uint64_t entry) ;
+
+// Same, by timestamp
+long lil_db_index_find_time(const lil_db_index_record_t * records,
+			    long count, uint64_t timestamp_ns) ;
+
+#endif // LIL_DB_INDEX_H
@@ -0,0 +1,243 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_level.h header file
+ * Log levels and per-call-site switches for lil_db
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Every LIL_DB_<LEVEL>() call site gets its own static lil_db_site_t. All
+ * of them land in the "lil_db_sites" section, which is how lil_db finds
+ * them again to flip them on and off at runtime. A disabled site costs a
+ * load and a not-taken branch, and its arguments are never evaluated.
+ *
+ * Sites below LIL_DB_MIN_LEVEL are not compiled at all, e.g.
+ *
+ *	gcc -DLIL_DB_MIN_LEVEL=LIL_DB_LEVEL_INFO ...
+ *
+ * turns every LIL_DB_TRACE() and LIL_DB_DEBUG(), and every LIL_DB_LOG() and
+ * friends at those levels, into nothing.
+ */
+
+#ifndef LIL_DB_LEVEL_H
+#define LIL_DB_LEVEL_H
+
+#include <stdint.h>
+
+// Plain #defines rather than an enum so that #if can see them
+#define LIL_DB_LEVEL_TRACE 	0
+#define LIL_DB_LEVEL_DEBUG 	1
+#define LIL_DB_LEVEL_INFO 	2
+#define LIL_DB_LEVEL_WARN 	3
+#define LIL_DB_LEVEL_ERROR 	4
+#define LIL_DB_LEVEL_FATAL 	5
+
+// Anything below this level is removed by the preprocessor
+#ifndef LIL_DB_MIN_LEVEL
+#define LIL_DB_MIN_LEVEL LIL_DB_LEVEL_TRACE
+#endif
+
+// The state of one call site
+typedef struct lil_db_site {
+	// Checked on every call, nothing else is touched when this is 0
+	int enabled ;
+
+	// One of the LIL_DB_LEVEL_* values above
+	int level ;
+
+	// Where the call site is, so you can find it to switch it off
+	const char * file ;
+	int line ;
+
+	// Token bucket: at most rate_per_sec entries a second on average,
+	// bursts of up to burst. rate_per_sec of 0 means no limit
+	uint32_t rate_per_sec, burst ;
+
+	// Only write 1 in every sample_every entries, 0 or 1 for all of them
+	uint32_t sample_every ;
+
+	// Calls seen, used for sampling
+	uint64_t hits ;
+
+	// Calls thrown away by rate limiting or sampling
+	uint64_t dropped ;
+
+	// Token bucket state: when the bucket will be full again, 0 if it
+	// already is. Every entry let through pushes it 1 / rate_per_sec
+	// later, and an entry that would push it more than burst of those
+	// past now finds the bucket empty. One word, so it's updated by
+	// compare and swap with no lock
+	uint64_t full_ns ;
+} lil_db_site_t ;
+
+// Define a call site in the lil_db_sites section and write an entry through
+// it if it lets us. Evaluates to the return value of lil_db_log, or 0 if the
+// entry was not written.
+#define LIL_DB_SITE_LOG(lvl, rate, burst_size, sample, options, ...) 	       \
+	__extension__ ({						       \
+		static lil_db_site_t lil_db_site_ 			       \
+			__attribute__((section("lil_db_sites"), used,	       \
+				       aligned(8))) = {			       \
+			.enabled = 1, .level = (lvl),			       \
+			.file = __FILE__, .line = __LINE__,		       \
+			.rate_per_sec = (rate), .burst = (burst_size),	       \
+			.sample_every = (sample),			       \
+		} ;							       \
+		int lil_db_ret_ = 0 ;					       \
+		if (lil_db_site_.enabled				       \
+		    && lil_db_site_admit(&lil_db_site_))		       \
+			lil_db_ret_ = lil_db_log(&lil_db_site_, (options),     \
+						 __VA_ARGS__) ;		       \
+		lil_db_ret_ ;						       \
+	})
+
+// Write an entry at a level. Anything that can't make LIL_DB_MIN_LEVEL is
+// thrown away by the compiler, arguments and all
+#define LIL_DB_LOG(lvl, options, ...) 					       \
+	LIL_DB_LOG_IF_LEVEL(lvl, 0, 0, 0, options, __VA_ARGS__)
+
+// Same, but at most rate entries per second with bursts of up to burst
+#define LIL_DB_LOG_RATE(lvl, rate, burst, options, ...) 		       \
+	LIL_DB_LOG_IF_LEVEL(lvl, rate, burst, 0, options, __VA_ARGS__)
+
+// Same, but only every n-th call is written
+#define LIL_DB_LOG_SAMPLED(lvl, n, options, ...) 			       \
+	LIL_DB_LOG_IF_LEVEL(lvl, 0, 0, n, options, __VA_ARGS__)
+
+// Helper for the above. lvl is expanded here and pasted onto LIL_DB_LOG_AT_
+// to pick one of those below, so it must be a LIL_DB_LEVEL_* name or a
+// plain 0 to 5
+#define LIL_DB_LOG_IF_LEVEL(lvl, rate, burst_size, sample, options, ...)      \
+	LIL_DB_LOG_AT(lvl, rate, burst_size, sample, options, __VA_ARGS__)
+
+#define LIL_DB_LOG_AT(lvl, ...) LIL_DB_LOG_AT_ ## lvl(__VA_ARGS__)
+
+// What a site below LIL_DB_MIN_LEVEL becomes: 0, with no site in the
+// lil_db_sites section and its arguments never evaluated
+#define LIL_DB_LOG_REMOVED(...) __extension__ ({ 0 ; })
+
+// One per level, decided by #if like the shorthands below
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_TRACE
+#define LIL_DB_LOG_AT_0(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LIL_DB_LOG_AT_0 LIL_DB_LOG_REMOVED
+#endif
+
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_DEBUG
+#define LIL_DB_LOG_AT_1(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LIL_DB_LOG_AT_1 LIL_DB_LOG_REMOVED
+#endif
+
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_INFO
+#define LIL_DB_LOG_AT_2(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LIL_DB_LOG_AT_2 LIL_DB_LOG_REMOVED
+#endif
+
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_WARN
+#define LIL_DB_LOG_AT_3(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LIL_DB_LOG_AT_3 LIL_DB_LOG_REMOVED
+#endif
+
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_ERROR
+#define LIL_DB_LOG_AT_4(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LIL_DB_LOG_AT_4 LIL_DB_LOG_REMOVED
+#endif
+
+#define LIL_DB_LOG_AT_5(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_FATAL, __VA_ARGS__)
+
+// One per level, for the common case of no options
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_TRACE
+#define LIL_DB_TRACE(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_TRACE, 0, 0, 0, 0, __VA_ARGS__)
+#else
+#define LIL_DB_TRACE(...) LIL_DB_LOG_REMOVED(__VA_ARGS__)
+#endif
+
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_DEBUG
+#define LIL_DB_DEBUG(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_DEBUG, 0, 0, 0, 0, __VA_ARGS__)
+#else
+#define LIL_DB_DEBUG(...) LIL_DB_LOG_REMOVED(__VA_ARGS__)
+#endif
+
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_INFO
+#define LIL_DB_INFO(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_INFO, 0, 0, 0, 0, __VA_ARGS__)
+#else
+#define LIL_DB_INFO(...) LIL_DB_LOG_REMOVED(__VA_ARGS__)
+#endif
+
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_WARN
+#define LIL_DB_WARN(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_WARN, 0, 0, 0, 0, __VA_ARGS__)
+#else
+#define LIL_DB_WARN(...) LIL_DB_LOG_REMOVED(__VA_ARGS__)
+#endif
+
+#if LIL_DB_MIN_LEVEL <= LIL_DB_LEVEL_ERROR
+#define LIL_DB_ERROR(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_ERROR, 0, 0, 0, 0, __VA_ARGS__)
+#else
+#define LIL_DB_ERROR(...) LIL_DB_LOG_REMOVED(__VA_ARGS__)
+#endif
+
+#define LIL_DB_FATAL(...) LIL_DB_SITE_LOG(LIL_DB_LEVEL_FATAL, 0, 0, 0, 0, __VA_ARGS__)
+
+// All functions return 0 on success and nonzero on failure unless otherwise specified
+
+// Take a token out of the site's bucket if there is one, without a lock.
+// Returns nonzero if there was
+int lil_db_site_take_token(lil_db_site_t * site) ;
+
+// Slow path of a call site, only taken if it is rate limited or sampled.
+// Returns nonzero if the entry should be written
+static inline int lil_db_site_admit_slow(lil_db_site_t * site)
+{
+	// 1 in N, counted without a lock since an off-by-one here is harmless
+	if (site->sample_every > 1
+	    && __atomic_fetch_add(&site->hits, 1, __ATOMIC_RELAXED)
+	       % site->sample_every) {
+		__atomic_fetch_add(&site->dropped, 1, __ATOMIC_RELAXED) ;
+		return 0 ;
+	}
+
+	return !site->rate_per_sec || lil_db_site_take_token(site) ;
+}
+
+// Nonzero if an enabled call site should go ahead and write its entry
+#define lil_db_site_admit(site) 					       \
+	(!((site)->sample_every | (site)->rate_per_sec)			       \
+	 || lil_db_site_admit_slow(site))
+
+// Write an entry tagged with the level of its call site. Otherwise exactly
+// like lil_db_printf
+int lil_db_log(lil_db_site_t * site, int options, char * format, ...)
+	__attribute__((format(printf, 3, 4))) ;
+
+// Enable sites at or above level and disable the rest. Returns the number
+// of sites that are now enabled
+int lil_db_set_level(int level) ;
+
+// Enable or disable every site in file (all files if NULL) on line (all
+// lines if 0). Returns the number of sites changed
+int lil_db_site_enable(const char * file, int line, int enabled) ;
+
+// Change the rate limit and sampling of matching sites, like above
+int lil_db_site_limit(const char * file, int line, uint32_t rate_per_sec,
+		      uint32_t burst, uint32_t sample_every) ;
+
+#endif // LIL_DB_LEVEL_H
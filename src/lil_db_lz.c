@@ -0,0 +1,327 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_lz.c source file
+ * A lil LZ77 codec for squashing rotated lil_db segments
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#include "lil_db_lz.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LIL_DB_LZ_MIN_MATCH 	4	// Shorter matches aren't worth a token
+#define LIL_DB_LZ_HASH_BITS 	12	// 16 KiB of hash table on the stack
+#define LIL_DB_LZ_MAX_OFFSET 	65535	// What fits in 2 bytes
+#define LIL_DB_LZ_LAST_LITERALS 5	// The tail of a block is always literals
+#define LIL_DB_LZ_MFLIMIT 	12	// No match may start this close to the end
+
+// Worst case size of a compressed block, used to size buffers
+#define LIL_DB_LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+// One block each way, allocated per stream rather than kept in static TLS,
+// which every thread of a program linking us would otherwise pay for
+typedef struct lil_db_lz_buffers {
+	uint8_t raw[LIL_DB_LZ_BLOCK_SIZE] ;
+	uint8_t packed[LIL_DB_LZ_BOUND(LIL_DB_LZ_BLOCK_SIZE)] ;
+} lil_db_lz_buffers_t ;
+
+// Unaligned little endian loads and stores
+static uint32_t lil_db_lz_read32(const uint8_t * p)
+{
+	uint32_t v ;
+
+	memcpy(&v, p, sizeof(v)) ;
+
+	return v ;
+}
+
+static void lil_db_lz_put32(uint8_t * p, uint32_t v)
+{
+	p[0] = v ;
+	p[1] = v >> 8 ;
+	p[2] = v >> 16 ;
+	p[3] = v >> 24 ;
+}
+
+static uint32_t lil_db_lz_get32(const uint8_t * p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24 ;
+}
+
+// Multiplicative hash of 4 bytes down to LIL_DB_LZ_HASH_BITS
+static uint32_t lil_db_lz_hash(uint32_t sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LIL_DB_LZ_HASH_BITS) ;
+}
+
+// Write a length that didn't fit in its 4 bit token field
+static int lil_db_lz_put_length(uint8_t ** op, uint8_t * oend, size_t length)
+{
+	for (; length >= 255; length -= 255) {
+		if (*op >= oend) return 0 ;
+		*(*op)++ = 255 ;
+	}
+	if (*op >= oend) return 0 ;
+	*(*op)++ = length ;
+
+	return 1 ;
+}
+
+// Write one sequence: token, literals, and (unless this is the last one)
+// the match. Returns 0 if dst ran out of room
+static int lil_db_lz_put_sequence(uint8_t ** op, uint8_t * oend,
+				  const uint8_t * literals, size_t literal_length,
+				  size_t offset, size_t match_length, int last)
+{
+	uint8_t * token = *op ;
+
+	if (*op >= oend) return 0 ;
+	*token = (literal_length < 15 ? literal_length : 15) << 4 ;
+	(*op)++ ;
+
+	if (literal_length >= 15
+	    && !lil_db_lz_put_length(op, oend, literal_length - 15))
+		return 0 ;
+
+	if ((size_t)(oend - *op) < literal_length) return 0 ;
+	memcpy(*op, literals, literal_length) ;
+	*op += literal_length ;
+
+	if (last) return 1 ;
+
+	if (oend - *op < 2) return 0 ;
+	*(*op)++ = offset ;
+	*(*op)++ = offset >> 8 ;
+
+	*token |= match_length < 15 ? match_length : 15 ;
+	if (match_length >= 15
+	    && !lil_db_lz_put_length(op, oend, match_length - 15))
+		return 0 ;
+
+	return 1 ;
+}
+
+size_t lil_db_lz_compress_block(const uint8_t * src, size_t n,
+				uint8_t * dst, size_t cap)
+{
+	uint32_t table[1 << LIL_DB_LZ_HASH_BITS] ;
+	const uint8_t * ip = src, * anchor = src, * end = src + n ;
+	uint8_t * op = dst, * oend = dst + cap ;
+
+	memset(table, 0, sizeof(table)) ;
+
+	if (n >= LIL_DB_LZ_MFLIMIT) {
+		const uint8_t * mflimit = end - LIL_DB_LZ_MFLIMIT,
+			      * matchlimit = end - LIL_DB_LZ_LAST_LITERALS ;
+
+		while (ip < mflimit) {
+			uint32_t sequence = lil_db_lz_read32(ip),
+				 h = lil_db_lz_hash(sequence) ;
+			const uint8_t * ref = src + table[h], * mp, * rp ;
+
+			table[h] = ip - src ;
+
+			// The table is just a guess, check it's a real match
+			if (ref >= ip || ip - ref > LIL_DB_LZ_MAX_OFFSET
+			    || lil_db_lz_read32(ref) != sequence) {
+				ip++ ;
+				continue ;
+			}
+
+			mp = ip + LIL_DB_LZ_MIN_MATCH ;
+			rp = ref + LIL_DB_LZ_MIN_MATCH ;
+			while (mp < matchlimit && *mp == *rp) {
+				mp++ ;
+				rp++ ;
+			}
+
+			if (!lil_db_lz_put_sequence(&op, oend, anchor,
+					ip - anchor, ip - ref,
+					mp - ip - LIL_DB_LZ_MIN_MATCH, 0))
+				return 0 ;
+
+			ip = anchor = mp ;
+		}
+	}
+
+	// Whatever is left goes out as literals
+	if (!lil_db_lz_put_sequence(&op, oend, anchor, end - anchor, 0, 0, 1))
+		return 0 ;
+
+	return op - dst ;
+}
+
+// Read a length that didn't fit in its 4 bit token field
+static int lil_db_lz_get_length(const uint8_t ** ip, const uint8_t * iend,
+				size_t * length)
+{
+	uint8_t byte ;
+
+	do {
+		if (*ip >= iend) return 0 ;
+		byte = *(*ip)++ ;
+		*length += byte ;
+	} while (byte == 255) ;
+
+	return 1 ;
+}
+
+long lil_db_lz_decompress_block(const uint8_t * src, size_t n,
+				uint8_t * dst, size_t cap)
+{
+	const uint8_t * ip = src, * iend = src + n ;
+	uint8_t * op = dst, * oend = dst + cap ;
+
+	while (ip < iend) {
+		uint8_t token = *ip++ ;
+		size_t length = token >> 4, offset ;
+
+		// Literals
+		if (length == 15 && !lil_db_lz_get_length(&ip, iend, &length))
+			return -1 ;
+		if ((size_t)(iend - ip) < length || (size_t)(oend - op) < length)
+			return -1 ;
+		memcpy(op, ip, length) ;
+		ip += length ;
+		op += length ;
+
+		// The last sequence has no match
+		if (ip == iend) break ;
+
+		// Match
+		if (iend - ip < 2) return -1 ;
+		offset = ip[0] | ip[1] << 8 ;
+		ip += 2 ;
+		if (!offset || offset > (size_t)(op - dst)) return -1 ;
+
+		length = token & 15 ;
+		if (length == 15 && !lil_db_lz_get_length(&ip, iend, &length))
+			return -1 ;
+		length += LIL_DB_LZ_MIN_MATCH ;
+		if ((size_t)(oend - op) < length) return -1 ;
+
+		// Byte at a time, since the match may overlap what it's making
+		for (const uint8_t * ref = op - offset; length--; )
+			*op++ = *ref++ ;
+	}
+
+	return op - dst ;
+}
+
+static int lil_db_lz_compress_into(FILE * in, FILE * out,
+				   lil_db_lz_buffers_t * buf)
+{
+	uint8_t * raw = buf->raw, * packed = buf->packed ;
+	uint8_t header[8] ;
+	size_t n, packed_size ;
+
+	if (fwrite(LIL_DB_LZ_MAGIC, 1, LIL_DB_LZ_MAGIC_SIZE, out)
+	    != LIL_DB_LZ_MAGIC_SIZE)
+		return 1 ;
+
+	while ((n = fread(raw, 1, sizeof(buf->raw), in)) > 0) {
+		packed_size = lil_db_lz_compress_block(raw, n, packed,
+						       sizeof(buf->packed)) ;
+
+		lil_db_lz_put32(header, n) ;
+		if (!packed_size || packed_size >= n) {
+			// Didn't shrink, keep it as it was
+			lil_db_lz_put32(header + 4, n | LIL_DB_LZ_STORED_RAW) ;
+			if (fwrite(header, 1, 8, out) != 8
+			    || fwrite(raw, 1, n, out) != n)
+				return 1 ;
+		} else {
+			lil_db_lz_put32(header + 4, packed_size) ;
+			if (fwrite(header, 1, 8, out) != 8
+			    || fwrite(packed, 1, packed_size, out) != packed_size)
+				return 1 ;
+		}
+	}
+
+	return ferror(in) || fflush(out) ;
+}
+
+int lil_db_lz_compress_stream(FILE * in, FILE * out)
+{
+	lil_db_lz_buffers_t * buf = malloc(sizeof(*buf)) ;
+	int ret ;
+
+	if (!buf) return 1 ;
+	ret = lil_db_lz_compress_into(in, out, buf) ;
+	free(buf) ;
+
+	return ret ;
+}
+
+int lil_db_lz_decompress_stream(FILE * in, FILE * out)
+{
+	char magic[LIL_DB_LZ_MAGIC_SIZE] ;
+
+	if (fread(magic, 1, sizeof(magic), in) != sizeof(magic)
+	    || memcmp(magic, LIL_DB_LZ_MAGIC, sizeof(magic)))
+		return 1 ;
+
+	return lil_db_lz_decompress_blocks(in, out) ;
+}
+
+static int lil_db_lz_decompress_from(FILE * in, FILE * out,
+				     lil_db_lz_buffers_t * buf)
+{
+	uint8_t * raw = buf->raw, * packed = buf->packed ;
+	uint8_t header[8] ;
+	size_t n ;
+
+	while ((n = fread(header, 1, sizeof(header), in)) == sizeof(header)) {
+		uint32_t raw_size = lil_db_lz_get32(header),
+			 stored = lil_db_lz_get32(header + 4),
+			 stored_size = stored & ~LIL_DB_LZ_STORED_RAW ;
+
+		if (raw_size > sizeof(buf->raw)
+		    || stored_size > sizeof(buf->packed))
+			return 1 ;
+
+		if (stored & LIL_DB_LZ_STORED_RAW) {
+			if (stored_size != raw_size
+			    || fread(raw, 1, raw_size, in) != raw_size)
+				return 1 ;
+		} else if (fread(packed, 1, stored_size, in) != stored_size
+			   || lil_db_lz_decompress_block(packed, stored_size,
+				raw, sizeof(buf->raw)) != (long)raw_size) {
+			return 1 ;
+		}
+
+		if (fwrite(raw, 1, raw_size, out) != raw_size) return 1 ;
+	}
+
+	// Anything other than a clean end between blocks is a truncated file
+	return n != 0 || ferror(in) ;
+}
+
+int lil_db_lz_decompress_blocks(FILE * in, FILE * out)
+{
+	lil_db_lz_buffers_t * buf = malloc(sizeof(*buf)) ;
+	int ret ;
+
+	if (!buf) return 1 ;
+	ret = lil_db_lz_decompress_from(in, out, buf) ;
+	free(buf) ;
+
+	return ret ;
+}
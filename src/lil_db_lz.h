@@ -0,0 +1,69 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_lz.h header file
+ * A lil LZ77 codec for squashing rotated lil_db segments
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Blocks use LZ4's sequence layout: a token byte holding the literal and
+ * match lengths (4 bits each, 15 meaning "more length bytes follow"), the
+ * literals, then a 2 byte little endian offset. The last sequence of a
+ * block is literals only.
+ *
+ * A compressed file is LIL_DB_LZ_MAGIC followed by blocks, each of which
+ * is a 4 byte raw length, a 4 byte stored length and the stored bytes, all
+ * little endian. If LIL_DB_LZ_STORED_RAW is set in the stored length the
+ * block didn't compress and is stored as is.
+ */
+
+#ifndef LIL_DB_LZ_H
+#define LIL_DB_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LIL_DB_LZ_MAGIC 	"LZDB"
+#define LIL_DB_LZ_MAGIC_SIZE 	4
+#define LIL_DB_LZ_BLOCK_SIZE 	(64 << 10)
+#define LIL_DB_LZ_STORED_RAW 	0x80000000U
+#define LIL_DB_LZ_SUFFIX 	".lz"
+
+// Compress n bytes of src into dst, which holds cap bytes. Returns the
+// compressed size, or 0 if it didn't fit (store the block raw instead)
+size_t lil_db_lz_compress_block(const uint8_t * src, size_t n,
+				uint8_t * dst, size_t cap) ;
+
+// Decompress n bytes of src into dst, which holds cap bytes. Returns the
+// decompressed size, or -1 if src is corrupt or dst is too small
+long lil_db_lz_decompress_block(const uint8_t * src, size_t n,
+				uint8_t * dst, size_t cap) ;
+
+// Compress everything from in to out as a compressed file.
+// Returns 0 on success and nonzero on failure
+int lil_db_lz_compress_stream(FILE * in, FILE * out) ;
+
+// Decompress a compressed file from in to out, a block at a time.
+// Returns 0 on success and nonzero on failure
+int lil_db_lz_decompress_stream(FILE * in, FILE * out) ;
+
+// Same, for when the caller has already read and checked the magic
+int lil_db_lz_decompress_blocks(FILE * in, FILE * out) ;
+
+#endif // LIL_DB_LZ_H
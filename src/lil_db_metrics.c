@@ -0,0 +1,286 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_metrics.c source file
+ * Counters, gauges and latency histograms, summarized through lil_db
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#include "lil_db.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+__thread unsigned int lil_db_metrics_thread = 0 ;
+
+// Bit s is set while shard s belongs to a live thread. The shared shard
+// is never in it
+static uint32_t taken_shards = 0 ;
+
+_Static_assert(LIL_DB_METRICS_SHARED < 32, "taken_shards is too narrow") ;
+
+// Every shard a thread can have to itself
+#define LIL_DB_METRICS_PRIVATE ((1U << LIL_DB_METRICS_SHARED) - 1)
+
+// Its destructor gives an exiting thread's shard back
+static pthread_key_t shard_key ;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT ;
+static int shard_key_failed = 0 ;
+
+// Every metric in the program, courtesy of the linker. Weak, since a
+// program without any metrics won't have the section at all
+extern lil_db_metric_t __start_lil_db_metrics[] __attribute__((weak)) ;
+extern lil_db_metric_t __stop_lil_db_metrics[] __attribute__((weak)) ;
+
+// The dumper thread
+static struct {
+	pthread_mutex_t lock ;
+	pthread_cond_t wake ;
+	unsigned int period_ms ;
+	int running, stopping ;
+	pthread_t thread ;
+} dumper = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+} ;
+
+// Thread exit: hand the shard on, counts and all. Every shard is summed
+// anyway, so whoever takes it next just keeps adding to them
+static void lil_db_metrics_thread_exit(void * shard)
+{
+	// Anything recorded from here on, e.g. by another key's destructor,
+	// goes to the shared shard
+	lil_db_metrics_thread = LIL_DB_METRICS_SHARED + 1 ;
+
+	// Release, so the next owner's plain loads see this thread's stores
+	__atomic_fetch_and(&taken_shards,
+			   ~(1U << ((uintptr_t)shard - 1)), __ATOMIC_RELEASE) ;
+}
+
+static void lil_db_metrics_key_create(void)
+{
+	shard_key_failed = pthread_key_create(&shard_key,
+					      lil_db_metrics_thread_exit) ;
+}
+
+unsigned int lil_db_metrics_thread_init(void)
+{
+	uint32_t taken ;
+	unsigned int shard = LIL_DB_METRICS_SHARED ;
+
+	pthread_once(&shard_key_once, lil_db_metrics_key_create) ;
+
+	// The lowest free shard, unless they're all taken or this thread
+	// couldn't give it back at exit
+	taken = __atomic_load_n(&taken_shards, __ATOMIC_RELAXED) ;
+	while (!shard_key_failed && ~taken & LIL_DB_METRICS_PRIVATE) {
+		shard = __builtin_ctz(~taken) ;
+		if (__atomic_compare_exchange_n(&taken_shards, &taken,
+						taken | 1U << shard, 1,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			break ;
+		shard = LIL_DB_METRICS_SHARED ;
+	}
+
+	if (shard != LIL_DB_METRICS_SHARED
+	    && pthread_setspecific(shard_key, (void *)(uintptr_t)(shard + 1))) {
+		lil_db_metrics_thread_exit((void *)(uintptr_t)(shard + 1)) ;
+		shard = LIL_DB_METRICS_SHARED ;
+	}
+	lil_db_metrics_thread = shard + 1 ;
+
+	return shard ;
+}
+
+uint64_t lil_db_counter_read(lil_db_counter_t * counter)
+{
+	uint64_t total = 0 ;
+
+	for (int s = 0; s < LIL_DB_METRICS_SHARDS; ++s)
+		total += __atomic_load_n(&counter->shards[s].value,
+					 __ATOMIC_RELAXED) ;
+
+	return total ;
+}
+
+// The biggest value that lands in bucket
+static uint64_t lil_db_hist_top(unsigned int bucket)
+{
+	unsigned int group = bucket / LIL_DB_HIST_SUB,
+		     sub = bucket % LIL_DB_HIST_SUB ;
+
+	if (!group) return bucket ;
+
+	return ((uint64_t)(LIL_DB_HIST_SUB + sub + 1) << (group - 1)) - 1 ;
+}
+
+void lil_db_hist_summarize(lil_db_hist_t * hist,
+			   lil_db_hist_summary_t * summary)
+{
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 } ;
+	uint64_t * percentiles[] = {
+		&summary->p50, &summary->p90, &summary->p99, &summary->p999
+	} ;
+	uint64_t buckets[LIL_DB_HIST_BUCKETS] = { 0 }, ranks[4], seen = 0, max ;
+	unsigned int q = 0 ;
+
+	memset(summary, 0, sizeof(*summary)) ;
+
+	for (int s = 0; s < LIL_DB_METRICS_SHARDS; ++s) {
+		lil_db_hist_shard_t * shard = &hist->shards[s] ;
+
+		for (int b = 0; b < LIL_DB_HIST_BUCKETS; ++b) {
+			buckets[b] += __atomic_load_n(&shard->buckets[b],
+						      __ATOMIC_RELAXED) ;
+		}
+		max = __atomic_load_n(&shard->max, __ATOMIC_RELAXED) ;
+		if (max > summary->max) summary->max = max ;
+	}
+	for (int b = 0; b < LIL_DB_HIST_BUCKETS; ++b)
+		summary->count += buckets[b] ;
+	if (!summary->count) return ;
+
+	// Each percentile is the value of rank ceil(quantile * count)
+	for (q = 0; q < 4; ++q) {
+		ranks[q] = quantiles[q] * summary->count ;
+		if (ranks[q] < quantiles[q] * summary->count || !ranks[q])
+			ranks[q]++ ;
+	}
+
+	q = 0 ;
+	for (int b = 0; b < LIL_DB_HIST_BUCKETS && q < 4; ++b) {
+		seen += buckets[b] ;
+		for (; q < 4 && seen >= ranks[q]; ++q) {
+			*percentiles[q] = lil_db_hist_top(b) < summary->max
+					  ? lil_db_hist_top(b) : summary->max ;
+		}
+	}
+}
+
+int lil_db_metrics_dump(void)
+{
+	lil_db_hist_summary_t summary ;
+	int ret = 0, failed ;
+
+	for (lil_db_metric_t * metric = __start_lil_db_metrics;
+	     metric && metric < __stop_lil_db_metrics; ++metric) {
+		switch (metric->kind) {
+		case LIL_DB_METRIC_COUNTER:
+			failed = lil_db_printf(LIL_DB_OPTION_DEFAULT,
+				"metric %s: %llu\n", metric->name,
+				(unsigned long long)
+				lil_db_counter_read(metric->metric)) ;
+			break ;
+		case LIL_DB_METRIC_GAUGE:
+			failed = lil_db_printf(LIL_DB_OPTION_DEFAULT,
+				"metric %s: %lld\n", metric->name,
+				(long long)lil_db_gauge_read(metric->metric)) ;
+			break ;
+		default:
+			lil_db_hist_summarize(metric->metric, &summary) ;
+			failed = lil_db_printf(LIL_DB_OPTION_DEFAULT,
+				"metric %s: count %llu p50 %llu p90 %llu "
+				"p99 %llu p999 %llu max %llu\n", metric->name,
+				(unsigned long long)summary.count,
+				(unsigned long long)summary.p50,
+				(unsigned long long)summary.p90,
+				(unsigned long long)summary.p99,
+				(unsigned long long)summary.p999,
+				(unsigned long long)summary.max) ;
+			break ;
+		}
+		if (!ret) ret = failed ;
+	}
+
+	return ret ;
+}
+
+// Body of the dumper thread
+static void * lil_db_metrics_dumper(void * unused)
+{
+	struct timespec deadline ;
+
+	pthread_mutex_lock(&dumper.lock) ;
+
+	while (!dumper.stopping) {
+		clock_gettime(CLOCK_REALTIME, &deadline) ;
+		deadline.tv_sec += dumper.period_ms / 1000 ;
+		deadline.tv_nsec += (dumper.period_ms % 1000) * 1000000L ;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++ ;
+			deadline.tv_nsec -= 1000000000L ;
+		}
+
+		while (!dumper.stopping
+		       && pthread_cond_timedwait(&dumper.wake, &dumper.lock,
+						 &deadline) != ETIMEDOUT) ;
+
+		// The last dump is lil_db_metrics_stop's
+		if (dumper.stopping) break ;
+
+		pthread_mutex_unlock(&dumper.lock) ;
+		lil_db_metrics_dump() ;
+		pthread_mutex_lock(&dumper.lock) ;
+	}
+
+	pthread_mutex_unlock(&dumper.lock) ;
+
+	return unused ;
+}
+
+int lil_db_metrics_start(unsigned int period_ms)
+{
+	int ret = 0 ;
+
+	pthread_mutex_lock(&dumper.lock) ;
+	if (!dumper.running) {
+		dumper.period_ms = period_ms ? period_ms
+			: LIL_DB_METRICS_DEFAULT_PERIOD_MS ;
+		dumper.stopping = 0 ;
+		ret = pthread_create(&dumper.thread, NULL,
+				     lil_db_metrics_dumper, NULL) ;
+		dumper.running = !ret ;
+	}
+	pthread_mutex_unlock(&dumper.lock) ;
+
+	return ret ;
+}
+
+int lil_db_metrics_stop(void)
+{
+	pthread_mutex_lock(&dumper.lock) ;
+	if (!dumper.running) {
+		pthread_mutex_unlock(&dumper.lock) ;
+		return 0 ;
+	}
+	dumper.stopping = 1 ;
+	pthread_cond_signal(&dumper.wake) ;
+	pthread_mutex_unlock(&dumper.lock) ;
+
+	pthread_join(dumper.thread, NULL) ;
+
+	pthread_mutex_lock(&dumper.lock) ;
+	dumper.running = 0 ;
+	dumper.stopping = 0 ;
+	pthread_mutex_unlock(&dumper.lock) ;
+
+	return lil_db_metrics_dump() ;
+}
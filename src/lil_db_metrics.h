@@ -0,0 +1,252 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_metrics.h header file
+ * Counters, gauges and latency histograms, summarized through lil_db
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Define them at file scope, static or not:
+ *
+ *	LIL_DB_COUNTER(requests) ;
+ *	static LIL_DB_HISTOGRAM(request_ns) ;
+ *
+ *	lil_db_counter_add(&requests, 1) ;
+ *	lil_db_hist_record(&request_ns, took_ns) ;
+ *
+ * Each definition also lands a lil_db_metric_t in the "lil_db_metrics"
+ * section, which is how lil_db_metrics_dump finds them all, one entry
+ * each. lil_db_metrics_start does that periodically from a thread.
+ *
+ * Counters and histograms are split into LIL_DB_METRICS_SHARDS shards, one
+ * per thread, so recording is a few plain loads and stores to memory no
+ * other thread writes: wait-free, and no cache line bouncing. A thread's
+ * shard goes back when it exits, for the next thread to carry on with.
+ * Threads past the LIL_DB_METRICS_SHARDS - 1 alive at once share the last
+ * shard, with atomic adds. A dump merges the shards as they stand, so it
+ * may miss a record made while it runs but never counts one twice.
+ * Everything is cumulative from the start of the program.
+ *
+ * Histograms are log-linear, like HdrHistogram: values under
+ * LIL_DB_HIST_SUB get a bucket each, and every power of two above that is
+ * split into LIL_DB_HIST_SUB buckets, so a percentile is never off by more
+ * than 1 / LIL_DB_HIST_SUB (6.25%). Values past 2^LIL_DB_HIST_MAX_BITS
+ * (18 minutes, in ns) all land in the last bucket, though max stays exact.
+ */
+
+#ifndef LIL_DB_METRICS_H
+#define LIL_DB_METRICS_H
+
+#include <stdint.h>
+
+// Shards per counter and histogram. The last is shared by the threads
+// that didn't get one of their own while the rest were taken
+#define LIL_DB_METRICS_SHARDS 		16
+#define LIL_DB_METRICS_SHARED 		(LIL_DB_METRICS_SHARDS - 1)
+
+// How often lil_db_metrics_start dumps, unless told otherwise
+#define LIL_DB_METRICS_DEFAULT_PERIOD_MS 10000
+
+// Buckets per power of two, and the power past which values are clamped
+#define LIL_DB_HIST_SUB_BITS 		4
+#define LIL_DB_HIST_SUB 		(1 << LIL_DB_HIST_SUB_BITS)
+#define LIL_DB_HIST_MAX_BITS 		40
+
+// One linear group below LIL_DB_HIST_SUB, then one per power of two
+#define LIL_DB_HIST_BUCKETS 						       \
+	((LIL_DB_HIST_MAX_BITS - LIL_DB_HIST_SUB_BITS + 1) * LIL_DB_HIST_SUB)
+
+// What a lil_db_metric_t points at
+typedef enum lil_db_metric_kind {
+	LIL_DB_METRIC_COUNTER = 0,	// lil_db_counter_t
+	LIL_DB_METRIC_GAUGE,		// lil_db_gauge_t
+	LIL_DB_METRIC_HISTOGRAM		// lil_db_hist_t
+} lil_db_metric_kind ;
+
+// A count that only goes up, e.g. requests served
+typedef struct lil_db_counter {
+	struct {
+		uint64_t value ;
+	} __attribute__((aligned(64))) shards[LIL_DB_METRICS_SHARDS] ;
+} lil_db_counter_t ;
+
+// A value that is set rather than counted, e.g. queue depth. Not sharded,
+// since the last value set is the one that counts
+typedef struct lil_db_gauge {
+	int64_t value ;
+} lil_db_gauge_t ;
+
+// One thread's share of a histogram
+typedef struct lil_db_hist_shard {
+	// The biggest value recorded, exactly
+	uint64_t max ;
+
+	uint64_t buckets[LIL_DB_HIST_BUCKETS] ;
+} __attribute__((aligned(64))) lil_db_hist_shard_t ;
+
+// A distribution of values, usually latencies in nanoseconds
+typedef struct lil_db_hist {
+	lil_db_hist_shard_t shards[LIL_DB_METRICS_SHARDS] ;
+} lil_db_hist_t ;
+
+// What a histogram's dump entry says
+typedef struct lil_db_hist_summary {
+	uint64_t count ;
+
+	// Percentiles, each the top of its bucket but never more than max
+	uint64_t p50, p90, p99, p999 ;
+
+	uint64_t max ;
+} lil_db_hist_summary_t ;
+
+// How lil_db_metrics_dump finds a metric. Lives in the lil_db_metrics
+// section, next to every other one in the program
+typedef struct lil_db_metric {
+	lil_db_metric_kind kind ;
+	const char * name ;
+	void * metric ;
+} lil_db_metric_t ;
+
+// Register var with lil_db_metrics_dump under its own name
+#define LIL_DB_METRIC_REGISTER(kind_, var) 				       \
+	static lil_db_metric_t lil_db_metric_##var 			       \
+		__attribute__((section("lil_db_metrics"), used,		       \
+			       aligned(8))) = {				       \
+		.kind = (kind_), .name = #var, .metric = &(var),	       \
+	}
+
+// Define a metric called var. Zeroed, so it costs the binary nothing
+#define LIL_DB_COUNTER(var) 						       \
+	lil_db_counter_t var ;						       \
+	LIL_DB_METRIC_REGISTER(LIL_DB_METRIC_COUNTER, var)
+
+#define LIL_DB_GAUGE(var) 						       \
+	lil_db_gauge_t var ;						       \
+	LIL_DB_METRIC_REGISTER(LIL_DB_METRIC_GAUGE, var)
+
+#define LIL_DB_HISTOGRAM(var) 						       \
+	lil_db_hist_t var ;						       \
+	LIL_DB_METRIC_REGISTER(LIL_DB_METRIC_HISTOGRAM, var)
+
+// This thread's shard plus 1, or 0 until it records something
+extern __thread unsigned int lil_db_metrics_thread ;
+
+// Give this thread a shard, until it exits. Returns it
+unsigned int lil_db_metrics_thread_init(void) ;
+
+// Which shard this thread records into
+static inline unsigned int lil_db_metrics_shard(void)
+{
+	unsigned int thread = lil_db_metrics_thread ;
+
+	return thread ? thread - 1 : lil_db_metrics_thread_init() ;
+}
+
+// Add n to a value in shard. No lock prefix unless the shard is shared
+static inline void lil_db_metrics_add(uint64_t * value, uint64_t n,
+				      unsigned int shard)
+{
+	if (shard == LIL_DB_METRICS_SHARED)
+		__atomic_fetch_add(value, n, __ATOMIC_RELAXED) ;
+	else
+		__atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED)
+				 + n, __ATOMIC_RELAXED) ;
+}
+
+static inline void lil_db_counter_add(lil_db_counter_t * counter, uint64_t n)
+{
+	unsigned int shard = lil_db_metrics_shard() ;
+
+	lil_db_metrics_add(&counter->shards[shard].value, n, shard) ;
+}
+
+static inline void lil_db_gauge_set(lil_db_gauge_t * gauge, int64_t value)
+{
+	__atomic_store_n(&gauge->value, value, __ATOMIC_RELAXED) ;
+}
+
+static inline void lil_db_gauge_add(lil_db_gauge_t * gauge, int64_t delta)
+{
+	__atomic_fetch_add(&gauge->value, delta, __ATOMIC_RELAXED) ;
+}
+
+static inline int64_t lil_db_gauge_read(lil_db_gauge_t * gauge)
+{
+	return __atomic_load_n(&gauge->value, __ATOMIC_RELAXED) ;
+}
+
+// The bucket value lands in
+static inline unsigned int lil_db_hist_bucket(uint64_t value)
+{
+	unsigned int shift ;
+
+	if (value < LIL_DB_HIST_SUB) return value ;
+	if (value >> LIL_DB_HIST_MAX_BITS) return LIL_DB_HIST_BUCKETS - 1 ;
+
+	// The top LIL_DB_HIST_SUB_BITS + 1 bits pick the bucket
+	shift = 63 - __builtin_clzll(value) - LIL_DB_HIST_SUB_BITS ;
+
+	return (shift + 1) * LIL_DB_HIST_SUB
+		+ (value >> shift) - LIL_DB_HIST_SUB ;
+}
+
+// Record one value, e.g. a latency in nanoseconds
+static inline void lil_db_hist_record(lil_db_hist_t * hist, uint64_t value)
+{
+	unsigned int shard = lil_db_metrics_shard() ;
+	lil_db_hist_shard_t * mine = &hist->shards[shard] ;
+	uint64_t max = __atomic_load_n(&mine->max, __ATOMIC_RELAXED) ;
+
+	lil_db_metrics_add(&mine->buckets[lil_db_hist_bucket(value)], 1,
+			   shard) ;
+
+	if (value <= max) return ;
+	if (shard != LIL_DB_METRICS_SHARED) {
+		__atomic_store_n(&mine->max, value, __ATOMIC_RELAXED) ;
+		return ;
+	}
+
+	// Only the shared shard can lose a race, and only to a bigger value
+	while (value > max
+	       && !__atomic_compare_exchange_n(&mine->max, &max, value, 1,
+					       __ATOMIC_RELAXED,
+					       __ATOMIC_RELAXED)) ;
+}
+
+// All functions return 0 on success and nonzero on failure unless otherwise specified
+
+// The total of every shard
+uint64_t lil_db_counter_read(lil_db_counter_t * counter) ;
+
+// Merge the shards of hist and work out what its dump entry would say
+void lil_db_hist_summarize(lil_db_hist_t * hist,
+			   lil_db_hist_summary_t * summary) ;
+
+// Write one entry per metric in the program with lil_db_printf, e.g.
+// "metric request_ns: count 1000 p50 812 p90 1023 p99 2047 p999 4095
+// max 3877". Returns the first failure, but writes the rest anyway
+int lil_db_metrics_dump(void) ;
+
+// Dump from a thread every period_ms (0 for the default) until
+// lil_db_metrics_stop, which lil_db_kill calls
+int lil_db_metrics_start(unsigned int period_ms) ;
+
+// Dump one last time and stop the thread, if it's running
+int lil_db_metrics_stop(void) ;
+
+#endif // LIL_DB_METRICS_H
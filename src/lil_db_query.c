@@ -0,0 +1,413 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_query.c source file
+ * Pull an entry range or a time window out of a big lil_db log
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Usage: lil_db_query [-i INDEX] [-n FIRST[-LAST]] [-t FROM[-TO]]
+ *                     [-g PATTERN] LOG
+ *
+ *   -n  Entries FIRST through LAST, as numbered by LIL_DB_OPTION_NUMBERED.
+ *       FIRST alone is one entry, FIRST- runs to the end of the log
+ *   -t  Entries written between FROM and TO, in seconds since the epoch
+ *       like LIL_DB_OPTION_TIMESTAMP prints them. Needs the index and is
+ *       only as exact as it is, so ask lil_db_set_index for a small
+ *       interval if you need tight windows
+ *   -g  Only print lines containing PATTERN
+ *   -i  Index to use, LOG.idx by default
+ *
+ * The log and its index are mmap'd. The index gets us within interval
+ * entries of where we want to be, then the "[N]. " prefixes are found with
+ * the same substring search -g uses, which is AVX2 when the CPU has it.
+ */
+
+#define _GNU_SOURCE // memmem and memrchr
+#include "lil_db.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <immintrin.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A read only mapping of a whole file
+typedef struct lil_db_query_map {
+	const char * data ;
+	size_t size ;
+} lil_db_query_map_t ;
+
+// Map path. An empty file maps to nothing, successfully
+static int lil_db_query_map(const char * path, lil_db_query_map_t * map)
+{
+	struct stat st ;
+	int fd ;
+
+	map->data = NULL ;
+	map->size = 0 ;
+
+	if ((fd = open(path, O_RDONLY)) < 0) return 1 ;
+	if (fstat(fd, &st)) {
+		close(fd) ;
+		return 1 ;
+	}
+
+	if (st.st_size) {
+		map->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) ;
+		if (map->data == MAP_FAILED) {
+			map->data = NULL ;
+			close(fd) ;
+			return 1 ;
+		}
+		map->size = st.st_size ;
+
+		// We read front to back, tell readahead to get on with it
+		madvise((void *)map->data, map->size, MADV_SEQUENTIAL) ;
+	}
+	close(fd) ;
+
+	return 0 ;
+}
+
+/* SUBSTRING SEARCH */
+
+// Compare the first and last bytes of the needle against 32 positions at
+// once, and only memcmp the middle where both match. Log text rarely
+// matches both, so we mostly go 32 bytes per couple of instructions
+__attribute__((target("avx2")))
+static const char * lil_db_query_find_avx2(const char * haystack, size_t n,
+					   const char * needle, size_t m)
+{
+	const __m256i first = _mm256_set1_epi8(needle[0]),
+		      last = _mm256_set1_epi8(needle[m - 1]) ;
+	size_t i = 0 ;
+
+	// Both loads must stay inside the haystack
+	for (; i + m + 31 <= n; i += 32) {
+		__m256i block_first = _mm256_loadu_si256(
+				(const __m256i *)(haystack + i)),
+			block_last = _mm256_loadu_si256(
+				(const __m256i *)(haystack + i + m - 1)) ;
+		uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(first, block_first),
+			_mm256_cmpeq_epi8(last, block_last))) ;
+
+		for (; mask; mask &= mask - 1) {
+			size_t at = i + __builtin_ctz(mask) ;
+
+			if (m <= 2 || !memcmp(haystack + at + 1, needle + 1, m - 2))
+				return haystack + at ;
+		}
+	}
+
+	// The last few bytes go the slow way
+	return memmem(haystack + i, n - i, needle, m) ;
+}
+
+// Without AVX2, glibc's memmem is as good as it gets
+static const char * lil_db_query_find_plain(const char * haystack, size_t n,
+					    const char * needle, size_t m)
+{
+	return memmem(haystack, n, needle, m) ;
+}
+
+// Find needle in haystack, NULL if it isn't there
+static const char * lil_db_query_find(const char * haystack, size_t n,
+				      const char * needle, size_t m)
+{
+	static const char * (*find)(const char *, size_t, const char *, size_t) ;
+
+	if (!m) return haystack ;
+	if (n < m) return NULL ;
+
+	if (!find) {
+		find = __builtin_cpu_supports("avx2") ? lil_db_query_find_avx2
+						      : lil_db_query_find_plain ;
+	}
+
+	return find(haystack, n, needle, m) ;
+}
+
+/* SEEKING */
+
+// Find where entry starts in the log, looking no further than [from, to).
+// Returns nonzero if its "[N]. " prefix isn't there (the entry wasn't
+// NUMBERED), in which case the nearest index record will have to do
+static int lil_db_query_entry_offset(const lil_db_query_map_t * log,
+				     size_t from, size_t to, uint64_t entry,
+				     size_t * at)
+{
+	static const char emphasis[] = LIL_DB_EMPHASIS_STYLE ;
+	char prefix[32] ;
+	const char * found ;
+
+	snprintf(prefix, sizeof(prefix), "[%llu]. ", (unsigned long long)entry) ;
+	found = lil_db_query_find(log->data + from, to - from, prefix,
+				  strlen(prefix)) ;
+	if (!found) return 1 ;
+
+	// An EMPHASIS entry starts before its number
+	*at = found - log->data ;
+	if (*at >= from + sizeof(emphasis) - 1
+	    && !memcmp(found - (sizeof(emphasis) - 1), emphasis,
+		       sizeof(emphasis) - 1))
+		*at -= sizeof(emphasis) - 1 ;
+
+	return 0 ;
+}
+
+// Offsets of the index records either side of where entry should be:
+// *from is the last record at or before it, *to the first after it
+static void lil_db_query_entry_bounds(const lil_db_index_record_t * records,
+				      long count, size_t size, uint64_t entry,
+				      size_t * from, size_t * to)
+{
+	long r = lil_db_index_find_entry(records, count, entry) ;
+
+	*from = 0 ;
+	*to = size ;
+	if (r < 0) return ;
+
+	// Case: It's before anything the index knows about
+	if (records[r].entry > entry) {
+		*to = records[r].offset ;
+		return ;
+	}
+
+	*from = records[r].offset ;
+	if (r + 1 < count) *to = records[r + 1].offset ;
+}
+
+// Same, by time
+static void lil_db_query_time_bounds(const lil_db_index_record_t * records,
+				     long count, size_t size, uint64_t ns,
+				     size_t * from, size_t * to)
+{
+	long r = lil_db_index_find_time(records, count, ns) ;
+
+	*from = 0 ;
+	*to = size ;
+	if (r < 0) return ;
+
+	if (records[r].timestamp_ns > ns) {
+		*to = records[r].offset ;
+		return ;
+	}
+
+	*from = records[r].offset ;
+	if (r + 1 < count) *to = records[r + 1].offset ;
+}
+
+// Parse a decimal number at arg into *value, leaving *end after it. With
+// seconds, it's seconds with up to nanosecond decimals, and *value is in
+// nanoseconds. Only digits and a '.' are taken, so there's no sign,
+// whitespace or hex to slip through, and a double never rounds it
+static int lil_db_query_parse_number(const char * arg, char ** end,
+				     int seconds, uint64_t * value)
+{
+	uint64_t scale = 1000000000ULL ;
+
+	if (*arg < '0' || *arg > '9') return 1 ;
+
+	errno = 0 ;
+	*value = strtoull(arg, end, 10) ;
+	if (errno == ERANGE) return 1 ;
+	if (!seconds) return 0 ;
+
+	if (*value > UINT64_MAX / scale) return 1 ;
+	*value *= scale ;
+
+	if (**end != '.') return 0 ;
+	// Decimals past the ninth are read and thrown away
+	for (++*end; **end >= '0' && **end <= '9'; ++*end) {
+		scale /= 10 ;
+		*value += (**end - '0') * scale ;
+	}
+
+	return 0 ;
+}
+
+// Parse "FIRST", "FIRST-" or "FIRST-LAST" like lil_db_query_parse_number.
+// *has_last is 0 for "FIRST-"
+static int lil_db_query_parse_range(const char * arg, int seconds,
+				    uint64_t * first, uint64_t * last,
+				    int * has_last)
+{
+	char * end ;
+
+	if (lil_db_query_parse_number(arg, &end, seconds, first)) return 1 ;
+
+	*has_last = 1 ;
+	*last = *first ;
+	if (*end == '-') {
+		arg = ++end ;
+		*has_last = *arg != '\0' ;
+		if (*has_last
+		    && lil_db_query_parse_number(arg, &end, seconds, last))
+			return 1 ;
+	}
+
+	return *end != '\0' || (*has_last && *last < *first) ;
+}
+
+/* OUTPUT */
+
+// Print every line in [from, to) that contains pattern
+static void lil_db_query_grep(const lil_db_query_map_t * log, size_t from,
+			      size_t to, const char * pattern)
+{
+	const char * p = log->data + from, * end = log->data + to,
+		   * line, * eol ;
+	size_t m = strlen(pattern) ;
+
+	while (p < end && (p = lil_db_query_find(p, end - p, pattern, m))) {
+		line = memrchr(log->data + from, '\n', p - (log->data + from)) ;
+		line = line ? line + 1 : log->data + from ;
+		eol = memchr(p, '\n', end - p) ;
+		eol = eol ? eol + 1 : end ;
+
+		fwrite(line, 1, eol - line, stdout) ;
+
+		// One match per line is plenty
+		p = eol ;
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	const char * index_path = NULL, * pattern = NULL, * entries = NULL,
+		   * window = NULL ;
+	char default_index[PATH_MAX] ;
+	lil_db_query_map_t log, index = { NULL, 0 } ;
+	const lil_db_index_record_t * records = NULL ;
+	long count = 0 ;
+	size_t start, end, from, to ;
+	int opt ;
+
+	while ((opt = getopt(argc, argv, "i:n:t:g:")) != -1) {
+		switch (opt) {
+		case 'i': index_path = optarg ; break ;
+		case 'n': entries = optarg ; break ;
+		case 't': window = optarg ; break ;
+		case 'g': pattern = optarg ; break ;
+		default: goto usage ;
+		}
+	}
+	if (optind != argc - 1) goto usage ;
+
+	if (lil_db_query_map(argv[optind], &log)) {
+		perror(argv[optind]) ;
+		return 1 ;
+	}
+
+	// A truncated name could open some other file as the index
+	if (!index_path) {
+		if ((size_t)snprintf(default_index, sizeof(default_index), "%s"
+				     LIL_DB_INDEX_SUFFIX, argv[optind])
+		    >= sizeof(default_index)) {
+			fprintf(stderr, "%s: %s\n", argv[optind],
+				strerror(ENAMETOOLONG)) ;
+			return 1 ;
+		}
+		index_path = default_index ;
+	}
+
+	// No index is fine for -n, we just scan the whole log for the prefix
+	if (!lil_db_query_map(index_path, &index)) {
+		count = lil_db_index_records(index.data, index.size, &records) ;
+		if (count < 0) {
+			fprintf(stderr, "%s is not a lil_db index\n", index_path) ;
+			return 1 ;
+		}
+
+		// The index can get ahead of the log if it was caught mid-flush
+		while (count && records[count - 1].offset > log.size) count-- ;
+	}
+
+	start = 0 ;
+	end = log.size ;
+
+	if (entries) {
+		uint64_t first, last ;
+		int has_last ;
+
+		if (lil_db_query_parse_range(entries, 0, &first, &last,
+					     &has_last))
+			goto usage ;
+
+		// Case: There's no entry after it to stop at
+		if (last == UINT64_MAX) has_last = 0 ;
+
+		// Case: Not NUMBERED, so round out to the index records
+		lil_db_query_entry_bounds(records, count, log.size, first,
+					  &from, &to) ;
+		if (lil_db_query_entry_offset(&log, from, to, first, &start))
+			start = from ;
+
+		// Up to wherever the entry after the last one starts
+		if (has_last) {
+			lil_db_query_entry_bounds(records, count, log.size,
+						  last + 1, &from, &to) ;
+			if (from < start) from = start ;
+			if (to < from
+			    || lil_db_query_entry_offset(&log, from, to,
+							 last + 1, &end))
+				end = to ;
+		}
+	}
+
+	if (window) {
+		uint64_t first, last ;
+		int has_last ;
+
+		if (lil_db_query_parse_range(window, 1, &first, &last,
+					     &has_last))
+			goto usage ;
+		if (!count) {
+			fprintf(stderr, "-t needs an index, see lil_db_set_index\n") ;
+			return 1 ;
+		}
+
+		lil_db_query_time_bounds(records, count, log.size,
+					 first, &from, &to) ;
+		if (from > start) start = from ;
+
+		if (has_last) {
+			lil_db_query_time_bounds(records, count, log.size,
+						 last, &from, &to) ;
+			if (to < end) end = to ;
+		}
+	}
+
+	if (start < end) {
+		if (pattern) lil_db_query_grep(&log, start, end, pattern) ;
+		else fwrite(log.data + start, 1, end - start, stdout) ;
+	}
+
+	return fflush(stdout) != 0 ;
+
+usage:
+	fprintf(stderr, "usage: %s [-i INDEX] [-n FIRST[-LAST]] "
+		"[-t FROM[-TO]] [-g PATTERN] LOG\n", argv[0]) ;
+	return 2 ;
+}
@@ -0,0 +1,75 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_recover.c source file
+ * Rebuild the ordered log from a ring left behind by lil_db_init_ring
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Usage: lil_db_recover RING_FILE [OUTPUT_FILE]
+ */
+
+#include "lil_db_ring.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int main(int argc, char ** argv)
+{
+	struct stat st ;
+	FILE * out = stdout ;
+	void * map ;
+	long entries ;
+	int fd ;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s RING_FILE [OUTPUT_FILE]\n", argv[0]) ;
+		return 2 ;
+	}
+
+	if ((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st)) {
+		perror(argv[1]) ;
+		return 1 ;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) ;
+	close(fd) ;
+	if (map == MAP_FAILED) {
+		perror("mmap") ;
+		return 1 ;
+	}
+
+	if (argc == 3 && !(out = fopen(argv[2], "w"))) {
+		perror(argv[2]) ;
+		return 1 ;
+	}
+
+	entries = lil_db_ring_recover(map, st.st_size, out) ;
+	if (entries < 0) {
+		fprintf(stderr, "%s is not a lil_db ring\n", argv[1]) ;
+		return 1 ;
+	}
+
+	fprintf(stderr, "Recovered %ld entries from %s\n", entries, argv[1]) ;
+
+	if (out != stdout) fclose(out) ;
+	munmap(map, st.st_size) ;
+
+	return 0 ;
+}
@@ -0,0 +1,241 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_ring.c source file
+ * A crash-resilient memory-mapped log ring for lil_db
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#include "lil_db_ring.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Round n up to the next record boundary
+#define LIL_DB_RING_ROUND_UP(n) 					       \
+		(((n) + LIL_DB_RING_ALIGN - 1) & ~(size_t)(LIL_DB_RING_ALIGN - 1))
+
+// FNV-1a, continued from a previous hash value
+static uint32_t lil_db_ring_fnv1a(uint32_t hash, const void * bytes, size_t n)
+{
+	const unsigned char * p = bytes ;
+
+	while (n--) {
+		hash ^= *p++ ;
+		hash *= 16777619U ;
+	}
+
+	return hash ;
+}
+
+// Checksum covering everything in a record that a torn write could damage
+static uint32_t lil_db_ring_checksum(uint64_t sequence, uint32_t length,
+				     const void * text)
+{
+	uint32_t hash = 2166136261U ;
+
+	hash = lil_db_ring_fnv1a(hash, &sequence, sizeof(sequence)) ;
+	hash = lil_db_ring_fnv1a(hash, &length, sizeof(length)) ;
+
+	return lil_db_ring_fnv1a(hash, text, length) ;
+}
+
+int lil_db_ring_open(lil_db_ring_t * ring, const char * filename, size_t capacity)
+{
+	struct stat st ;
+	int fd, fresh ;
+
+	capacity = LIL_DB_RING_ROUND_UP(capacity) ;
+	if (capacity < sizeof(lil_db_ring_record_t) + LIL_DB_RING_ALIGN)
+		return 1 ;
+
+	fd = open(filename, O_RDWR | O_CREAT, 0644) ;
+	if (fd < 0) return 1 ;
+
+	if (fstat(fd, &st)) {
+		close(fd) ;
+		return 1 ;
+	}
+
+	// An existing file of exactly the right size might be a ring we can reuse
+	ring->map_size = LIL_DB_RING_DATA_OFFSET + capacity ;
+	fresh = (size_t)st.st_size != ring->map_size ;
+
+	// ftruncate() does all the disk allocation up front, so that appends
+	// never need to ask the kernel for anything
+	if (fresh && ftruncate(fd, ring->map_size)) {
+		close(fd) ;
+		return 1 ;
+	}
+
+	ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd, 0) ;
+	close(fd) ; // The mapping keeps its own reference to the file
+	if (ring->map == MAP_FAILED) return 1 ;
+
+	ring->header = (lil_db_ring_header_t *)ring->map ;
+	ring->data = ring->map + LIL_DB_RING_DATA_OFFSET ;
+
+	// Anything that doesn't look like one of our rings gets wiped
+	if (fresh
+	    || ring->header->magic != LIL_DB_RING_MAGIC
+	    || ring->header->version != LIL_DB_RING_VERSION
+	    || ring->header->data_offset != LIL_DB_RING_DATA_OFFSET
+	    || ring->header->capacity != capacity) {
+		memset(ring->map, 0, ring->map_size) ;
+		ring->header->version = LIL_DB_RING_VERSION ;
+		ring->header->data_offset = LIL_DB_RING_DATA_OFFSET ;
+		ring->header->capacity = capacity ;
+		ring->header->head = 0 ;
+		ring->header->sequence = 0 ;
+		__atomic_store_n(&ring->header->magic, LIL_DB_RING_MAGIC,
+				 __ATOMIC_RELEASE) ;
+	}
+
+	return 0 ;
+}
+
+int lil_db_ring_append(lil_db_ring_t * ring, const char * text, uint32_t length)
+{
+	lil_db_ring_header_t * header = ring->header ;
+	lil_db_ring_record_t * record ;
+	size_t needed, offset ;
+
+	needed = LIL_DB_RING_ROUND_UP(sizeof(*record) + length) ;
+	if (needed > header->capacity) return 1 ;
+
+	// Records never straddle the end, skip the tail and start over at 0
+	offset = header->head % header->capacity ;
+	if (header->capacity - offset < needed) {
+		header->head += header->capacity - offset ;
+		offset = 0 ;
+	}
+
+	record = (lil_db_ring_record_t *)(ring->data + offset) ;
+
+	// Kill the old magic first so a crash mid-copy leaves garbage, not
+	// a record that claims to be valid
+	__atomic_store_n(&record->magic, 0, __ATOMIC_RELAXED) ;
+
+	record->length = length ;
+	record->sequence = header->sequence ;
+	record->checksum = lil_db_ring_checksum(header->sequence, length, text) ;
+	record->reserved = 0 ;
+	memcpy(record + 1, text, length) ;
+
+	// Publish the record, then the header that points past it
+	__atomic_store_n(&record->magic, LIL_DB_RING_RECORD_MAGIC,
+			 __ATOMIC_RELEASE) ;
+	header->sequence++ ;
+	__atomic_store_n(&header->head, header->head + needed, __ATOMIC_RELEASE) ;
+
+	return 0 ;
+}
+
+int lil_db_ring_close(lil_db_ring_t * ring)
+{
+	int ret = 0 ;
+
+	if (ring->map && munmap(ring->map, ring->map_size)) ret = 1 ;
+
+	memset(ring, 0, sizeof(*ring)) ;
+
+	return ret ;
+}
+
+// A record found while scanning a ring, sorted by sequence for output
+typedef struct lil_db_ring_found {
+	uint64_t sequence ;
+	const lil_db_ring_record_t * record ;
+} lil_db_ring_found_t ;
+
+// qsort() comparator for lil_db_ring_found_t, ascending sequence
+static int lil_db_ring_found_cmp(const void * a, const void * b)
+{
+	uint64_t x = ((const lil_db_ring_found_t *)a)->sequence,
+		 y = ((const lil_db_ring_found_t *)b)->sequence ;
+
+	return (x > y) - (x < y) ;
+}
+
+long lil_db_ring_recover(const void * map, size_t map_size, FILE * out)
+{
+	const lil_db_ring_header_t * header = map ;
+	const unsigned char * data ;
+	lil_db_ring_found_t * found ;
+	size_t offset, count = 0, first ;
+
+	if (map_size < LIL_DB_RING_DATA_OFFSET
+	    || header->magic != LIL_DB_RING_MAGIC
+	    || header->version != LIL_DB_RING_VERSION
+	    || header->data_offset + header->capacity > map_size)
+		return -1 ;
+
+	data = (const unsigned char *)map + header->data_offset ;
+
+	// There can't be more records than there are record sized slots
+	found = calloc(header->capacity / LIL_DB_RING_ROUND_UP(
+		sizeof(lil_db_ring_record_t)) + 1, sizeof(*found)) ;
+	if (!found) return -1 ;
+
+	// The header may be stale if the writer died mid-append, so don't trust
+	// it. Instead, look at every boundary in the data area and keep any
+	// record that checks out. A valid record is skipped over whole so that
+	// its text can't be mistaken for another record.
+	for (offset = 0;
+	     offset + sizeof(lil_db_ring_record_t) <= header->capacity; ) {
+		const lil_db_ring_record_t * record =
+			(const lil_db_ring_record_t *)(data + offset) ;
+		size_t size = LIL_DB_RING_ROUND_UP(sizeof(*record)
+						   + (size_t)record->length) ;
+
+		if (record->magic != LIL_DB_RING_RECORD_MAGIC
+		    || size > header->capacity - offset
+		    || record->checksum != lil_db_ring_checksum(
+				record->sequence, record->length, record + 1)) {
+			offset += LIL_DB_RING_ALIGN ;
+			continue ;
+		}
+
+		found[count].sequence = record->sequence ;
+		found[count++].record = record ;
+		offset += size ;
+	}
+
+	qsort(found, count, sizeof(*found), lil_db_ring_found_cmp) ;
+
+	// Only the unbroken run of sequence numbers ending at the newest record
+	// is the log. Anything older than a gap was partly overwritten.
+	for (first = count; first > 0; --first) {
+		if (first < count
+		    && found[first - 1].sequence + 1 != found[first].sequence)
+			break ;
+	}
+
+	for (size_t i = first; i < count; ++i) {
+		fwrite(found[i].record + 1, 1, found[i].record->length, out) ;
+	}
+
+	free(found) ;
+
+	return (long)(count - first) ;
+}
@@ -0,0 +1,119 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_ring.h header file
+ * A crash-resilient memory-mapped log ring for lil_db
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#ifndef LIL_DB_RING_H
+#define LIL_DB_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// On-disk layout of a ring file:
+//
+//	[ header | data area of `capacity` bytes ]
+//
+// Every entry in the data area is a record header followed by the entry
+// text, padded out to an 8 byte boundary. Records never straddle the end
+// of the data area, the writer just skips ahead to offset 0 instead.
+// Since the file is mapped MAP_SHARED, everything written so far lives in
+// the page cache and survives the writing process crashing.
+
+#define LIL_DB_RING_MAGIC 		0x474e495242444c4cULL // "LLDBRING"
+#define LIL_DB_RING_RECORD_MAGIC 	0x4c444252U	       // "RBDL"
+#define LIL_DB_RING_VERSION 		1
+#define LIL_DB_RING_DATA_OFFSET 	64  // Header is padded to a cache line
+#define LIL_DB_RING_ALIGN 		8   // Records start on this boundary
+#define LIL_DB_RING_DEFAULT_SIZE 	(1 << 20)
+
+// Lives at offset 0 of the ring file
+typedef struct lil_db_ring_header {
+	// Must be LIL_DB_RING_MAGIC or the file is not a ring
+	uint64_t magic ;
+
+	// Layout version, in case I change my mind later
+	uint32_t version ;
+
+	// Offset of the data area from the beginning of the file
+	uint32_t data_offset ;
+
+	// Size of the data area in bytes
+	uint64_t capacity ;
+
+	// Total bytes ever written, the write position is head % capacity
+	uint64_t head ;
+
+	// Sequence number that will be given to the next record
+	uint64_t sequence ;
+} lil_db_ring_header_t ;
+
+// Precedes the text of every entry in the data area
+typedef struct lil_db_ring_record {
+	// Stored last so a half-written record is never mistaken for a real one
+	uint32_t magic ;
+
+	// Number of bytes of entry text following this header
+	uint32_t length ;
+
+	// Position of this entry in the log, counting from 0
+	uint64_t sequence ;
+
+	// FNV-1a of the sequence number, length and entry text
+	uint32_t checksum ;
+
+	// Pads the header out to 24 bytes, always 0
+	uint32_t reserved ;
+} lil_db_ring_record_t ;
+
+// A ring that is currently mapped by this process
+typedef struct lil_db_ring {
+	// The whole mapping, header included
+	unsigned char * map ;
+
+	// Size of the whole mapping in bytes
+	size_t map_size ;
+
+	// Points into map, for convenience
+	lil_db_ring_header_t * header ;
+
+	// Points into map just past the header
+	unsigned char * data ;
+} lil_db_ring_t ;
+
+// All functions return 0 on success and nonzero on failure unless otherwise specified
+
+// Map a ring file, creating it with a data area of `capacity` bytes if needed.
+// An existing ring is reused and continues from its last sequence number.
+int lil_db_ring_open(lil_db_ring_t * ring, const char * filename, size_t capacity) ;
+
+// Copy an entry into the ring. This is only memory copies, no syscalls
+int lil_db_ring_append(lil_db_ring_t * ring, const char * text, uint32_t length) ;
+
+// Unmap the ring. The file stays behind for lil_db_recover to read
+int lil_db_ring_close(lil_db_ring_t * ring) ;
+
+// Rebuild the ordered log from a mapped ring file and write it to out.
+// Returns the number of entries recovered, or -1 if map is not a ring
+long lil_db_ring_recover(const void * map, size_t map_size, FILE * out) ;
+
+#endif // LIL_DB_RING_H
@@ -0,0 +1,222 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_rotate.c source file
+ * Size and time based rotation of lil_db output files
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#include "lil_db_rotate.h"
+#include "lil_db_lz.h"
+#include "lil_db_trace.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The compressor thread and its queue of rotated segments
+static struct {
+	pthread_mutex_t lock ;
+	pthread_cond_t wake ;
+	char paths[LIL_DB_ROTATE_QUEUE_SIZE][LIL_DB_ROTATE_PATH_MAX] ;
+	unsigned int head, count ;
+	int running, stopping ;
+	pthread_t thread ;
+} compressor = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+} ;
+
+// Nonzero if something exists at path
+static int lil_db_rotate_exists(const char * path)
+{
+	struct stat st ;
+
+	return !stat(path, &st) ;
+}
+
+long lil_db_rotate_rename(const char * filename, unsigned long * next_segment)
+{
+	char path[LIL_DB_ROTATE_PATH_MAX], packed[LIL_DB_ROTATE_PATH_MAX] ;
+	unsigned long segment = *next_segment ? *next_segment : 1 ;
+
+	// Skip past anything left over from an earlier run
+	for (;; ++segment) {
+		snprintf(path, sizeof(path), "%s.%lu", filename, segment) ;
+		snprintf(packed, sizeof(packed), "%s.%lu" LIL_DB_LZ_SUFFIX,
+			 filename, segment) ;
+		if (!lil_db_rotate_exists(path) && !lil_db_rotate_exists(packed))
+			break ;
+	}
+
+	// rename() is atomic, readers see either the old name or the new one
+	if (rename(filename, path)) return -1 ;
+
+	*next_segment = segment + 1 ;
+
+	return segment ;
+}
+
+// Sync the directory path is in, so that a rename into it survives a crash
+static int lil_db_rotate_sync_dir(const char * path)
+{
+	char dir[LIL_DB_ROTATE_PATH_MAX + 8] ;
+	char * slash ;
+	int fd, failed ;
+
+	snprintf(dir, sizeof(dir), "%s", path) ;
+	// Keeping the slash if it is the root
+	if ((slash = strrchr(dir, '/'))) slash[slash == dir] = '\0' ;
+	else snprintf(dir, sizeof(dir), ".") ;
+
+	if ((fd = open(dir, O_RDONLY | O_DIRECTORY)) < 0) return 1 ;
+	failed = fsync(fd) ;
+	failed |= close(fd) ;
+
+	return failed ? 1 : 0 ;
+}
+
+// Squash one segment into path.lz. Goes through a temporary file so that
+// path.lz only ever appears complete
+static void lil_db_rotate_compress_one(const char * path)
+{
+	char tmp[LIL_DB_ROTATE_PATH_MAX + 8], packed[LIL_DB_ROTATE_PATH_MAX + 8] ;
+	FILE * in, * out ;
+	int failed ;
+
+	snprintf(packed, sizeof(packed), "%s" LIL_DB_LZ_SUFFIX, path) ;
+	snprintf(tmp, sizeof(tmp), "%s" LIL_DB_LZ_SUFFIX ".tmp", path) ;
+
+	if (!(in = fopen(path, "r"))) return ;
+	if (!(out = fopen(tmp, "w"))) {
+		fclose(in) ;
+		return ;
+	}
+
+	failed = lil_db_lz_compress_stream(in, out) ;
+	fclose(in) ;
+
+	// On disk before it can take the original's place
+	failed |= fflush(out) ;
+	failed |= fsync(fileno(out)) ;
+	failed |= fclose(out) ;
+
+	// Only drop the original once the compressed copy is in place, and
+	// the rename that put it there is durable. Otherwise a crash could
+	// leave neither
+	if (failed || rename(tmp, packed)) {
+		unlink(tmp) ;
+		return ;
+	}
+	if (lil_db_rotate_sync_dir(packed)) return ;
+	unlink(path) ;
+}
+
+// Body of the compressor thread
+static void * lil_db_rotate_compressor(void * unused)
+{
+	char path[LIL_DB_ROTATE_PATH_MAX] ;
+
+	pthread_mutex_lock(&compressor.lock) ;
+
+	for (;;) {
+		while (!compressor.count && !compressor.stopping)
+			pthread_cond_wait(&compressor.wake, &compressor.lock) ;
+
+		// Drain the queue before going home
+		if (!compressor.count) break ;
+
+		memcpy(path, compressor.paths[compressor.head], sizeof(path)) ;
+		compressor.head = (compressor.head + 1) % LIL_DB_ROTATE_QUEUE_SIZE ;
+		compressor.count-- ;
+
+		pthread_mutex_unlock(&compressor.lock) ;
+		LIL_DB_SPAN_BEGIN("lil_db_compress") ;
+		lil_db_rotate_compress_one(path) ;
+		LIL_DB_SPAN_END() ;
+		pthread_mutex_lock(&compressor.lock) ;
+	}
+
+	pthread_mutex_unlock(&compressor.lock) ;
+
+	return unused ;
+}
+
+int lil_db_rotate_compress_start(void)
+{
+	int ret = 0 ;
+
+	pthread_mutex_lock(&compressor.lock) ;
+	if (!compressor.running) {
+		compressor.stopping = 0 ;
+		ret = pthread_create(&compressor.thread, NULL,
+				     lil_db_rotate_compressor, NULL) ;
+		compressor.running = !ret ;
+	}
+	pthread_mutex_unlock(&compressor.lock) ;
+
+	return ret ;
+}
+
+int lil_db_rotate_compress_enqueue(const char * filename, long segment)
+{
+	unsigned int tail ;
+
+	pthread_mutex_lock(&compressor.lock) ;
+
+	// Full, or nobody home. The segment just stays uncompressed
+	if (!compressor.running
+	    || compressor.count == LIL_DB_ROTATE_QUEUE_SIZE) {
+		pthread_mutex_unlock(&compressor.lock) ;
+		return 1 ;
+	}
+
+	tail = (compressor.head + compressor.count) % LIL_DB_ROTATE_QUEUE_SIZE ;
+	snprintf(compressor.paths[tail], LIL_DB_ROTATE_PATH_MAX, "%s.%ld",
+		 filename, segment) ;
+	compressor.count++ ;
+
+	pthread_cond_signal(&compressor.wake) ;
+	pthread_mutex_unlock(&compressor.lock) ;
+
+	return 0 ;
+}
+
+int lil_db_rotate_compress_stop(void)
+{
+	pthread_mutex_lock(&compressor.lock) ;
+	if (!compressor.running) {
+		pthread_mutex_unlock(&compressor.lock) ;
+		return 0 ;
+	}
+	compressor.stopping = 1 ;
+	pthread_cond_signal(&compressor.wake) ;
+	pthread_mutex_unlock(&compressor.lock) ;
+
+	pthread_join(compressor.thread, NULL) ;
+
+	pthread_mutex_lock(&compressor.lock) ;
+	compressor.running = 0 ;
+	compressor.stopping = 0 ;
+	pthread_mutex_unlock(&compressor.lock) ;
+
+	return 0 ;
+}
@@ -0,0 +1,72 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_rotate.h header file
+ * Size and time based rotation of lil_db output files
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * When the output file gets too big or too old it is renamed to
+ * FILENAME.N, N counting up from 1, and a fresh FILENAME is opened in its
+ * place. Both happen under lil_db's lock, so every entry lands in exactly
+ * one segment. If compression is on, a background thread then squashes
+ * FILENAME.N into FILENAME.N.lz and removes the original, so the thread
+ * that happened to trigger the rotation never pays for it.
+ */
+
+#ifndef LIL_DB_ROTATE_H
+#define LIL_DB_ROTATE_H
+
+#include <stdint.h>
+
+// Enough for a full lil_db filename plus ".N.lz.tmp"
+#define LIL_DB_ROTATE_PATH_MAX 		512
+
+// Rotated segments waiting for the compressor. If it falls this far
+// behind, new segments are left uncompressed rather than stall a writer
+#define LIL_DB_ROTATE_QUEUE_SIZE 	16
+
+// When to rotate. Zero in a field means never for that reason
+typedef struct lil_db_rotate_config {
+	// Rotate once the file holds at least this many bytes
+	uint64_t max_bytes ;
+
+	// Rotate once the file has been open this long
+	unsigned int max_age_sec ;
+
+	// Nonzero to compress rotated segments with lil_db_lz
+	int compress ;
+} lil_db_rotate_config_t ;
+
+// All functions return 0 on success and nonzero on failure unless otherwise specified
+
+// Rename filename to filename.N for the first N at or above *next_segment
+// that isn't taken, compressed or not. *next_segment ends up past N.
+// Returns N, or -1 on failure
+long lil_db_rotate_rename(const char * filename, unsigned long * next_segment) ;
+
+// Start the compressor thread if it isn't running
+int lil_db_rotate_compress_start(void) ;
+
+// Hand filename.N to the compressor thread
+int lil_db_rotate_compress_enqueue(const char * filename, long segment) ;
+
+// Compress everything still queued, then stop the compressor thread
+int lil_db_rotate_compress_stop(void) ;
+
+#endif // LIL_DB_ROTATE_H
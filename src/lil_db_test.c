@@ -24,6 +24,14 @@
 
 #include "lil_test.h"
 #include "lil_db.h"
+#include "lil_db_lz.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 TEST_SET(demo1,
 	int x = 4 ;
@@ -84,6 +92,1399 @@ TEST_SET(demo3,
 	) ;
 ) ;
 
+// The ring is tiny, so only the newest entries should survive
+TEST_SET(ring,
+
+	char ringname[] = "DUMMY_RING" ;
+	lil_db_init_ring(ringname,sizeof(ringname),1024) ;
+	for (int i = 0; i < 100; ++i) {
+		lil_db_printf(LIL_DB_OPTION_NUMBERED, "ring entry\n") ;
+	}
+	lil_db_kill() ;
+
+	char * recovered = NULL ;
+	size_t recovered_size = 0 ;
+	long recovered_count = -1 ;
+	int fd = open(ringname, O_RDONLY) ;
+	struct stat st ;
+	if (fd >= 0 && !fstat(fd, &st)) {
+		void * map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0) ;
+		FILE * out = open_memstream(&recovered, &recovered_size) ;
+		recovered_count = lil_db_ring_recover(map,st.st_size,out) ;
+		fclose(out) ;
+		munmap(map,st.st_size) ;
+		close(fd) ;
+	}
+
+	TEST_CASE(ring_recovered,
+		ASSERT(recovered_count > 0) ;
+		ASSERT(recovered_count < 100) ;
+	) ;
+
+	TEST_CASE(ring_newest_last,
+		const char newest[] = "[99]. ring entry\n" ;
+		ASSERT(recovered_size >= sizeof(newest) - 1) ;
+		ASSERT(!strcmp(recovered + recovered_size - (sizeof(newest) - 1),
+			       newest)) ;
+	) ;
+
+	TEST_CASE(ring_oldest_gone,
+		ASSERT(!strstr(recovered, "[0]. ")) ;
+	) ;
+
+	TEST_CASE(ring_removed,
+		free(recovered) ;
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_RING")) ;
+	) ;
+) ;
+
+// Batches of 8, once through io_uring (if we have it) and once through writev
+TEST_SET(batch,
+
+	char batchname[] = "DUMMY_BATCH" ;
+	lil_db_batch_stats_t uring_stats = { 0 }, writev_stats = { 0 } ;
+	lil_db_batch_config_t config = { .max_entries = 8, .max_age_ms = 60000 } ;
+
+	lil_db_init_batched(batchname,sizeof(batchname),&config) ;
+	for (int i = 0; i < 20; ++i) {
+		lil_db_printf(LIL_DB_OPTION_NUMBERED, "batch entry\n") ;
+	}
+	lil_db_get_batch_stats(&uring_stats) ;
+	lil_db_kill() ;
+
+	config.disable_io_uring = 1 ;
+	lil_db_init_batched(batchname,sizeof(batchname),&config) ;
+	for (int i = 0; i < 20; ++i) {
+		lil_db_printf(LIL_DB_OPTION_NUMBERED, "batch entry\n") ;
+	}
+	lil_db_flush() ;
+	lil_db_get_batch_stats(&writev_stats) ;
+	lil_db_kill() ;
+
+	int lines = 0 ;
+	FILE * batchfile = fopen(batchname, "r") ;
+	for (int c; batchfile && (c = fgetc(batchfile)) != EOF; ) {
+		lines += c == '\n' ;
+	}
+	if (batchfile) fclose(batchfile) ;
+
+	TEST_CASE(batch_full_batches_written,
+		ASSERT(uring_stats.entries == 16) ;
+		ASSERT(uring_stats.batches == 2) ;
+	) ;
+
+	TEST_CASE(batch_one_syscall_per_batch,
+		ASSERT(uring_stats.syscalls == uring_stats.batches) ;
+		ASSERT(writev_stats.syscalls == writev_stats.batches) ;
+	) ;
+
+	TEST_CASE(batch_flush_writes_partial_batch,
+		ASSERT(!writev_stats.using_io_uring) ;
+		ASSERT(writev_stats.entries == 20) ;
+	) ;
+
+	TEST_CASE(batch_nothing_lost,
+		ASSERT(lines == 40) ;
+	) ;
+
+	TEST_CASE(batch_short_writes_resumed,
+		// A megabyte in one writev() into a pipe drained slowly, with
+		// signals landing on the writer while it waits for room. Each
+		// one cuts the writev() short, and the rest has to go out
+		// after it exactly once, in order. Entries are an odd size so
+		// the cuts land in the middle of them, not on page boundaries
+		static lil_db_batch_t piped ;
+		static unsigned char sent[1000 * 1021], got[sizeof(sent) + 1] ;
+		lil_db_batch_config_t one = { .max_entries = 1000,
+					      .max_bytes = sizeof(sent),
+					      .max_age_ms = 60000,
+					      .disable_io_uring = 1 } ;
+		struct sigaction interrupt = { .sa_handler = LAMBDA(void,
+			(int signal) { (void)signal ; }) }, saved ;
+		pthread_t reader, signaller, writer = pthread_self() ;
+		size_t received = 0 ;
+		int done = 0, flushed ;
+
+		void * drain(void * arg)
+		{
+			int fd = open("DUMMY_BATCH_FIFO", O_RDONLY) ;
+			ssize_t n = 1 ;
+
+			while (fd >= 0 && n > 0 && received < sizeof(got)) {
+				n = read(fd, got + received, 512) ;
+				if (n > 0) received += n ;
+				nanosleep(&(struct timespec){ 0, 20000 }, NULL) ;
+			}
+			if (fd >= 0) close(fd) ;
+			return arg ;
+		}
+
+		void * interrupter(void * arg)
+		{
+			while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+				pthread_kill(writer, SIGUSR1) ;
+				nanosleep(&(struct timespec){ 0, 200000 }, NULL) ;
+			}
+			return arg ;
+		}
+
+		for (size_t i = 0; i < sizeof(sent); ++i)
+			sent[i] = i / 1021 * 7 + i % 251 ;
+		remove("DUMMY_BATCH_FIFO") ;
+		ASSERT(!mkfifo("DUMMY_BATCH_FIFO", 0600)) ;
+		ASSERT(!pthread_create(&reader, NULL, drain, NULL)) ;
+		ASSERT(!lil_db_batch_open(&piped, "DUMMY_BATCH_FIFO", &one)) ;
+
+		// No SA_RESTART, so a signal ends a blocked writev() early
+		sigaction(SIGUSR1, &interrupt, &saved) ;
+		pthread_create(&signaller, NULL, interrupter, NULL) ;
+		for (int i = 0; i < 999; ++i)
+			lil_db_batch_append(&piped, (char *)sent + i * 1021,
+					    1021) ;
+		flushed = lil_db_batch_append(&piped, (char *)sent + 999 * 1021,
+					      1021) ;
+		__atomic_store_n(&done, 1, __ATOMIC_RELEASE) ;
+		pthread_join(signaller, NULL) ;
+		sigaction(SIGUSR1, &saved, NULL) ;
+
+		lil_db_batch_close(&piped) ;
+		pthread_join(reader, NULL) ;
+		remove("DUMMY_BATCH_FIFO") ;
+
+		ASSERT(!flushed && piped.stats.batches == 1) ;
+		ASSERT(piped.stats.syscalls > 1) ;	// It was cut short
+		ASSERT(received == sizeof(sent)) ;
+		ASSERT_MEM_EQ(got, sent, sizeof(sent)) ;
+	) ;
+
+	TEST_CASE(batch_removed,
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_BATCH")) ;
+	) ;
+) ;
+
+// Four threads hammering durable entries should need fewer syncs than entries
+TEST_SET(durability,
+
+	char syncname[] = "DUMMY_SYNC" ;
+	lil_db_durability_stats_t group_stats = { 0 }, periodic_stats = { 0 } ;
+	uint64_t before = 0 ;
+	pthread_t writers[4] ;
+
+	lil_db_init(syncname,sizeof(syncname)) ;
+	lil_db_set_durability(LIL_DB_DURABILITY_GROUP_COMMIT,0) ;
+	lil_db_get_durability_stats(&group_stats) ;
+	before = group_stats.syncs ;
+	for (int i = 0; i < 4; ++i) {
+		pthread_create(&writers[i], NULL, LAMBDA(void *,(void * arg) {
+			for (int j = 0; j < 25; ++j) {
+				lil_db_printf(LIL_DB_OPTION_DURABLE,
+					      "durable entry\n") ;
+			}
+			return arg ;
+		}), NULL) ;
+	}
+	for (int i = 0; i < 4; ++i) pthread_join(writers[i], NULL) ;
+	lil_db_get_durability_stats(&group_stats) ;
+
+	// Periodic mode: the entry waits for the syncer thread instead
+	lil_db_set_durability(LIL_DB_DURABILITY_PERIODIC,10) ;
+	lil_db_printf(LIL_DB_OPTION_DURABLE, "periodic entry\n") ;
+	lil_db_get_durability_stats(&periodic_stats) ;
+	lil_db_kill() ;
+
+	TEST_CASE(durability_group_commit_covers_all,
+		ASSERT(group_stats.synced == group_stats.appended) ;
+	) ;
+
+	TEST_CASE(durability_group_commit_shares_syncs,
+		ASSERT(group_stats.syncs > before) ;
+		ASSERT(group_stats.syncs - before <= 100) ;
+	) ;
+
+	TEST_CASE(durability_periodic_waits_for_syncer,
+		ASSERT(periodic_stats.synced == periodic_stats.appended) ;
+	) ;
+
+	TEST_CASE(durability_removed,
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_SYNC")) ;
+	) ;
+) ;
+
+// TSC timestamps should land close to what clock_gettime says
+TEST_SET(timestamp,
+
+	char stampname[] = "DUMMY_STAMP" ;
+	struct timespec before, after ;
+	double stamp = 0 ;
+
+	lil_db_init(stampname,sizeof(stampname)) ;
+	clock_gettime(CLOCK_REALTIME, &before) ;
+	lil_db_printf(LIL_DB_OPTION_TIMESTAMP, "stamped entry\n") ;
+	clock_gettime(CLOCK_REALTIME, &after) ;
+	lil_db_kill() ;
+
+	FILE * stampfile = fopen(stampname, "r") ;
+	int parsed = stampfile && fscanf(stampfile, "[%lf] stamped entry", &stamp) == 1 ;
+	if (stampfile) fclose(stampfile) ;
+
+	// Reanchoring on every read, the worst case for going backwards
+	lil_db_clock_t clock ;
+	uint64_t previous = 0, now_ns ;
+	int backwards = 0, tsc = 0 ;
+	lil_db_clock_calibrate(&clock) ;
+	tsc = clock.use_tsc ;
+	clock.reanchor_ticks = 1 ;
+	for (int i = 0; i < 10000; ++i) {
+		now_ns = lil_db_clock_now_ns(&clock) ;
+		backwards += now_ns < previous ;
+		previous = now_ns ;
+	}
+
+	// Only written where it fits
+	char prefix[LIL_DB_CLOCK_PREFIX_MAX] ;
+	int cramped = lil_db_clock_format(previous, prefix, 8) ;
+	int roomy = lil_db_clock_format(previous, prefix, sizeof(prefix)) ;
+
+	TEST_CASE(timestamp_parsed,
+		ASSERT(parsed) ;
+	) ;
+
+	TEST_CASE(timestamp_in_range,
+		// Allow a millisecond of slop either way for calibration error
+		ASSERT(stamp >= before.tv_sec + before.tv_nsec / 1e9 - 1e-3) ;
+		ASSERT(stamp <= after.tv_sec + after.tv_nsec / 1e9 + 1e-3) ;
+	) ;
+
+	TEST_CASE(timestamp_monotonic,
+		ASSERT(backwards == 0) ;
+		// The rate comes from the raw clock, so reanchoring keeps it
+		ASSERT(clock.use_tsc == tsc) ;
+	) ;
+
+	TEST_CASE(timestamp_format_bounded,
+		ASSERT(cramped == 0) ;
+		ASSERT(roomy > 0 && roomy == (int)strlen(prefix)) ;
+	) ;
+
+	TEST_CASE(timestamp_removed,
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_STAMP")) ;
+	) ;
+) ;
+
+// Sampling, rate limiting, and switching sites off at runtime
+TEST_SET(levels,
+
+	char levelname[] = "DUMMY_LEVEL" ;
+	int evaluated = 0, disabled_count = 0 ;
+
+	lil_db_init(levelname,sizeof(levelname)) ;
+	for (int i = 0; i < 10; ++i) {
+		LIL_DB_LOG_SAMPLED(LIL_DB_LEVEL_INFO, 5, 0, "sampled\n") ;
+		LIL_DB_LOG_RATE(LIL_DB_LEVEL_WARN, 1, 3, 0, "limited\n") ;
+	}
+	lil_db_set_level(LIL_DB_LEVEL_INFO) ;
+	LIL_DB_DEBUG("debug %d\n", ++evaluated) ;
+	LIL_DB_ERROR("error %d\n", ++evaluated) ;
+	lil_db_set_level(LIL_DB_LEVEL_TRACE) ;
+	disabled_count = lil_db_site_enable(__FILE__, 0, 0) ;
+	LIL_DB_FATAL("fatal %d\n", ++evaluated) ;
+	lil_db_site_enable(NULL, 0, 1) ;
+	lil_db_kill() ;
+
+	int sampled = 0, limited = 0, debugs = 0, errors = 0 ;
+	char line[64] ;
+	FILE * levelfile = fopen(levelname, "r") ;
+	while (levelfile && fgets(line, sizeof(line), levelfile)) {
+		sampled += !strcmp(line, "[INFO] sampled\n") ;
+		limited += !strcmp(line, "[WARN] limited\n") ;
+		debugs += !strncmp(line, "[DEBUG] ", 8) ;
+		errors += !strcmp(line, "[ERROR] error 1\n") ;
+	}
+	if (levelfile) fclose(levelfile) ;
+
+	TEST_CASE(levels_one_in_five,
+		ASSERT(sampled == 2) ;
+	) ;
+
+	TEST_CASE(levels_burst_of_three,
+		ASSERT(limited == 3) ;
+	) ;
+
+	TEST_CASE(levels_burst_shared_by_threads,
+		// A token a second, so all four threads together get the
+		// burst of 50, and maybe one more if a second ticks over
+		lil_db_site_t site = { .enabled = 1, .rate_per_sec = 1,
+				       .burst = 50 } ;
+		pthread_t takers[4] ;
+		int taken = 0 ;
+
+		void * take(void * arg)
+		{
+			for (int j = 0; j < 100; ++j) {
+				if (lil_db_site_take_token(&site))
+					__atomic_fetch_add(&taken, 1,
+							   __ATOMIC_RELAXED) ;
+			}
+			return arg ;
+		}
+
+		for (int i = 0; i < 4; ++i)
+			pthread_create(&takers[i], NULL, take, NULL) ;
+		for (int i = 0; i < 4; ++i) pthread_join(takers[i], NULL) ;
+		ASSERT(taken == 50 || taken == 51) ;
+		ASSERT(site.dropped == 400 - (uint64_t)taken) ;
+	) ;
+
+	TEST_CASE(levels_below_minimum_not_evaluated,
+		ASSERT(debugs == 0) ;
+		ASSERT(errors == 1) ;
+	) ;
+
+	TEST_CASE(levels_site_switched_off,
+		ASSERT(disabled_count >= 5) ;
+		ASSERT(evaluated == 1) ;
+	) ;
+
+	TEST_CASE(levels_removed,
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_LEVEL")) ;
+	) ;
+) ;
+
+// Rotate every ~200 bytes and compress the old segments in the background
+TEST_SET(rotation,
+
+	char rotname[] = "DUMMY_ROT" ;
+	lil_db_rotate_config_t rotation = { .max_bytes = 200, .compress = 1 } ;
+	char segment[64] ;
+	int segments = 0, uncompressed_left = 0, entries = 0 ;
+
+	lil_db_init(rotname,sizeof(rotname)) ;
+	lil_db_set_rotation(&rotation) ;
+	for (int i = 0; i < 50; ++i) {
+		lil_db_printf(LIL_DB_OPTION_NUMBERED, "rotated entry\n") ;
+	}
+	lil_db_kill() ; // Waits for the compressor to finish
+
+	// Stitch the log back together, oldest segment first
+	char * whole = NULL ;
+	size_t whole_size = 0 ;
+	FILE * stitched = open_memstream(&whole, &whole_size) ;
+	for (int n = 1;; ++n) {
+		snprintf(segment, sizeof(segment), "DUMMY_ROT.%d", n) ;
+		uncompressed_left += !access(segment, F_OK) ;
+		snprintf(segment, sizeof(segment), "DUMMY_ROT.%d.lz", n) ;
+		FILE * in = fopen(segment, "r") ;
+		if (!in) break ;
+		segments++ ;
+		lil_db_lz_decompress_stream(in, stitched) ;
+		fclose(in) ;
+		remove(segment) ;
+	}
+	FILE * current = fopen(rotname, "r") ;
+	for (int c; current && (c = fgetc(current)) != EOF; ) fputc(c, stitched) ;
+	if (current) fclose(current) ;
+	fclose(stitched) ;
+
+	for (char * p = whole; (p = strstr(p, "rotated entry\n")); ++p) {
+		entries++ ;
+	}
+
+	// Durable writers racing rotation: a sync in flight must never be left
+	// holding the fd of a segment that was closed under it
+	char rotsyncname[] = "DUMMY_ROTSYNC" ;
+	lil_db_rotate_config_t small = { .max_bytes = 100 } ;
+	lil_db_durability_stats_t rotsync_stats = { 0 } ;
+	pthread_t rotsync_writers[4] ;
+	int rotsync_entries = 0 ;
+	char rotsync_line[64] ;
+
+	lil_db_init(rotsyncname,sizeof(rotsyncname)) ;
+	lil_db_set_rotation(&small) ;
+	lil_db_set_durability(LIL_DB_DURABILITY_GROUP_COMMIT,0) ;
+	for (int i = 0; i < 4; ++i) {
+		pthread_create(&rotsync_writers[i], NULL,
+			       LAMBDA(void *,(void * arg) {
+			for (int j = 0; j < 25; ++j) {
+				lil_db_printf(LIL_DB_OPTION_DURABLE,
+					      "durable rotated entry\n") ;
+			}
+			return arg ;
+		}), NULL) ;
+	}
+	for (int i = 0; i < 4; ++i) pthread_join(rotsync_writers[i], NULL) ;
+	lil_db_get_durability_stats(&rotsync_stats) ;
+	int rotsync_valid = lil_db_is_not_valid() ;
+	lil_db_kill() ;
+
+	for (int n = 0;; ++n) {
+		if (n) snprintf(segment, sizeof(segment), "DUMMY_ROTSYNC.%d", n) ;
+		FILE * in = fopen(n ? segment : rotsyncname, "r") ;
+		if (!in) break ;
+		while (fgets(rotsync_line, sizeof(rotsync_line), in))
+			rotsync_entries += !strcmp(rotsync_line,
+						   "durable rotated entry\n") ;
+		fclose(in) ;
+		remove(n ? segment : rotsyncname) ;
+	}
+
+	// And the codec on its own, on something that should squash well
+	char text[4096], packed[4096 + 64], unpacked[4096] ;
+	for (size_t i = 0; i < sizeof(text); ++i) text[i] = "lil_db! "[i % 8] ;
+	size_t packed_size = lil_db_lz_compress_block((uint8_t *)text,
+		sizeof(text), (uint8_t *)packed, sizeof(packed)) ;
+	long unpacked_size = lil_db_lz_decompress_block((uint8_t *)packed,
+		packed_size, (uint8_t *)unpacked, sizeof(unpacked)) ;
+
+	TEST_CASE(rotation_made_segments,
+		ASSERT(segments >= 3) ;
+	) ;
+
+	TEST_CASE(rotation_compressed_all,
+		ASSERT(uncompressed_left == 0) ;
+	) ;
+
+	TEST_CASE(rotation_lost_nothing,
+		ASSERT(entries == 50) ;
+		ASSERT(strstr(whole, "[0]. rotated entry\n") == whole) ;
+	) ;
+
+	TEST_CASE(rotation_durable_across_segments,
+		// A sync that hit a closed fd would have made lil_db invalid
+		ASSERT(rotsync_valid) ;
+		ASSERT(rotsync_stats.synced == rotsync_stats.appended) ;
+		ASSERT(rotsync_entries == 100) ;
+	) ;
+
+	TEST_CASE(rotation_lz_round_trip,
+		ASSERT(packed_size > 0 && packed_size < sizeof(text) / 10) ;
+		ASSERT(unpacked_size == sizeof(text)) ;
+		ASSERT(!memcmp(text, unpacked, sizeof(text))) ;
+	) ;
+
+	TEST_CASE(rotation_removed,
+		free(whole) ;
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_ROT")) ;
+	) ;
+) ;
+
+TEST_SET(index,
+	char idxname[] = "DUMMY_IDX" ;
+	char log[1024] = { 0 }, idx[1024] ;
+	const lil_db_index_record_t * records ;
+	long count, found ;
+	int rotated_index ;
+	FILE * in ;
+	size_t idx_size ;
+
+	lil_db_init(idxname,sizeof(idxname)) ;
+	lil_db_set_index(4) ;
+	for (int i = 0; i < 10; ++i) {
+		lil_db_printf(LIL_DB_OPTION_NUMBERED, "indexed entry\n") ;
+	}
+	lil_db_flush() ;
+
+	in = fopen("DUMMY_IDX", "r") ;
+	fread(log, 1, sizeof(log) - 1, in) ;
+	fclose(in) ;
+	in = fopen("DUMMY_IDX.idx", "r") ;
+	idx_size = fread(idx, 1, sizeof(idx), in) ;
+	fclose(in) ;
+
+	count = lil_db_index_records(idx, idx_size, &records) ;
+	found = lil_db_index_find_entry(records, count, 6) ;
+
+	// The index follows its log when it rotates
+	lil_db_rotate() ;
+	rotated_index = !access("DUMMY_IDX.1.idx", F_OK) ;
+	lil_db_kill() ;
+
+	TEST_CASE(index_every_fourth_entry,
+		ASSERT(count == 3) ;
+		ASSERT(records[0].entry == 0 && records[1].entry == 4
+		       && records[2].entry == 8) ;
+	) ;
+
+	TEST_CASE(index_offsets_land_on_entries,
+		ASSERT(!strncmp(log + records[1].offset, "[4]. ", 5)) ;
+		ASSERT(!strncmp(log + records[2].offset, "[8]. ", 5)) ;
+	) ;
+
+	TEST_CASE(index_find_entry,
+		ASSERT(found == 1) ;
+		ASSERT(lil_db_index_find_entry(records, count, 100) == 2) ;
+	) ;
+
+	TEST_CASE(index_rotates_with_log,
+		ASSERT(rotated_index) ;
+	) ;
+
+	TEST_CASE(index_removed,
+		remove("DUMMY_IDX.1") ;
+		remove("DUMMY_IDX.1.idx") ;
+		remove("DUMMY_IDX.idx") ;
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_IDX")) ;
+	) ;
+) ;
+
+// Runs with lil_db open, so the cases themselves can log
+TEST_SET(capture,
+	char capname[] = "DUMMY_CAP" ;
+	char * held = NULL ;
+	size_t held_size = 0 ;
+	long captured ;
+
+	lil_db_init(capname,sizeof(capname)) ;
+
+	TEST_CASE(capture_passing_case_logs,
+		lil_db_printf(LIL_DB_OPTION_DEFAULT, "noise from a pass\n") ;
+	) ;
+
+	TEST_CASE(capture_pass_dropped,
+		char contents[64] = { 0 } ;
+		FILE * in ;
+
+		lil_db_flush() ;
+		ASSERT((in = fopen("DUMMY_CAP", "r"))) ;
+		fread(contents, 1, sizeof(contents) - 1, in) ;
+		fclose(in) ;
+		ASSERT(!strstr(contents, "noise from a pass")) ;
+	) ;
+
+	TEST_CASE(capture_dumps_on_request,
+		// Ends the case's own capture a little early, which is harmless
+		FILE * dump = open_memstream(&held, &held_size) ;
+
+		lil_db_capture_begin() ;
+		lil_db_printf(LIL_DB_OPTION_NUMBERED, "held entry\n") ;
+		captured = lil_db_capture_end(dump) ;
+		fclose(dump) ;
+
+		ASSERT(captured == (long)strlen("[0]. held entry\n")) ;
+		ASSERT(!strcmp(held, "[0]. held entry\n")) ;
+	) ;
+
+	TEST_CASE(capture_removed,
+		free(held) ;
+		lil_db_kill() ;
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_CAP")) ;
+	) ;
+) ;
+
+// Odd sizes, so the vector loops and the scalar tails both get a go
+TEST_SET(bulk,
+	size_t n = 1000003 ;
+	unsigned char * x = malloc(n), * y = malloc(n) ;
+	float f[37], g[37] ;
+	double d[37], e[37] ;
+	float pz = 0.0f, nz = -0.0f ;
+
+	for (size_t i = 0; i < n; ++i) x[i] = y[i] = i * 31 ;
+	for (int i = 0; i < 37; ++i) {
+		f[i] = g[i] = (i - 18) * 0.3f ;
+		d[i] = e[i] = (i - 18) * 0.3 ;
+	}
+	// Nudge a couple of elements by a few ulps, straight in the bits
+	union { float f ; int32_t i ; } up = { .f = g[20] } ;
+	union { double d ; int64_t i ; } down = { .d = e[35] } ;
+	up.i += 2 ;
+	down.i -= 1 ;
+	g[20] = up.f ;
+	e[35] = down.d ;
+
+	TEST_CASE(bulk_mem_eq,
+		ASSERT_MEM_EQ(x, y, n) ;
+	) ;
+
+	TEST_CASE(bulk_mem_mismatch_found,
+		y[n - 2] ^= 1 ;
+		ASSERT(test_mem_mismatch(x, y, n) == n - 2) ;
+		ASSERT(test_mem_mismatch(x, y, n - 2) == n - 2) ;
+		y[n - 2] ^= 1 ;
+	) ;
+
+	TEST_CASE(bulk_array_near,
+		ASSERT_ARRAY_NEAR(f, g, 37, 2) ;
+		ASSERT_ARRAY_NEAR(d, e, 37, 1) ;
+		ASSERT_ARRAY_NEAR(&pz, &nz, 1, 0) ;
+	) ;
+
+	TEST_CASE(bulk_array_mismatch_found,
+		ASSERT(test_floats_mismatch(f, g, 37, 1) == 20) ;
+		ASSERT(test_doubles_mismatch(d, e, 37, 0) == 35) ;
+		ASSERT(test_ulps_double(-0.0, 0.0) == 0) ;
+	) ;
+
+	TEST_CASE(bulk_str_eq,
+		ASSERT_STR_EQ("lil_db", "lil_db") ;
+	) ;
+
+	TEST_CASE(bulk_why_points_at_mismatch,
+		test_why_str("a, b", "say \"hi\"\n", "say \"ho\"\n", 6) ;
+		ASSERT(strstr(test_why, "char 6")) ;
+		ASSERT(strstr(test_why, "a: \"say \\\"h[i]\\\"\\x0a\"")) ;
+		test_why_mem("x, y", "\1\2\3", "\1\7\3", 3, 1) ;
+		ASSERT(strstr(test_why, "b: 01 [07] 03")) ;
+	) ;
+
+	TEST_CASE(bulk_why_stays_in_bounds,
+		// Arguments long enough that the window lands past the end
+		static char what[TEST_WHY_SIZE - 3], quoted[64] ;
+		memset(what, 'w', sizeof(what) - 1) ;
+		memset(quoted, '\1', sizeof(quoted) - 1) ;
+		test_why_str(what, quoted, "", 20) ;
+		ASSERT(strlen(test_why) == TEST_WHY_SIZE - 1) ;
+		test_why_doubles(what, d, e, 37, 35, 0) ;
+		ASSERT(strlen(test_why) == TEST_WHY_SIZE - 1) ;
+		ASSERT(test_why_printf(TEST_WHY_SIZE - 1, "more")
+		       == TEST_WHY_SIZE - 1) ;
+	) ;
+
+	TEST_CASE(bulk_freed,
+		free(x) ;
+		free(y) ;
+	) ;
+) ;
+
+TEST_SET(golden,
+	// Static, so no case has to be the one that frees it
+	static unsigned char made[300007] ;
+	size_t n = sizeof(made) ;
+	struct stat st ;
+	uint64_t known ;
+
+	for (size_t i = 0; i < n; ++i) made[i] = i * 7 + (i >> 9) ;
+
+	// Every case has a golden file of its own, since under --jobs they
+	// can run in any order and at once. Start path afresh, holding made
+	// if asked to
+	int gold(const char * path, int write)
+	{
+		char hash[256] ;
+
+		snprintf(hash, sizeof(hash), "%s" TEST_GOLDEN_HASH_SUFFIX,
+			 path) ;
+		remove(hash) ;
+		remove(path) ;
+
+		return write ? test_golden_write(path, made, n) : 0 ;
+	}
+
+	TEST_CASE(golden_missing_fails,
+		gold("DUMMY_GOLD_MISSING", 0) ;
+		ASSERT(test_golden_check("made", made, n,
+					 "DUMMY_GOLD_MISSING")) ;
+		ASSERT(strstr(test_why, "--update-golden")) ;
+	) ;
+
+	TEST_CASE(golden_update_writes,
+		gold("DUMMY_GOLD_UPDATE", 0) ;
+		test_options.update_golden = 1 ;
+		ASSERT_MATCHES_GOLDEN(made, n, "DUMMY_GOLD_UPDATE") ;
+		test_options.update_golden = 0 ;
+		ASSERT(!stat("DUMMY_GOLD_UPDATE", &st)) ;
+		ASSERT((size_t)st.st_size == n) ;
+		// Written in the same tick as its sidecar, it can't be
+		// vouched for yet. Once it is older, matching again does
+		ASSERT(!utimensat(AT_FDCWD, "DUMMY_GOLD_UPDATE",
+				  (struct timespec [2]){ { 0, UTIME_OMIT },
+							 { 1, 0 } }, 0)) ;
+		ASSERT_MATCHES_GOLDEN(made, n, "DUMMY_GOLD_UPDATE") ;
+		ASSERT(!stat("DUMMY_GOLD_UPDATE", &st)) ;
+		ASSERT(!test_golden_known_hash("DUMMY_GOLD_UPDATE", &st,
+					       &known)) ;
+		ASSERT(known == test_hash64(made, n)) ;
+		gold("DUMMY_GOLD_UPDATE", 0) ;
+	) ;
+
+	TEST_CASE(golden_matches,
+		ASSERT(!gold("DUMMY_GOLD_MATCH", 1)) ;
+		// Without the sidecar it has to compare, then it's there
+		ASSERT_MATCHES_GOLDEN(made, n, "DUMMY_GOLD_MATCH") ;
+		ASSERT(!stat("DUMMY_GOLD_MATCH.hash", &st)) ;
+		ASSERT_MATCHES_GOLDEN(made, n, "DUMMY_GOLD_MATCH") ;
+		gold("DUMMY_GOLD_MATCH", 0) ;
+	) ;
+
+	TEST_CASE(golden_mismatch_found,
+		ASSERT(!gold("DUMMY_GOLD_MISMATCH", 1)) ;
+		made[n - 100] ^= 0x40 ;
+		ASSERT(test_golden_check("made", made, n,
+					 "DUMMY_GOLD_MISMATCH")) ;
+		ASSERT(strstr(test_why, "at byte 299907,")) ;
+		ASSERT(test_golden_check("made", made, n - 1,
+					 "DUMMY_GOLD_MISMATCH")) ;
+		ASSERT(strstr(test_why, "golden has 300007")) ;
+		made[n - 100] ^= 0x40 ;
+		gold("DUMMY_GOLD_MISMATCH", 0) ;
+	) ;
+
+	TEST_CASE(golden_stale_hash_ignored,
+		// Matched once, so the sidecar vouches for it, then changed
+		// behind the sidecar's back, same size
+		ASSERT(!gold("DUMMY_GOLD_STALE", 1)) ;
+		ASSERT_MATCHES_GOLDEN(made, n, "DUMMY_GOLD_STALE") ;
+		made[5] ^= 1 ;
+		ASSERT(!test_golden_write("DUMMY_GOLD_STALE", made, n)) ;
+		made[5] ^= 1 ;
+		ASSERT(test_golden_check("made", made, n, "DUMMY_GOLD_STALE")) ;
+		ASSERT(strstr(test_why, "at byte 5,")) ;
+		gold("DUMMY_GOLD_STALE", 0) ;
+	) ;
+
+	TEST_CASE(golden_hash,
+		unsigned char block[TEST_HASH_BLOCK * 3] ;
+		uint64_t scalar[8] = { 1, 2, 3, 4, 5, 6, 7, 8 } ;
+
+		memcpy(block, made, sizeof(block)) ;
+		ASSERT(test_hash64("ab", 2) != test_hash64("ab\0", 3)) ;
+		ASSERT(test_hash64(made, n) == test_hash64(made, n)) ;
+		made[n / 2] ^= 1 ;
+		known = test_hash64(made, n) ;
+		made[n / 2] ^= 1 ;
+		ASSERT(known != test_hash64(made, n)) ;
+#if defined(__x86_64__) || defined(__i386__)
+		uint64_t vector[8] = { 1, 2, 3, 4, 5, 6, 7, 8 } ;
+
+		test_hash_blocks(scalar, block, 3) ;
+		if (test_have_avx2()) test_hash_blocks_avx2(vector, block, 3) ;
+		else test_hash_blocks(vector, block, 3) ;
+		ASSERT_MEM_EQ(scalar, vector, sizeof(scalar)) ;
+#endif
+	) ;
+) ;
+
+TEST_SET(schedule,
+	test_options_data_t options = test_options ;
+	typeof(test_history) history = test_history ;
+	size_t order[4] ;
+
+	// Stand in for previous runs, without touching the real history
+	void pretend(const char * name, unsigned long long ns,
+		     unsigned int since_fail)
+	{
+		char key[TEST_HISTORY_NAME_SIZE] ;
+		test_history_entry_t * entry ;
+
+		snprintf(key, sizeof(key), "schedule/test_schedule_%s", name) ;
+		entry = test_history_insert(key) ;
+		entry->ns = ns ;
+		entry->since_fail = since_fail ;
+	}
+
+	void begin(void)
+	{
+		test_history = (typeof(test_history)) { 1, 0, 0, NULL } ;
+		test_options.history = "DUMMY_HIST" ;
+		test_options.failed_first = 0 ;
+		test_options.jobs = 0 ;
+		pretend("a_declared", 100, TEST_HISTORY_NEVER) ;
+		pretend("b_failed_first", 500, 3) ;
+		pretend("c_longest_first", 900, TEST_HISTORY_NEVER) ;
+	}
+
+	void end(void)
+	{
+		test_history_free() ;
+		test_history = history ;
+		test_options = options ;
+	}
+
+	TEST_CASE(schedule_a_declared,
+		begin() ;
+		test_schedule_order(this, order) ;
+		end() ;
+		ASSERT(order[0] == 0 && order[1] == 1 && order[2] == 2) ;
+		ASSERT(order[3] == 3) ;
+	) ;
+
+	TEST_CASE(schedule_b_failed_first,
+		begin() ;
+		pretend("a_declared", 100, 0) ;
+		test_options.failed_first = 1 ;
+		test_schedule_order(this, order) ;
+		end() ;
+		// Latest failure, older failure, no history, the rest
+		ASSERT(order[0] == 0 && order[1] == 1 && order[2] == 3) ;
+		ASSERT(order[3] == 2) ;
+	) ;
+
+	TEST_CASE(schedule_c_longest_first,
+		begin() ;
+		test_options.jobs = 4 ;
+		test_schedule_order(this, order) ;
+		end() ;
+		ASSERT(order[0] == 3 && order[1] == 2 && order[2] == 1) ;
+		ASSERT(order[3] == 0) ;
+	) ;
+
+	TEST_CASE(schedule_d_history_saved,
+		test_history_entry_t * entry ;
+		unsigned long long ns ;
+		unsigned int since_fail ;
+
+		begin() ;
+		test_history_record("schedule", "test_schedule_c_longest_first",
+				    1, 100) ;
+		test_history_record("schedule", "test_schedule_a_declared",
+				    0, 100) ;
+		test_history_save() ;
+		test_history_free() ;
+		test_history = (typeof(test_history)) { 0, 0, 0, NULL } ;
+		test_history_load() ;
+		entry = test_history_lookup("schedule",
+					    "test_schedule_c_longest_first") ;
+		ns = entry ? entry->ns : 0 ;
+		entry = test_history_lookup("schedule", "test_schedule_a_declared") ;
+		since_fail = entry ? entry->since_fail : 1 ;
+		end() ;
+		ASSERT(ns == 900 - 900 / 4 + 100 / 4) ;
+		ASSERT(since_fail == 0) ;
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_HIST")) ;
+	) ;
+) ;
+
+// Repeat a case that fails on one seed in four
+TEST_SET(repeat,
+	test_options_data_t options = test_options ;
+	test_repeat_t * repeat ;
+	double low, high ;
+
+	// Runs 0 to 39 get seeds 1001 to 1040, so 1003, 1007, ... 1039 fail.
+	// Each call counts into a block of its own, since under --jobs the
+	// cases calling it can run at once in different workers
+	test_repeat_t * go(unsigned int jobs, int until_fail)
+	{
+		test_repeat_t * repeat = mmap(NULL, sizeof(*repeat),
+					      PROT_READ | PROT_WRITE,
+					      MAP_SHARED | MAP_ANONYMOUS,
+					      -1, 0) ;
+
+		if (repeat == MAP_FAILED) return NULL ;
+
+		test_options.seed = 1001 ;
+		test_options.jobs = jobs ;
+		test_options.until_fail = until_fail ;
+		repeat->limit = 40 ;
+		test_repeat_case(this, 0, repeat) ;
+		test_options = options ;
+
+		return repeat ;
+	}
+
+	TEST_CASE(repeat_flaky,
+		ASSERT(test_seed % 4 != 3) ;
+	) ;
+
+	TEST_CASE(repeat_counted,
+		ASSERT((repeat = go(2, 0))) ;
+		ASSERT(repeat->runs == 40 && repeat->passes == 30) ;
+		ASSERT(repeat->first_fail == 2) ;
+		ASSERT(!strncmp(repeat->output, "FAIL test_repeat_flaky", 22)) ;
+		TEST_CASE_PASS_IF_FALSE(munmap(repeat, sizeof(*repeat))) ;
+	) ;
+
+	TEST_CASE(repeat_until_fail,
+		ASSERT((repeat = go(1, 1))) ;
+		ASSERT(repeat->runs == 3 && repeat->passes == 2) ;
+		TEST_CASE_PASS_IF_FALSE(munmap(repeat, sizeof(*repeat))) ;
+	) ;
+
+	TEST_CASE(repeat_until_fail_capped,
+		test_options.until_fail = 1 ;
+		ASSERT(test_repeat_limit(NULL) == TEST_REPEAT_UNTIL_FAIL_RUNS) ;
+		ASSERT(test_repeat_limit("repeat/*") == ~0ULL) ;
+		test_options.repeat = 7 ;
+		ASSERT(test_repeat_limit(NULL) == 7) ;
+		test_options = options ;
+	) ;
+
+	TEST_CASE(repeat_wilson,
+		test_wilson(30, 40, &low, &high) ;
+		ASSERT(low > 0.5975 && low < 0.5985) ;
+		ASSERT(high > 0.8575 && high < 0.8585) ;
+		test_wilson(40, 40, &low, &high) ;
+		ASSERT(low > 0.911 && low < 0.913 && high == 1) ;
+	) ;
+) ;
+
+// Benchmarks just run once here, unless the driver is given --bench
+TEST_SET(bench,
+	size_t fixture_size = 1 << 20, packed_size = 0 ;
+	uint8_t * fixture = test_bench_alloc(fixture_size),
+		packed[LIL_DB_LZ_BLOCK_SIZE + LIL_DB_LZ_BLOCK_SIZE / 8] ;
+	double samples[] = { 10, 11, 9, 10, 30 } ;
+	test_bench_result_t result ;
+	test_options_data_t options = test_options ;
+	unsigned long long calls = 0 ;
+
+	for (size_t i = 0; fixture && i < fixture_size; ++i)
+		fixture[i] = "lil_db! "[i % 8] + i / 4096 ;
+
+	TEST_CASE(bench_fixture_resident,
+		unsigned char resident[fixture_size / sysconf(_SC_PAGESIZE)] ;
+		size_t pages = 0 ;
+
+		ASSERT(fixture) ;
+		ASSERT(!mincore(fixture, fixture_size, resident)) ;
+		for (size_t i = 0; i < sizeof(resident); ++i)
+			pages += resident[i] & 1 ;
+		ASSERT(pages == sizeof(resident)) ;
+	) ;
+
+	TEST_BENCH(bench_lz_warm, TEST_BENCH_WARM,
+		packed_size = lil_db_lz_compress_block(fixture,
+			LIL_DB_LZ_BLOCK_SIZE, packed, sizeof(packed)) ;
+		TEST_BENCH_KEEP(packed_size) ;
+	) ;
+
+	TEST_BENCH(bench_lz_cold, TEST_BENCH_COLD,
+		packed_size = lil_db_lz_compress_block(fixture,
+			LIL_DB_LZ_BLOCK_SIZE, packed, sizeof(packed)) ;
+		TEST_BENCH_KEEP(packed_size) ;
+	) ;
+
+	TEST_CASE(bench_ran_once,
+		ASSERT(packed_size > 0 && packed_size < LIL_DB_LZ_BLOCK_SIZE) ;
+	) ;
+
+	TEST_CASE(bench_summarized,
+		test_bench_summarize(samples, 5, &result) ;
+		ASSERT(result.median_ns == 10 && result.min_ns == 9) ;
+		// One slow sample hardly matters: MAD is 1, so 14.826%
+		ASSERT(result.noise > 14.82 && result.noise < 14.83) ;
+	) ;
+
+	TEST_CASE(bench_measured,
+		test_options.bench = 1 ;
+		test_options.bench_samples = 5 ;
+		test_bench_measure(LAMBDA(void, (void) { calls++ ; }),
+				   TEST_BENCH_WARM, &result) ;
+		test_options = options ;
+		ASSERT(result.samples == 5 && result.ops > 1) ;
+		// Warm up, then each calibration round and each sample
+		ASSERT(calls >= 1 + 5 * result.ops) ;
+		ASSERT(result.min_ns <= result.median_ns) ;
+	) ;
+
+	TEST_CASE(bench_freed,
+		test_bench_free(fixture, fixture_size) ;
+	) ;
+) ;
+
+TEST_SET(complexity,
+	double n[] = { 16, 64, 256, 1024, 4096, 16384, 65536 }, ns[7] ;
+	size_t sizes = sizeof(n) / sizeof(*n) ;
+	test_bench_fit_t fit ;
+	uint8_t fixture[1 << 16] ;
+	unsigned long sum = 0 ;
+
+	for (size_t i = 0; i < sizeof(fixture); ++i) fixture[i] = i ;
+
+	TEST_CASE(complexity_log2,
+		ASSERT(test_log2(1) == 0 && test_log2(1024) == 10) ;
+		ASSERT(test_log2(3) > 1.58496 && test_log2(3) < 1.58497) ;
+		ASSERT(test_log2(0.25) == -2) ;
+		ASSERT(test_exp2(10) > 1023.999 && test_exp2(10) < 1024.001) ;
+		ASSERT(test_exp2(-1.5) > 0.35355 && test_exp2(-1.5) < 0.35356) ;
+	) ;
+
+	TEST_CASE(complexity_fit_n_log_n,
+		for (size_t s = 0; s < sizes; ++s)
+			ns[s] = 5 * n[s] * test_log2(n[s]) ;
+		test_bench_fit_models(n, ns, sizes, &fit) ;
+		ASSERT(fit.model == O_N_LOG_N) ;
+		ASSERT(fit.coefficient > 4.99 && fit.coefficient < 5.01) ;
+		ASSERT(fit.error < 0.01) ;
+	) ;
+
+	TEST_CASE(complexity_fit_quadratic,
+		// Linear overhead is soon swamped
+		for (size_t s = 0; s < sizes; ++s)
+			ns[s] = 3 * n[s] * n[s] + 100 * n[s] ;
+		test_bench_fit_models(n, ns, sizes, &fit) ;
+		ASSERT(fit.model == O_N_SQUARED) ;
+	) ;
+
+	TEST_CASE(complexity_fit_noisy_constant,
+		for (size_t s = 0; s < sizes; ++s) ns[s] = 40 + s % 2 ;
+		test_bench_fit_models(n, ns, sizes, &fit) ;
+		ASSERT(fit.model == O_1) ;
+		ASSERT(fit.coefficient > 40 && fit.coefficient < 41) ;
+	) ;
+
+	TEST_CASE(complexity_fit_jittery_linear,
+		// 15% either way is a lot more nanoseconds at the big sizes,
+		// but no more wrong there than anywhere else
+		for (size_t s = 0; s < sizes; ++s)
+			ns[s] = 2 * n[s] * (s % 2 ? 1.15 : 0.85) ;
+		test_bench_fit_models(n, ns, sizes, &fit) ;
+		ASSERT(fit.model == O_N) ;
+		ASSERT(fit.errors[O_N] < fit.errors[O_N_LOG_N]) ;
+	) ;
+
+	TEST_CASE(complexity_fit_one_size,
+		test_bench_fit_models(n, ns, 1, &fit) ;
+		ASSERT(fit.model == -1) ;
+	) ;
+
+	TEST_BENCH_RANGE(complexity_sum, 256, sizeof(fixture), 4,
+		for (size_t i = 0; i < n; ++i) sum += fixture[i] ;
+		TEST_BENCH_KEEP(sum) ;
+	) ;
+
+	TEST_CASE(complexity_sum_at_most_linear,
+		// Passes without --bench too, when nothing was fit
+		ASSERT(sum > 0) ;
+		ASSERT_COMPLEXITY_AT_MOST(O_N) ;
+	) ;
+
+	TEST_CASE(complexity_at_most,
+		test_bench_fit_t last = test_bench_fit ;
+
+		test_bench_fit.model = O_N ;
+		ASSERT_COMPLEXITY_AT_MOST(O_N_LOG_N) ;
+		ASSERT_COMPLEXITY_AT_MOST(O_N) ;
+
+		// Too noisy to say it's worse than linear
+		test_bench_fit.model = O_N_LOG_N ;
+		test_bench_fit.errors[O_N] = 8 ;
+		test_bench_fit.noise = 5 ;
+		ASSERT_COMPLEXITY_AT_MOST(O_N) ;
+		test_bench_fit = last ;
+	) ;
+) ;
+
+TEST_SET(telemetry,
+	// A segment of its own, so a run without --telemetry publishes
+	// nothing and one with it is left alone. Unlinked as soon as it's
+	// mapped, so nothing is left behind whichever cases run, and where
+	test_telemetry_t * telemetry = test_telemetry_map("DUMMY_TELEMETRY") ;
+	unsigned long long seq = 4 ;
+
+	unlink("DUMMY_TELEMETRY") ;
+
+	TEST_CASE(telemetry_seqlock,
+		test_telemetry_write_begin(&seq) ;
+		ASSERT(seq == 5) ;		// Odd, readers wait
+		test_telemetry_write_end(&seq) ;
+		ASSERT(seq == 6) ;
+	) ;
+
+	TEST_CASE(telemetry_mapped,
+		ASSERT(telemetry) ;
+		ASSERT(telemetry->magic == TEST_TELEMETRY_MAGIC) ;
+		ASSERT(telemetry->workers == TEST_TELEMETRY_WORKERS) ;
+		ASSERT(telemetry->worker[0].pid == telemetry->pid) ;
+		ASSERT(telemetry->progress.sets_total
+		       == test_telemetry_shared.sets) ;
+		ASSERT(!telemetry->finished) ;
+	) ;
+
+	TEST_CASE(telemetry_current_case,
+		test_telemetry_worker_t * worker = telemetry->worker + 1 ;
+
+		ASSERT(telemetry) ;
+		test_telemetry_worker_write(worker, this->set_name,
+					    this->case_names[case_id]) ;
+		ASSERT(worker->since >= telemetry->started) ;
+		ASSERT(!(worker->seq & 1)) ;
+		ASSERT(!strcmp(worker->name,
+			       "telemetry/test_telemetry_current_case")) ;
+
+		test_telemetry_worker_write(worker, NULL, NULL) ;
+		ASSERT(!worker->since && !worker->name[0]) ;
+		ASSERT(worker->seq == 4) ;
+	) ;
+
+	TEST_CASE(telemetry_seen_across_fork,
+		int status ;
+		pid_t pid ;
+
+		ASSERT(telemetry) ;
+		if (!(pid = fork())) {
+			telemetry->worker[3].pid = getpid() ;
+			test_telemetry_worker_write(telemetry->worker + 3,
+						    this->set_name,
+						    this->case_names[case_id]) ;
+			_exit(0) ;
+		}
+		ASSERT(pid > 0 && waitpid(pid, &status, 0) == pid) ;
+		ASSERT(telemetry->worker[3].pid == pid) ;
+		ASSERT(!strcmp(telemetry->worker[3].name,
+			       "telemetry/test_telemetry_seen_across_fork")) ;
+	) ;
+) ;
+
+// Found by lil_db_metrics_dump through the lil_db_metrics section
+static LIL_DB_COUNTER(test_requests) ;
+static LIL_DB_GAUGE(test_depth) ;
+static LIL_DB_HISTOGRAM(test_latency_ns) ;
+
+TEST_SET(metrics,
+
+	char metricsname[] = "DUMMY_METRICS", line[LIL_DB_DEFAULT_BUFFSZ + 1] ;
+	// More threads than shards, so some of them share the last one
+	pthread_t recorders[LIL_DB_METRICS_SHARDS + 4] ;
+	size_t threads = sizeof(recorders) / sizeof(*recorders) ;
+	lil_db_hist_summary_t summary ;
+	const char latency[] = "metric test_latency_ns: count 200000 p50 " ;
+	int dumps = 0, dumped_requests = 0, dumped_latency = 0 ;
+
+	for (size_t i = 0; i < threads; ++i) {
+		pthread_create(&recorders[i], NULL, LAMBDA(void *,(void * arg) {
+			for (uint64_t j = 0; j < 10000; ++j) {
+				lil_db_counter_add(&test_requests, 1) ;
+				lil_db_hist_record(&test_latency_ns, j % 1000 + 1) ;
+			}
+			return arg ;
+		}), NULL) ;
+	}
+	for (size_t i = 0; i < threads; ++i) pthread_join(recorders[i], NULL) ;
+	lil_db_gauge_set(&test_depth, 10) ;
+	lil_db_gauge_add(&test_depth, -3) ;
+	lil_db_hist_summarize(&test_latency_ns, &summary) ;
+
+	// One dump from the thread, then the last one from lil_db_kill
+	lil_db_init(metricsname, sizeof(metricsname)) ;
+	lil_db_metrics_start(1) ;
+	nanosleep(&(struct timespec){ 0, 20000000 }, NULL) ;
+	lil_db_kill() ;
+
+	FILE * metricsfile = fopen(metricsname, "r") ;
+	while (metricsfile && fgets(line, sizeof(line), metricsfile)) {
+		dumps += !strcmp(line, "metric test_depth: 7\n") ;
+		dumped_requests += !strcmp(line, "metric test_requests: 200000\n") ;
+		dumped_latency += !strncmp(line, latency,
+					   sizeof(latency) - 1) ;
+	}
+	if (metricsfile) fclose(metricsfile) ;
+
+	TEST_CASE(metrics_buckets,
+		// One each up to LIL_DB_HIST_SUB, then that many per power of 2
+		ASSERT(lil_db_hist_bucket(0) == 0) ;
+		ASSERT(lil_db_hist_bucket(15) == 15) ;
+		ASSERT(lil_db_hist_bucket(31) == 31) ;
+		ASSERT(lil_db_hist_bucket(32) == lil_db_hist_bucket(33)) ;
+		ASSERT(lil_db_hist_bucket(33) + 1 == lil_db_hist_bucket(34)) ;
+		ASSERT(lil_db_hist_bucket(1ULL << LIL_DB_HIST_MAX_BITS)
+		       == LIL_DB_HIST_BUCKETS - 1) ;
+		ASSERT(lil_db_hist_bucket(~0ULL) == LIL_DB_HIST_BUCKETS - 1) ;
+	) ;
+
+	TEST_CASE(metrics_nothing_lost,
+		ASSERT(lil_db_counter_read(&test_requests) == threads * 10000) ;
+		ASSERT(summary.count == threads * 10000) ;
+		ASSERT(lil_db_gauge_read(&test_depth) == 7) ;
+	) ;
+
+	TEST_CASE(metrics_percentiles,
+		// Uniform over 1..1000, each off by at most a bucket
+		ASSERT(summary.max == 1000) ;
+		ASSERT(summary.p50 >= 500 && summary.p50 < 500 * 17 / 16) ;
+		ASSERT(summary.p90 >= 900 && summary.p90 < 900 * 17 / 16) ;
+		ASSERT(summary.p99 >= 990 && summary.p99 <= 1000) ;
+		ASSERT(summary.p999 >= 999 && summary.p999 <= 1000) ;
+	) ;
+
+	TEST_CASE(metrics_dumped,
+		ASSERT(dumps >= 2) ;
+		ASSERT(dumped_requests == dumps && dumped_latency == dumps) ;
+	) ;
+
+	TEST_CASE(metrics_shards_recycled,
+		// One after another, many more than there are shards, and
+		// every one still gets a shard of its own
+		lil_db_counter_t * counter = calloc(1, sizeof(*counter)) ;
+		unsigned int shared = 0, runs = 4 * LIL_DB_METRICS_SHARDS ;
+		pthread_t recorder ;
+		void * shard ;
+
+		void * record(void * arg)
+		{
+			lil_db_counter_add(counter, 1) ;
+			return (void *)(uintptr_t)lil_db_metrics_shard() ;
+		}
+
+		ASSERT(counter) ;
+		for (unsigned int i = 0; i < runs; ++i) {
+			pthread_create(&recorder, NULL, record, NULL) ;
+			pthread_join(recorder, &shard) ;
+			shared += (uintptr_t)shard == LIL_DB_METRICS_SHARED ;
+		}
+		ASSERT(!shared) ;
+		ASSERT(lil_db_counter_read(counter) == runs) ;
+		free(counter) ;
+	) ;
+
+	TEST_CASE(metrics_removed,
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_METRICS")) ;
+	) ;
+) ;
+
+TEST_SET(trace,
+
+	char tracename[] = "DUMMY_TRACE.json", logname[] = "DUMMY_TRACE" ;
+	char line[512], name[64], first[64] = "", last[64] = "" ;
+	unsigned long long ts, ts_ns, dur, dur_ns ;
+	unsigned long long outer_begin = 0, outer_end = 0, inner_begin = 0,
+			   inner_end = 0 ;
+	int pid, tid, thread_tids[4] = { 0 }, events = 0, unparsed = 0 ;
+	unsigned int depth, deepest = 0, opened_deep, left_deep ;
+	int outer = 0, inner = 0, appends = 0, threaded = 0,
+	    threaded_inner = 0, deep = 0, full = 0, off = 0 ;
+	uint64_t dropped_before, dropped_full ;
+	pthread_t tracers[4] ;
+	// Under --trace it's already on, and stays that way
+	int was_on = lil_db_trace_on ;
+
+	lil_db_trace_start(0) ;
+
+	// Nested, with lil_db's own spans inside
+	lil_db_init(logname, sizeof(logname)) ;
+	LIL_DB_SPAN_BEGIN("test_outer") ;
+	LIL_DB_SPAN_BEGIN("test_inner") ;
+	LIL_DB_SPAN_END() ;
+	lil_db_printf(LIL_DB_OPTION_DEFAULT, "traced\n") ;
+	LIL_DB_SPAN_END() ;
+	lil_db_kill() ;
+
+	for (size_t i = 0; i < 4; ++i) {
+		pthread_create(&tracers[i], NULL, LAMBDA(void *,(void * arg) {
+			for (int j = 0; j < 100; ++j) {
+				LIL_DB_SPAN_BEGIN("test_thread") ;
+				LIL_DB_SPAN_BEGIN("test_thread_inner") ;
+				LIL_DB_SPAN_END() ;
+				LIL_DB_SPAN_END() ;
+			}
+			return arg ;
+		}), NULL) ;
+	}
+	for (size_t i = 0; i < 4; ++i) pthread_join(tracers[i], NULL) ;
+
+	// Deeper than anything is recorded, then left without any ENDs
+	for (int j = 0; j < LIL_DB_TRACE_DEPTH + 2; ++j)
+		opened_deep = lil_db_span_begin("test_deep") ;
+	lil_db_span_unwind(0) ;
+	left_deep = lil_db_span_depth ;
+
+	// A thread with room for 8 spans opens 10, then 5 more
+	dropped_before = lil_db_trace_dropped() ;
+	lil_db_trace_start(8) ;
+	pthread_create(&tracers[0], NULL, LAMBDA(void *,(void * arg) {
+		for (int j = 0; j < 10; ++j) LIL_DB_SPAN_BEGIN("test_full") ;
+		lil_db_span_unwind(0) ;
+		for (int j = 0; j < 5; ++j) {
+			LIL_DB_SPAN_BEGIN("test_full") ;
+			LIL_DB_SPAN_END() ;
+		}
+		return arg ;
+	}), NULL) ;
+	pthread_join(tracers[0], NULL) ;
+	lil_db_trace_start(0) ;
+	dropped_full = lil_db_trace_dropped() - dropped_before ;
+
+	if (!was_on) {
+		lil_db_trace_stop() ;
+		LIL_DB_SPAN_BEGIN("test_off") ;
+		LIL_DB_SPAN_END() ;
+	}
+
+	lil_db_trace_write(tracename) ;
+
+	FILE * tracefile = fopen(tracename, "r") ;
+	while (tracefile && fgets(line, sizeof(line), tracefile)) {
+		if (!*first) snprintf(first, sizeof(first), "%.63s", line) ;
+		snprintf(last, sizeof(last), "%.63s", line) ;
+		if (sscanf(line, "{\"name\":\"%63[^\"]\",\"cat\":\"lil_db\","
+			   "\"ph\":\"X\",\"ts\":%llu.%llu,\"dur\":%llu.%llu,"
+			   "\"pid\":%d,\"tid\":%d,\"args\":{\"depth\":%u}}",
+			   name, &ts, &ts_ns, &dur, &dur_ns, &pid, &tid,
+			   &depth) != 8) {
+			unparsed++ ;
+			continue ;
+		}
+		events++ ;
+		ts = ts * 1000 + ts_ns ;
+		dur = dur * 1000 + dur_ns ;
+
+		if (!strcmp(name, "test_outer") && !depth && tid == pid) {
+			outer++ ;
+			outer_begin = ts ;
+			outer_end = ts + dur ;
+		} else if (!strcmp(name, "test_inner") && depth == 1) {
+			inner++ ;
+			inner_begin = ts ;
+			inner_end = ts + dur ;
+		} else if (!strcmp(name, "lil_db_append") && depth == 2
+			   && tid == pid && ts >= outer_begin) {
+			appends++ ;
+		} else if (!strcmp(name, "test_thread") && !depth) {
+			threaded++ ;
+			for (int t = 0; t < 4; ++t) {
+				if (thread_tids[t] == tid) break ;
+				if (!thread_tids[t]) {
+					thread_tids[t] = tid ;
+					break ;
+				}
+			}
+		} else if (!strcmp(name, "test_thread_inner") && depth == 1) {
+			threaded_inner++ ;
+		} else if (!strcmp(name, "test_deep")) {
+			deep++ ;
+			if (depth > deepest) deepest = depth ;
+		} else if (!strcmp(name, "test_full")) {
+			full++ ;
+		} else if (!strcmp(name, "test_off")) {
+			off++ ;
+		}
+	}
+	if (tracefile) fclose(tracefile) ;
+
+	TEST_CASE(trace_nested,
+		ASSERT(outer == 1 && inner == 1) ;
+		ASSERT(outer_begin <= inner_begin && inner_end <= outer_end) ;
+		// lil_db_printf is a lil_db_write with a lil_db_append in it
+		ASSERT(appends >= 1) ;
+	) ;
+
+	TEST_CASE(trace_threads,
+		ASSERT(threaded == 400 && threaded_inner == 400) ;
+		for (int t = 0; t < 4; ++t) {
+			ASSERT(thread_tids[t] && thread_tids[t] != getpid()) ;
+		}
+	) ;
+
+	TEST_CASE(trace_too_deep,
+		ASSERT(opened_deep == LIL_DB_TRACE_DEPTH + 2) ;
+		ASSERT(left_deep == 0) ;
+		ASSERT(deep == LIL_DB_TRACE_DEPTH) ;
+		ASSERT(deepest == LIL_DB_TRACE_DEPTH - 1) ;
+	) ;
+
+	TEST_CASE(trace_full,
+		// Every span recorded had room for its end
+		ASSERT(full == 8) ;
+		ASSERT(dropped_full == 2 + 5) ;
+	) ;
+
+	TEST_CASE(trace_stopped,
+		ASSERT(off == 0) ;
+		if (!was_on) { ASSERT(!lil_db_trace_on) ; }
+	) ;
+
+	TEST_CASE(trace_json,
+		ASSERT(!strcmp(first, "{\"traceEvents\":[\n")) ;
+		ASSERT(!strncmp(last, "],\"displayTimeUnit\":\"ns\",", 25)) ;
+		// Just those two, every other line is an event
+		ASSERT(unparsed == 2) ;
+		ASSERT(events >= 1 + 1 + 800 + LIL_DB_TRACE_DEPTH + 8) ;
+	) ;
+
+	TEST_CASE(trace_removed,
+		ASSERT(!remove("DUMMY_TRACE.json")) ;
+		TEST_CASE_PASS_IF_FALSE(remove("DUMMY_TRACE")) ;
+	) ;
+) ;
 
 TEST_MAIN() ;
 
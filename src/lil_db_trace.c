@@ -0,0 +1,251 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_trace.c source file
+ * Scoped spans, written out as a Chrome/Perfetto trace
+ * By Joel Savitz <jsavitz@redhat.com>
+ */
+
+#include "lil_db.h"
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+int lil_db_trace_on = 0 ;
+
+__thread unsigned int lil_db_span_depth = 0 ;
+
+// Every thread's buffer, NULL until it records something. Never unmapped,
+// so that a trace can be written after its threads are gone
+static lil_db_trace_buffer_t * buffers[LIL_DB_TRACE_THREADS] ;
+
+// Buffers handed out so far, possibly past the end of buffers[]
+static unsigned int next_buffer = 0 ;
+
+// Room in the next buffer handed out
+static uint64_t trace_events = LIL_DB_TRACE_DEFAULT_EVENTS ;
+
+// Spans opened by threads without a buffer
+static uint64_t untraced = 0 ;
+
+// This thread's buffer, and whether it has tried to get one
+static __thread lil_db_trace_buffer_t * mine = NULL ;
+static __thread int tried = 0 ;
+
+static inline uint64_t lil_db_trace_now(void)
+{
+	struct timespec now ;
+
+	clock_gettime(CLOCK_MONOTONIC, &now) ;
+
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec ;
+}
+
+// This thread's buffer, mapped the first time it's wanted. NULL if there
+// are no more to go around
+static lil_db_trace_buffer_t * lil_db_trace_buffer(void)
+{
+	lil_db_trace_buffer_t * buffer ;
+	uint64_t capacity ;
+	unsigned int slot ;
+
+	if (mine || tried) return mine ;
+	tried = 1 ;
+
+	slot = __atomic_fetch_add(&next_buffer, 1, __ATOMIC_RELAXED) ;
+	if (slot >= LIL_DB_TRACE_THREADS) return NULL ;
+
+	// Zeroed and only backed as it's used, so a big one is cheap
+	capacity = __atomic_load_n(&trace_events, __ATOMIC_RELAXED) ;
+	buffer = mmap(NULL, sizeof(*buffer)
+		      + capacity * sizeof(*buffer->events),
+		      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+		      -1, 0) ;
+	if (buffer == MAP_FAILED) return NULL ;
+
+	buffer->capacity = capacity ;
+	buffer->tid = syscall(SYS_gettid) ;
+
+	// Only filled in, as far as lil_db_trace_write is concerned, once it
+	// can see it
+	__atomic_store_n(&buffers[slot], buffer, __ATOMIC_RELEASE) ;
+
+	return mine = buffer ;
+}
+
+unsigned int lil_db_span_begin(const char * name)
+{
+	lil_db_trace_buffer_t * buffer ;
+	unsigned int depth = lil_db_span_depth ;
+
+	if (!__atomic_load_n(&lil_db_trace_on, __ATOMIC_RELAXED) && !depth)
+		return 0 ;
+
+	buffer = lil_db_trace_buffer() ;
+	lil_db_span_depth = depth + 1 ;
+
+	// Case: Nowhere to put it. Still counted in the depth, so that its
+	// LIL_DB_SPAN_END ends it and not the span around it
+	if (!buffer) {
+		__atomic_fetch_add(&untraced, 1, __ATOMIC_RELAXED) ;
+		return depth + 1 ;
+	}
+	if (depth >= LIL_DB_TRACE_DEPTH) {
+		__atomic_store_n(&buffer->dropped, buffer->dropped + 1,
+				 __ATOMIC_RELAXED) ;
+		return depth + 1 ;
+	}
+
+	// Case: Full, counting the ends of the spans already open
+	if (buffer->written + buffer->reserved >= buffer->capacity) {
+		buffer->open[depth].name = NULL ;
+		__atomic_store_n(&buffer->dropped, buffer->dropped + 1,
+				 __ATOMIC_RELAXED) ;
+		return depth + 1 ;
+	}
+
+	buffer->reserved++ ;
+	buffer->open[depth].name = name ;
+	buffer->open[depth].begin_ns = lil_db_trace_now() ; // As late as can be
+
+	return depth + 1 ;
+}
+
+void lil_db_span_end(void)
+{
+	uint64_t now = lil_db_trace_now() ; // As early as can be
+	lil_db_trace_buffer_t * buffer = mine ;
+	lil_db_trace_event_t * event ;
+	unsigned int depth ;
+
+	if (!lil_db_span_depth) return ;
+	depth = --lil_db_span_depth ;
+
+	if (!buffer || depth >= LIL_DB_TRACE_DEPTH || !buffer->open[depth].name)
+		return ;
+
+	// Its room was reserved when it began
+	event = buffer->events + buffer->written ;
+	event->name = buffer->open[depth].name ;
+	event->begin_ns = buffer->open[depth].begin_ns ;
+	event->end_ns = now ;
+	event->depth = depth ;
+	buffer->reserved-- ;
+
+	// lil_db_trace_write only reads what's been published here
+	__atomic_store_n(&buffer->written, buffer->written + 1,
+			 __ATOMIC_RELEASE) ;
+}
+
+void lil_db_span_unwind(unsigned int depth)
+{
+	while (lil_db_span_depth > depth) lil_db_span_end() ;
+}
+
+int lil_db_trace_start(size_t events)
+{
+	__atomic_store_n(&trace_events, events ? events
+			 : LIL_DB_TRACE_DEFAULT_EVENTS, __ATOMIC_RELAXED) ;
+	__atomic_store_n(&lil_db_trace_on, 1, __ATOMIC_RELAXED) ;
+
+	return 0 ;
+}
+
+int lil_db_trace_stop(void)
+{
+	__atomic_store_n(&lil_db_trace_on, 0, __ATOMIC_RELAXED) ;
+
+	return 0 ;
+}
+
+uint64_t lil_db_trace_dropped(void)
+{
+	uint64_t dropped = __atomic_load_n(&untraced, __ATOMIC_RELAXED) ;
+	lil_db_trace_buffer_t * buffer ;
+
+	for (int b = 0; b < LIL_DB_TRACE_THREADS; ++b) {
+		if ((buffer = __atomic_load_n(&buffers[b], __ATOMIC_ACQUIRE)))
+			dropped += __atomic_load_n(&buffer->dropped,
+						   __ATOMIC_RELAXED) ;
+	}
+
+	return dropped ;
+}
+
+// Write name as the inside of a JSON string
+static void lil_db_trace_escape(FILE * out, const char * name)
+{
+	for (; *name; ++name) {
+		if (*name == '"' || *name == '\\')
+			fprintf(out, "\\%c", *name) ;
+		else if ((unsigned char)*name < 0x20)
+			fprintf(out, "\\u%04x", *name) ;
+		else
+			fputc(*name, out) ;
+	}
+}
+
+int lil_db_trace_write(const char * path)
+{
+	lil_db_trace_buffer_t * buffer ;
+	lil_db_trace_event_t * event ;
+	const char * separator = "" ;
+	uint64_t written ;
+	int pid = getpid(), failed ;
+	FILE * out = fopen(path, "w") ;
+
+	if (!out) return 1 ;
+
+	// Complete ("X") events: one per span, so a trace cut off anywhere
+	// still pairs every begin with its end
+	fputs("{\"traceEvents\":[", out) ;
+	for (int b = 0; b < LIL_DB_TRACE_THREADS; ++b) {
+		if (!(buffer = __atomic_load_n(&buffers[b], __ATOMIC_ACQUIRE)))
+			continue ;
+
+		written = __atomic_load_n(&buffer->written, __ATOMIC_ACQUIRE) ;
+		for (event = buffer->events; event < buffer->events + written;
+		     ++event) {
+			fprintf(out, "%s\n{\"name\":\"", separator) ;
+			lil_db_trace_escape(out, event->name) ;
+			fprintf(out, "\",\"cat\":\"lil_db\",\"ph\":\"X\","
+				"\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,"
+				"\"pid\":%d,\"tid\":%d,"
+				"\"args\":{\"depth\":%u}}",
+				(unsigned long long)event->begin_ns / 1000,
+				(unsigned long long)event->begin_ns % 1000,
+				(unsigned long long)(event->end_ns
+						     - event->begin_ns) / 1000,
+				(unsigned long long)(event->end_ns
+						     - event->begin_ns) % 1000,
+				pid, buffer->tid, event->depth) ;
+			separator = "," ;
+		}
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ns\","
+		"\"otherData\":{\"dropped\":\"%llu\"}}\n",
+		(unsigned long long)lil_db_trace_dropped()) ;
+
+	failed = ferror(out) ;
+	failed |= fclose(out) ;
+
+	return failed ? 1 : 0 ;
+}
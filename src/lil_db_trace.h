@@ -0,0 +1,146 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_db_trace.h header file
+ * Scoped spans, written out as a Chrome/Perfetto trace
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Bracket anything worth seeing on a timeline:
+ *
+ *	LIL_DB_SPAN_BEGIN("parse") ;
+ *	...
+ *	LIL_DB_SPAN_END() ;
+ *
+ * Spans nest, per thread, and cost a load and a branch until
+ * lil_db_trace_start. After that, each thread records into a buffer of its
+ * own that no other thread writes, so there's no lock and no cache line
+ * bouncing: a begin pushes the name and a CLOCK_MONOTONIC timestamp onto
+ * the thread's stack of open spans, and the end stores one event with both
+ * timestamps and the depth. lil_db_trace_write turns every buffer into
+ * trace event JSON, which chrome://tracing and ui.perfetto.dev both open,
+ * and may do so while the threads are still at it.
+ *
+ * A buffer only grows until it's full: past that, new spans are dropped and
+ * counted, but a span that was recorded always has room for its end, so
+ * there's never half of one. Threads past LIL_DB_TRACE_THREADS and spans
+ * deeper than LIL_DB_TRACE_DEPTH are counted the same way.
+ *
+ * Names are kept by pointer, not copied, so they must outlive the trace.
+ * String literals do.
+ */
+
+#ifndef LIL_DB_TRACE_H
+#define LIL_DB_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Threads with a buffer. Any after that aren't traced
+#define LIL_DB_TRACE_THREADS 		64
+
+// Spans a thread can record unless lil_db_trace_start says otherwise
+#define LIL_DB_TRACE_DEFAULT_EVENTS 	65536
+
+// Spans a thread can have open at once and still record the innermost
+#define LIL_DB_TRACE_DEPTH 		32
+
+// One finished span
+typedef struct lil_db_trace_event {
+	const char * name ;
+
+	// CLOCK_MONOTONIC, in nanoseconds
+	uint64_t begin_ns, end_ns ;
+
+	// Spans it was nested in, 0 for the outermost
+	uint32_t depth ;
+} lil_db_trace_event_t ;
+
+// One thread's spans. Only that thread writes it
+typedef struct lil_db_trace_buffer {
+	// Events stored and readable, and the room for them
+	uint64_t written, capacity ;
+
+	// Events promised to open spans, so their ends always fit
+	uint64_t reserved ;
+
+	// Spans that didn't fit
+	uint64_t dropped ;
+
+	// The thread, as the kernel knows it
+	int tid ;
+
+	// What's open, by depth. A NULL name is a span that isn't recorded
+	struct {
+		const char * name ;
+		uint64_t begin_ns ;
+	} open[LIL_DB_TRACE_DEPTH] ;
+
+	lil_db_trace_event_t events[] ;
+} lil_db_trace_buffer_t ;
+
+// Nonzero between lil_db_trace_start and lil_db_trace_stop
+extern int lil_db_trace_on ;
+
+// Spans this thread has open, recorded or not
+extern __thread unsigned int lil_db_span_depth ;
+
+// Open a span called name on this thread, if tracing or already in one
+#define LIL_DB_SPAN_BEGIN(name) 					       \
+	do { 								       \
+		if (__atomic_load_n(&lil_db_trace_on, __ATOMIC_RELAXED)        \
+		    || lil_db_span_depth)				       \
+			lil_db_span_begin(name) ;			       \
+	} while (0)
+
+// Close the innermost span this thread has open
+#define LIL_DB_SPAN_END() 						       \
+	do { 								       \
+		if (lil_db_span_depth) lil_db_span_end() ; 		       \
+	} while (0)
+
+// All functions return 0 on success and nonzero on failure unless otherwise specified
+
+// What LIL_DB_SPAN_BEGIN calls, and may be called directly. Returns how
+// many spans this thread has open with this one, or 0 if it wasn't opened
+unsigned int lil_db_span_begin(const char * name) ;
+
+// What LIL_DB_SPAN_END calls
+void lil_db_span_end(void) ;
+
+// End spans on this thread until only depth are open, e.g. after leaving
+// some by a return that skipped their LIL_DB_SPAN_END
+void lil_db_span_unwind(unsigned int depth) ;
+
+// Start recording spans. events is the room each thread gets, 0 for
+// LIL_DB_TRACE_DEFAULT_EVENTS, and only applies to threads that haven't
+// recorded anything yet. Starting twice is harmless
+int lil_db_trace_start(size_t events) ;
+
+// Stop opening new spans. Those already open still record their ends
+int lil_db_trace_stop(void) ;
+
+// Spans that weren't recorded for lack of room, depth, or buffers. Returns
+// the count
+uint64_t lil_db_trace_dropped(void) ;
+
+// Write every span recorded so far to path as trace event JSON. Spans still
+// open aren't in it
+int lil_db_trace_write(const char * path) ;
+
+#endif // LIL_DB_TRACE_H
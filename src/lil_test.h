@@ -35,7 +35,8 @@
  *
  * Architecture (very brief synopsis):
  * 		Test sets are defined in global scope and automatically
- * 	       +executed before main. Test cases are defined within test set
+ * 	       +executed before main, or registered with lil_test_host and
+ * 	       +executed when it says so. Test cases are defined within test set
  * 	       +scope. A function is generated for each test set that executes
  * 	       +all test cases. The generated function has the following
  * 	       +phases:
@@ -58,10 +59,14 @@
  * 	      		 +statements proceed or follow the definition of a
  * 	      		 +test case in control flow.
  *
- *  	      Execution : All test cases defined in the test set are executed.
- *  	      		 +Passing and failing tests are reported. Subsequently,
- *  	      		 +the the name of the test set and the ratio of passed
- *  	      		 +tests to total tests is reported.
+ *  	      Execution : All test cases defined in the test set are executed,
+ *  	      		 +in the order they were defined unless the command
+ *  	      		 +line asks for another, possibly in several worker
+ *  	      		 +processes. Passing and failing tests are reported.
+ *  	      		 +Whatever a case logs while it runs is held back and
+ *  	      		 +only shown if it fails. Subsequently, the the name
+ *  	      		 +of the test set and the ratio of passed tests to
+ *  	      		 +total tests is reported.
  *
  *  	    Destruction : All resouces allocated for the test set are free'd.
  *
@@ -75,9 +80,22 @@
 
 /* Dependencies */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 // TODO: configuration option header?
 // TODO: move all non-documentation inline commentary to GitHub issues
@@ -97,6 +115,15 @@
 #define TEST_OPTION_VERBOSE 		 /* Show all passes */
 #undef TEST_OPTION_SUPPRESS_FAILURE	 /* Show all fails  */
 
+/* Output capture options */
+#define TEST_OPTION_CAPTURE		 /* Hold lil_db entries per case    */
+#undef TEST_OPTION_CAPTURE_STDIO	 /* Hold stdout and stderr too      */
+
+/* Timing options, not set here. Define before including to turn on       */
+/*	TEST_OPTION_TIMING		    Report time spent in each phase */
+/*	TEST_OPTION_INCREMENTAL		    Rerun only what changed, see    */
+/*					    make incremental		    */
+
 /* Specification of documentation information */
 
  /*
@@ -254,6 +281,345 @@
 									       \
 /* end #define REALLOCATE_OR_DIE					    */
 
+/* SECTION: COMMAND LINE */
+
+/* Where case history is kept if scheduling needs it and no file is given */
+#define TEST_HISTORY_DEFAULT ".lil_test_history"
+
+/* What was asked for on the test program's command line		    */
+typedef struct test_options_data {
+	/* Nonzero to rewrite golden files instead of comparing against them */
+	int update_golden ;
+
+	/* Nonzero to run cases that failed recently before the rest	    */
+	int failed_first ;
+
+	/* Nonzero to stop the whole run at the first failing case	    */
+	int fail_fast ;
+
+	/* Worker processes to run each test set's cases in, 0 or 1 for none */
+	unsigned int jobs ;
+
+	/* File of per-case durations and outcomes, NULL to keep none	    */
+	const char * history ;
+
+	/* Runs of each case under --repeat, 0 for test_repeat_limit()'s  */
+	/* default under --until-fail					    */
+	unsigned long long repeat ;
+
+	/* Nonzero to stop repeating a case once it has failed		    */
+	int until_fail ;
+
+	/* Seed of the first repeated run, each after it gets the next one  */
+	unsigned long long seed ;
+
+	/* Pattern of the cases to repeat, NULL for all of them		    */
+	const char * only ;
+
+	/* Nonzero to time benchmarks rather than just run them once	    */
+	int bench ;
+
+	/* CPU to pin benchmarks to, or -1 to leave them where they are     */
+	int bench_cpu ;
+
+	/* Nonzero to run benchmarks at the highest priority allowed	    */
+	int bench_priority ;
+
+	/* Nonzero to back benchmark fixtures with transparent huge pages  */
+	int bench_thp ;
+
+	/* Timed samples per benchmark, 0 for TEST_BENCH_SAMPLES	    */
+	size_t bench_samples ;
+
+	/* Nonzero to publish progress for lil_test_top			    */
+	int telemetry ;
+
+	/* File to write a trace of every case to, NULL for no trace	    */
+	const char * trace ;
+} test_options_data_t ;
+
+static test_options_data_t test_options = { 0 } ;
+
+/* The seed of the run in progress, for cases that want something random */
+/* to differ from run to run. 0 unless cases are being repeated	    */
+static unsigned long long test_seed = 0 ;
+
+/* The value of option name in argv[*i], as --name=VALUE or --name VALUE, */
+/* stepping *i past it, or NULL if argv[*i] isn't that option		    */
+static inline const char * test_option_value(int argc, char ** argv, int * i,
+					     const char * name)
+{
+	size_t n = strlen(name) ;
+
+	if (strncmp(argv[*i], name, n)) return NULL ;
+	if (argv[*i][n] == '=') return argv[*i] + n + 1 ;
+	if (argv[*i][n] || *i + 1 >= argc) return NULL ;
+
+	return argv[++*i] ;
+}
+
+ /*
+  * Identifier:
+  * 		test_parse_args(argc, argv, envp)
+  *
+  * Purpose:
+  * 		Pick lil_test's options off the command line. Test sets run
+  * 	       +as constructors, long before main() could hand them argv.
+  *
+  * Inputs:
+  * 	     argc, argv	: As main() would get them, courtesy of glibc, which
+  * 	     		 +passes them to constructors too
+  *
+  * 	           envp	: Unused
+  *
+  * Resolution:
+  * 		Recognized options are recorded in test_options, anything else
+  * 	       +is left for main(). Runs at constructor priority 101, so
+  * 	       +before any test set.
+  *
+  * 		--update-golden : Rewrite golden files that don't match
+  *
+  * 		 --failed-first : Run each set's recently failed and new
+  * 		 		 +cases first
+  *
+  * 		    --fail-fast : Stop at the first failing case
+  *
+  * 		     --jobs N	: Run each set's cases in N worker processes,
+  * 		     		 +longest expected first
+  *
+  * 		 --history FILE : Keep case history in FILE, by default
+  * 		 		 +TEST_HISTORY_DEFAULT when --failed-first or
+  * 		 		 +--jobs need one
+  *
+  * 		   --repeat N	: Run each case N times instead of once, in
+  * 		   		 +--jobs workers (by default one per CPU), and
+  * 		   		 +report how often it passed
+  *
+  * 		   --until-fail	: Stop repeating a case when it fails, after
+  * 		   		 +at most --repeat N runs if that's given,
+  * 		   		 +else without limit if --case is, else
+  * 		   		 +after TEST_REPEAT_UNTIL_FAIL_RUNS
+  *
+  * 		    --seed S	: Seed of the first repeated run, by default
+  * 		    		 +from the clock
+  *
+  * 		    --case GLOB	: Repeat only the cases whose "set/test_name"
+  * 		    		 +or "test_name" matches GLOB
+  *
+  * 		        --bench	: Time each TEST_BENCH instead of running its
+  * 		        	 +body once
+  *
+  * 		 --bench-cpu N	: Pin benchmarks to CPU N while they're timed
+  *
+  * 		--bench-priority : Time benchmarks at SCHED_FIFO, or failing
+  * 				 +that the lowest nice value, if permitted
+  *
+  * 		    --bench-thp : Back fixtures from test_bench_alloc() with
+  * 		    		 +transparent huge pages
+  *
+  * 	     --bench-samples N	: Take N timed samples of each benchmark
+  *
+  * 		    --telemetry	: Publish progress in shared memory, where
+  * 		    		 +lil_test_top can watch it
+  *
+  * 		   --trace FILE	: Write a span for each case, and whatever
+  * 		   		 +lil_db spans it opens, to FILE as trace
+  * 		   		 +event JSON
+  */
+__attribute__((constructor(101)))
+static void test_parse_args(int argc, char ** argv, char ** envp)
+{
+	const char * value ;
+
+	test_options.bench_cpu = -1 ;
+
+	for (int i = 1; i < argc && argv; ++i) {
+		if (!strcmp(argv[i], "--update-golden"))
+			test_options.update_golden = 1 ;
+		else if (!strcmp(argv[i], "--failed-first"))
+			test_options.failed_first = 1 ;
+		else if (!strcmp(argv[i], "--fail-fast"))
+			test_options.fail_fast = 1 ;
+		else if ((value = test_option_value(argc, argv, &i, "--jobs")))
+			test_options.jobs = strtoul(value, NULL, 10) ;
+		else if ((value = test_option_value(argc, argv, &i,
+						    "--history")))
+			test_options.history = value ;
+		else if ((value = test_option_value(argc, argv, &i,
+						    "--repeat")))
+			test_options.repeat = strtoull(value, NULL, 10) ;
+		else if (!strcmp(argv[i], "--until-fail"))
+			test_options.until_fail = 1 ;
+		else if ((value = test_option_value(argc, argv, &i, "--seed")))
+			test_options.seed = strtoull(value, NULL, 0) ;
+		else if ((value = test_option_value(argc, argv, &i, "--case")))
+			test_options.only = value ;
+		else if (!strcmp(argv[i], "--bench"))
+			test_options.bench = 1 ;
+		else if ((value = test_option_value(argc, argv, &i,
+						    "--bench-cpu")))
+			test_options.bench_cpu = strtol(value, NULL, 10) ;
+		else if (!strcmp(argv[i], "--bench-priority"))
+			test_options.bench_priority = 1 ;
+		else if (!strcmp(argv[i], "--bench-thp"))
+			test_options.bench_thp = 1 ;
+		else if ((value = test_option_value(argc, argv, &i,
+						    "--bench-samples")))
+			test_options.bench_samples = strtoul(value, NULL, 10) ;
+		else if (!strcmp(argv[i], "--telemetry"))
+			test_options.telemetry = 1 ;
+		else if ((value = test_option_value(argc, argv, &i, "--trace")))
+			test_options.trace = value ;
+	}
+
+	/* A fresh seed each time, unless one was given to rerun a failure */
+	if (!test_options.seed)
+		test_options.seed = (unsigned long long)time(NULL) << 20
+				    ^ getpid() ;
+
+	if (!test_options.history
+	    && (test_options.failed_first || test_options.jobs > 1))
+		test_options.history = TEST_HISTORY_DEFAULT ;
+}
+
+/* SECTION: OUTPUT CAPTURE */
+
+/* lil_db, if it's linked in. Weak, so lil_test doesn't need it            */
+int lil_db_capture_begin(void) __attribute__((weak)) ;
+long lil_db_capture_end(FILE * dump) __attribute__((weak)) ;
+
+/* Where the case currently running has its output held                     */
+typedef struct test_capture_data {
+	/* Nonzero between test_capture_begin() and test_capture_end()      */
+	int active ;
+
+	/* Nonzero while stdout and stderr point at file		    */
+	int redirected ;
+
+	/* The real stdout and stderr while redirected			    */
+	int saved_stdout, saved_stderr ;
+
+	/* Scratch file for held output, reused from case to case	    */
+	FILE * file ;
+} test_capture_data_t ;
+
+static test_capture_data_t test_capture = { 0 } ;
+
+ /*
+  * Identifier:
+  * 		test_capture_begin()
+  *
+  * Purpose:
+  * 		Start holding back whatever the next test case logs, so that
+  * 	       +passing cases don't cost any I/O.
+  *
+  * Resolution:
+  * 		lil_db entries go to lil_db's in-memory capture ring if the
+  * 	       +CAPTURE option is set and lil_db is linked in. If the
+  * 	       +CAPTURE_STDIO option is set, stdout and stderr are pointed at
+  * 	       +a scratch file. Failing to make the scratch file just means
+  * 	       +stdout and stderr aren't held.
+  */
+static inline void test_capture_begin(void)
+{
+#ifdef TEST_OPTION_CAPTURE
+	if (lil_db_capture_begin) lil_db_capture_begin() ;
+#endif
+#ifdef TEST_OPTION_CAPTURE_STDIO
+	if (test_capture.file || (test_capture.file = tmpfile())) {
+		fflush(stdout) ;
+		fflush(stderr) ;
+		test_capture.saved_stdout = dup(STDOUT_FILENO) ;
+		test_capture.saved_stderr = dup(STDERR_FILENO) ;
+		dup2(fileno(test_capture.file), STDOUT_FILENO) ;
+		dup2(fileno(test_capture.file), STDERR_FILENO) ;
+		test_capture.redirected = 1 ;
+	}
+#endif
+	test_capture.active = 1 ;
+}
+
+ /*
+  * Identifier:
+  * 		test_capture_restore()
+  *
+  * Purpose:
+  * 		Point stdout and stderr back at the terminal without dropping
+  * 	       +anything held so far, so a failing case can say so first.
+  *
+  * Resolution:
+  * 		If stdout and stderr were redirected, they are flushed and the
+  * 	       +originals are put back. Otherwise nothing happens.
+  */
+static inline void test_capture_restore(void)
+{
+	if (!test_capture.redirected) return ;
+
+	fflush(stdout) ;
+	fflush(stderr) ;
+	dup2(test_capture.saved_stdout, STDOUT_FILENO) ;
+	dup2(test_capture.saved_stderr, STDERR_FILENO) ;
+	close(test_capture.saved_stdout) ;
+	close(test_capture.saved_stderr) ;
+	test_capture.redirected = 0 ;
+}
+
+ /*
+  * Identifier:
+  * 		test_capture_end(dump)
+  *
+  * Purpose:
+  * 		Stop holding output for the current test case.
+  *
+  * Inputs:
+  * 	           dump : Nonzero to print what was held, zero to drop it
+  *
+  * Resolution:
+  * 		stdout and stderr are restored. When dumping, held stdio
+  * 	       +output and lil_db entries are gathered in the scratch file and
+  * 	       +printed under the failure message, if there are any. The
+  * 	       +scratch file is emptied for the next case either way. Does
+  * 	       +nothing if the case already ended its capture.
+  */
+static inline void test_capture_end(int dump)
+{
+	char buff[4096] ;
+	size_t n ;
+	long held ;
+
+	if (!test_capture.active) return ;
+	test_capture.active = 0 ;
+	test_capture_restore() ;
+
+	if (!dump || (!test_capture.file && !(test_capture.file = tmpfile()))) {
+#ifdef TEST_OPTION_CAPTURE
+		if (lil_db_capture_end) lil_db_capture_end(NULL) ;
+#endif
+	} else {
+		/* stdio output is already in there, lil_db's goes after it  */
+		fseek(test_capture.file, 0, SEEK_END) ;
+#ifdef TEST_OPTION_CAPTURE
+		if (lil_db_capture_end) lil_db_capture_end(test_capture.file) ;
+#endif
+		fflush(test_capture.file) ;
+		held = ftell(test_capture.file) ;
+		rewind(test_capture.file) ;
+
+		if (held > 0) fprintf(stdout, "\tCaptured output:\n") ;
+		while (held > 0 && (n = fread(buff, 1, sizeof(buff),
+					      test_capture.file)) > 0) {
+			fwrite(buff, 1, n, stdout) ;
+		}
+		if (held > 0) fprintf(stdout, "\n") ;
+	}
+
+	if (test_capture.file) {
+		fflush(test_capture.file) ;
+		if (ftruncate(fileno(test_capture.file), 0)) { /* Meh */ }
+		rewind(test_capture.file) ;
+	}
+}
+
  /*
   * Identifier:
   * 		TEST_MAIN()
@@ -292,6 +658,7 @@
 #ifdef TEST_OPTION_VERBOSE
 #define TEST_CASE_PASS()						       \
 									       \
+	test_capture_end(0) ;	        /* Passing cases have nothing to say */\
 	fprintf(stdout,		        /* Begin an informational message   */ \
 		"PASS %s\n\n",	        /* Good news			    */ \
 		this->case_names[case_id]) ;   	     /* Print case name     */ \
@@ -323,16 +690,25 @@
 #ifndef TEST_OPTION_SUPPRESS_FAILURE
 #define TEST_CASE_FAIL(why_string)					       \
 									       \
+	test_capture_restore() ;        /* Get stdout back to tell the user */ \
 	fprintf(stdout,		        /* Begin an informational message   */ \
 		"FAIL %s:\n"            /* Bad news                         */ \
 		"\t%s\n",               /* Indented why_string              */ \
 		this->case_names[case_id],    /* Print case name            */ \
 		why_string) ;  	        /* Print failure defailt            */ \
+	test_capture_end(1) ;	        /* Followed by what the case logged */ \
 	return TEST_RETURN_FAIL ; 	/* The test case has now failed     */ \
 									       \
 /* end #define TEST_CASE_FAIL						    */
 #else
 #define TEST_CASE_FAIL(why_string) return TEST_RETURN_FAIL ; /* Test failed */
+#endif /* ifndef TEST_OPTION_SUPPRESS_FAILURE */
+
+/* Whether a case that failed without saying so gets its output shown      */
+#ifndef TEST_OPTION_SUPPRESS_FAILURE
+#define TEST_CAPTURE_DUMP_FAILURES 1
+#else
+#define TEST_CAPTURE_DUMP_FAILURES 0
 #endif /* ifndef TEST_OPTION_SUPPRESS_FAILURE */
 
  /*
@@ -430,299 +806,4258 @@
 
 #define ASSERT_TRUE(predicate) TEST_CASE_FAIL_IF_TRUE(predicate)
 
-/* SECTION: TEST CASE GENERATION */
+/* SECTION: BULK ASSERTIONS */
+
+/* Room for a failure message with its diff window			    */
+#define TEST_WHY_SIZE 2048
+
+/* Bytes or chars either side of a mismatch shown in its diff window     */
+#define TEST_DIFF_WINDOW 8
+
+/* Same for array elements, which get a line each			    */
+#define TEST_DIFF_ELEMENTS 3
+
+/* Where the bulk assertions format their failure messages. Only touched  */
+/* once something has already failed					    */
+static char test_why[TEST_WHY_SIZE] ;
 
-// TODO: move to configuration
-#define TEST_DEFAULT_CASE_BUFFSIZE 100 /* Initial case_capacity (arbitrary)  */
-#define TEST_DEFAULT_RESIZE_FACTOR 1.3 /* Ratio for capacity growth          */
-			
  /*
   * Identifier:
-  * 		TEST_CHECK_SPACE()
+  * 		test_mem_mismatch(a, b, n)
   *
   * Purpose:
-  * 		Check if enough memory is allocated for an aditional test case
-  * 	       +in the current test set. If more space is needed, allocate it.
+  * 		Find the first byte at which two buffers differ, as fast as
+  * 	       +the CPU allows, so comparing 100 MB costs about as much as
+  * 	       +reading it.
+  *
+  * Inputs:
+  * 		  a, b	: The buffers
+  *
+  * 		     n	: Their length in bytes
   *
   * Resolution:
-  *  	        A conditional statement that tests if the dynamically allocated
-  *  	       +memory in the current test set's test_set_data struct is filled. In
-  *  	       +the case of a true result, additional memory is allocated. If
-  *  	       +the allocation fails, the program quits with an error message.
+  * 		The offset of the first differing byte, or n if there is none.
+  * 	       +Compares 32 bytes at a time with AVX2 if the CPU has it, 16
+  * 	       +at a time with SSE2 otherwise, and the tail a byte at a time.
   */
-#define TEST_CHECK_SPACE() 						       \
-									       \
-	if (this->case_count_total >= 	/* If count of test cases defined   */ \
-		this->case_capacity) {  /* Is at/above allocated capacity   */ \
-		this->case_capacity *=  /* Increase the capacity value 	    */ \
-			TEST_DEFAULT_RESIZE_FACTOR ; /* By default factor   */ \
-									       \
-		REALLOCATE_OR_DIE(	/* First reallocate test case space */ \
-			this->cases,        /* Located at this address 	    */ \
-			this->case_capacity /* Using out new capacity value */ \
-		) ;							       \
-									       \
-		REALLOCATE_OR_DIE(	/* Next reallocated case name space */ \
-			this->case_names,   /* Located at this address 	    */ \
-			this->case_capacity /* Using out new capacity value */ \
-		) ;							       \
-	} /* end if() */						       \
-									       \
-/* end #define TEST_CHECK_SPACE */
-		
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline size_t test_mem_mismatch_avx2(const unsigned char * a,
+					    const unsigned char * b, size_t n)
+{
+	size_t i = 0 ;
+	unsigned int equal ;
+
+	for (; i + 32 <= n; i += 32) {
+		equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(a + i)),
+			_mm256_loadu_si256((const __m256i *)(b + i)))) ;
+		if (equal != 0xffffffffU) return i + __builtin_ctz(~equal) ;
+	}
+	for (; i < n && a[i] == b[i]; ++i) ;
+
+	return i ;
+}
+
+__attribute__((target("sse2")))
+static inline size_t test_mem_mismatch_sse2(const unsigned char * a,
+					    const unsigned char * b, size_t n)
+{
+	size_t i = 0 ;
+	unsigned int equal ;
+
+	for (; i + 16 <= n; i += 16) {
+		equal = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + i)),
+			_mm_loadu_si128((const __m128i *)(b + i)))) ;
+		if (equal != 0xffffU) return i + __builtin_ctz(~equal) ;
+	}
+	for (; i < n && a[i] == b[i]; ++i) ;
+
+	return i ;
+}
+
+/* Nonzero if AVX2 kernels can be used. Test sets run as constructors,    */
+/* possibly before libgcc has looked at the CPU, hence the init		    */
+static inline int test_have_avx2(void)
+{
+	__builtin_cpu_init() ;
+
+	return __builtin_cpu_supports("avx2") ;
+}
+#endif /* if defined(__x86_64__) || defined(__i386__) */
+
+static inline size_t test_mem_mismatch(const void * a, const void * b,
+				       size_t n)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (test_have_avx2()) return test_mem_mismatch_avx2(a, b, n) ;
+	return test_mem_mismatch_sse2(a, b, n) ;
+#else
+	const unsigned char * x = a, * y = b ;
+	size_t i = 0 ;
+
+	for (; i < n && x[i] == y[i]; ++i) ;
+
+	return i ;
+#endif
+}
+
  /*
   * Identifier:
-  * 		TEST_CASE(name,...)
+  * 		test_ulps_float(x, y), test_ulps_double(x, y)
   *
   * Purpose:
-  *		Define a test case, the core unit of this system
+  * 		Count the representable values between two floats, which is
+  * 	       +the only tolerance that means the same thing at every
+  * 	       +magnitude.
   *
   * Inputs:
-  * 		   name : A descriptive name of the test case
+  * 		  x, y	: The values to compare
   *
-  *    __VA_ARGS_ / ...	: A sequence of zero or more valid executable
-  *    			 +statements
+  * Resolution:
+  * 		The distance in units in the last place. The bits are mapped
+  * 	       +to integers that order the same way the values do, with -0
+  * 	       +and +0 both at 0, and subtracted. NaNs get no special
+  * 	       +treatment: they sit just past the infinities, so a NaN is a
+  * 	       +few ulps from INF and its neighbouring NaNs, and a tolerance
+  * 	       +that large lets them match.
+  */
+static inline unsigned long long test_ulps_float(float x, float y)
+{
+	int32_t a, b ;
+
+	memcpy(&a, &x, sizeof(a)) ;
+	memcpy(&b, &y, sizeof(b)) ;
+	a = a < 0 ? INT32_MIN - a : a ;
+	b = b < 0 ? INT32_MIN - b : b ;
+
+	return a > b ? (int64_t)a - b : (int64_t)b - a ;
+}
+
+static inline unsigned long long test_ulps_double(double x, double y)
+{
+	int64_t a, b ;
+
+	memcpy(&a, &x, sizeof(a)) ;
+	memcpy(&b, &y, sizeof(b)) ;
+	a = a < 0 ? INT64_MIN - a : a ;
+	b = b < 0 ? INT64_MIN - b : b ;
+
+	return a > b ? (uint64_t)a - (uint64_t)b : (uint64_t)b - (uint64_t)a ;
+}
+
+ /*
+  * Identifier:
+  * 		test_floats_mismatch(a, b, n, ulps),
+  * 		test_doubles_mismatch(a, b, n, ulps)
+  *
+  * Purpose:
+  * 		Find the first element at which two arrays are more than ulps
+  * 	       +apart.
+  *
+  * Inputs:
+  * 		  a, b	: The arrays
+  *
+  * 		     n	: Their length in elements
+  *
+  * 		  ulps	: How far apart elements may be
   *
   * Resolution:
-  * 		A function named test_name is declared and defined and a pointer
-  * 	       +to the function is saved to the current test set.
+  * 		The index of the first element out of tolerance, or n. The
+  * 	       +vector loops map whole registers to ordered integers and
+  * 	       +check them against ulps at once. They only vouch for lanes
+  * 	       +with matching signs, where the subtraction can't overflow,
+  * 	       +and hand anything else to the exact scalar loop.
+  */
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static inline size_t test_floats_mismatch_avx2(const float * a,
+					       const float * b, size_t n,
+					       unsigned long long ulps)
+{
+	const __m256i limit = _mm256_set1_epi32(ulps < INT32_MAX ? ulps
+								 : INT32_MAX),
+		      low = _mm256_sub_epi32(_mm256_setzero_si256(), limit),
+		      lowest = _mm256_set1_epi32(INT32_MIN),
+		      none = _mm256_set1_epi32(-1) ;
+	size_t i = 0 ;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i)),
+			y = _mm256_loadu_si256((const __m256i *)(b + i)),
+			x_neg = _mm256_srai_epi32(x, 31),
+			y_neg = _mm256_srai_epi32(y, 31), diff, ok ;
+
+		/* Negative lanes become INT32_MIN - bits, like the scalar  */
+		x = _mm256_blendv_epi8(x, _mm256_sub_epi32(lowest, x), x_neg) ;
+		y = _mm256_blendv_epi8(y, _mm256_sub_epi32(lowest, y), y_neg) ;
+		diff = _mm256_sub_epi32(x, y) ;
+
+		ok = _mm256_and_si256(
+			_mm256_cmpgt_epi32(_mm256_xor_si256(x, y), none),
+			_mm256_andnot_si256(
+				_mm256_or_si256(_mm256_cmpgt_epi32(diff, limit),
+						_mm256_cmpgt_epi32(low, diff)),
+				none)) ;
+		if ((unsigned int)_mm256_movemask_epi8(ok) != 0xffffffffU) break ;
+	}
+	for (; i < n && test_ulps_float(a[i], b[i]) <= ulps; ++i) ;
+
+	return i ;
+}
+
+__attribute__((target("avx2")))
+static inline size_t test_doubles_mismatch_avx2(const double * a,
+						const double * b, size_t n,
+						unsigned long long ulps)
+{
+	const __m256i limit = _mm256_set1_epi64x(ulps < INT64_MAX ? ulps
+								  : INT64_MAX),
+		      low = _mm256_sub_epi64(_mm256_setzero_si256(), limit),
+		      lowest = _mm256_set1_epi64x(INT64_MIN),
+		      zero = _mm256_setzero_si256(),
+		      none = _mm256_set1_epi64x(-1) ;
+	size_t i = 0 ;
+
+	for (; i + 4 <= n; i += 4) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i)),
+			y = _mm256_loadu_si256((const __m256i *)(b + i)),
+			x_neg = _mm256_cmpgt_epi64(zero, x),
+			y_neg = _mm256_cmpgt_epi64(zero, y), diff, ok ;
+
+		x = _mm256_blendv_epi8(x, _mm256_sub_epi64(lowest, x), x_neg) ;
+		y = _mm256_blendv_epi8(y, _mm256_sub_epi64(lowest, y), y_neg) ;
+		diff = _mm256_sub_epi64(x, y) ;
+
+		ok = _mm256_and_si256(
+			_mm256_cmpgt_epi64(_mm256_xor_si256(x, y), none),
+			_mm256_andnot_si256(
+				_mm256_or_si256(_mm256_cmpgt_epi64(diff, limit),
+						_mm256_cmpgt_epi64(low, diff)),
+				none)) ;
+		if ((unsigned int)_mm256_movemask_epi8(ok) != 0xffffffffU) break ;
+	}
+	for (; i < n && test_ulps_double(a[i], b[i]) <= ulps; ++i) ;
+
+	return i ;
+}
+
+__attribute__((target("sse2")))
+static inline size_t test_floats_mismatch_sse2(const float * a,
+					       const float * b, size_t n,
+					       unsigned long long ulps)
+{
+	const __m128i limit = _mm_set1_epi32(ulps < INT32_MAX ? ulps
+							      : INT32_MAX),
+		      low = _mm_sub_epi32(_mm_setzero_si128(), limit),
+		      lowest = _mm_set1_epi32(INT32_MIN),
+		      none = _mm_set1_epi32(-1) ;
+	size_t i = 0 ;
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i)),
+			y = _mm_loadu_si128((const __m128i *)(b + i)),
+			x_neg = _mm_srai_epi32(x, 31),
+			y_neg = _mm_srai_epi32(y, 31), diff, ok ;
+
+		/* No blendv in SSE2, so select with and/andnot		    */
+		x = _mm_or_si128(_mm_andnot_si128(x_neg, x), _mm_and_si128(
+			x_neg, _mm_sub_epi32(lowest, x))) ;
+		y = _mm_or_si128(_mm_andnot_si128(y_neg, y), _mm_and_si128(
+			y_neg, _mm_sub_epi32(lowest, y))) ;
+		diff = _mm_sub_epi32(x, y) ;
+
+		ok = _mm_and_si128(
+			_mm_cmpgt_epi32(_mm_xor_si128(x, y), none),
+			_mm_andnot_si128(
+				_mm_or_si128(_mm_cmpgt_epi32(diff, limit),
+					     _mm_cmpgt_epi32(low, diff)),
+				none)) ;
+		if (_mm_movemask_epi8(ok) != 0xffff) break ;
+	}
+	for (; i < n && test_ulps_float(a[i], b[i]) <= ulps; ++i) ;
+
+	return i ;
+}
+#endif /* if defined(__x86_64__) || defined(__i386__) */
+
+static inline size_t test_floats_mismatch(const float * a, const float * b,
+					  size_t n, unsigned long long ulps)
+{
+	size_t i = 0 ;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (test_have_avx2()) return test_floats_mismatch_avx2(a, b, n, ulps) ;
+	return test_floats_mismatch_sse2(a, b, n, ulps) ;
+#endif
+	for (; i < n && test_ulps_float(a[i], b[i]) <= ulps; ++i) ;
+
+	return i ;
+}
+
+static inline size_t test_doubles_mismatch(const double * a, const double * b,
+					   size_t n, unsigned long long ulps)
+{
+	size_t i = 0 ;
+
+	/* SSE2 can't compare 64 bit lanes, so it's AVX2 or nothing	    */
+#if defined(__x86_64__) || defined(__i386__)
+	if (test_have_avx2()) return test_doubles_mismatch_avx2(a, b, n, ulps) ;
+#endif
+	for (; i < n && test_ulps_double(a[i], b[i]) <= ulps; ++i) ;
+
+	return i ;
+}
+
+ /*
+  * Identifier:
+  * 		test_why_mem(what, a, b, n, at), test_why_floats(...),
+  * 		test_why_doubles(...), test_why_str(what, a, b, at)
+  *
+  * Purpose:
+  * 		Explain a failed bulk assertion: where the first difference
+  * 	       +is, and what's around it.
+  *
+  * Inputs:
+  * 		  what	: The assertion's arguments as written
+  *
+  * 		  a, b	: What was compared
+  *
+  * 		     n	: How much was compared
+  *
+  * 		    at	: Where the first difference is
+  *
+  * 		  ulps	: The tolerance, for the float versions
+  *
+  * Resolution:
+  * 		A message in test_why, ready to hand to TEST_CASE_FAIL. The
+  * 	       +window shows up to TEST_DIFF_WINDOW bytes or chars, or
+  * 	       +TEST_DIFF_ELEMENTS elements, either side of the difference.
+  * 	       +Mismatched bytes are in [brackets], elements marked with '>'.
   *
   * Requirements:
-  *  	        A test case must be defined directly within the scope of a test
-  *  	       +set.
+  * 		Only called once an assertion has failed.
   */
-#define TEST_CASE(name,...)						       \
-									       \
-	TEST_CHECK_SPACE() ;	/* Guarentee sufficent space for new tests  */ \
-	this->cases[this->case_count_total++] = /* Add a new test case	    */ \
-		LAMBDA(int,(size_t case_id) 	/* Defined using our lambda */ \
-		{							       \
-			char case_name[] =	/* Generate our case_name   */ \
-				TO_STRING(test_##name) ; /* Using the cpp   */ \
-									       \
-			this->case_names[case_id] = NULL ;		       \
-			REALLOCATE_OR_DIE(      /* Guarentee reallocation   */ \
-				this->case_names[case_id], /* For case_name */ \
-				sizeof(case_name)  	   /* Of this size  */ \
-			) ;						       \
-									       \
-			 /* Safe strcpy(): buffer space and 		    */ \
-			 /* \0-termination guarenteed above  		    */ \
-			strcpy( 					       \
-				this->case_names[case_id], /* alloc'd above */ \
-				case_name 		   /* cpp generated */ \
-			) ;						       \
-									       \
-			__VA_ARGS__ 	 /* Test case body: assertions, etc */ \
-									       \
-			TEST_CASE_PASS() ; /* If this runs, the test passes */ \
-		});							       \
-									       \
-/* end #define TEST_CASE 				                    */
+/* Append to test_why after len chars. Returns the new length, which	    */
+/* stops at the last char test_why holds however much didn't fit	    */
+__attribute__((format(printf, 2, 3)))
+static inline int test_why_printf(int len, const char * format, ...)
+{
+	va_list args ;
+	int n ;
 
-/* SECTION: TEST SET GENERATION */
+	if (len >= TEST_WHY_SIZE - 1) return TEST_WHY_SIZE - 1 ;
+
+	va_start(args, format) ;
+	n = vsnprintf(test_why + len, sizeof(test_why) - len, format, args) ;
+	va_end(args) ;
+
+	if (n < 0) return len ;
+
+	return n < TEST_WHY_SIZE - 1 - len ? len + n : TEST_WHY_SIZE - 1 ;
+}
+
+/* Hex of x and y around at, named x_name and y_name, after len chars    */
+static inline int test_why_window(int len, const unsigned char * x,
+				  const unsigned char * y, size_t n, size_t at,
+				  const char * x_name, const char * y_name)
+{
+	size_t from = at > TEST_DIFF_WINDOW ? at - TEST_DIFF_WINDOW : 0,
+	       to = n - at > TEST_DIFF_WINDOW ? at + TEST_DIFF_WINDOW + 1 : n ;
+
+	len = test_why_printf(len, "\n\t  @%zu %s:", from, x_name) ;
+	for (size_t i = from; i < to && len < TEST_WHY_SIZE - 1; ++i)
+		len = test_why_printf(len, x[i] == y[i] ? " %02x" : " [%02x]",
+				      x[i]) ;
+	len = test_why_printf(len, "\n\t  @%zu %s:", from, y_name) ;
+	for (size_t i = from; i < to && len < TEST_WHY_SIZE - 1; ++i)
+		len = test_why_printf(len, x[i] == y[i] ? " %02x" : " [%02x]",
+				      y[i]) ;
+
+	return len ;
+}
+
+static inline void test_why_mem(const char * what, const void * a,
+				const void * b, size_t n, size_t at)
+{
+	int len ;
+
+	len = test_why_printf(0, "MEM_EQ(%s): first difference at byte %zu "
+			      "of %zu", what, at, n) ;
+	test_why_window(len, a, b, n, at, "a", "b") ;
+}
+
+static inline void test_why_floats(const char * what, const float * a,
+				   const float * b, size_t n, size_t at,
+				   unsigned long long ulps)
+{
+	size_t from = at > TEST_DIFF_ELEMENTS ? at - TEST_DIFF_ELEMENTS : 0,
+	       to = n - at > TEST_DIFF_ELEMENTS ? at + TEST_DIFF_ELEMENTS + 1
+						: n ;
+	int len ;
+
+	len = test_why_printf(0, "ARRAY_NEAR(%s): element %zu of %zu is %llu "
+			      "ulps off, %llu allowed", what, at, n,
+			      test_ulps_float(a[at], b[at]), ulps) ;
+	for (size_t i = from; i < to && len < TEST_WHY_SIZE - 1; ++i)
+		len = test_why_printf(len, "\n\t  %c[%zu] a: %.9g b: %.9g",
+				      test_ulps_float(a[i], b[i]) > ulps
+				      ? '>' : ' ', i, a[i], b[i]) ;
+}
+
+static inline void test_why_doubles(const char * what, const double * a,
+				    const double * b, size_t n, size_t at,
+				    unsigned long long ulps)
+{
+	size_t from = at > TEST_DIFF_ELEMENTS ? at - TEST_DIFF_ELEMENTS : 0,
+	       to = n - at > TEST_DIFF_ELEMENTS ? at + TEST_DIFF_ELEMENTS + 1
+						: n ;
+	int len ;
+
+	len = test_why_printf(0, "ARRAY_NEAR(%s): element %zu of %zu is %llu "
+			      "ulps off, %llu allowed", what, at, n,
+			      test_ulps_double(a[at], b[at]), ulps) ;
+	for (size_t i = from; i < to && len < TEST_WHY_SIZE - 1; ++i)
+		len = test_why_printf(len, "\n\t  %c[%zu] a: %.17g b: %.17g",
+				      test_ulps_double(a[i], b[i]) > ulps
+				      ? '>' : ' ', i, a[i], b[i]) ;
+}
+
+/* Quote up to TEST_DIFF_WINDOW chars either side of at, escaped	    */
+static inline int test_why_quote(int len, const char * s, size_t at)
+{
+	size_t from = at > TEST_DIFF_WINDOW ? at - TEST_DIFF_WINDOW : 0 ;
+
+	len = test_why_printf(len, "%s\"", from ? "..." : "") ;
+	for (size_t i = from;
+	     i <= at + TEST_DIFF_WINDOW && len < TEST_WHY_SIZE - 1; ++i) {
+		unsigned char c = s[i] ;
+
+		if (i == at) len = test_why_printf(len, "[") ;
+		if (!c) return test_why_printf(len, i == at ? "]\"" : "\"") ;
+		len = test_why_printf(len, c == '"' || c == '\\' ? "\\%c"
+				      : c >= ' ' && c < 0x7f ? "%c" : "\\x%02x",
+				      c) ;
+		if (i == at) len = test_why_printf(len, "]") ;
+	}
+
+	return test_why_printf(len, "...\"") ;
+}
+
+static inline void test_why_str(const char * what, const char * a,
+				const char * b, size_t at)
+{
+	int len ;
+
+	len = test_why_printf(0, "STR_EQ(%s): first difference at char %zu"
+			      "\n\t  a: ", what, at) ;
+	len = test_why_quote(len, a, at) ;
+	len = test_why_printf(len, "\n\t  b: ") ;
+	test_why_quote(len, b, at) ;
+}
 
  /*
   * Identifier:
-  * 		TEST_SET_CONSTRUCTOR(name)
+  * 		ASSERT_MEM_EQ(a, b, n)
   *
   * Purpose:
-  * 		Allocate memory to support a set of test cases
+  * 		Fail a test case unless two buffers hold the same bytes
   *
   * Inputs:
-  * 	           name : A descriptive name for the test set
+  * 		  a, b	: Pointers to the buffers
+  *
+  * 		     n	: Bytes to compare
   *
   * Resolution:
-  * 		A test_set_data_t is allocated and it's fields are assigned
-  * 	       +sensible defualt values. Some of these fields are themselves
-  * 	       +dynamically allocated. Any allocation failure is fatal to
-  * 	       +the entire program and is also kind of sad.
+  * 		The buffers are compared with test_mem_mismatch(). If they
+  * 	       +differ, the test fails with the offset of the first
+  * 	       +difference and a hex window around it. Each argument is
+  * 	       +evaluated once.
   *
   * Requirements:
-  * 		Usage of this macro only really makes sense in the context
-  * 	       +the definition of the TEST_SET macro, but I suppose there
-  * 	       +isn't any reason why one could not use this anywhere they
-  * 	       +would like to, provided that no identifiers are redeclared.
+  * 		Must be run within the scope of a test case
   */
-#define TEST_SET_CONSTRUCTOR(name)					       \
+#define ASSERT_MEM_EQ(a,b,n)						       \
 									       \
-	/* ALLOCATION OF TEST SET DATA STRUCTURE */			       \
-	test_set_data_t * this = NULL ; /* Initialize pointer to set data   */ \
-	REALLOCATE_OR_DIE(this,1) ;	/* Allocate space for data or die   */ \
-									       \
-	/* ASIGNMENT OF SENSIBLE DEFAULT VALUES				    */ \
-	*this = (const test_set_data_t) /* Cast & assign to allocated space */ \
-	{				/* begin compound literal           */ \
-		NULL,			/* void (*cases)(size_t case_id)    */ \
-		NULL,			/* char ** case_names		    */ \
-		NULL,			/* char  * set_name		    */ \
-		0,			/* size_t case_count_capacity       */ \
-		0,			/* size_t case_count_total          */ \
-		0,			/* size_t case_count passed         */ \
-		sizeof(TO_STRING(name)) /* size_t set_name_length           */ \
-	} ;				/* end compound literal             */ \
-	/* From this point onward, this data is accessed via the this ptr   */ \
-									       \
-	/* DYNAMIC ALLOCATION OF TEST CASE SPACE */	       		       \
-	this->case_capacity = 		/* Initally the capacity should be  */ \
-		TEST_DEFAULT_CASE_BUFFSIZE ; /*+the default value           */ \
-									       \
-	REALLOCATE_OR_DIE(		/* Allocation failure is fatal here */ \
-		this->cases,		/* Allocate memory for this ptr     */ \
-		this->case_capacity ) ; /* To hold this many of it's type   */ \
-									       \
-	REALLOCATE_OR_DIE(		/* Same as previous 		    */ \
-		this->case_names,       /* But for test name strings        */ \
-		this->case_capacity ) ; /* Which should have same capacity  */ \
-									       \
-	memset(  /* Powerwash our array of (char*)s to clear garbage values */ \
-		this->case_names,       /* Located at this address          */ \
-		0,			/* (int)0 == NULL essentially       */ \
-		this->case_capacity     /* Hold this many nothings          */ \
-	) ; /* Note: without this call to memset(), realloc() makes a       */ \
-	    /* a conditional jump that depends on an uninitialized value    */ \
-									       \
-	/* DYNAMIC ALLOCATION OF TEST SET NAME			            */ \
-	REALLOCATE_OR_DIE(		/* Last but not least...	    */ \
-		this->set_name,         /* Space for the set name string    */ \
-		this->set_name_size ) ; /* Size in bytes determined above   */ \
-									       \
-	strcpy(  /* Safe: buffer space and \0-termination guarenteed above  */ \
-		this->set_name, 	/* dest: the newly allocated buffer */ \
-		TO_STRING(name) ) ;     /* src : const char[] from cpp      */ \
+	{								       \
+		const void * test_a = (a), * test_b = (b) ;		       \
+		size_t test_n = (n),					       \
+		       test_at = test_mem_mismatch(test_a, test_b, test_n) ;   \
+		if (test_at < test_n) {	/* Only now do we format anything   */ \
+			test_why_mem(TO_STRING(a) ", " TO_STRING(b) ", "       \
+				     TO_STRING(n), test_a, test_b, test_n,     \
+				     test_at) ;				       \
+			TEST_CASE_FAIL(test_why) ;			       \
+		}							       \
+	}								       \
 									       \
-/* end #define TEST_SET_CONSTRUCTOR 				            */
+/* end #define ASSERT_MEM_EQ						    */
 
  /*
   * Identifier:
-  * 		TEST_SET_EXECUTOR()
+  * 		ASSERT_ARRAY_NEAR(a, b, n, ulps)
   *
   * Purpose:
-  *		Execute all test cases defined in a test set.
+  * 		Fail a test case unless two float or double arrays agree to
+  * 	       +within ulps units in the last place, element by element
+  *
+  * Inputs:
+  * 		  a, b	: Pointers to float or pointers to double, not mixed
+  *
+  * 		     n	: Elements to compare
+  *
+  * 		  ulps	: How many representable values apart elements may be,
+  * 		  	 +0 for bit for bit equality (give or take the sign
+  * 		  	 +of 0)
   *
   * Resolution:
-  * 		All defined test cases in the cases function pointer array
-  * 	       +are executed and the pass/total ratio is reported.
+  * 		The element type picks test_floats_mismatch() or
+  * 	       +test_doubles_mismatch(). If an element is out of tolerance,
+  * 	       +the test fails with its index and the values around it, the
+  * 	       +offenders marked with '>'. Each argument is evaluated once.
   *
   * Requirements:
-  *  		TEST_SET_CONSTRUCTOR must be called earlier in scope.
+  * 		Must be run within the scope of a test case
   */
-#define TEST_SET_EXECUTOR()						       \
-									       \
-	/* EXECUTION */							       \
-	for (size_t i = 0;				/* Iterate through  */ \
-		i < this->case_count_total; ++i) {      /* All test cases   */ \
-		this->case_count_passed += 		/* Count passes     */ \
-			this->cases[i](i) ;	/* By executing test cases  */ \
-	}		/* A test case return 1 for pass and 0 for failure  */ \
+#define ASSERT_ARRAY_NEAR(a,b,n,ulps)					       \
 									       \
-	/* REPORT */							       \
-	fprintf(stdout,	/* When all test cases in the set have been run,    */ \
-		"\nFINISHED TEST_SET: %s\n"   /* Report which set was run,  */ \
-		"\tPassed %lu/%lu test cases.\n\n", /* and the pass ratio   */ \
-			this->set_name,				               \
-			this->case_count_passed,			       \
-			this->case_count_total ) ;  			       \
+	{								       \
+		typeof(&*(a)) test_a = (a) ;				       \
+		typeof(&*(a)) test_b = (b) ;				       \
+		size_t test_n = (n) ;					       \
+		unsigned long long test_ulps = (ulps) ;			       \
+		size_t test_at = _Generic(*test_a,			       \
+			float: test_floats_mismatch,			       \
+			double: test_doubles_mismatch)			       \
+			(test_a, test_b, test_n, test_ulps) ;		       \
+		if (test_at < test_n) {	/* Only now do we format anything   */ \
+			_Generic(*test_a,				       \
+				float: test_why_floats,			       \
+				double: test_why_doubles)		       \
+				(TO_STRING(a) ", " TO_STRING(b) ", "	       \
+				 TO_STRING(n) ", " TO_STRING(ulps),	       \
+				 test_a, test_b, test_n, test_at, test_ulps) ; \
+			TEST_CASE_FAIL(test_why) ;			       \
+		}							       \
+	}								       \
 									       \
-/* end #define TEST_SET_EXECUTOR 				            */
+/* end #define ASSERT_ARRAY_NEAR					    */
 
  /*
   * Identifier:
-  * 		TEST_SET_DESTRUCTOR()
+  * 		ASSERT_STR_EQ(a, b)
   *
   * Purpose:
-  *		Free any dynamically allocated memory associated with a test
-  *	       +set.
+  * 		Fail a test case unless two strings are equal
+  *
+  * Inputs:
+  * 		  a, b	: \0-terminated strings
   *
   * Resolution:
-  * 		All dynamically allocated fields in the test_set_data_t at
-  * 	       +address "this" are freed, as well as the test_set_data_t
-  * 	       +itself.
+  * 		The strings are measured with strlen() and compared with
+  * 	       +test_mem_mismatch(), terminator included. If they differ,
+  * 	       +the test fails with the index of the first difference and
+  * 	       +both strings around it, escaped. Each argument is evaluated
+  * 	       +once.
   *
   * Requirements:
-  *  		TEST_SET_CONSTRUCTOR was called earlier in scope, and
-  *  		TEST SET_DESTRUCTOR has not already been called since that
-  *  	       +point. Like the constructor, it doesn't really make sense
-  *  	       +to use this outside of the TEST_SET macro definition. Because
-  *  	       +of that, I don't bother to check if any of these fields are
-  *  	       +NULL, because the program will terminate on failed allocation
-  *  	       +when used as intended. But hey, it's open source, do what you
-  *  	       +want.
+  * 		Must be run within the scope of a test case
   */
-#define TEST_SET_DESTRUCTOR() 						       \
+#define ASSERT_STR_EQ(a,b)						       \
 									       \
-	free(this->cases) ;			 /* Free function ptr array */ \
-	for(size_t i = 0;			 /* Iterate through the     */ \
-		i < this->case_count_total; ++i) /* Array of (char *)s      */ \
-		{ free(this->case_names[i]) ; }  /* And free all of them    */ \
-	free(this->case_names) ;		 /* Then free the (char**)  */ \
-	free(this->set_name) ;			 /* Free the last (char*)   */ \
-	free(this) ; 				 /* Lastly, free yourself   */ \
-						 /* I'M FREE AT LAST	    */ \
-/* end #define TEST_SET_DESTRUCTOR					    */
+	{								       \
+		const char * test_a = (a), * test_b = (b) ;		       \
+		size_t test_n = strlen(test_a), test_m = strlen(test_b),       \
+		       test_at = test_mem_mismatch(test_a, test_b,	       \
+				(test_n < test_m ? test_n : test_m) + 1) ;     \
+		if (test_at <= test_n && test_at <= test_m) {		       \
+			test_why_str(TO_STRING(a) ", " TO_STRING(b),	       \
+				     test_a, test_b, test_at) ;		       \
+			TEST_CASE_FAIL(test_why) ;			       \
+		}							       \
+	}								       \
+									       \
+/* end #define ASSERT_STR_EQ						    */
+
+/* SECTION: GOLDEN FILES */
+
+/* Bytes hashed per stripe, and stripes per block between scrambles	    */
+#define TEST_HASH_STRIPE 64
+#define TEST_HASH_BLOCK (TEST_HASH_STRIPE * 16)
+
+#define TEST_HASH_PRIME32_1 0x9E3779B1U
+#define TEST_HASH_PRIME32_2 0x85EBCA77U
+#define TEST_HASH_PRIME32_3 0xC2B2AE3DU
+#define TEST_HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define TEST_HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define TEST_HASH_PRIME64_3 0x165667B19E3779F9ULL
+#define TEST_HASH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define TEST_HASH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+/* Mixed into each lane of a stripe, borrowed from XXH3's default secret  */
+static const uint64_t test_hash_secret[8] = {
+	0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL,
+	0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+	0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL,
+	0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+} ;
+
+/* Sidecar next to each golden file, caching its hash			    */
+#define TEST_GOLDEN_HASH_SUFFIX ".hash"
+
+/* First word of a sidecar, so a stray file isn't taken for one	    */
+#define TEST_GOLDEN_HASH_MAGIC "lil_test-golden-2"
 
  /*
   * Identifier:
-  * 		TEST_SET(name,...)
+  * 		test_hash64(data, n)
   *
   * Purpose:
-  * 		Define a test set to be executed before main()
+  * 		Hash a buffer about as fast as it can be read, so a golden
+  * 	       +file only needs comparing byte for byte when it has changed.
   *
   * Inputs:
-  * 		   name : A descriptive name of the test set
+  * 		   data	: The buffer
   *
-  *    __VA_ARGS_ / ...	: A sequence of zero or more valid executable
-  *    			 +statements, including zero or more test case
-  *    			 +definitions
+  * 		      n	: Its length in bytes
   *
   * Resolution:
-  * 		A function is declared with the constructor attribute so that
-  *	       +it will run before main(). The function is then imediately
-  *	       +defined with a function body that constructs the required data
-  *	       +for a test set, executes an arbitary number of statements,
-  *	       +optionally including test case definitions, executes any
-  *	       +defined test cases, and frees all allocated memory.
+  * 		A 64 bit hash, built the way XXH3 builds its long hash but not
+  * 	       +compatible with it. Eight 64 bit lanes each take a multiply of
+  * 	       +their data's halves, after mixing in the secret, and their
+  * 	       +neighbour's raw data; every block, the lanes are scrambled.
+  * 	       +The lanes are then folded together with XXH64's rounds.
+  * 	       +Whole blocks go through AVX2 if the CPU has it, which gives
+  * 	       +the same hash as the scalar code. Lanes are read little
+  * 	       +endian on little endian machines only, so sidecars don't
+  * 	       +travel between byte orders.
+  */
+static inline void test_hash_stripe(uint64_t * acc, const unsigned char * p)
+{
+	uint64_t data, key ;
+
+	for (int i = 0; i < 8; ++i) {
+		memcpy(&data, p + 8 * i, sizeof(data)) ;
+		key = data ^ test_hash_secret[i] ;
+		acc[i ^ 1] += data ;
+		acc[i] += (key & 0xffffffffU) * (key >> 32) ;
+	}
+}
+
+static inline void test_hash_scramble(uint64_t * acc)
+{
+	for (int i = 0; i < 8; ++i) {
+		acc[i] ^= acc[i] >> 47 ;
+		acc[i] ^= test_hash_secret[i] ;
+		acc[i] *= TEST_HASH_PRIME32_1 ;
+	}
+}
+
+static inline void test_hash_blocks(uint64_t * acc, const unsigned char * p,
+				    size_t blocks)
+{
+	for (; blocks--; p += TEST_HASH_BLOCK) {
+		for (size_t s = 0; s < TEST_HASH_BLOCK; s += TEST_HASH_STRIPE)
+			test_hash_stripe(acc, p + s) ;
+		test_hash_scramble(acc) ;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static inline void test_hash_blocks_avx2(uint64_t * acc,
+					 const unsigned char * p,
+					 size_t blocks)
+{
+	__m256i lanes[2], keys[2], data, key ;
+	const __m256i prime = _mm256_set1_epi32(TEST_HASH_PRIME32_1) ;
+
+	for (int h = 0; h < 2; ++h) {
+		lanes[h] = _mm256_loadu_si256((const __m256i *)(acc + 4 * h)) ;
+		keys[h] = _mm256_loadu_si256(
+			(const __m256i *)(test_hash_secret + 4 * h)) ;
+	}
+
+	for (; blocks--; p += TEST_HASH_BLOCK) {
+		for (size_t s = 0; s < TEST_HASH_BLOCK; s += TEST_HASH_STRIPE) {
+			for (int h = 0; h < 2; ++h) {
+				data = _mm256_loadu_si256(
+					(const __m256i *)(p + s + 32 * h)) ;
+				key = _mm256_xor_si256(data, keys[h]) ;
+				/* Neighbouring lanes trade data	    */
+				lanes[h] = _mm256_add_epi64(lanes[h],
+					_mm256_shuffle_epi32(data,
+						_MM_SHUFFLE(1, 0, 3, 2))) ;
+				lanes[h] = _mm256_add_epi64(lanes[h],
+					_mm256_mul_epu32(key,
+						_mm256_srli_epi64(key, 32))) ;
+			}
+		}
+		for (int h = 0; h < 2; ++h) {
+			lanes[h] = _mm256_xor_si256(lanes[h],
+				_mm256_srli_epi64(lanes[h], 47)) ;
+			lanes[h] = _mm256_xor_si256(lanes[h], keys[h]) ;
+			/* 64 bit by 32 bit multiply, a half at a time	    */
+			lanes[h] = _mm256_add_epi64(
+				_mm256_mul_epu32(lanes[h], prime),
+				_mm256_slli_epi64(_mm256_mul_epu32(
+					_mm256_srli_epi64(lanes[h], 32),
+					prime), 32)) ;
+		}
+	}
+
+	for (int h = 0; h < 2; ++h)
+		_mm256_storeu_si256((__m256i *)(acc + 4 * h), lanes[h]) ;
+}
+#endif /* if defined(__x86_64__) || defined(__i386__) */
+
+static inline uint64_t test_hash_round(uint64_t lane)
+{
+	lane *= TEST_HASH_PRIME64_2 ;
+	lane = lane << 31 | lane >> 33 ;
+
+	return lane * TEST_HASH_PRIME64_1 ;
+}
+
+static inline uint64_t test_hash64(const void * data, size_t n)
+{
+	uint64_t acc[8] = {
+		TEST_HASH_PRIME32_3, TEST_HASH_PRIME64_1, TEST_HASH_PRIME64_2,
+		TEST_HASH_PRIME64_3, TEST_HASH_PRIME64_4, TEST_HASH_PRIME32_2,
+		TEST_HASH_PRIME64_5, TEST_HASH_PRIME32_1,
+	} ;
+	const unsigned char * p = data ;
+	unsigned char last[TEST_HASH_STRIPE] = { 0 } ;
+	size_t blocks = n / TEST_HASH_BLOCK, left = n % TEST_HASH_BLOCK ;
+	uint64_t h = n * TEST_HASH_PRIME64_1 ;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (test_have_avx2()) test_hash_blocks_avx2(acc, p, blocks) ;
+	else
+#endif
+	test_hash_blocks(acc, p, blocks) ;
+	p += blocks * TEST_HASH_BLOCK ;
+
+	for (; left >= TEST_HASH_STRIPE; p += TEST_HASH_STRIPE,
+					 left -= TEST_HASH_STRIPE)
+		test_hash_stripe(acc, p) ;
+
+	/* The tail, zero padded. n went into h, so "a" isn't "a\0"	    */
+	memcpy(last, p, left) ;
+	test_hash_stripe(acc, last) ;
+
+	for (int i = 0; i < 8; ++i) {
+		h ^= test_hash_round(acc[i]) ;
+		h = (h << 27 | h >> 37) * TEST_HASH_PRIME64_1
+		    + TEST_HASH_PRIME64_4 ;
+	}
+
+	/* Avalanche						    */
+	h ^= h >> 33 ;
+	h *= TEST_HASH_PRIME64_2 ;
+	h ^= h >> 29 ;
+	h *= TEST_HASH_PRIME64_3 ;
+	h ^= h >> 32 ;
+
+	return h ;
+}
+
+ /*
+  * Identifier:
+  * 		test_golden_write(path, buf, len)
   *
-  * Requirements:
-  *  		The inclusion of this header file.
+  * Purpose:
+  * 		Replace a file without anyone ever seeing half of it, even if
+  * 	       +the test program dies midway.
+  *
+  * Inputs:
+  * 		   path	: The file to replace
+  *
+  * 		    buf	: Its new contents
+  *
+  * 		    len	: How many bytes of them
+  *
+  * Resolution:
+  * 		buf is written to path.tmp.PID in the same directory, synced
+  * 	       +and renamed over path. Returns 0 on success. On failure the
+  * 	       +temporary file is removed, path is untouched, -1 is returned
+  * 	       +and errno says why.
   */
-#define TEST_SET(name,...)\
-									       \
-	void test_set_##name (void) 	       /* Declare a function to be  */ \
-		__attribute__((constructor)) ; /* autoexec'd before main()  */ \
-									       \
-	void test_set_##name (void) {          /* And immediately define it */ \
-		TEST_SET_CONSTRUCTOR(name) ;         /* Phase: Construction */ \
-		__VA_ARGS__ ;                        /* Phase: Definition   */ \
-		TEST_SET_EXECUTOR() ;                /* Phase: Execution    */ \
-		TEST_SET_DESTRUCTOR() ; }	     /* Phase: Destruction  */ \
-									       \
-/* end #define TEST_SET							    */
+static inline int test_golden_write(const char * path, const void * buf,
+				    size_t len)
+{
+	char tmp[4096] ;
+	const char * p = buf ;
+	ssize_t n ;
+	int fd, saved ;
 
-/* This is the decleration of the data format used to support a test set    */
-typedef struct test_set_data {
-	/* Test cases in the set. Takes case_id as a parameter in order to  */
-	/* to index the case_names array via a ptr to this struct           */
-	int (** cases)(size_t case_id) ;
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp.%d", path, getpid())
+	    >= sizeof(tmp)) {
+		errno = ENAMETOOLONG ;
+		return -1 ;
+	}
 
-	/* Name strings for each test case 				    */
-	char ** case_names,
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return -1 ;
 
-	/* The name of this test set 				            */
-	      * set_name ;
+	for (; len; p += n, len -= n) {
+		if ((n = write(fd, p, len)) < 0) {
+			if (errno == EINTR) { n = 0 ; continue ; }
+			break ;
+		}
+	}
 
-	/* The capacity of the space allocated for case func ptrs           */
-	size_t  case_capacity,
+	if (len || fsync(fd)) {
+		saved = errno ;
+		close(fd) ;
+		unlink(tmp) ;
+		errno = saved ;
+		return -1 ;
+	}
 
-	/* The number of defined test cases reachable via the array 	    */
-		case_count_total,
+	if (close(fd) || rename(tmp, path)) {
+		saved = errno ;
+		unlink(tmp) ;
+		errno = saved ;
+		return -1 ;
+	}
 
-	/* The number of passed test cases determined via execution 	    */
-		case_count_passed,
+	return 0 ;
+}
 
-	/* The number of bytes in the set_name string, including \0  	    */
-		set_name_size ;
-} test_set_data_t ;
+ /*
+  * Identifier:
+  * 		test_golden_known_hash(path, st, hash)
+  * 		test_golden_remember_hash(path, hash)
+  *
+  * Purpose:
+  * 		Keep the hash of each golden file in a sidecar next to it,
+  * 	       +path.hash, so that checking against an unchanged golden file
+  * 	       +only has to read the buffer under test and never the file.
+  *
+  * Inputs:
+  * 		   path	: The golden file
+  *
+  * 		     st	: What stat() says about it right now
+  *
+  * 		   hash	: Where to put, or what to save as, its hash
+  *
+  * Resolution:
+  * 		The sidecar records the golden file's size, inode, mtime and
+  * 	       +ctime next to its hash, and only counts while those still
+  * 	       +match. Timestamps only tick so often, so like git's index a
+  * 	       +sidecar is also ignored unless the golden file's mtime is
+  * 	       +strictly older than the sidecar's own: a rewrite in the same
+  * 	       +tick could otherwise leave every field looking the same. It
+  * 	       +is a cache: a missing or stale one just means a byte for
+  * 	       +byte compare, after which it is refreshed. Since git
+  * 	       +checkouts reset mtimes, sidecars are best left out of
+  * 	       +version control. test_golden_known_hash() returns 0 if hash
+  * 	       +was found, and failing to save one is ignored.
+  */
+static inline int test_golden_known_hash(const char * path,
+					 const struct stat * st,
+					 uint64_t * hash)
+{
+	char sidecar[4096] ;
+	FILE * stream ;
+	struct stat written ;
+	unsigned long long known, size, ino ;
+	long long sec, csec ;
+	long nsec, cnsec ;
+	int found ;
+
+	if ((size_t)snprintf(sidecar, sizeof(sidecar), "%s%s", path,
+			     TEST_GOLDEN_HASH_SUFFIX) >= sizeof(sidecar)
+	    || !(stream = fopen(sidecar, "r")))
+		return 1 ;
+
+	found = fscanf(stream, TEST_GOLDEN_HASH_MAGIC
+		       " %llx %llu %llu %lld.%ld %lld.%ld",
+		       &known, &size, &ino, &sec, &nsec, &csec, &cnsec) == 7
+		&& size == (unsigned long long)st->st_size
+		&& ino == (unsigned long long)st->st_ino
+		&& sec == (long long)st->st_mtim.tv_sec
+		&& nsec == st->st_mtim.tv_nsec
+		&& csec == (long long)st->st_ctim.tv_sec
+		&& cnsec == st->st_ctim.tv_nsec
+		&& !fstat(fileno(stream), &written)
+		&& (st->st_mtim.tv_sec < written.st_mtim.tv_sec
+		    || (st->st_mtim.tv_sec == written.st_mtim.tv_sec
+			&& st->st_mtim.tv_nsec < written.st_mtim.tv_nsec)) ;
+	fclose(stream) ;
+
+	if (found) *hash = known ;
+
+	return !found ;
+}
+
+static inline void test_golden_remember_hash(const char * path, uint64_t hash)
+{
+	char sidecar[4096], line[192] ;
+	struct stat st ;
+	int len ;
+
+	if (stat(path, &st)
+	    || (size_t)snprintf(sidecar, sizeof(sidecar), "%s%s", path,
+				TEST_GOLDEN_HASH_SUFFIX) >= sizeof(sidecar))
+		return ;
+
+	len = snprintf(line, sizeof(line),
+		       TEST_GOLDEN_HASH_MAGIC
+		       " %016llx %llu %llu %lld.%09ld %lld.%09ld\n",
+		       (unsigned long long)hash, (unsigned long long)st.st_size,
+		       (unsigned long long)st.st_ino,
+		       (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+		       (long long)st.st_ctim.tv_sec, st.st_ctim.tv_nsec) ;
+	test_golden_write(sidecar, line, len) ;
+}
+
+ /*
+  * Identifier:
+  * 		test_golden_check(what, buf, len, path)
+  *
+  * Purpose:
+  * 		Do the work of ASSERT_MATCHES_GOLDEN() out of line.
+  *
+  * Inputs:
+  * 		   what	: The assertion's arguments as written
+  *
+  * 		    buf	: What the test made
+  *
+  * 		    len	: How many bytes of it
+  *
+  * 		   path	: The golden file to compare it with
+  *
+  * Resolution:
+  * 		If the sidecar knows the golden file's hash and buf hashes to
+  * 	       +it, buf matches. Otherwise the golden file is mmap()ed and
+  * 	       +compared with test_mem_mismatch(). Returns 0 on a match,
+  * 	       +leaving a fresh sidecar behind. Otherwise, with the
+  * 	       +update_golden option, buf is written over the golden file and
+  * 	       +0 is returned; without it, 1 is returned with an explanation
+  * 	       +in test_why.
+  */
+static inline int test_golden_check(const char * what, const void * buf,
+				    size_t len, const char * path)
+{
+	const unsigned char * golden = NULL ;
+	struct stat st ;
+	uint64_t hash = 0, known ;
+	size_t size = 0, at = 0 ;
+	int fd, have_hash = 0, len_why ;
+
+	if ((fd = open(path, O_RDONLY)) < 0 && errno != ENOENT) {
+		snprintf(test_why, sizeof(test_why),
+			 "MATCHES_GOLDEN(%s): can't open %s: %s", what, path,
+			 strerror(errno)) ;
+		return 1 ;
+	}
+
+	if (fd >= 0) {
+		if (fstat(fd, &st)) {
+			snprintf(test_why, sizeof(test_why),
+				 "MATCHES_GOLDEN(%s): can't stat %s: %s", what,
+				 path, strerror(errno)) ;
+			close(fd) ;
+			return 1 ;
+		}
+		size = st.st_size ;
+
+		/* Fast path: only buf needs reading			    */
+		if (size == len && !test_golden_known_hash(path, &st, &known)) {
+			hash = test_hash64(buf, len) ;
+			have_hash = 1 ;
+			if (hash == known) {
+				close(fd) ;
+				return 0 ;
+			}
+		}
+
+		/* Slow path: read both, at memory speed if it's cached     */
+		if (size) {
+			golden = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) ;
+			if (golden == MAP_FAILED) {
+				snprintf(test_why, sizeof(test_why),
+					 "MATCHES_GOLDEN(%s): can't map %s: %s",
+					 what, path, strerror(errno)) ;
+				close(fd) ;
+				return 1 ;
+			}
+			madvise((void *)golden, size, MADV_SEQUENTIAL) ;
+		}
+		close(fd) ;
+
+		at = test_mem_mismatch(buf, golden, len < size ? len : size) ;
+		if (at == size && at == len) {
+			if (golden) munmap((void *)golden, size) ;
+			test_golden_remember_hash(path, have_hash ? hash
+						  : test_hash64(buf, len)) ;
+			return 0 ;
+		}
+	}
+
+	if (test_options.update_golden) {
+		if (golden) munmap((void *)golden, size) ;
+		if (test_golden_write(path, buf, len)) {
+			snprintf(test_why, sizeof(test_why),
+				 "MATCHES_GOLDEN(%s): can't update %s: %s",
+				 what, path, strerror(errno)) ;
+			return 1 ;
+		}
+		test_golden_remember_hash(path, have_hash ? hash
+					  : test_hash64(buf, len)) ;
+		fprintf(stdout, "\tUpdated golden file %s\n", path) ;
+		return 0 ;
+	}
+
+	if (fd < 0) {
+		snprintf(test_why, sizeof(test_why),
+			 "MATCHES_GOLDEN(%s): no golden file %s, "
+			 "run with --update-golden to make it", what, path) ;
+		return 1 ;
+	}
+
+	len_why = test_why_printf(0, "MATCHES_GOLDEN(%s): differs from %s at "
+				  "byte %zu, got %zu bytes, golden has %zu",
+				  what, path, at, len, size) ;
+	test_why_window(len_why, buf, golden, len < size ? len : size, at,
+			"got", "golden") ;
+	if (golden) munmap((void *)golden, size) ;
+
+	return 1 ;
+}
+
+ /*
+  * Identifier:
+  * 		ASSERT_MATCHES_GOLDEN(buf, len, path)
+  *
+  * Purpose:
+  * 		Fail a test case unless it made exactly what a reference file
+  * 	       +holds, e.g. a serializer's output. Comparing gigabytes costs
+  * 	       +what reading them does.
+  *
+  * Inputs:
+  * 		    buf	: Pointer to what the test made
+  *
+  * 		    len	: How many bytes of it
+  *
+  * 		   path	: The golden file, relative to the working directory
+  *
+  * Resolution:
+  * 		buf is compared with the golden file by test_golden_check().
+  * 	       +On a mismatch the test fails with the offset of the first
+  * 	       +difference and a hex window around it, unless the program
+  * 	       +was run with --update-golden, in which case the golden file
+  * 	       +is atomically replaced with buf and the test goes on. Each
+  * 	       +argument is evaluated once.
+  *
+  * Requirements:
+  * 		Must be run within the scope of a test case
+  */
+#define ASSERT_MATCHES_GOLDEN(buf,len,path)				       \
+									       \
+	{								       \
+		if (test_golden_check(TO_STRING(buf) ", " TO_STRING(len)       \
+				      ", " TO_STRING(path),		       \
+				      (buf), (len), (path))) {		       \
+			TEST_CASE_FAIL(test_why) ;			       \
+		}							       \
+	}								       \
+									       \
+/* end #define ASSERT_MATCHES_GOLDEN					    */
+
+/* SECTION: TEST CASE GENERATION */
+
+// TODO: move to configuration
+#define TEST_DEFAULT_CASE_BUFFSIZE 100 /* Initial case_capacity (arbitrary)  */
+#define TEST_DEFAULT_RESIZE_FACTOR 1.3 /* Ratio for capacity growth          */
+			
+ /*
+  * Identifier:
+  * 		TEST_CHECK_SPACE()
+  *
+  * Purpose:
+  * 		Check if enough memory is allocated for an aditional test case
+  * 	       +in the current test set. If more space is needed, allocate it.
+  *
+  * Resolution:
+  *  	        A conditional statement that tests if the dynamically allocated
+  *  	       +memory in the current test set's test_set_data struct is filled. In
+  *  	       +the case of a true result, additional memory is allocated. If
+  *  	       +the allocation fails, the program quits with an error message.
+  */
+#define TEST_CHECK_SPACE() 						       \
+									       \
+	if (this->case_count_total >= 	/* If count of test cases defined   */ \
+		this->case_capacity) {  /* Is at/above allocated capacity   */ \
+		this->case_capacity *=  /* Increase the capacity value 	    */ \
+			TEST_DEFAULT_RESIZE_FACTOR ; /* By default factor   */ \
+									       \
+		REALLOCATE_OR_DIE(	/* First reallocate test case space */ \
+			this->cases,        /* Located at this address 	    */ \
+			this->case_capacity /* Using out new capacity value */ \
+		) ;							       \
+									       \
+		REALLOCATE_OR_DIE(	/* Next reallocated case name space */ \
+			this->case_names,   /* Located at this address 	    */ \
+			this->case_capacity /* Using out new capacity value */ \
+		) ;							       \
+	} /* end if() */						       \
+									       \
+/* end #define TEST_CHECK_SPACE */
+		
+ /*
+  * Identifier:
+  * 		TEST_CASE(name,...)
+  *
+  * Purpose:
+  *		Define a test case, the core unit of this system
+  *
+  * Inputs:
+  * 		   name : A descriptive name of the test case
+  *
+  *    __VA_ARGS_ / ...	: A sequence of zero or more valid executable
+  *    			 +statements
+  *
+  * Resolution:
+  * 		A function named test_name is declared and defined and a pointer
+  * 	       +to the function is saved to the current test set, along with
+  * 	       +its name.
+  *
+  * Requirements:
+  *  	        A test case must be defined directly within the scope of a test
+  *  	       +set.
+  */
+#define TEST_CASE(name,...)						       \
+									       \
+	TEST_CHECK_SPACE() ;	/* Guarentee sufficent space for new tests  */ \
+	this->case_names[this->case_count_total] = NULL ;		       \
+	REALLOCATE_OR_DIE(      /* Name it now, so it can be scheduled	    */ \
+		this->case_names[this->case_count_total], /* Its case_name  */ \
+		sizeof(TO_STRING(test_##name))		  /* Of this size   */ \
+	) ;								       \
+									       \
+	/* Safe strcpy(): buffer space and \0-termination guarenteed above  */ \
+	strcpy(								       \
+		this->case_names[this->case_count_total], /* alloc'd above  */ \
+		TO_STRING(test_##name)			  /* cpp generated  */ \
+	) ;								       \
+									       \
+	this->cases[this->case_count_total++] = /* Add a new test case	    */ \
+		LAMBDA(int,(size_t case_id) 	/* Defined using our lambda */ \
+		{							       \
+			__VA_ARGS__ 	 /* Test case body: assertions, etc */ \
+									       \
+			TEST_CASE_PASS() ; /* If this runs, the test passes */ \
+		});							       \
+									       \
+/* end #define TEST_CASE 				                    */
+
+/* SECTION: PHASE TIMING */
+
+ /*
+  * Identifier:
+  * 		TEST_TIMING_BEGIN(), TEST_TIMING_MARK(phase),
+  * 		TEST_TIMING_REPORT(name)
+  *
+  * Purpose:
+  * 		Measure what the framework itself costs: how long a test set
+  * 	       +takes to construct and define its cases, to execute them, and
+  * 	       +to free everything afterwards.
+  *
+  * Inputs:
+  * 	          phase : defined, executed or destroyed
+  *
+  * 	           name : The name of the test set
+  *
+  * Resolution:
+  * 		With the TIMING option defined, a CLOCK_MONOTONIC reading is
+  * 	       +taken at the start of the set and after each phase, and a
+  * 	       +line of the form
+  * 	       +	TIMING name cases=N define_ns=D execute_ns=E destroy_ns=F
+  * 	       +is printed to stderr once the set is done. Otherwise these
+  * 	       +expand to nothing.
+  *
+  * Requirements:
+  * 		Only makes sense inside the TEST_SET macro definition.
+  * 	       +TEST_TIMING_MARK(executed) must come before the destructor,
+  * 	       +since it also saves the case count.
+  */
+/* Nanoseconds on CLOCK_MONOTONIC, also how the scheduler times cases    */
+static inline unsigned long long test_timing_now(void)
+{
+	struct timespec ts ;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts) ;
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec ;
+}
+
+#ifdef TEST_OPTION_TIMING
+#define TEST_TIMING_BEGIN()						       \
+									       \
+	struct {			/* One reading per phase boundary   */ \
+		unsigned long long begun, defined, executed, destroyed ;       \
+		size_t cases ;		/* Saved before the destructor runs */ \
+	} test_timing = { test_timing_now(), 0, 0, 0, 0 }		       \
+									       \
+/* end #define TEST_TIMING_BEGIN					    */
+
+#define TEST_TIMING_MARK(phase)						       \
+									       \
+	test_timing.phase = test_timing_now() ;	/* Stamp the phase	    */ \
+	test_timing.cases = this ? this->case_count_total /* Count cases    */ \
+				 : test_timing.cases  /* Unless destroyed   */ \
+									       \
+/* end #define TEST_TIMING_MARK						    */
+
+#define TEST_TIMING_REPORT(name)					       \
+									       \
+	fprintf(stderr,			/* Out of the way of PASS and FAIL  */ \
+		"TIMING %s cases=%lu define_ns=%llu execute_ns=%llu "	       \
+		"destroy_ns=%llu\n", TO_STRING(name), test_timing.cases,      \
+		test_timing.defined - test_timing.begun,		       \
+		test_timing.executed - test_timing.defined,		       \
+		test_timing.destroyed - test_timing.executed)		       \
+									       \
+/* end #define TEST_TIMING_REPORT					    */
+#else
+#define TEST_TIMING_BEGIN()
+#define TEST_TIMING_MARK(phase)
+#define TEST_TIMING_REPORT(name)
+#endif /* ifdef TEST_OPTION_TIMING */
+
+/* SECTION: BENCHMARKS */
+
+/* Timed samples per benchmark, unless --bench-samples says otherwise     */
+#define TEST_BENCH_SAMPLES 31
+
+/* A warm sample runs the body enough times to take at least this long   */
+#define TEST_BENCH_SAMPLE_NS 1000000ULL
+
+/* Noise, in percent, past which a benchmark's result is flagged	    */
+#define TEST_BENCH_NOISY 5.0
+
+/* Last level cache to assume if the system won't say how big it is	    */
+#define TEST_BENCH_LLC_DEFAULT (32 << 20)
+
+/* Alignment and size of a transparent huge page			    */
+#define TEST_BENCH_HUGE_PAGE (2 << 20)
+
+/* How a benchmark finds the caches at the start of each timed sample    */
+#define TEST_BENCH_WARM 0	/* As the sample before left them	    */
+#define TEST_BENCH_COLD 1	/* Emptied by streaming over twice the LLC  */
+
+/* What timing a benchmark found					    */
+typedef struct test_bench_result {
+	/* Timed samples taken, 0 if the body just ran once as a test	    */
+	size_t samples ;
+
+	/* Runs of the body in each sample				    */
+	unsigned long long ops ;
+
+	/* Nanoseconds per run, in the median and the fastest sample	    */
+	double median_ns, min_ns ;
+
+	/* Spread of the samples, as a percentage of the median		    */
+	double noise ;
+} test_bench_result_t ;
+
+/* What test_bench_enter() changed, for test_bench_leave() to put back   */
+typedef struct test_bench_saved {
+	/* CPUs the thread was allowed before it was pinned, if it was	    */
+	unsigned long cpus[16] ;
+	int pinned ;
+
+	/* Scheduling before it was raised, if it was			    */
+	int policy, nice, raised ;
+	struct sched_param param ;
+} test_bench_saved_t ;
+
+/* The eviction buffer, and whether the benchmark setup has been shown   */
+static struct {
+	volatile unsigned char * buffer ;
+	size_t size ;
+	int shown, unlocked ;
+} test_bench = { 0 } ;
+
+ /*
+  * Identifier:
+  * 		test_bench_alloc(size), test_bench_free(fixture, size)
+  *
+  * Purpose:
+  * 		Give benchmarks memory that won't fault or be paged out while
+  * 	       +they're timed, so a sample doesn't pay for the kernel.
+  *
+  * Inputs:
+  * 		   size	: Bytes wanted
+  *
+  * 		fixture	: What test_bench_alloc() returned
+  *
+  * Resolution:
+  * 		The memory is mapped, aligned to a huge page and advised
+  * 	       +MADV_HUGEPAGE under --bench-thp, written to a page at a time
+  * 	       +so every page exists, and mlock()ed. Locking is best effort,
+  * 	       +RLIMIT_MEMLOCK is often small, and the benchmark setup line
+  * 	       +says when it failed. Returns NULL if nothing could be mapped.
+  *
+  * Requirements:
+  * 		Allocate fixtures in a test set's definition phase, where
+  * 	       +they aren't timed, and free them in a last case.
+  */
+static inline size_t test_bench_round(size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE),
+	       align = test_options.bench_thp ? TEST_BENCH_HUGE_PAGE : page ;
+
+	return (size + align - 1) / align * align ;
+}
+
+static inline void * test_bench_alloc(size_t size)
+{
+	size_t length = test_bench_round(size), page = sysconf(_SC_PAGESIZE),
+	       slack = test_options.bench_thp ? TEST_BENCH_HUGE_PAGE : 0 ;
+	unsigned char * map, * fixture ;
+
+	map = mmap(NULL, length + slack, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) ;
+	if (map == MAP_FAILED) return NULL ;
+
+	/* Trim it to start on a huge page, so all of it can be one	    */
+	fixture = map ;
+	if (slack) {
+		fixture = (unsigned char *)(((uintptr_t)map + slack - 1)
+					    & ~(uintptr_t)(slack - 1)) ;
+		if (fixture > map) munmap(map, fixture - map) ;
+		if (map + slack > fixture)
+			munmap(fixture + length, map + slack - fixture) ;
+		madvise(fixture, length, MADV_HUGEPAGE) ;
+	}
+
+	for (size_t i = 0; i < length; i += page) fixture[i] = 0 ;
+	if (mlock(fixture, length)) test_bench.unlocked = 1 ;
+
+	return fixture ;
+}
+
+static inline void test_bench_free(void * fixture, size_t size)
+{
+	if (fixture) munmap(fixture, test_bench_round(size)) ;
+}
+
+/* Size of the last level cache, from the system if it knows	    */
+static inline size_t test_bench_llc(void)
+{
+	long size = sysconf(_SC_LEVEL3_CACHE_SIZE) ;
+
+	if (size <= 0) size = sysconf(_SC_LEVEL2_CACHE_SIZE) ;
+
+	return size > 0 ? (size_t)size : TEST_BENCH_LLC_DEFAULT ;
+}
+
+/* Push everything a benchmark left in the caches out, by writing to a  */
+/* line at a time of a buffer twice the size of the last level	    */
+static inline void test_bench_evict(void)
+{
+	if (!test_bench.buffer) {
+		test_bench.size = 2 * test_bench_llc() ;
+		test_bench.buffer = test_bench_alloc(test_bench.size) ;
+		if (!test_bench.buffer) return ;
+	}
+
+	for (size_t i = 0; i < test_bench.size; i += 64) test_bench.buffer[i]++ ;
+}
+
+__attribute__((destructor))
+static void test_bench_evict_free(void)
+{
+	test_bench_free((void *)test_bench.buffer, test_bench.size) ;
+	test_bench.buffer = NULL ;
+}
+
+/* Pin and raise the calling thread as the options ask, noting how it   */
+/* was, and say once what was obtained					    */
+static inline void test_bench_enter(test_bench_saved_t * saved)
+{
+	unsigned long cpus[sizeof(saved->cpus) / sizeof(*saved->cpus)] = { 0 } ;
+	int cpu = test_options.bench_cpu, bits = 8 * sizeof(*cpus) ;
+	struct sched_param param = { .sched_priority = 1 } ;
+	const char * priority = "unchanged" ;
+
+	memset(saved, 0, sizeof(*saved)) ;
+
+	/* The raw system call, since cpu_set_t wants _GNU_SOURCE	    */
+	if (cpu >= 0 && cpu < (int)sizeof(cpus) * 8
+	    && syscall(SYS_sched_getaffinity, 0, sizeof(saved->cpus),
+		       saved->cpus) > 0) {
+		cpus[cpu / bits] = 1UL << cpu % bits ;
+		saved->pinned = !syscall(SYS_sched_setaffinity, 0,
+					 sizeof(cpus), cpus) ;
+	}
+
+	if (test_options.bench_priority) {
+		saved->policy = sched_getscheduler(0) ;
+		sched_getparam(0, &saved->param) ;
+		errno = 0 ;
+		saved->nice = getpriority(PRIO_PROCESS, 0) ;
+		if (!sched_setscheduler(0, SCHED_FIFO, &param)) {
+			saved->raised = 1 ;
+			priority = "SCHED_FIFO" ;
+		} else if (!setpriority(PRIO_PROCESS, 0, -20)) {
+			saved->raised = 2 ;
+			priority = "nice -20" ;
+		} else {
+			priority = "unchanged, not permitted" ;
+		}
+	}
+
+	if (test_bench.shown) return ;
+	test_bench.shown = 1 ;
+	fprintf(stdout, "BENCH setup: ") ;
+	if (saved->pinned) fprintf(stdout, "pinned to CPU %d", cpu) ;
+	else if (cpu >= 0) fprintf(stdout, "can't pin to CPU %d", cpu) ;
+	else fprintf(stdout, "not pinned") ;
+	fprintf(stdout, ", priority %s, %s fixtures%s, LLC %zu KiB\n\n",
+		priority, test_options.bench_thp ? "huge page" : "small page",
+		test_bench.unlocked ? " (some not locked)" : "",
+		test_bench_llc() >> 10) ;
+}
+
+/* Put back what test_bench_enter() changed				    */
+static inline void test_bench_leave(test_bench_saved_t * saved)
+{
+	if (saved->pinned)
+		syscall(SYS_sched_setaffinity, 0, sizeof(saved->cpus),
+			saved->cpus) ;
+	if (saved->raised == 1)
+		sched_setscheduler(0, saved->policy, &saved->param) ;
+	if (saved->raised == 2) setpriority(PRIO_PROCESS, 0, saved->nice) ;
+}
+
+static int test_bench_compare(const void * a, const void * b)
+{
+	double x = *(const double *)a, y = *(const double *)b ;
+
+	return (x > y) - (x < y) ;
+}
+
+ /*
+  * Identifier:
+  * 		test_bench_summarize(ns, samples, result)
+  *
+  * Purpose:
+  * 		Boil samples down to a time and how far to trust it.
+  *
+  * Inputs:
+  * 		     ns	: Nanoseconds per run in each sample, sorted here
+  *
+  * 		samples	: How many, at least one
+  *
+  * 		 result	: Where to put it
+  *
+  * Resolution:
+  * 		The median, the fastest sample, and the noise: the median
+  * 	       +absolute deviation scaled to a standard deviation (x1.4826)
+  * 	       +as a percentage of the median. Unlike the standard deviation
+  * 	       +itself, one sample that got preempted barely moves it. Two
+  * 	       +runs that differ by less than about twice the noise can't be
+  * 	       +told apart.
+  */
+static inline void test_bench_summarize(double * ns, size_t samples,
+					test_bench_result_t * result)
+{
+	double deviation[samples] ;
+
+	qsort(ns, samples, sizeof(*ns), test_bench_compare) ;
+	result->samples = samples ;
+	result->min_ns = ns[0] ;
+	result->median_ns = samples % 2 ? ns[samples / 2]
+			    : (ns[samples / 2 - 1] + ns[samples / 2]) / 2 ;
+
+	for (size_t s = 0; s < samples; ++s) {
+		deviation[s] = ns[s] > result->median_ns
+			       ? ns[s] - result->median_ns
+			       : result->median_ns - ns[s] ;
+	}
+	qsort(deviation, samples, sizeof(*deviation), test_bench_compare) ;
+	result->noise = result->median_ns <= 0 ? 0
+		: 100 * 1.4826 * (samples % 2 ? deviation[samples / 2]
+				  : (deviation[samples / 2 - 1]
+				     + deviation[samples / 2]) / 2)
+		  / result->median_ns ;
+}
+
+ /*
+  * Identifier:
+  * 		test_bench_measure(body, cache, result)
+  *
+  * Purpose:
+  * 		Time body, or under no --bench just run it once.
+  *
+  * Inputs:
+  * 		   body	: What to time
+  *
+  * 		  cache	: TEST_BENCH_WARM or TEST_BENCH_COLD
+  *
+  * 		 result	: Where to put the timing
+  *
+  * Resolution:
+  * 		After test_bench_enter() and one untimed run to fault in
+  * 	       +what body touches, a warm benchmark finds how many runs make
+  * 	       +a sample of TEST_BENCH_SAMPLE_NS and times that many per
+  * 	       +sample. A cold one times single runs, each after
+  * 	       +test_bench_evict(). The cost of reading the clock is taken
+  * 	       +off every sample.
+  */
+static inline void test_bench_measure(void (* body)(void), int cache,
+				      test_bench_result_t * result)
+{
+	size_t samples = test_options.bench_samples
+			 ? test_options.bench_samples : TEST_BENCH_SAMPLES ;
+	unsigned long long ops = 1, begun, took, overhead = ~0ULL ;
+	double ns[samples] ;
+	test_bench_saved_t saved ;
+
+	memset(result, 0, sizeof(*result)) ;
+	if (!test_options.bench) {
+		body() ;
+		return ;
+	}
+
+	test_bench_enter(&saved) ;
+
+	for (int i = 0; i < 1000; ++i) {
+		begun = test_timing_now() ;
+		took = test_timing_now() - begun ;
+		if (took < overhead) overhead = took ;
+	}
+
+	body() ;
+
+	while (cache == TEST_BENCH_WARM) {
+		begun = test_timing_now() ;
+		for (unsigned long long i = 0; i < ops; ++i) body() ;
+		took = test_timing_now() - begun ;
+		if (took >= TEST_BENCH_SAMPLE_NS || ops >= 1ULL << 40) break ;
+		ops *= 2 ;
+	}
+
+	for (size_t s = 0; s < samples; ++s) {
+		if (cache == TEST_BENCH_COLD) test_bench_evict() ;
+		begun = test_timing_now() ;
+		for (unsigned long long i = 0; i < ops; ++i) body() ;
+		took = test_timing_now() - begun ;
+		ns[s] = (double)(took > overhead ? took - overhead : 0) / ops ;
+	}
+
+	test_bench_leave(&saved) ;
+	result->ops = ops ;
+	test_bench_summarize(ns, samples, result) ;
+}
+
+/* Print a benchmark's timing, if it was timed				    */
+static inline void test_bench_report(const char * name, int cache,
+				     const test_bench_result_t * result)
+{
+	if (!result->samples) return ;
+
+	fprintf(stdout, "BENCH %s: %.1f ns/op median, %.1f min, noise %.1f%% "
+		"(%zu samples of %llu ops, %s cache)\n", name,
+		result->median_ns, result->min_ns, result->noise,
+		result->samples, result->ops,
+		cache == TEST_BENCH_COLD ? "cold" : "warm") ;
+	if (result->noise > TEST_BENCH_NOISY)
+		fprintf(stdout, "\tNOISY: changes under %.0f%% can't be told "
+			"from noise\n", 2 * result->noise) ;
+}
+
+ /*
+  * Identifier:
+  * 		TEST_BENCH_KEEP(value)
+  *
+  * Purpose:
+  * 		Stop the compiler from dropping work whose result a
+  * 	       +benchmark body doesn't otherwise use.
+  *
+  * Inputs:
+  * 		  value	: The result
+  *
+  * Resolution:
+  * 		An empty asm statement that claims to read value and
+  * 	       +clobber memory.
+  */
+#define TEST_BENCH_KEEP(value) __asm__ volatile("" : : "g"(value) : "memory")
+
+ /*
+  * Identifier:
+  * 		TEST_BENCH(name, cache, ...)
+  *
+  * Purpose:
+  * 		Define a benchmark, a test case that times its body under
+  * 	       +--bench.
+  *
+  * Inputs:
+  * 		   name : A descriptive name of the benchmark
+  *
+  * 		  cache	: TEST_BENCH_WARM to time runs back to back, or
+  * 		  	 +TEST_BENCH_COLD to empty the caches before each
+  *
+  *    __VA_ARGS_ / ...	: The statements to time
+  *
+  * Resolution:
+  * 		A test case named test_name whose body is made into a
+  * 	       +function, handed to test_bench_measure(), and reported. The
+  * 	       +case passes once the body has run. Without --bench the body
+  * 	       +runs once, so benchmarks still work as smoke tests in a plain
+  * 	       +test run.
+  *
+  * Requirements:
+  *  	        Like a test case, directly within the scope of a test set.
+  *  	       +The body can't use assertions, since it isn't a test case
+  *  	       +itself; set up fixtures in the set's scope, where they're
+  *  	       +captured by reference.
+  */
+#define TEST_BENCH(name,cache,...)					       \
+									       \
+	TEST_CASE(name,							       \
+		test_bench_result_t test_bench_result ;			       \
+									       \
+		test_bench_measure(LAMBDA(void,(void) /* Made a function    */ \
+			{ __VA_ARGS__ ; }), cache,    /* And timed	    */ \
+			&test_bench_result) ;				       \
+		test_bench_report(this->case_names[case_id], cache,	       \
+				  &test_bench_result) ;			       \
+	)								       \
+									       \
+/* end #define TEST_BENCH						    */
+
+/* Most input sizes one TEST_BENCH_RANGE will time			    */
+#define TEST_BENCH_RANGE_SIZES 64
+
+/* How a benchmark's time per run may grow with its input size n	    */
+enum test_bench_model {
+	O_1,		/* Constant					    */
+	O_LOG_N,	/* Logarithmic					    */
+	O_N,		/* Linear					    */
+	O_N_LOG_N,	/* Linearithmic					    */
+	O_N_SQUARED,	/* Quadratic					    */
+	TEST_BENCH_MODELS
+} ;
+
+static const char * const test_bench_model_names[TEST_BENCH_MODELS] = {
+	"1", "log n", "n", "n log n", "n^2"
+} ;
+
+/* How many times smaller a more complex model's error must be to win  */
+#define TEST_BENCH_FIT_MARGIN 2.0
+
+/* Which model fit a TEST_BENCH_RANGE best, and how well		    */
+typedef struct test_bench_fit {
+	/* One of enum test_bench_model, or -1 if nothing was fit	    */
+	int model ;
+
+	/* Nanoseconds per run is about coefficient * model(n)	    */
+	double coefficient ;
+
+	/* Typical relative residual of the winner, in percent		    */
+	double error ;
+
+	/* The same for every model, or -1 for one that couldn't be fit    */
+	double errors[TEST_BENCH_MODELS] ;
+
+	/* Worst noise of the timings fit, in percent, 0 if not timed	    */
+	double noise ;
+} test_bench_fit_t ;
+
+/* The fit of the last TEST_BENCH_RANGE, for ASSERT_COMPLEXITY_AT_MOST  */
+static test_bench_fit_t test_bench_fit = { -1, 0, 0 } ;
+
+/* Square root by Newton's method, so as not to need -lm		    */
+static inline double test_sqrt(double x)
+{
+	double root = x > 1 ? x : 1 ;
+
+	if (x <= 0) return 0 ;
+	for (int i = 0; i < 64; ++i) root = (root + x / root) / 2 ;
+
+	return root ;
+}
+
+/* Base 2 logarithm of x > 0, a bit at a time so there's no -lm to link */
+static inline double test_log2(double x)
+{
+	double log = 0, bit = 1 ;
+
+	if (x <= 0) return 0 ;
+	for (; x >= 2; x /= 2) log++ ;
+	for (; x < 1; x *= 2) log-- ;
+	for (int i = 0; i < 40; ++i) {
+		bit /= 2 ;
+		x *= x ;
+		if (x >= 2) {
+			x /= 2 ;
+			log += bit ;
+		}
+	}
+
+	return log ;
+}
+
+/* 2 to the x, by its Taylor series on the fraction, also without -lm  */
+static inline double test_exp2(double x)
+{
+	double power = 1, term = 1, sum = 1 ;
+	int whole = (int)x ;
+
+	if (x < whole) whole-- ;	// Round down, negatives too
+	// What's left, as a power of e under ln 2
+	x = (x - whole) * 0.69314718055994530942 ;
+	for (int i = 1; i < 24; ++i) sum += term *= x / i ;
+
+	for (; whole > 0; --whole) power *= 2 ;
+	for (; whole < 0; ++whole) power /= 2 ;
+
+	return power * sum ;
+}
+
+/* What model makes of n						    */
+static inline double test_bench_model(int model, double n)
+{
+	switch (model) {
+	case O_1:	return 1 ;
+	case O_LOG_N:	return test_log2(n) ;
+	case O_N:	return n ;
+	case O_N_LOG_N:	return n * test_log2(n) ;
+	default:	return n * n ;
+	}
+}
+
+ /*
+  * Identifier:
+  * 		test_bench_fit_models(n, ns, sizes, fit)
+  *
+  * Purpose:
+  * 		Find which complexity best explains how a benchmark's time
+  * 	       +grew with its input.
+  *
+  * Inputs:
+  * 		      n	: Each input size, at least 1
+  *
+  * 		     ns	: Nanoseconds per run at each size
+  *
+  * 		  sizes	: How many, at least two to tell models apart
+  *
+  * 		    fit	: Where to put the best one
+  *
+  * Resolution:
+  * 		Each model is fit in log space, to log ns = log c + log f(n),
+  * 	       +so every size counts by how far off it is relative to its
+  * 	       +own time and the largest size can't drown out the rest. log c
+  * 	       +is then the mean of log(ns / f(n)), and a model's error is
+  * 	       +the root mean square of what's left, as a percentage.
+  * 	       +Models are tried simplest first, and a more complex one only
+  * 	       +takes over if its error is TEST_BENCH_FIT_MARGIN times
+  * 	       +smaller, so noise can't promote a constant to a logarithm. A
+  * 	       +model too slow-growing for the data leaves a residual that
+  * 	       +grows with n, and one too fast-growing misses the small
+  * 	       +sizes, so the sizes should span at least a couple of orders
+  * 	       +of magnitude. fit->noise is left for the caller. fit->model
+  * 	       +is -1 if there were fewer than two sizes.
+  */
+static inline void test_bench_fit_models(const double * n, const double * ns,
+					 size_t sizes, test_bench_fit_t * fit)
+{
+	fit->model = -1 ;
+	fit->coefficient = fit->error = 0 ;
+	for (int model = O_1; model < TEST_BENCH_MODELS; ++model)
+		fit->errors[model] = -1 ;
+	if (sizes < 2) return ;
+
+	for (int model = O_1; model < TEST_BENCH_MODELS; ++model) {
+		double logs[sizes], log_c = 0, residual = 0, error ;
+		size_t s ;
+
+		for (s = 0; s < sizes; ++s) {
+			double f = test_bench_model(model, n[s]) ;
+
+			if (f <= 0) break ;	// log 1 is 0, nothing to fit
+			// A run too quick to time is taken as a picosecond
+			logs[s] = test_log2(ns[s] > 0.001 ? ns[s] : 0.001)
+				  - test_log2(f) ;
+			log_c += logs[s] / sizes ;
+		}
+		if (s < sizes) continue ;
+
+		for (s = 0; s < sizes; ++s) {
+			residual += (logs[s] - log_c) * (logs[s] - log_c)
+				    / sizes ;
+		}
+		error = 100 * (test_exp2(test_sqrt(residual)) - 1) ;
+		fit->errors[model] = error ;
+
+		if (fit->model < 0
+		    || error * TEST_BENCH_FIT_MARGIN < fit->error) {
+			fit->model = model ;
+			fit->coefficient = test_exp2(log_c) ;
+			fit->error = error ;
+		}
+	}
+}
+
+/* The next size a TEST_BENCH_RANGE times, or 0 if it can't grow	    */
+static inline size_t test_bench_range_next(size_t n, size_t multiplier)
+{
+	if (multiplier < 2 || n > (size_t)-1 / multiplier) return 0 ;
+
+	return n * multiplier ;
+}
+
+/* Fit a TEST_BENCH_RANGE's timings and print them, if they were timed  */
+static inline void test_bench_range_report(const char * name,
+					   const double * n,
+					   const test_bench_result_t * results,
+					   size_t sizes)
+{
+	double ns[TEST_BENCH_RANGE_SIZES] ;
+
+	for (size_t s = 0; s < sizes; ++s) ns[s] = results[s].median_ns ;
+	test_bench_fit_models(n, ns, sizes, &test_bench_fit) ;
+	test_bench_fit.noise = 0 ;
+	for (size_t s = 0; s < sizes; ++s) {
+		if (results[s].noise > test_bench_fit.noise)
+			test_bench_fit.noise = results[s].noise ;
+	}
+	if (!sizes) return ;
+
+	if (test_bench_fit.model < 0) {
+		fprintf(stdout, "BENCH_RANGE %s: one size, nothing to fit\n",
+			name) ;
+	} else {
+		fprintf(stdout, "BENCH_RANGE %s: O(%s), %.3g ns * %s, fit "
+			"error %.1f%%\n", name,
+			test_bench_model_names[test_bench_fit.model],
+			test_bench_fit.coefficient,
+			test_bench_model_names[test_bench_fit.model],
+			test_bench_fit.error) ;
+	}
+
+	for (size_t s = 0; s < sizes; ++s) {
+		fprintf(stdout, "\tn = %.0f: %.1f ns/op median, noise %.1f%%%s\n",
+			n[s], results[s].median_ns, results[s].noise,
+			results[s].noise > TEST_BENCH_NOISY ? " NOISY" : "") ;
+	}
+}
+
+ /*
+  * Identifier:
+  * 		TEST_BENCH_RANGE(name, n_from, n_to, multiplier, ...)
+  *
+  * Purpose:
+  * 		Define a benchmark that times its body over growing input
+  * 	       +sizes and finds its complexity, which no one size can show.
+  *
+  * Inputs:
+  * 		   name : A descriptive name of the benchmark
+  *
+  * 		 n_from	: The first input size, at least 1
+  *
+  * 		   n_to	: The largest input size to try
+  *
+  * 	     multiplier	: How much bigger each size is than the one before,
+  * 	     		 +at least 2
+  *
+  *    __VA_ARGS_ / ...	: The statements to time, which read the input
+  *    			 +size from the size_t n
+  *
+  * Resolution:
+  * 		A test case named test_name that, under --bench, times its
+  * 	       +body warm like TEST_BENCH at n = n_from, n_from * multiplier,
+  * 	       +... up to n_to, fits the medians with test_bench_fit_models()
+  * 	       +and reports the best model with its coefficient, then the
+  * 	       +timing at each size. The fit is kept for
+  * 	       +ASSERT_COMPLEXITY_AT_MOST. Without --bench the body runs once
+  * 	       +with n = n_from and nothing is fit.
+  *
+  * Requirements:
+  *  	        Those of TEST_BENCH. The body can't change n. Fixtures
+  *  	       +must be big enough for n_to.
+  */
+#define TEST_BENCH_RANGE(name,n_from,n_to,multiplier,...)		       \
+									       \
+	TEST_CASE(name,							       \
+		test_bench_result_t					       \
+			test_bench_results[TEST_BENCH_RANGE_SIZES] ;	       \
+		double test_bench_n[TEST_BENCH_RANGE_SIZES] ;		       \
+		size_t n, test_bench_sizes = 0 ;			       \
+									       \
+		for (n = (n_from); n && n <= (size_t)(n_to)		       \
+		     && test_bench_sizes < TEST_BENCH_RANGE_SIZES;	       \
+		     n = test_bench_range_next(n, (multiplier))) {	       \
+			test_bench_measure(LAMBDA(void,(void) /* Reads n    */ \
+				{ __VA_ARGS__ ; }), TEST_BENCH_WARM,	       \
+				&test_bench_results[test_bench_sizes]) ;       \
+			if (!test_bench_results[test_bench_sizes].samples)     \
+				break ;		      /* Ran once, untimed  */ \
+			test_bench_n[test_bench_sizes++] = n ;		       \
+		}							       \
+		test_bench_range_report(this->case_names[case_id],	       \
+					test_bench_n, test_bench_results,      \
+					test_bench_sizes) ;		       \
+	)								       \
+									       \
+/* end #define TEST_BENCH_RANGE						    */
+
+ /*
+  * Identifier:
+  * 		ASSERT_COMPLEXITY_AT_MOST(bound)
+  *
+  * Purpose:
+  * 		Fail a test case if the last TEST_BENCH_RANGE grew faster
+  * 	       +than it should, e.g. a lookup that went quadratic.
+  *
+  * Inputs:
+  * 		  bound	: O_1, O_LOG_N, O_N, O_N_LOG_N or O_N_SQUARED
+  *
+  * Resolution:
+  * 		The test fails, naming the model that fit, if that model
+  * 	       +grows faster than bound and bound itself fits worse than
+  * 	       +twice the noisiest size's noise. Within that, the timings
+  * 	       +can't tell the two apart, and the test passes. Also passes
+  * 	       +if nothing was fit, as when the program was run without
+  * 	       +--bench.
+  *
+  * Requirements:
+  * 		Must be run within the scope of a test case that follows
+  * 	       +the TEST_BENCH_RANGE in the same test set
+  */
+#define ASSERT_COMPLEXITY_AT_MOST(bound)				       \
+									       \
+	{								       \
+		if (test_bench_fit.model > (int)(bound)			       \
+		    && (test_bench_fit.errors[(bound)] < 0		       \
+			|| test_bench_fit.errors[(bound)]		       \
+			   > 2 * test_bench_fit.noise)) {		       \
+			snprintf(test_why, sizeof(test_why),		       \
+				 "complexity O(%s), at most O(%s) expected "   \
+				 "(fit error %.1f%% vs %.1f%%, noise %.1f%%)", \
+				 test_bench_model_names[test_bench_fit.model], \
+				 test_bench_model_names[(bound)],	       \
+				 test_bench_fit.error,			       \
+				 test_bench_fit.errors[(bound)],	       \
+				 test_bench_fit.noise) ;		       \
+			TEST_CASE_FAIL(test_why) ;			       \
+		}							       \
+	}								       \
+									       \
+/* end #define ASSERT_COMPLEXITY_AT_MOST				    */
+
+/* SECTION: TEST SET GENERATION */
+
+ /*
+  * Identifier:
+  * 		TEST_SET_CONSTRUCTOR(name)
+  *
+  * Purpose:
+  * 		Allocate memory to support a set of test cases
+  *
+  * Inputs:
+  * 	           name : A descriptive name for the test set
+  *
+  * Resolution:
+  * 		A test_set_data_t is allocated and it's fields are assigned
+  * 	       +sensible defualt values. Some of these fields are themselves
+  * 	       +dynamically allocated. Any allocation failure is fatal to
+  * 	       +the entire program and is also kind of sad.
+  *
+  * Requirements:
+  * 		Usage of this macro only really makes sense in the context
+  * 	       +the definition of the TEST_SET macro, but I suppose there
+  * 	       +isn't any reason why one could not use this anywhere they
+  * 	       +would like to, provided that no identifiers are redeclared.
+  */
+#define TEST_SET_CONSTRUCTOR(name)					       \
+									       \
+	/* ALLOCATION OF TEST SET DATA STRUCTURE */			       \
+	test_set_data_t * this = NULL ; /* Initialize pointer to set data   */ \
+	REALLOCATE_OR_DIE(this,1) ;	/* Allocate space for data or die   */ \
+									       \
+	/* ASIGNMENT OF SENSIBLE DEFAULT VALUES				    */ \
+	*this = (const test_set_data_t) /* Cast & assign to allocated space */ \
+	{				/* begin compound literal           */ \
+		NULL,			/* void (*cases)(size_t case_id)    */ \
+		NULL,			/* char ** case_names		    */ \
+		NULL,			/* char  * set_name		    */ \
+		0,			/* size_t case_count_capacity       */ \
+		0,			/* size_t case_count_total          */ \
+		0,			/* size_t case_count passed         */ \
+		sizeof(TO_STRING(name)) /* size_t set_name_length           */ \
+	} ;				/* end compound literal             */ \
+	/* From this point onward, this data is accessed via the this ptr   */ \
+									       \
+	/* DYNAMIC ALLOCATION OF TEST CASE SPACE */	       		       \
+	this->case_capacity = 		/* Initally the capacity should be  */ \
+		TEST_DEFAULT_CASE_BUFFSIZE ; /*+the default value           */ \
+									       \
+	REALLOCATE_OR_DIE(		/* Allocation failure is fatal here */ \
+		this->cases,		/* Allocate memory for this ptr     */ \
+		this->case_capacity ) ; /* To hold this many of it's type   */ \
+									       \
+	REALLOCATE_OR_DIE(		/* Same as previous 		    */ \
+		this->case_names,       /* But for test name strings        */ \
+		this->case_capacity ) ; /* Which should have same capacity  */ \
+									       \
+	memset(  /* Powerwash our array of (char*)s to clear garbage values */ \
+		this->case_names,       /* Located at this address          */ \
+		0,			/* (int)0 == NULL essentially       */ \
+		this->case_capacity     /* Hold this many nothings          */ \
+	) ; /* Note: without this call to memset(), realloc() makes a       */ \
+	    /* a conditional jump that depends on an uninitialized value    */ \
+									       \
+	/* DYNAMIC ALLOCATION OF TEST SET NAME			            */ \
+	REALLOCATE_OR_DIE(		/* Last but not least...	    */ \
+		this->set_name,         /* Space for the set name string    */ \
+		this->set_name_size ) ; /* Size in bytes determined above   */ \
+									       \
+	strcpy(  /* Safe: buffer space and \0-termination guarenteed above  */ \
+		this->set_name, 	/* dest: the newly allocated buffer */ \
+		TO_STRING(name) ) ;     /* src : const char[] from cpp      */ \
+									       \
+/* end #define TEST_SET_CONSTRUCTOR 				            */
+
+ /*
+  * Identifier:
+  * 		TEST_SET_EXECUTOR()
+  *
+  * Purpose:
+  *		Execute all test cases defined in a test set.
+  *
+  * Resolution:
+  * 		All defined test cases in the cases function pointer array
+  * 	       +are executed by test_schedule_run(), in declaration order
+  * 	       +unless the command line asks otherwise, and the pass/total
+  * 	       +ratio is reported.
+  *
+  * Requirements:
+  *  		TEST_SET_CONSTRUCTOR must be called earlier in scope.
+  */
+#define TEST_SET_EXECUTOR()						       \
+									       \
+	/* EXECUTION */							       \
+	test_schedule_run(this) ;	/* In the order that was asked for  */ \
+									       \
+	/* REPORT */							       \
+	fprintf(stdout,	/* When all test cases in the set have been run,    */ \
+		"\nFINISHED TEST_SET: %s\n"   /* Report which set was run,  */ \
+		"\tPassed %lu/%lu test cases.\n\n", /* and the pass ratio   */ \
+			this->set_name,				               \
+			this->case_count_passed,			       \
+			this->case_count_total ) ;  			       \
+									       \
+/* end #define TEST_SET_EXECUTOR 				            */
+
+ /*
+  * Identifier:
+  * 		TEST_SET_DESTRUCTOR()
+  *
+  * Purpose:
+  *		Free any dynamically allocated memory associated with a test
+  *	       +set.
+  *
+  * Resolution:
+  * 		All dynamically allocated fields in the test_set_data_t at
+  * 	       +address "this" are freed, as well as the test_set_data_t
+  * 	       +itself.
+  *
+  * Requirements:
+  *  		TEST_SET_CONSTRUCTOR was called earlier in scope, and
+  *  		TEST SET_DESTRUCTOR has not already been called since that
+  *  	       +point. Like the constructor, it doesn't really make sense
+  *  	       +to use this outside of the TEST_SET macro definition. Because
+  *  	       +of that, I don't bother to check if any of these fields are
+  *  	       +NULL, because the program will terminate on failed allocation
+  *  	       +when used as intended. But hey, it's open source, do what you
+  *  	       +want.
+  */
+#define TEST_SET_DESTRUCTOR() 						       \
+									       \
+	free(this->cases) ;			 /* Free function ptr array */ \
+	for(size_t i = 0;			 /* Iterate through the     */ \
+		i < this->case_count_total; ++i) /* Array of (char *)s      */ \
+		{ free(this->case_names[i]) ; }  /* And free all of them    */ \
+	free(this->case_names) ;		 /* Then free the (char**)  */ \
+	free(this->set_name) ;			 /* Free the last (char*)   */ \
+	free(this) ; 				 /* Lastly, free yourself   */ \
+						 /* I'M FREE AT LAST	    */ \
+/* end #define TEST_SET_DESTRUCTOR					    */
+
+/* What a host needs to run a test set, and what it gets back		    */
+typedef struct test_registration {
+	/* The name of the test set					    */
+	const char * name ;
+
+	/* The function TEST_SET generated for it			    */
+	void (* run)(void) ;
+
+	/* How many of its test cases passed, of how many, once it has run  */
+	size_t passed, total ;
+
+	/* Nonzero if --fail-fast says the run ends after it		    */
+	int stopped ;
+} test_registration_t ;
+
+ /*
+  * Identifier:
+  * 		test_host_register(set)
+  *
+  * Purpose:
+  * 		Let a program that loads test shared objects, such as
+  * 	       +lil_test_host, decide when their test sets run.
+  *
+  * Inputs:
+  * 		    set	: A test set being loaded
+  *
+  * Resolution:
+  * 		Declared weak and left undefined here. A program that defines
+  * 	       +it and exports it (-rdynamic) is handed every test set in the
+  * 	       +shared objects it dlopen()s, and runs them by calling
+  * 	       +set->run(). Anywhere else it is NULL, and test sets run
+  * 	       +before main() as they always have.
+  */
+extern void test_host_register(test_registration_t * set)
+	__attribute__((weak)) ;
+
+ /*
+  * Identifier:
+  * 		TEST_SET(name,...)
+  *
+  * Purpose:
+  * 		Define a test set to be executed before main()
+  *
+  * Inputs:
+  * 		   name : A descriptive name of the test set
+  *
+  *    __VA_ARGS_ / ...	: A sequence of zero or more valid executable
+  *    			 +statements, including zero or more test case
+  *    			 +definitions
+  *
+  * Resolution:
+  * 		A function is declared with the constructor attribute so that
+  *	       +it will run before main(), and hand the test set to
+  *	       +test_host_register() if a host defined it, or else run it.
+  *	       +The test set's function is then imediately defined with a
+  *	       +function body that constructs the required data for a test
+  *	       +set, executes an arbitary number of statements, optionally
+  *	       +including test case definitions, executes any defined test
+  *	       +cases, notes how many passed for the host, and frees all
+  *	       +allocated memory. Another constructor, run before any set,
+  *	       +counts the set so --telemetry knows how many there are.
+  *
+  * Requirements:
+  *  		The inclusion of this header file.
+  */
+#define TEST_SET(name,...)\
+									       \
+	void test_set_##name (void) ;	       /* Declare a function to run */ \
+									       \
+	static test_registration_t	       /* What a host needs to run  */ \
+		test_registration_##name =     /* it, if there is one	    */ \
+		{ #name, test_set_##name } ;				       \
+									       \
+	static void test_register_##name (void) /* And one to be	    */ \
+		__attribute__((constructor)) ; /* autoexec'd before main()  */ \
+									       \
+	static void test_register_##name (void) { /* Which runs the set */     \
+		if (test_host_register)	       /* unless a host will later  */ \
+			test_host_register(&test_registration_##name) ;	       \
+		else							       \
+			test_set_##name() ; }				       \
+									       \
+	static void test_declare_##name (void) /* Count it before any set   */ \
+		__attribute__((constructor(102))) ; /* runs, for telemetry  */ \
+	static void test_declare_##name (void) { test_telemetry_declare() ; }  \
+									       \
+	void test_set_##name (void) {          /* And immediately define it */ \
+		test_telemetry_set_begin(#name) ;    /* Show it's running   */ \
+		if (test_incremental_set_begin(	     /* Skip it if nothing  */ \
+			(void *)test_set_##name,     /* it uses changed	    */ \
+			&test_registration_##name)) {			       \
+			test_telemetry_set_end() ;			       \
+			return ; }					       \
+		TEST_TIMING_BEGIN() ;		     /* If anyone's asking  */ \
+		TEST_SET_CONSTRUCTOR(name) ;         /* Phase: Construction */ \
+		__VA_ARGS__ ;                        /* Phase: Definition   */ \
+		TEST_TIMING_MARK(defined) ;				       \
+		TEST_SET_EXECUTOR() ;                /* Phase: Execution    */ \
+		test_registration_##name.passed =    /* Tell any host how   */ \
+			this->case_count_passed ;    /* it went		    */ \
+		test_registration_##name.total = this->case_count_total ;      \
+		TEST_TIMING_MARK(executed) ;				       \
+		TEST_SET_DESTRUCTOR() ;	             /* Phase: Destruction  */ \
+		this = NULL ;			     /* Gone, don't look    */ \
+		TEST_TIMING_MARK(destroyed) ;				       \
+		TEST_TIMING_REPORT(name) ;				       \
+		test_telemetry_set_end() ;			       	       \
+		test_schedule_stop(		     /* If --fail-fast says */ \
+			&test_registration_##name) ; }			       \
+									       \
+/* end #define TEST_SET							    */
+
+/* This is the decleration of the data format used to support a test set    */
+typedef struct test_set_data {
+	/* Test cases in the set. Takes case_id as a parameter in order to  */
+	/* to index the case_names array via a ptr to this struct           */
+	int (** cases)(size_t case_id) ;
+
+	/* Name strings for each test case 				    */
+	char ** case_names,
+
+	/* The name of this test set 				            */
+	      * set_name ;
+
+	/* The capacity of the space allocated for case func ptrs           */
+	size_t  case_capacity,
+
+	/* The number of defined test cases reachable via the array 	    */
+		case_count_total,
+
+	/* The number of passed test cases determined via execution 	    */
+		case_count_passed,
+
+	/* The number of bytes in the set_name string, including \0  	    */
+		set_name_size ;
+} test_set_data_t ;
+
+/* SECTION: INCREMENTAL RUNS */
+
+ /*
+  * Identifier:
+  * 		test_incremental_active(),
+  * 		test_incremental_set_begin(set_function, set),
+  * 		test_incremental_case_begin(), test_incremental_case_end(set,
+  * 		i, passed)
+  *
+  * Purpose:
+  * 		Skip the cases a change can't have affected. Built with the
+  * 	       +INCREMENTAL option, -finstrument-functions and
+  * 	       +-Wl,--emit-relocs (see make incremental), the test program
+  * 	       +learns which functions each case calls and, on the next run,
+  * 	       +only reruns sets in which one of them has changed.
+  *
+  * Inputs:
+  * 	   set_function	: The function a TEST_SET generates, whose
+  * 	   		 +definition phase every case depends on
+  *
+  * 		    set	: Its registration, given its counts if it's skipped
+  *
+  * 		    set	: The test set
+  *
+  * 		      i	: A case in it
+  *
+  * 		 passed	: Whether it did
+  *
+  * Resolution:
+  * 		The program reads its own symbol table and hashes every
+  * 	       +function's code with the relocated fields zeroed. What they
+  * 	       +referred to is hashed in instead: symbol names, the contents
+  * 	       +of objects, and the text of string literals. So code that
+  * 	       +merely moved keeps its hash. Local symbols are known by
+  * 	       +file:name, with GCC's numbered suffixes dropped so that
+  * 	       +"function_identifier.12" is still itself when it becomes .13.
+  *
+  * 	       +While the definition phase and then each case runs, the
+  * 	       +instrumentation hooks note which functions are entered. After
+  * 	       +a case, the names and hashes of those functions are saved
+  * 	       +with its outcome in TEST_INCREMENTAL_DEFAULT. A case that
+  * 	       +passed last time, and whose every function is still in the
+  * 	       +program with the same hash, is unchanged. Cases share their
+  * 	       +set's scope and the work its definition phase did, and often
+  * 	       +lean on the cases before them, so it's whole sets that are
+  * 	       +skipped: test_incremental_set_begin() returns nonzero, before
+  * 	       +the definition phase, if every case in the set is unchanged,
+  * 	       +and the set is reported as passing. A set with any changed
+  * 	       +case runs whole. The file is saved as the program exits.
+  *
+  * 	       +Anything that can't be worked out counts as a change: a case
+  * 	       +with no record, one that touched too many functions, or an
+  * 	       +address outside the program. Without a symbol table, or off
+  * 	       +x86_64, every set runs and none are recorded.
+  *
+  * Requirements:
+  * 		Only one file of the test program may include this header
+  * 	       +with the INCREMENTAL option, since it defines the
+  * 	       +instrumentation hooks. Workers aren't used in this mode, as
+  * 	       +what a case touches is only seen in the process it ran in.
+  */
+#if defined(TEST_OPTION_INCREMENTAL) && defined(__x86_64__)
+#include <elf.h>
+
+/* Where what each case touched is kept					    */
+#define TEST_INCREMENTAL_DEFAULT ".lil_test_incremental"
+
+/* First line of that file, so a stray file isn't taken for it		    */
+#define TEST_INCREMENTAL_MAGIC "lil_test-incremental-1"
+
+/* Room in each set of touched functions, kept under three quarters full */
+#define TEST_TOUCHED_BITS 14
+#define TEST_TOUCHED_SIZE (1 << TEST_TOUCHED_BITS)
+
+/* Room for a symbol's key, and for a line of the file		    */
+#define TEST_INCREMENTAL_KEY_SIZE 1024
+
+/* Start of the program as loaded, to tell run time addresses from link   */
+/* time ones. Defined by the linker					    */
+extern const char __executable_start[] ;
+
+/* A function or object in the program					    */
+typedef struct test_symbol {
+	/* Link time address and size					    */
+	uintptr_t addr ;
+	size_t size ;
+
+	/* name, or file:name for a local, without GCC's .N suffixes	    */
+	char * key ;
+
+	/* Of its bytes with relocated fields zeroed, and what they refer to */
+	uint64_t hash ;
+
+	/* Nonzero for functions, zero for objects			    */
+	int function ;
+} test_symbol_t ;
+
+/* What a case touched the last time it ran				    */
+typedef struct test_incremental_record {
+	/* "set/test_case"						    */
+	char * name ;
+
+	/* How many cases by that name ran and passed, 0 if any failed   */
+	int passed ;
+
+	/* A "hash key" line per function, as in the file		    */
+	char * deps ;
+} test_incremental_record_t ;
+
+static struct {
+	/* Nonzero once the program and the file have been read		    */
+	int loaded ;
+
+	/* Nonzero if the program could be read at all			    */
+	int usable ;
+
+	/* Where the hooks note functions, NULL when not recording	    */
+	uintptr_t * recording ;
+
+	/* Set if more functions were touched than there was room for	    */
+	int overflowed ;
+
+	/* Run time address minus link time address			    */
+	uintptr_t bias ;
+
+	/* Functions and objects, by address, and just the functions by key */
+	test_symbol_t * symbols ;
+	test_symbol_t ** by_key ;
+	size_t symbol_count, function_count ;
+
+	/* Functions entered by the definition phase, then by one case	    */
+	uintptr_t defined[TEST_TOUCHED_SIZE], touched[TEST_TOUCHED_SIZE] ;
+	size_t defined_count, touched_count ;
+
+	/* Every case's record, by name					    */
+	test_incremental_record_t * records ;
+	size_t record_count, record_capacity ;
+} test_incremental = { 0 } ;
+
+/* Add fn to the set the hooks are recording into			    */
+__attribute__((no_instrument_function))
+static inline void test_incremental_touch(uintptr_t fn)
+{
+	uintptr_t * set = test_incremental.recording ;
+	size_t * count = set == test_incremental.defined
+			 ? &test_incremental.defined_count
+			 : &test_incremental.touched_count ;
+	size_t slot = (fn >> 4) * 0x9E3779B97F4A7C15ULL
+		      >> (64 - TEST_TOUCHED_BITS) ;
+
+	while (set[slot] && set[slot] != fn)
+		slot = (slot + 1) & (TEST_TOUCHED_SIZE - 1) ;
+	if (set[slot]) return ;
+
+	if (*count >= TEST_TOUCHED_SIZE / 4 * 3) {
+		/* 1 if the definition phase overflowed, 2 if the case did  */
+		test_incremental.overflowed |= set == test_incremental.defined
+					       ? 1 : 2 ;
+		return ;
+	}
+	set[slot] = fn ;
+	++*count ;
+}
+
+/* Called on entry to every instrumented function			    */
+__attribute__((no_instrument_function))
+void __cyg_profile_func_enter(void * fn, void * call_site)
+{
+	if (test_incremental.recording) test_incremental_touch((uintptr_t)fn) ;
+}
+
+__attribute__((no_instrument_function))
+void __cyg_profile_func_exit(void * fn, void * call_site)
+{
+}
+
+__attribute__((no_instrument_function))
+static int test_symbol_by_addr(const void * a, const void * b)
+{
+	const test_symbol_t * x = a, * y = b ;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr ;
+}
+
+__attribute__((no_instrument_function))
+static int test_symbol_by_key(const void * a, const void * b)
+{
+	const test_symbol_t * x = *(test_symbol_t * const *)a,
+			    * y = *(test_symbol_t * const *)b ;
+	int order = strcmp(x->key, y->key) ;
+
+	if (order) return order ;
+
+	return x->hash < y->hash ? -1 : x->hash > y->hash ;
+}
+
+__attribute__((no_instrument_function))
+static int test_rela_by_offset(const void * a, const void * b)
+{
+	const Elf64_Rela * x = a, * y = b ;
+
+	return x->r_offset < y->r_offset ? -1 : x->r_offset > y->r_offset ;
+}
+
+/* The symbol containing link time address addr, or NULL		    */
+__attribute__((no_instrument_function))
+static inline test_symbol_t * test_symbol_at(uintptr_t addr, int function)
+{
+	size_t low = 0, high = test_incremental.symbol_count, mid ;
+	test_symbol_t * symbol ;
+
+	while (low < high) {
+		mid = low + (high - low) / 2 ;
+		if (test_incremental.symbols[mid].addr <= addr) low = mid + 1 ;
+		else high = mid ;
+	}
+
+	/* Objects and functions don't overlap, but a size 0 one might      */
+	for (; low--; ) {
+		symbol = test_incremental.symbols + low ;
+		if (addr >= symbol->addr + symbol->size) return NULL ;
+		if (symbol->function == function || function < 0)
+			return symbol ;
+	}
+
+	return NULL ;
+}
+
+/* Bytes a relocation of type fills in, and whether it's PC relative      */
+__attribute__((no_instrument_function))
+static inline size_t test_rela_width(unsigned int type, int * pc_relative)
+{
+	*pc_relative = type == R_X86_64_PC32 || type == R_X86_64_PLT32
+		       || type == R_X86_64_GOTPCREL || type == R_X86_64_PC64
+		       || type == R_X86_64_GOTPCRELX
+		       || type == R_X86_64_REX_GOTPCRELX ;
+
+	switch (type) {
+	case R_X86_64_NONE : return 0 ;
+	case R_X86_64_64 :
+	case R_X86_64_PC64 :
+	case R_X86_64_GOTOFF64 : return 8 ;
+	default : return 4 ;
+	}
+}
+
+ /*
+  * Identifier:
+  * 		test_incremental_hash(image, sections, section, names, syms,
+  * 		keys, relas, rela_count, symbol)
+  *
+  * Purpose:
+  * 		Hash one symbol of the program so that the hash only changes
+  * 	       +if what the symbol does does.
+  *
+  * Resolution:
+  * 		Its bytes are copied and each relocated field in them zeroed.
+  * 	       +For each, what it points at goes into the hash: the target
+  * 	       +symbol's key, and its hash too if it's an already hashed
+  * 	       +object, or the text of a string literal, or else the section
+  * 	       +name. Objects are hashed before functions, so functions
+  * 	       +can include them. Symbols with no bytes hash their key.
+  */
+__attribute__((no_instrument_function))
+static inline uint64_t test_incremental_hash(const unsigned char * image,
+					     const Elf64_Shdr * sections,
+					     size_t section,
+					     const char * names,
+					     const Elf64_Sym * syms,
+					     char ** keys,
+					     const Elf64_Rela * relas,
+					     size_t rela_count,
+					     const test_symbol_t * symbol)
+{
+	const Elf64_Shdr * home = sections + section ;
+	unsigned char * bytes = NULL ;
+	uint64_t hash = test_hash64(symbol->key, strlen(symbol->key)),
+		 mix[2] ;
+	size_t low = 0, high = rela_count, mid, width ;
+	int pc_relative ;
+
+	if (!section || home->sh_type == SHT_NOBITS || !symbol->size)
+		return hash ;
+
+	REALLOCATE_OR_DIE(bytes, symbol->size) ;
+	memcpy(bytes, image + home->sh_offset + symbol->addr - home->sh_addr,
+	       symbol->size) ;
+
+	/* The first relocation at or after the symbol			    */
+	while (low < high) {
+		mid = low + (high - low) / 2 ;
+		if (relas[mid].r_offset < symbol->addr) low = mid + 1 ;
+		else high = mid ;
+	}
+
+	for (; low < rela_count
+	       && relas[low].r_offset < symbol->addr + symbol->size; ++low) {
+		const Elf64_Rela * rela = relas + low ;
+		const Elf64_Sym * target = syms + ELF64_R_SYM(rela->r_info) ;
+		size_t at = rela->r_offset - symbol->addr ;
+		const char * what = keys[ELF64_R_SYM(rela->r_info)] ;
+		uint64_t detail = 0 ;
+
+		width = test_rela_width(ELF64_R_TYPE(rela->r_info),
+					&pc_relative) ;
+		memset(bytes + at, 0, at + width <= symbol->size
+				      ? width : symbol->size - at) ;
+
+		if (ELF64_ST_TYPE(target->st_info) == STT_SECTION
+		    && target->st_shndx && target->st_shndx < SHN_LORESERVE) {
+			/* Local things are referred to by section + offset  */
+			const Elf64_Shdr * into = sections + target->st_shndx ;
+			uintptr_t addr = target->st_value + rela->r_addend
+					 + (pc_relative ? 4 : 0) ;
+			const test_symbol_t * found = test_symbol_at(addr, -1) ;
+
+			what = names + into->sh_name ;
+			if (found) {
+				what = found->key ;
+				detail = found->function ? 0 : found->hash ;
+			} else if ((into->sh_flags & SHF_STRINGS)
+				   && into->sh_type == SHT_PROGBITS
+				   && addr >= into->sh_addr
+				   && addr < into->sh_addr + into->sh_size) {
+				const char * text = (const char *)image
+					+ into->sh_offset + addr - into->sh_addr ;
+
+				detail = test_hash64(text, strnlen(text,
+					into->sh_addr + into->sh_size - addr)) ;
+			}
+		} else if (!what) {
+			what = "" ;
+		} else if ((size_t)(target - syms) && target->st_shndx
+			   && target->st_shndx < SHN_LORESERVE) {
+			const test_symbol_t * found =
+				test_symbol_at(target->st_value, 0) ;
+
+			if (found && found->addr == target->st_value)
+				detail = found->hash ;
+		}
+
+		mix[0] = hash ^ test_hash64(what, strlen(what)) ;
+		mix[1] = detail + at ;
+		hash = test_hash64(mix, sizeof(mix)) ;
+	}
+
+	hash ^= test_hash64(bytes, symbol->size) ;
+	free(bytes) ;
+
+	return hash ;
+}
+
+ /*
+  * Identifier:
+  * 		test_incremental_load_program()
+  *
+  * Purpose:
+  * 		Read and hash every function and object in the test program.
+  *
+  * Resolution:
+  * 		/proc/self/exe is mapped and its .symtab and the relocations
+  * 	       +--emit-relocs left in are read. test_incremental.usable is
+  * 	       +set if that worked.
+  */
+__attribute__((no_instrument_function))
+static inline void test_incremental_load_program(void)
+{
+	const unsigned char * image ;
+	const Elf64_Ehdr * header ;
+	const Elf64_Shdr * sections, * symtab = NULL ;
+	const Elf64_Sym * syms ;
+	const char * strtab, * names, * file = "" ;
+	Elf64_Rela * relas = NULL ;
+	char ** keys = NULL, * kept = NULL, key[TEST_INCREMENTAL_KEY_SIZE] ;
+	size_t size, sym_count, rela_count = 0, count = 0, functions = 0 ;
+	struct stat st ;
+	int fd, based = 0 ;
+
+	if ((fd = open("/proc/self/exe", O_RDONLY)) < 0) return ;
+	if (fstat(fd, &st) || (size = st.st_size) < sizeof(*header)
+	    || (image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0))
+	       == MAP_FAILED) {
+		close(fd) ;
+		return ;
+	}
+	close(fd) ;
+
+	header = (const Elf64_Ehdr *)image ;
+	sections = (const Elf64_Shdr *)(image + header->e_shoff) ;
+	if (memcmp(header->e_ident, ELFMAG, SELFMAG)
+	    || header->e_ident[EI_CLASS] != ELFCLASS64
+	    || header->e_machine != EM_X86_64
+	    || header->e_shoff + header->e_shnum * sizeof(*sections) > size) {
+		munmap((void *)image, size) ;
+		return ;
+	}
+
+	for (size_t i = 0; i < header->e_shnum; ++i) {
+		if (sections[i].sh_type == SHT_SYMTAB) symtab = sections + i ;
+	}
+	if (!symtab) {
+		munmap((void *)image, size) ;
+		return ;
+	}
+
+	names = (const char *)image + sections[header->e_shstrndx].sh_offset ;
+	syms = (const Elf64_Sym *)(image + symtab->sh_offset) ;
+	sym_count = symtab->sh_size / sizeof(*syms) ;
+	strtab = (const char *)image + sections[symtab->sh_link].sh_offset ;
+
+	/* Every relocation into loaded sections, by address		    */
+	for (size_t i = 0; i < header->e_shnum; ++i) {
+		const Elf64_Shdr * rela = sections + i ;
+
+		if (rela->sh_type != SHT_RELA
+		    || rela->sh_link != (size_t)(symtab - sections)
+		    || !(sections[rela->sh_info].sh_flags & SHF_ALLOC))
+			continue ;
+		REALLOCATE_OR_DIE(relas, (rela_count + rela->sh_size
+					  / sizeof(*relas))) ;
+		memcpy(relas + rela_count, image + rela->sh_offset,
+		       rela->sh_size) ;
+		rela_count += rela->sh_size / sizeof(*relas) ;
+	}
+	if (!rela_count) { /* Not linked with --emit-relocs		    */
+		munmap((void *)image, size) ;
+		return ;
+	}
+	qsort(relas, rela_count, sizeof(*relas), test_rela_by_offset) ;
+
+	/* A key per symbol, and an entry per sized function and object     */
+	REALLOCATE_OR_DIE(keys, sym_count) ;
+	REALLOCATE_OR_DIE(kept, sym_count) ;
+	REALLOCATE_OR_DIE(test_incremental.symbols, sym_count) ;
+	memset(kept, 0, sym_count) ;
+	for (size_t i = 0; i < sym_count; ++i) {
+		const Elf64_Sym * sym = syms + i ;
+		const char * name = strtab + sym->st_name ;
+		int type = ELF64_ST_TYPE(sym->st_info) ;
+		size_t stem = *name ? strcspn(name + 1, ".") + 1 : 0 ;
+
+		keys[i] = NULL ;
+		if (type == STT_FILE) file = name ;
+		if (!*name || type == STT_FILE || type == STT_SECTION) continue ;
+
+		if (ELF64_ST_BIND(sym->st_info) == STB_LOCAL)
+			snprintf(key, sizeof(key), "%s:%.*s", file, (int)stem,
+				 name) ;
+		else
+			snprintf(key, sizeof(key), "%.*s", (int)stem, name) ;
+		REALLOCATE_OR_DIE(keys[i], (strlen(key) + 1)) ;
+		strcpy(keys[i], key) ; /* Safe: sized just above	    */
+
+		if (!strcmp(name, "__executable_start")) {
+			test_incremental.bias = (uintptr_t)__executable_start
+						- sym->st_value ;
+			based = 1 ;
+		}
+
+		if ((type != STT_FUNC && type != STT_OBJECT) || !sym->st_size
+		    || !sym->st_shndx || sym->st_shndx >= SHN_LORESERVE
+		    || sym->st_shndx >= header->e_shnum)
+			continue ;
+
+		test_incremental.symbols[count++] = (test_symbol_t) {
+			sym->st_value, sym->st_size, keys[i], 0,
+			type == STT_FUNC
+		} ;
+		functions += type == STT_FUNC ;
+		kept[i] = 1 ;
+	}
+	test_incremental.symbol_count = count ;
+	qsort(test_incremental.symbols, count, sizeof(test_symbol_t),
+	      test_symbol_by_addr) ;
+
+	/* Objects first, since functions take in the objects they use      */
+	for (int function = 0; function < 2; ++function) {
+		for (size_t i = 0; i < count; ++i) {
+			test_symbol_t * symbol = test_incremental.symbols + i ;
+			size_t section = 0 ;
+
+			if (symbol->function != function) continue ;
+			for (size_t s = 1; s < header->e_shnum; ++s) {
+				if ((sections[s].sh_flags & SHF_ALLOC)
+				    && symbol->addr >= sections[s].sh_addr
+				    && symbol->addr + symbol->size
+				       <= sections[s].sh_addr
+					  + sections[s].sh_size) {
+					section = s ;
+					break ;
+				}
+			}
+			symbol->hash = test_incremental_hash(image, sections,
+				section, names, syms, keys, relas, rela_count,
+				symbol) ;
+		}
+	}
+
+	/* The keys of symbols that aren't functions or objects aren't kept */
+	for (size_t i = 0; i < sym_count; ++i) {
+		if (!kept[i]) free(keys[i]) ;
+	}
+	free(keys) ;
+	free(kept) ;
+	free(relas) ;
+	munmap((void *)image, size) ;
+
+	REALLOCATE_OR_DIE(test_incremental.by_key, (functions ? functions : 1)) ;
+	for (size_t i = 0, j = 0; i < count; ++i) {
+		if (test_incremental.symbols[i].function)
+			test_incremental.by_key[j++] = test_incremental.symbols + i ;
+	}
+	test_incremental.function_count = functions ;
+	qsort(test_incremental.by_key, functions, sizeof(test_symbol_t *),
+	      test_symbol_by_key) ;
+
+	test_incremental.usable = based ;
+}
+
+/* The record for name, and where it is or would go			    */
+__attribute__((no_instrument_function))
+static inline test_incremental_record_t * test_incremental_find(
+	const char * name, size_t * at)
+{
+	size_t low = 0, high = test_incremental.record_count, mid ;
+	int order ;
+
+	while (low < high) {
+		mid = low + (high - low) / 2 ;
+		order = strcmp(name, test_incremental.records[mid].name) ;
+		if (!order) {
+			*at = mid ;
+			return test_incremental.records + mid ;
+		}
+		if (order < 0) high = mid ;
+		else low = mid + 1 ;
+	}
+	*at = low ;
+
+	return NULL ;
+}
+
+/* The record for name, made empty if there wasn't one		    */
+__attribute__((no_instrument_function))
+static inline test_incremental_record_t * test_incremental_insert(
+	const char * name)
+{
+	test_incremental_record_t * record ;
+	size_t at ;
+
+	if ((record = test_incremental_find(name, &at))) return record ;
+
+	if (test_incremental.record_count >= test_incremental.record_capacity) {
+		test_incremental.record_capacity =
+			test_incremental.record_capacity
+			? test_incremental.record_capacity * 2 : 64 ;
+		REALLOCATE_OR_DIE(test_incremental.records,
+				  test_incremental.record_capacity) ;
+	}
+
+	record = test_incremental.records + at ;
+	memmove(record + 1, record, (test_incremental.record_count++ - at)
+				    * sizeof(*record)) ;
+	record->name = NULL ;
+	REALLOCATE_OR_DIE(record->name, (strlen(name) + 1)) ;
+	strcpy(record->name, name) ; /* Safe: sized just above		    */
+	record->passed = 0 ;
+	record->deps = NULL ;
+
+	return record ;
+}
+
+/* Nonzero if snprintf() said it wrote len bytes of key into size and a */
+/* case name can't round trip through the file that way: cut short, or  */
+/* split in two by the %s that reads it back				    */
+__attribute__((no_instrument_function))
+static inline int test_incremental_unkeyable(const char * key, int len,
+					     size_t size)
+{
+	return len < 0 || (size_t)len >= size || strpbrk(key, " \t\n\v\f\r") ;
+}
+
+/* Read back what the last run saved, a "case name passed" line then its */
+/* "hash key" lines for each case					    */
+__attribute__((no_instrument_function))
+static inline void test_incremental_load_file(void)
+{
+	char line[TEST_INCREMENTAL_KEY_SIZE + 32],
+	     name[TEST_INCREMENTAL_KEY_SIZE], * text = NULL ;
+	test_incremental_record_t * record = NULL ;
+	FILE * stream, * deps = NULL ;
+	size_t size ;
+	int passed ;
+
+	if (!(stream = fopen(TEST_INCREMENTAL_DEFAULT, "r"))) return ;
+
+	if (!fgets(line, sizeof(line), stream)
+	    || strcmp(line, TEST_INCREMENTAL_MAGIC "\n")) {
+		fclose(stream) ;
+		return ;
+	}
+
+	while (fgets(line, sizeof(line), stream)) {
+		if (sscanf(line, "case %1023s %d", name, &passed) == 2) {
+			if (deps && !fclose(deps)) record->deps = text ;
+			record = test_incremental_insert(name) ;
+			record->passed = passed ;
+			deps = open_memstream(&text, &size) ;
+		} else if (deps) {
+			fputs(line, deps) ;
+		}
+	}
+	if (deps && !fclose(deps)) record->deps = text ;
+
+	fclose(stream) ;
+}
+
+__attribute__((no_instrument_function))
+static inline void test_incremental_save(void)
+{
+	char * text = NULL ;
+	size_t size = 0 ;
+	FILE * stream ;
+
+	if (!test_incremental.usable
+	    || !(stream = open_memstream(&text, &size)))
+		return ;
+
+	fprintf(stream, "%s\n", TEST_INCREMENTAL_MAGIC) ;
+	for (size_t i = 0; i < test_incremental.record_count; ++i) {
+		test_incremental_record_t * record = test_incremental.records
+						     + i ;
+
+		fprintf(stream, "case %s %d\n%s", record->name, record->passed,
+			record->deps ? record->deps : "") ;
+	}
+
+	if (!fclose(stream) && test_golden_write(TEST_INCREMENTAL_DEFAULT,
+						 text, size))
+		fprintf(stderr, "lil_test: can't save %s: %s\n",
+			TEST_INCREMENTAL_DEFAULT, strerror(errno)) ;
+	free(text) ;
+}
+
+/* Save what this run learned, then free what was read, which lives as */
+/* long as the program							    */
+__attribute__((no_instrument_function, destructor))
+static void test_incremental_free(void)
+{
+	test_incremental.recording = NULL ;
+	test_incremental_save() ;
+
+	for (size_t i = 0; i < test_incremental.symbol_count; ++i)
+		free(test_incremental.symbols[i].key) ;
+	free(test_incremental.symbols) ;
+	free(test_incremental.by_key) ;
+
+	for (size_t i = 0; i < test_incremental.record_count; ++i) {
+		free(test_incremental.records[i].name) ;
+		free(test_incremental.records[i].deps) ;
+	}
+	free(test_incremental.records) ;
+}
+
+/* Nonzero if cases can be skipped, reading everything the first time     */
+__attribute__((no_instrument_function))
+static inline int test_incremental_active(void)
+{
+	if (!test_incremental.loaded) {
+		test_incremental.loaded = 1 ;
+		test_incremental_load_program() ;
+
+		if (test_incremental.usable) test_incremental_load_file() ;
+		else fprintf(stderr, "lil_test: no symbols or relocations in "
+			     "this program, running every case\n") ;
+	}
+
+	return test_incremental.usable ;
+}
+
+/* Nonzero if every function a case's record names is still the same    */
+__attribute__((no_instrument_function))
+static inline int test_incremental_current(test_incremental_record_t * record)
+{
+	char key[TEST_INCREMENTAL_KEY_SIZE] ;
+	test_symbol_t probe = { 0 }, * wanted = &probe ;
+	unsigned long long hash ;
+
+	if (!record->passed || !record->deps) return 0 ;
+
+	for (const char * line = record->deps; *line;
+	     line = strchr(line, '\n') + 1) {
+		if (sscanf(line, "%llx %1023s", &hash, key) != 2) return 0 ;
+		probe.key = key ;
+		probe.hash = hash ;
+		if (!bsearch(&wanted, test_incremental.by_key,
+			     test_incremental.function_count,
+			     sizeof(test_symbol_t *), test_symbol_by_key))
+			return 0 ;
+	}
+
+	return 1 ;
+}
+
+__attribute__((no_instrument_function))
+static inline int test_incremental_set_begin(void * set_function,
+					     test_registration_t * set)
+{
+	char prefix[TEST_INCREMENTAL_KEY_SIZE] ;
+	size_t first, last, prefix_size, current = 0, unchanged = 0 ;
+
+	if (!test_incremental_active()) return 0 ;
+
+	/* The set's records sort together, as "set/...". A set whose name  */
+	/* can't be a key has none, so it always runs			    */
+	prefix_size = snprintf(prefix, sizeof(prefix), "%s/", set->name) ;
+	if (test_incremental_unkeyable(prefix, prefix_size, sizeof(prefix)))
+		return 0 ;
+	test_incremental_find(prefix, &first) ;
+	for (last = first; last < test_incremental.record_count
+	     && !strncmp(test_incremental.records[last].name, prefix,
+			 prefix_size); ++last) {
+		if (test_incremental_current(test_incremental.records + last)) {
+			current++ ;
+			unchanged += test_incremental.records[last].passed ;
+		}
+	}
+
+	/* Every case was run last time and passed, so none is rerun. A    */
+	/* case added or removed changes the set's own function		    */
+	if (current && current == last - first) {
+		fprintf(stdout, "UNCHANGED since they passed, "
+			"%lu test cases not rerun.\n"
+			"\nFINISHED TEST_SET: %s\n"
+			"\tPassed %lu/%lu test cases.\n\n",
+			unchanged, set->name, unchanged, unchanged) ;
+		set->passed = set->total = unchanged ;
+		return 1 ;
+	}
+
+	/* Otherwise it runs whole, and its cases are recorded afresh	    */
+	for (size_t i = first; i < last; ++i) {
+		free(test_incremental.records[i].name) ;
+		free(test_incremental.records[i].deps) ;
+	}
+	memmove(test_incremental.records + first,
+		test_incremental.records + last,
+		(test_incremental.record_count - last)
+		* sizeof(*test_incremental.records)) ;
+	test_incremental.record_count -= last - first ;
+
+	memset(test_incremental.defined, 0, sizeof(test_incremental.defined)) ;
+	test_incremental.defined_count = 0 ;
+	test_incremental.overflowed = 0 ;
+	test_incremental.recording = test_incremental.defined ;
+	test_incremental_touch((uintptr_t)set_function) ;
+
+	return 0 ;
+}
+
+__attribute__((no_instrument_function))
+static inline void test_incremental_case_begin(void)
+{
+	if (!test_incremental.usable) return ;
+
+	memset(test_incremental.touched, 0, sizeof(test_incremental.touched)) ;
+	test_incremental.touched_count = 0 ;
+	test_incremental.overflowed &= ~2 ;
+	test_incremental.recording = test_incremental.touched ;
+}
+
+/* Nonzero if fn is in set						    */
+__attribute__((no_instrument_function))
+static inline int test_incremental_has(const uintptr_t * set, uintptr_t fn)
+{
+	size_t slot = (fn >> 4) * 0x9E3779B97F4A7C15ULL
+		      >> (64 - TEST_TOUCHED_BITS) ;
+
+	while (set[slot] && set[slot] != fn)
+		slot = (slot + 1) & (TEST_TOUCHED_SIZE - 1) ;
+
+	return set[slot] == fn ;
+}
+
+/* Write the line for a function the case touched, or one that never     */
+/* matches if it isn't one of the program's				    */
+__attribute__((no_instrument_function))
+static inline void test_incremental_depend(FILE * deps, uintptr_t fn)
+{
+	test_symbol_t * symbol = test_symbol_at(fn - test_incremental.bias, 1) ;
+
+	if (symbol && symbol->addr == fn - test_incremental.bias)
+		fprintf(deps, "%016llx %s\n", (unsigned long long)symbol->hash,
+			symbol->key) ;
+	else
+		fprintf(deps, "0 ?\n") ;
+}
+
+__attribute__((no_instrument_function))
+static inline void test_incremental_case_end(test_set_data_t * set, size_t i,
+					     int passed)
+{
+	char name[TEST_INCREMENTAL_KEY_SIZE], * text = NULL ;
+	test_incremental_record_t * record ;
+	size_t size, at ;
+	FILE * deps ;
+	int again, len ;
+
+	if (!test_incremental.usable) return ;
+	test_incremental.recording = NULL ;
+
+	/* Cases may share a name, they then share a record too. One whose  */
+	/* name can't be a key is changed every time instead: it leaves a   */
+	/* failed record under the bare "set/" so the whole set reruns	    */
+	len = snprintf(name, sizeof(name), "%s/%s", set->set_name,
+		       set->case_names[i]) ;
+	if (test_incremental_unkeyable(name, len, sizeof(name))) {
+		len = snprintf(name, sizeof(name), "%s/", set->set_name) ;
+		if (test_incremental_unkeyable(name, len, sizeof(name)))
+			return ;
+		passed = 0 ;
+	}
+	again = test_incremental_find(name, &at) != NULL ;
+	record = test_incremental_insert(name) ;
+
+	/* Whatever it touched past the first few thousand is unknown, so  */
+	/* it's as good as failed					    */
+	if (!passed || test_incremental.overflowed
+	    || (again && !record->passed)
+	    || !(deps = open_memstream(&text, &size))) {
+		record->passed = 0 ;
+		free(record->deps) ;
+		record->deps = NULL ;
+		return ;
+	}
+	record->passed++ ;
+
+	if (record->deps) fputs(record->deps, deps) ;
+	free(record->deps) ;
+	record->deps = NULL ;
+
+	for (size_t j = 0; j < TEST_TOUCHED_SIZE; ++j) {
+		if (test_incremental.defined[j])
+			test_incremental_depend(deps,
+						test_incremental.defined[j]) ;
+	}
+	for (size_t j = 0; j < TEST_TOUCHED_SIZE; ++j) {
+		if (test_incremental.touched[j]
+		    && !test_incremental_has(test_incremental.defined,
+					     test_incremental.touched[j]))
+			test_incremental_depend(deps,
+						test_incremental.touched[j]) ;
+	}
+
+	if (!fclose(deps)) record->deps = text ;
+}
+#else
+static inline int test_incremental_active(void) { return 0 ; }
+static inline int test_incremental_set_begin(void * set_function,
+					     test_registration_t * set)
+{
+	return 0 ;
+}
+static inline void test_incremental_case_begin(void) { }
+static inline void test_incremental_case_end(test_set_data_t * set, size_t i,
+					     int passed) { }
+#endif /* if defined(TEST_OPTION_INCREMENTAL) && defined(__x86_64__) */
+
+/* SECTION: TELEMETRY */
+
+/* Where a test program publishes its progress, by pid			    */
+#define TEST_TELEMETRY_PATH "/dev/shm/lil_test.%d"
+
+/* Set last, once the rest of a segment can be read			    */
+#define TEST_TELEMETRY_MAGIC 0x316c65745f6c696cULL /* "lil_tel1" */
+
+/* Workers with a slot of their own, the main process included		    */
+#define TEST_TELEMETRY_WORKERS 64
+
+/* Longest "set/test_name" published, truncated past that		    */
+#define TEST_TELEMETRY_NAME_SIZE 104
+
+/* What one process is running. Only that process writes it		    */
+typedef struct test_telemetry_worker {
+	/* Odd while the rest is being written				    */
+	unsigned long long seq ;
+
+	/* When the case started, 0 between cases			    */
+	unsigned long long since ;
+
+	/* The process, 0 if the slot was never used			    */
+	int pid ;
+
+	/* "set/test_name" of the case					    */
+	char name[TEST_TELEMETRY_NAME_SIZE] ;
+} __attribute__((aligned(64))) test_telemetry_worker_t ;
+
+/* Which test sets are done. Only the main process writes it		    */
+typedef struct test_telemetry_progress {
+	/* Test sets finished and declared				    */
+	size_t sets_done, sets_total ;
+
+	/* The one running, "" between sets				    */
+	char set[TEST_TELEMETRY_NAME_SIZE] ;
+} test_telemetry_progress_t ;
+
+/* A test program's progress, as lil_test_top finds it in shared memory  */
+typedef struct test_telemetry {
+	/* TEST_TELEMETRY_MAGIC once the segment is ready		    */
+	unsigned long long magic ;
+
+	/* The test program, and the size of worker[]			    */
+	int pid ;
+	unsigned int workers ;
+
+	/* CLOCK_MONOTONIC when it started and, 0 until then, finished	    */
+	unsigned long long started, finished ;
+
+	/* Odd while progress is being written				    */
+	unsigned long long seq __attribute__((aligned(64))) ;
+	test_telemetry_progress_t progress ;
+
+	/* Cases finished, counted atomically by whichever process ran them */
+	unsigned long long passed __attribute__((aligned(64))), failed ;
+
+	test_telemetry_worker_t worker[TEST_TELEMETRY_WORKERS] ;
+} test_telemetry_t ;
+
+/* The segment, who made it, and how many test sets there are. Weak and  */
+/* not static, so that lil_test_host and every suite it loads share one  */
+__attribute__((weak)) struct {
+	test_telemetry_t * segment ;
+	int owner ;
+	size_t sets ;
+} test_telemetry_shared = { 0 } ;
+
+/* The worker[] slot this process writes, -1 for none			    */
+static int test_telemetry_slot = 0 ;
+
+ /*
+  * Identifier:
+  * 		test_telemetry_write_begin(seq), test_telemetry_write_end(seq)
+  *
+  * Purpose:
+  * 		Bracket the writes of a seqlock, so a reader in another
+  * 	       +process can take a consistent copy without a lock or a
+  * 	       +syscall on either side.
+  *
+  * Inputs:
+  * 		    seq	: The sequence count guarding the fields written
+  *
+  * Resolution:
+  * 		seq is odd from begin to end. A reader copies the fields
+  * 	       +between two loads of seq and keeps the copy only if both
+  * 	       +were the same even number.
+  *
+  * Requirements:
+  * 		Only one process ever writes under a given seq
+  */
+static inline void test_telemetry_write_begin(unsigned long long * seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED) ;
+	__atomic_thread_fence(__ATOMIC_RELEASE) ;
+}
+
+static inline void test_telemetry_write_end(unsigned long long * seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE) ;
+}
+
+/* Count a test set, before any of them run				    */
+static inline void test_telemetry_declare(void)
+{
+	test_telemetry_shared.sets++ ;
+}
+
+/* Make a segment at path, ready for lil_test_top to read, without	    */
+/* publishing anything to it. NULL, with errno set, if it can't be made  */
+static inline test_telemetry_t * test_telemetry_map(const char * path)
+{
+	test_telemetry_t * telemetry ;
+	int fd, saved ;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) ;
+	if (fd < 0 || ftruncate(fd, sizeof(*telemetry))
+	    || (telemetry = mmap(NULL, sizeof(*telemetry),
+				 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))
+	       == MAP_FAILED) {
+		saved = errno ;
+		if (fd >= 0) close(fd) ;
+		unlink(path) ;
+		errno = saved ;
+		return NULL ;
+	}
+	close(fd) ;
+
+	telemetry->pid = getpid() ;
+	telemetry->workers = TEST_TELEMETRY_WORKERS ;
+	telemetry->started = test_timing_now() ;
+	telemetry->progress.sets_total = test_telemetry_shared.sets ;
+	telemetry->worker[0].pid = telemetry->pid ;
+	__atomic_store_n(&telemetry->magic, TEST_TELEMETRY_MAGIC,
+			 __ATOMIC_RELEASE) ;
+
+	return telemetry ;
+}
+
+/* Map the segment, the first time anything is published under	    */
+/* --telemetry. NULL if there isn't one					    */
+static inline test_telemetry_t * test_telemetry_open(void)
+{
+	test_telemetry_t * telemetry ;
+	char path[64] ;
+
+	if (test_telemetry_shared.segment || !test_options.telemetry)
+		return test_telemetry_shared.segment ;
+	test_options.telemetry = 0 ;	/* Only try once		    */
+
+	snprintf(path, sizeof(path), TEST_TELEMETRY_PATH, getpid()) ;
+	if (!(telemetry = test_telemetry_map(path))) {
+		fprintf(stderr, "lil_test: can't publish telemetry at %s: "
+			"%s\n", path, strerror(errno)) ;
+		return NULL ;
+	}
+
+	test_telemetry_shared.owner = telemetry->pid ;
+
+	return test_telemetry_shared.segment = telemetry ;
+}
+
+/* Say the run is over and take the segment's name away, so a watching  */
+/* lil_test_top shows the end and nothing new finds it		    */
+__attribute__((destructor))
+static void test_telemetry_close(void)
+{
+	test_telemetry_t * telemetry = test_telemetry_shared.segment ;
+	char path[64] ;
+
+	/* Other suites leave it to whichever made it			    */
+	if (!telemetry || test_telemetry_shared.owner != getpid()) return ;
+	test_telemetry_shared.owner = 0 ;
+
+	__atomic_store_n(&telemetry->finished, test_timing_now(),
+			 __ATOMIC_RELEASE) ;
+	snprintf(path, sizeof(path), TEST_TELEMETRY_PATH, telemetry->pid) ;
+	unlink(path) ;
+}
+
+/* Publish that the main process is starting a test set			    */
+static inline void test_telemetry_set_begin(const char * name)
+{
+	test_telemetry_t * telemetry = test_telemetry_open() ;
+
+	if (!telemetry) return ;
+
+	test_telemetry_write_begin(&telemetry->seq) ;
+	telemetry->progress.sets_total = test_telemetry_shared.sets ;
+	snprintf(telemetry->progress.set, sizeof(telemetry->progress.set),
+		 "%s", name) ;
+	test_telemetry_write_end(&telemetry->seq) ;
+}
+
+/* Publish that the main process finished a test set, or skipped it	    */
+static inline void test_telemetry_set_end(void)
+{
+	test_telemetry_t * telemetry = test_telemetry_shared.segment ;
+
+	if (!telemetry) return ;
+
+	test_telemetry_write_begin(&telemetry->seq) ;
+	telemetry->progress.sets_done++ ;
+	telemetry->progress.set[0] = '\0' ;
+	test_telemetry_write_end(&telemetry->seq) ;
+}
+
+/* Take worker[slot], in a newly forked worker process. Those past the   */
+/* last slot still count cases but show no current case		    */
+static inline void test_telemetry_worker(unsigned int slot)
+{
+	test_telemetry_t * telemetry = test_telemetry_shared.segment ;
+
+	test_telemetry_slot = slot < TEST_TELEMETRY_WORKERS ? (int)slot : -1 ;
+	if (!telemetry || test_telemetry_slot < 0) return ;
+
+	test_telemetry_write_begin(&telemetry->worker[slot].seq) ;
+	telemetry->worker[slot].pid = getpid() ;
+	telemetry->worker[slot].since = 0 ;
+	telemetry->worker[slot].name[0] = '\0' ;
+	test_telemetry_write_end(&telemetry->worker[slot].seq) ;
+}
+
+/* Publish in worker that set/name is running, or with a NULL name that */
+/* nothing is							    */
+static inline void test_telemetry_worker_write(test_telemetry_worker_t * worker,
+					       const char * set,
+					       const char * name)
+{
+	test_telemetry_write_begin(&worker->seq) ;
+	worker->since = name ? test_timing_now() : 0 ;
+	if (name)
+		snprintf(worker->name, sizeof(worker->name), "%s/%s", set,
+			 name) ;
+	else
+		worker->name[0] = '\0' ;
+	test_telemetry_write_end(&worker->seq) ;
+}
+
+/* Publish that this process is starting case i of set			    */
+static inline void test_telemetry_case_begin(test_set_data_t * set, size_t i)
+{
+	if (!test_telemetry_shared.segment || test_telemetry_slot < 0) return ;
+
+	test_telemetry_worker_write(test_telemetry_shared.segment->worker
+				    + test_telemetry_slot, set->set_name,
+				    set->case_names[i]) ;
+}
+
+/* Publish that this process finished its case, and how it went	    */
+static inline void test_telemetry_case_end(int passed)
+{
+	test_telemetry_t * telemetry = test_telemetry_shared.segment ;
+
+	if (!telemetry) return ;
+
+	__atomic_fetch_add(passed ? &telemetry->passed : &telemetry->failed,
+			   1, __ATOMIC_RELAXED) ;
+	if (test_telemetry_slot < 0) return ;
+
+	test_telemetry_worker_write(telemetry->worker + test_telemetry_slot,
+				    NULL, NULL) ;
+}
+
+/* SECTION: TRACING */
+
+/* lil_db, if it's linked in. Weak, so lil_test doesn't need it            */
+unsigned int lil_db_span_begin(const char * name) __attribute__((weak)) ;
+void lil_db_span_unwind(unsigned int depth) __attribute__((weak)) ;
+int lil_db_trace_start(size_t events) __attribute__((weak)) ;
+uint64_t lil_db_trace_dropped(void) __attribute__((weak)) ;
+int lil_db_trace_write(const char * path) __attribute__((weak)) ;
+
+/* The spans of cases run under --trace				    */
+static struct {
+	/* The process tracing, 0 if none				    */
+	int pid ;
+
+	/* "set/test_name" of every case traced. Spans keep their names by  */
+	/* pointer, and the sets free theirs long before the trace is written */
+	char ** names ;
+	size_t count, capacity ;
+} test_trace = { 0 } ;
+
+ /*
+  * Identifier:
+  * 		test_trace_start(), test_trace_case_begin(set, i),
+  * 		test_trace_case_end(depth), test_trace_write()
+  *
+  * Purpose:
+  * 		Put each case on the same timeline as the lil_db spans it
+  * 	       +opens, so one trace shows where a case spent its time and
+  * 	       +where one case ended and the next began.
+  *
+  * Inputs:
+  * 		    set	: The test set data of the case
+  *
+  * 		      i	: The index of the case in set
+  *
+  * 		  depth	: What test_trace_case_begin returned
+  *
+  * Resolution:
+  * 		Under --trace FILE, lil_db starts tracing before any test set
+  * 	       +runs, each case is a span called "set/test_name" in the
+  * 	       +category lil_db, and FILE is written at exit, along with a
+  * 	       +line saying how many cases it holds. A case that returns
+  * 	       +out of spans it opened, by a failed assertion say, has them
+  * 	       +closed at its end.
+  *
+  * Requirements:
+  * 		lil_db linked in, or --trace is ignored with a warning. Only
+  * 	       +the process that started is traced: cases run in --jobs or
+  * 	       +--repeat worker processes aren't in the trace. Under
+  * 	       +lil_test_host, each suite links its own lil_db, and so writes
+  * 	       +FILE in turn.
+  */
+__attribute__((constructor(102)))
+static void test_trace_start(void)
+{
+	if (!test_options.trace || !lil_db_trace_start) return ;
+
+	lil_db_trace_start(0) ;
+	test_trace.pid = getpid() ;
+}
+
+static inline unsigned int test_trace_case_begin(test_set_data_t * set,
+						 size_t i)
+{
+	size_t size ;
+	char * name = NULL ;
+
+	if (!test_trace.pid) {
+		if (test_options.trace) {
+			fprintf(stderr, "lil_test: --trace needs lil_db, "
+				"ignoring it\n") ;
+			test_options.trace = NULL ;
+		}
+		return 0 ;
+	}
+	if (test_trace.pid != getpid()) return 0 ;
+
+	size = strlen(set->set_name) + strlen(set->case_names[i]) + 2 ;
+	REALLOCATE_OR_DIE(name, size) ;
+	snprintf(name, size, "%s/%s", set->set_name, set->case_names[i]) ;
+
+	if (test_trace.count >= test_trace.capacity) {
+		test_trace.capacity = test_trace.capacity
+				      ? test_trace.capacity * 2 : 64 ;
+		REALLOCATE_OR_DIE(test_trace.names, test_trace.capacity) ;
+	}
+	test_trace.names[test_trace.count++] = name ;
+
+	return lil_db_span_begin(name) ;
+}
+
+static inline void test_trace_case_end(unsigned int depth)
+{
+	if (depth) lil_db_span_unwind(depth - 1) ;
+}
+
+__attribute__((destructor))
+static void test_trace_write(void)
+{
+	if (!test_trace.pid || test_trace.pid != getpid()) return ;
+	test_trace.pid = 0 ;
+
+	if (lil_db_trace_write(test_options.trace))
+		fprintf(stderr, "lil_test: can't write trace to %s: %s\n",
+			test_options.trace, strerror(errno)) ;
+	else
+		fprintf(stdout, "TRACED %lu test cases to %s, %llu spans "
+			"dropped\n", test_trace.count, test_options.trace,
+			(unsigned long long)lil_db_trace_dropped()) ;
+	fflush(stdout) ;
+
+	while (test_trace.count--) free(test_trace.names[test_trace.count]) ;
+	free(test_trace.names) ;
+}
+
+/* SECTION: SCHEDULING */
+
+/* How many runs a failure keeps a case at the front under --failed-first */
+#define TEST_HISTORY_RECENT 5
+
+/* since_fail of a case that has never failed				    */
+#define TEST_HISTORY_NEVER 0xffffffffU
+
+/* First line of a history file, so a stray file isn't taken for one     */
+#define TEST_HISTORY_MAGIC "lil_test-history-1"
+
+/* Room for "set/case" in the history					    */
+#define TEST_HISTORY_NAME_SIZE 512
+
+/* What's known about one case from previous runs			    */
+typedef struct test_history_entry {
+	/* "set/test_case", as the names are printed			    */
+	char * name ;
+
+	/* Smoothed duration in nanoseconds				    */
+	unsigned long long ns ;
+
+	/* Runs since it last failed: 0 if it failed last time, or NEVER     */
+	unsigned int since_fail ;
+} test_history_entry_t ;
+
+/* Every case's history, sorted by name and loaded on first use	    */
+static struct {
+	int loaded ;
+	size_t count, capacity ;
+	test_history_entry_t * entries ;
+} test_history = { 0 } ;
+
+ /*
+  * Identifier:
+  * 		test_history_find(name, at), test_history_insert(name),
+  * 		test_history_load(), test_history_save()
+  *
+  * Purpose:
+  * 		Keep a small history of how long each case took and when it
+  * 	       +last failed, in the file named by --history, so the next run
+  * 	       +can put the cases that matter first.
+  *
+  * Inputs:
+  * 		   name	: "set/test_case"
+  *
+  * 		     at	: Where name is or would go in the sorted entries, if
+  * 		     	 +not NULL
+  *
+  * Resolution:
+  * 		The file is a line of TEST_HISTORY_MAGIC, then a line of
+  * 	       +"ns since_fail name" per case. It is read the first time a
+  * 	       +set needs it and rewritten atomically after each set, so a
+  * 	       +run that crashes keeps what it learned. A missing or foreign
+  * 	       +file is an empty history; failing to save one is reported on
+  * 	       +stderr and otherwise ignored.
+  */
+static inline test_history_entry_t * test_history_find(const char * name,
+							size_t * at)
+{
+	size_t low = 0, high = test_history.count, mid ;
+	int order ;
+
+	while (low < high) {
+		mid = low + (high - low) / 2 ;
+		order = strcmp(name, test_history.entries[mid].name) ;
+		if (!order) {
+			if (at) *at = mid ;
+			return test_history.entries + mid ;
+		}
+		if (order < 0) high = mid ;
+		else low = mid + 1 ;
+	}
+	if (at) *at = low ;
+
+	return NULL ;
+}
+
+static inline test_history_entry_t * test_history_insert(const char * name)
+{
+	test_history_entry_t * entry ;
+	size_t at ;
+
+	if ((entry = test_history_find(name, &at))) return entry ;
+
+	if (test_history.count >= test_history.capacity) {
+		test_history.capacity = test_history.capacity
+					? test_history.capacity * 2 : 64 ;
+		REALLOCATE_OR_DIE(test_history.entries, test_history.capacity) ;
+	}
+
+	entry = test_history.entries + at ;
+	memmove(entry + 1, entry, (test_history.count++ - at) * sizeof(*entry)) ;
+	entry->name = NULL ;
+	REALLOCATE_OR_DIE(entry->name, (strlen(name) + 1)) ;
+	strcpy(entry->name, name) ; /* Safe: sized just above		    */
+	entry->ns = 0 ;
+	entry->since_fail = TEST_HISTORY_NEVER ;
+
+	return entry ;
+}
+
+static inline void test_history_load(void)
+{
+	char magic[sizeof(TEST_HISTORY_MAGIC)], name[TEST_HISTORY_NAME_SIZE] ;
+	unsigned long long ns ;
+	unsigned int since_fail ;
+	test_history_entry_t * entry ;
+	FILE * stream ;
+
+	if (test_history.loaded) return ;
+	test_history.loaded = 1 ;
+
+	if (!(stream = fopen(test_options.history, "r"))) return ;
+
+	if (fscanf(stream, "%18s", magic) == 1
+	    && !strcmp(magic, TEST_HISTORY_MAGIC)) {
+		while (fscanf(stream, "%llu %u %511s", &ns, &since_fail,
+			      name) == 3) {
+			entry = test_history_insert(name) ;
+			entry->ns = ns ;
+			entry->since_fail = since_fail ;
+		}
+	}
+
+	fclose(stream) ;
+}
+
+static inline void test_history_save(void)
+{
+	char * text = NULL ;
+	size_t size = 0 ;
+	FILE * stream ;
+
+	if (!(stream = open_memstream(&text, &size))) return ;
+
+	fprintf(stream, "%s\n", TEST_HISTORY_MAGIC) ;
+	for (size_t i = 0; i < test_history.count; ++i)
+		fprintf(stream, "%llu %u %s\n", test_history.entries[i].ns,
+			test_history.entries[i].since_fail,
+			test_history.entries[i].name) ;
+
+	if (!fclose(stream) && test_golden_write(test_options.history, text,
+						 size))
+		fprintf(stderr, "lil_test: can't save history to %s: %s\n",
+			test_options.history, strerror(errno)) ;
+	free(text) ;
+}
+
+/* Nothing else frees the history, which lives as long as the program    */
+__attribute__((destructor))
+static void test_history_free(void)
+{
+	for (size_t i = 0; i < test_history.count; ++i)
+		free(test_history.entries[i].name) ;
+	free(test_history.entries) ;
+}
+
+/* The history entry for a case, or NULL if it has none		    */
+static inline test_history_entry_t * test_history_lookup(const char * set,
+							  const char * name)
+{
+	char key[TEST_HISTORY_NAME_SIZE] ;
+
+	snprintf(key, sizeof(key), "%s/%s", set, name) ;
+
+	return test_history_find(key, NULL) ;
+}
+
+/* Fold a case's latest run into its history				    */
+static inline void test_history_record(const char * set, const char * name,
+				       int passed, unsigned long long ns)
+{
+	char key[TEST_HISTORY_NAME_SIZE] ;
+	test_history_entry_t * entry ;
+
+	snprintf(key, sizeof(key), "%s/%s", set, name) ;
+	entry = test_history_insert(key) ;
+
+	/* A quarter of the way to each new duration, so one slow run in a  */
+	/* noisy one doesn't reorder everything				    */
+	entry->ns = entry->ns ? entry->ns - entry->ns / 4 + ns / 4 : ns ;
+
+	if (!passed) entry->since_fail = 0 ;
+	else if (entry->since_fail < TEST_HISTORY_NEVER - 1)
+		entry->since_fail++ ;
+}
+
+/* Order of the groups cases are sorted into				    */
+#define TEST_TIER_FAILED 0	/* Failed within TEST_HISTORY_RECENT runs   */
+#define TEST_TIER_NEW 	 1	/* No history, likely still being written   */
+#define TEST_TIER_REST 	 2	/* Everything else			    */
+
+/* What a case is sorted by						    */
+typedef struct test_schedule_key {
+	size_t index ;
+	int tier, longest_first ;
+	unsigned int since_fail ;
+	unsigned long long ns ;
+} test_schedule_key_t ;
+
+static int test_schedule_compare(const void * a, const void * b)
+{
+	const test_schedule_key_t * x = a, * y = b ;
+
+	if (x->tier != y->tier) return x->tier - y->tier ;
+
+	if (x->tier == TEST_TIER_FAILED) {
+		/* Most recent failures first, quickest first among them    */
+		if (x->since_fail != y->since_fail)
+			return x->since_fail < y->since_fail ? -1 : 1 ;
+		if (x->ns != y->ns) return x->ns < y->ns ? -1 : 1 ;
+	} else if (x->tier == TEST_TIER_REST && x->longest_first
+		   && x->ns != y->ns) {
+		return x->ns > y->ns ? -1 : 1 ;
+	}
+
+	/* Otherwise as declared					    */
+	return x->index < y->index ? -1 : x->index > y->index ;
+}
+
+ /*
+  * Identifier:
+  * 		test_schedule_order(set, order)
+  *
+  * Purpose:
+  * 		Decide what order to run a set's cases in.
+  *
+  * Inputs:
+  * 		    set	: The test set
+  *
+  * 		  order	: Room for case_count_total case indices
+  *
+  * Resolution:
+  * 		Without history, order is declaration order. With
+  * 	       +--failed-first, cases that failed in the last
+  * 	       +TEST_HISTORY_RECENT runs come first, most recent and then
+  * 	       +quickest first, then cases with no history. With --jobs,
+  * 	       +cases with no history come first too, and the rest go longest
+  * 	       +expected first, so the run doesn't end waiting on one
+  * 	       +straggler. Everything else stays in declaration order, which
+  * 	       +is also how ties are broken.
+  *
+  * Requirements:
+  * 		Cases must not depend on each other having run if their order
+  * 	       +is going to change.
+  */
+static inline void test_schedule_order(test_set_data_t * set, size_t * order)
+{
+	size_t total = set->case_count_total ;
+	int longest_first = test_options.jobs > 1 ;
+	test_schedule_key_t * keys = NULL ;
+	test_history_entry_t * entry ;
+
+	for (size_t i = 0; i < total; ++i) order[i] = i ;
+	if (!test_options.history || !total) return ;
+
+	test_history_load() ;
+	REALLOCATE_OR_DIE(keys, total) ;
+
+	for (size_t i = 0; i < total; ++i) {
+		entry = test_history_lookup(set->set_name, set->case_names[i]) ;
+		keys[i] = (test_schedule_key_t) {
+			i, TEST_TIER_REST, longest_first,
+			entry ? entry->since_fail : TEST_HISTORY_NEVER,
+			entry ? entry->ns : 0
+		} ;
+		if (!entry && (test_options.failed_first || longest_first))
+			keys[i].tier = TEST_TIER_NEW ;
+		else if (entry && test_options.failed_first
+			 && entry->since_fail < TEST_HISTORY_RECENT)
+			keys[i].tier = TEST_TIER_FAILED ;
+	}
+
+	qsort(keys, total, sizeof(*keys), test_schedule_compare) ;
+	for (size_t i = 0; i < total; ++i) order[i] = keys[i].index ;
+
+	free(keys) ;
+}
+
+/* Where a case stands in a scheduled run				    */
+#define TEST_JOB_WAITING 0
+#define TEST_JOB_RUNNING 1
+#define TEST_JOB_DONE	 2
+
+/* One case's slot in a scheduled run					    */
+typedef struct test_job_slot {
+	int state, passed ;
+	unsigned long long ns ;
+} test_job_slot_t ;
+
+/* A scheduled run, shared with any worker processes			    */
+typedef struct test_jobs {
+	/* Next place in the order to hand out, taken atomically	    */
+	size_t next ;
+
+	/* Set by the first failure under --fail-fast			    */
+	int stop ;
+
+	test_job_slot_t slots[] ;
+} test_jobs_t ;
+
+/* Set once --fail-fast has seen a failure, to end the run after the set */
+static int test_stopped = 0 ;
+
+/* Run case i of set with its output held, timing it into ns if not NULL */
+static inline int test_run_case(test_set_data_t * set, size_t i,
+				unsigned long long * ns)
+{
+	unsigned long long begun = ns ? test_timing_now() : 0 ;
+	unsigned int depth ;
+	int passed ;
+
+	test_telemetry_case_begin(set, i) ; /* Show it's running	    */
+	depth = test_trace_case_begin(set, i) ; /* Time it on the trace    */
+	test_capture_begin() ;		 /* Hold what it logs		    */
+	test_incremental_case_begin() ;	 /* And note what it calls	    */
+	passed = set->cases[i](i) ;	 /* Run it			    */
+	test_incremental_case_end(set, i, passed) ;
+	if (ns) *ns = test_timing_now() - begun ;
+	test_capture_end(!passed &&	 /* In case it returned by	    */
+		TEST_CAPTURE_DUMP_FAILURES) ; /* +some other route	    */
+	test_trace_case_end(depth) ;
+	test_telemetry_case_end(passed) ;
+
+	return passed ;
+}
+
+/* Take cases off the order until there are none left or a stop	    */
+static inline void test_jobs_work(test_set_data_t * set, test_jobs_t * jobs,
+				  const size_t * order, int worker)
+{
+	test_job_slot_t * slot ;
+	size_t next ;
+
+	while (!__atomic_load_n(&jobs->stop, __ATOMIC_ACQUIRE)
+	       && (next = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_ACQ_REL))
+		  < set->case_count_total) {
+		slot = jobs->slots + order[next] ;
+		__atomic_store_n(&slot->state, TEST_JOB_RUNNING,
+				 __ATOMIC_RELEASE) ;
+		slot->passed = test_run_case(set, order[next], &slot->ns) ;
+		__atomic_store_n(&slot->state, TEST_JOB_DONE, __ATOMIC_RELEASE) ;
+
+		if (!slot->passed && test_options.fail_fast)
+			__atomic_store_n(&jobs->stop, 1, __ATOMIC_RELEASE) ;
+
+		/* A case's lines go out together, not mixed with another's */
+		if (worker) {
+			fflush(stdout) ;
+			fflush(stderr) ;
+		}
+	}
+}
+
+ /*
+  * Identifier:
+  * 		test_jobs_fork(set, jobs, order)
+  *
+  * Purpose:
+  * 		Run a set's cases in --jobs worker processes.
+  *
+  * Inputs:
+  * 		    set	: The test set, already defined
+  *
+  * 		   jobs	: The run, in memory shared with the workers
+  *
+  * 		  order	: The order to hand cases out in
+  *
+  * Resolution:
+  * 		Each worker is a fork of the set as it stands after its
+  * 	       +definition, and takes the next case off the order until none
+  * 	       +are left, so the longest cases handed out first keep every
+  * 	       +worker busy. A case whose worker died is reported as failed.
+  * 	       +If no worker can be started, the cases run here instead.
+  */
+static inline void test_jobs_fork(test_set_data_t * set, test_jobs_t * jobs,
+				  const size_t * order)
+{
+	size_t total = set->case_count_total ;
+	unsigned int workers = test_options.jobs < total ? test_options.jobs
+							 : total, started = 0 ;
+	pid_t pids[workers] ;
+	int status ;
+
+	/* Or the workers would each print whatever is still buffered	    */
+	fflush(stdout) ;
+	fflush(stderr) ;
+
+	for (unsigned int w = 0; w < workers; ++w) {
+		pid_t pid = fork() ;
+
+		if (!pid) {
+			/* The scratch file's offset would be shared	    */
+			if (test_capture.file) fclose(test_capture.file) ;
+			test_capture.file = NULL ;
+
+			test_telemetry_worker(w + 1) ;
+			test_jobs_work(set, jobs, order, 1) ;
+			_exit(0) ; /* Not exit(), the other sets aren't ours */
+		}
+		if (pid > 0) pids[started++] = pid ;
+	}
+
+	if (!started) {
+		test_jobs_work(set, jobs, order, 0) ;
+		return ;
+	}
+
+	for (unsigned int w = 0; w < started; ++w) {
+		while (waitpid(pids[w], &status, 0) < 0 && errno == EINTR) ;
+	}
+
+	for (size_t i = 0; i < total; ++i) {
+		if (jobs->slots[i].state != TEST_JOB_RUNNING) continue ;
+		fprintf(stdout, "FAIL %s:\n\tworker died running it\n\n",
+			set->case_names[i]) ;
+		jobs->slots[i].state = TEST_JOB_DONE ;
+		jobs->slots[i].passed = 0 ;
+		if (test_options.fail_fast) jobs->stop = 1 ;
+	}
+}
+
+/* Room kept for what a case's first failing run printed		    */
+#define TEST_REPEAT_OUTPUT_SIZE (64 << 10)
+
+/* z for a 95% confidence interval					    */
+#define TEST_REPEAT_Z 1.959964
+
+/* Most runs of each case under --until-fail alone, without --case	    */
+#define TEST_REPEAT_UNTIL_FAIL_RUNS 10000ULL
+
+/* One case's repeated runs, shared with any worker processes		    */
+typedef struct test_repeat {
+	/* Next run to hand out, taken atomically, and how many there are */
+	unsigned long long next, limit ;
+
+	/* Runs finished, and how many of them passed			    */
+	unsigned long long runs, passes ;
+
+	/* Set by a failure under --until-fail				    */
+	int stop ;
+
+	/* Held while the first failure below is looked at		    */
+	int lock ;
+
+	/* The earliest run that failed, or ~0, and what it printed	    */
+	unsigned long long first_fail ;
+	size_t output_size ;
+	char output[TEST_REPEAT_OUTPUT_SIZE] ;
+} test_repeat_t ;
+
+ /*
+  * Identifier:
+  * 		test_wilson(passes, runs, low, high)
+  *
+  * Purpose:
+  * 		Say how sure a pass rate is. A case that passed 500 times out
+  * 	       +of 500 may still fail once in a thousand.
+  *
+  * Inputs:
+  * 		 passes	: How many runs passed
+  *
+  * 		   runs	: Of how many, at least one
+  *
+  * 	      low, high	: Where to put the bounds, as fractions
+  *
+  * Resolution:
+  * 		The Wilson score interval at 95% confidence, which unlike
+  * 	       +p +/- z*sqrt(p(1-p)/n) is still sensible at 0 or n passes.
+  */
+static inline void test_wilson(unsigned long long passes,
+			       unsigned long long runs, double * low,
+			       double * high)
+{
+	double n = runs, p = passes / n, z2 = TEST_REPEAT_Z * TEST_REPEAT_Z,
+	       center = (p + z2 / (2 * n)) / (1 + z2 / n),
+	       half = TEST_REPEAT_Z * test_sqrt(p * (1 - p) / n
+						+ z2 / (4 * n * n))
+		      / (1 + z2 / n) ;
+
+	*low = center - half > 0 ? center - half : 0 ;
+	*high = center + half < 1 ? center + half : 1 ;
+}
+
+/* Run case i once in a child, as the set stood after its definition,   */
+/* with seed and its output going to out. Nonzero if it passed	    */
+static inline int test_repeat_once(test_set_data_t * set, size_t i,
+				   unsigned long long seed, int out)
+{
+	pid_t pid ;
+	int status ;
+
+	if (ftruncate(out, 0)) { /* Then it's just longer */ }
+	lseek(out, 0, SEEK_SET) ;
+
+	if (!(pid = fork())) {
+		dup2(out, STDOUT_FILENO) ;
+		dup2(out, STDERR_FILENO) ;
+		if (test_capture.file) fclose(test_capture.file) ;
+		test_capture.file = NULL ;
+
+		/* A different start each run shakes up thread interleavings */
+		test_seed = seed ;
+		srand(seed) ;
+		for (volatile unsigned int spin = seed % 4096; spin; --spin) ;
+
+		status = test_run_case(set, i, NULL) ;
+		fflush(stdout) ;
+		fflush(stderr) ;
+		_exit(!status) ; /* Not exit(), the other sets aren't ours  */
+	}
+	if (pid < 0) {
+		dprintf(out, "can't fork: %s\n", strerror(errno)) ;
+		return 0 ;
+	}
+
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR) ;
+	if (WIFSIGNALED(status))
+		dprintf(out, "\tkilled by signal %d\n", WTERMSIG(status)) ;
+
+	return WIFEXITED(status) && !WEXITSTATUS(status) ;
+}
+
+/* Take runs of case i until there are none left or a stop		    */
+static inline void test_repeat_work(test_set_data_t * set, size_t i,
+				    test_repeat_t * repeat)
+{
+	FILE * scratch = tmpfile() ;
+	unsigned long long run ;
+	int out, passed ;
+
+	if (!scratch) {
+		fprintf(stderr, "lil_test: no scratch file: %s\n",
+			strerror(errno)) ;
+		return ;
+	}
+	out = fileno(scratch) ;
+
+	while (!__atomic_load_n(&repeat->stop, __ATOMIC_ACQUIRE)
+	       && (run = __atomic_fetch_add(&repeat->next, 1,
+					    __ATOMIC_ACQ_REL))
+		  < repeat->limit) {
+		passed = test_repeat_once(set, i, test_options.seed + run,
+					  out) ;
+		__atomic_fetch_add(&repeat->passes, passed, __ATOMIC_ACQ_REL) ;
+		__atomic_fetch_add(&repeat->runs, 1, __ATOMIC_ACQ_REL) ;
+		if (passed) continue ;
+
+		if (test_options.until_fail)
+			__atomic_store_n(&repeat->stop, 1, __ATOMIC_RELEASE) ;
+
+		/* Keep the earliest failure, whichever worker saw it	    */
+		while (__atomic_exchange_n(&repeat->lock, 1, __ATOMIC_ACQUIRE))
+			sched_yield() ;
+		if (run < repeat->first_fail) {
+			ssize_t size = pread(out, repeat->output,
+					     sizeof(repeat->output), 0) ;
+
+			repeat->first_fail = run ;
+			repeat->output_size = size > 0 ? size : 0 ;
+		}
+		__atomic_store_n(&repeat->lock, 0, __ATOMIC_RELEASE) ;
+	}
+
+	fclose(scratch) ;
+}
+
+ /*
+  * Identifier:
+  * 		test_repeat_case(set, i, repeat)
+  *
+  * Purpose:
+  * 		Find out how flaky one case is, by running it many times.
+  *
+  * Inputs:
+  * 		    set	: The test set, already defined
+  *
+  * 		      i	: The case
+  *
+  * 		 repeat	: Where to count, in shared memory, with limit set
+  *
+  * Resolution:
+  * 		Every run is a fork of the set as it stood after its
+  * 	       +definition, so it is never constructed again and no run sees
+  * 	       +what another left behind. Run r gets test_seed
+  * 	       +test_options.seed + r, and its output is only kept if it is
+  * 	       +the earliest to fail. With --jobs, runs are taken by that
+  * 	       +many worker processes at once.
+  */
+static inline void test_repeat_case(test_set_data_t * set, size_t i,
+				    test_repeat_t * repeat)
+{
+	unsigned long long workers = test_options.jobs ;
+	pid_t pids[workers ? workers : 1] ;
+	unsigned int started = 0 ;
+
+	repeat->first_fail = ~0ULL ;
+
+	/* Or every child would print whatever is still buffered	    */
+	fflush(stdout) ;
+	fflush(stderr) ;
+
+	for (unsigned int w = 0; workers > 1 && w < workers
+	     && w < repeat->limit; ++w) {
+		pid_t pid = fork() ;
+
+		if (!pid) {
+			test_telemetry_worker(w + 1) ;
+			test_repeat_work(set, i, repeat) ;
+			_exit(0) ;
+		}
+		if (pid > 0) pids[started++] = pid ;
+	}
+
+	if (!started) test_repeat_work(set, i, repeat) ;
+
+	for (unsigned int w = 0; w < started; ++w) {
+		while (waitpid(pids[w], NULL, 0) < 0 && errno == EINTR) ;
+	}
+}
+
+/* Print how case i of set did over its runs				    */
+static inline void test_repeat_report(test_set_data_t * set, size_t i,
+				      test_repeat_t * repeat)
+{
+	double low, high ;
+
+	if (!repeat->runs) {
+		fprintf(stdout, "REPEAT %s: never ran\n\n", set->case_names[i]) ;
+		return ;
+	}
+
+	test_wilson(repeat->passes, repeat->runs, &low, &high) ;
+	fprintf(stdout, "REPEAT %s: %llu/%llu runs passed, %.2f%% "
+		"(95%% CI %.2f%% to %.2f%%)\n", set->case_names[i],
+		repeat->passes, repeat->runs,
+		100.0 * repeat->passes / repeat->runs, 100 * low, 100 * high) ;
+
+	if (repeat->first_fail != ~0ULL) {
+		fprintf(stdout, "\tfirst failed on run %llu, seed %llu "
+			"(--seed %llu --repeat 1 reruns it):\n\n",
+			repeat->first_fail + 1,
+			test_options.seed + repeat->first_fail,
+			test_options.seed + repeat->first_fail) ;
+		fwrite(repeat->output, 1, repeat->output_size, stdout) ;
+		if (repeat->output_size == sizeof(repeat->output))
+			fprintf(stdout, "\n\t... and more\n") ;
+	}
+	fprintf(stdout, "\n") ;
+}
+
+/* Runs to allow each case: --repeat N if given, else no limit when    */
+/* --until-fail hunts the cases only picks, else a cap, so that a whole */
+/* suite that never fails still finishes				    */
+static inline unsigned long long test_repeat_limit(const char * only)
+{
+	if (test_options.repeat) return test_options.repeat ;
+
+	return only ? ~0ULL : TEST_REPEAT_UNTIL_FAIL_RUNS ;
+}
+
+/* Repeat each of a set's cases that --case picks, counting a case as    */
+/* passed if every run of it did					    */
+static inline void test_repeat_run(test_set_data_t * set)
+{
+	char name[TEST_HISTORY_NAME_SIZE] ;
+	test_repeat_t * repeat ;
+	size_t skipped = 0 ;
+
+	if (!test_options.jobs)
+		test_options.jobs = sysconf(_SC_NPROCESSORS_ONLN) ;
+
+	repeat = mmap(NULL, sizeof(*repeat), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0) ;
+	if (repeat == MAP_FAILED) { TEST_ERROR_ALLOC_FAIL(sizeof(*repeat)) ; }
+
+	for (size_t i = 0; i < set->case_count_total; ++i) {
+		snprintf(name, sizeof(name), "%s/%s", set->set_name,
+			 set->case_names[i]) ;
+		if (test_options.only
+		    && fnmatch(test_options.only, name, 0)
+		    && fnmatch(test_options.only, set->case_names[i], 0)) {
+			skipped++ ;
+			continue ;
+		}
+
+		memset(repeat, 0, sizeof(*repeat)) ;
+		repeat->limit = test_repeat_limit(test_options.only) ;
+		test_repeat_case(set, i, repeat) ;
+		test_repeat_report(set, i, repeat) ;
+		set->case_count_passed += repeat->runs
+					  && repeat->passes == repeat->runs ;
+	}
+
+	if (skipped)
+		fprintf(stdout, "NOT SELECTED by --case, "
+			"%lu test cases not run.\n", skipped) ;
+
+	munmap(repeat, sizeof(*repeat)) ;
+}
+
+ /*
+  * Identifier:
+  * 		test_schedule_run(set)
+  *
+  * Purpose:
+  * 		Run all of a set's cases and count the passes, as the command
+  * 	       +line asked.
+  *
+  * Inputs:
+  * 		    set	: The test set, already defined
+  *
+  * Resolution:
+  * 		With no scheduling options, the cases just run in declaration
+  * 	       +order. Otherwise they are ordered by test_schedule_order(),
+  * 	       +run here or in workers, and timed into the history, which is
+  * 	       +then saved. Under --fail-fast, cases after the first failure
+  * 	       +aren't run and are reported as such, and test_stopped is set.
+  * 	       +Under --repeat or --until-fail, test_repeat_run() takes over.
+  */
+static inline void test_schedule_run(test_set_data_t * set)
+{
+	size_t total = set->case_count_total, size, skipped = 0,
+	       * order = NULL ;
+	test_jobs_t * jobs ;
+
+	if (test_options.repeat || test_options.until_fail) {
+		test_repeat_run(set) ;
+		return ;
+	}
+
+	if (!test_options.history && !test_options.fail_fast) {
+		for (size_t i = 0; i < total; ++i)
+			set->case_count_passed += test_run_case(set, i, NULL) ;
+		return ;
+	}
+
+	REALLOCATE_OR_DIE(order, (total ? total : 1)) ;
+	test_schedule_order(set, order) ;
+
+	size = sizeof(*jobs) + total * sizeof(test_job_slot_t) ;
+	jobs = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0) ;
+	if (jobs == MAP_FAILED) { TEST_ERROR_ALLOC_FAIL(size) ; }
+
+	if (test_options.jobs > 1 && total > 1 && !test_incremental_active())
+		test_jobs_fork(set, jobs, order) ;
+	else
+		test_jobs_work(set, jobs, order, 0) ;
+
+	for (size_t i = 0; i < total; ++i) {
+		if (jobs->slots[i].state != TEST_JOB_DONE) {
+			skipped++ ;
+			continue ;
+		}
+		set->case_count_passed += jobs->slots[i].passed ;
+		if (test_options.history)
+			test_history_record(set->set_name, set->case_names[i],
+					    jobs->slots[i].passed,
+					    jobs->slots[i].ns) ;
+	}
+
+	if (skipped)
+		fprintf(stdout, "STOPPED after the first failure, "
+			"%lu test cases not run.\n", skipped) ;
+	if (jobs->stop) test_stopped = 1 ;
+	if (test_options.history) test_history_save() ;
+
+	munmap(jobs, size) ;
+	free(order) ;
+}
+
+/* End the run once a set is done, if --fail-fast saw a failure in it.  */
+/* Under a host, only say so in set, so the host can print its report   */
+static inline void test_schedule_stop(test_registration_t * set)
+{
+	set->stopped = test_stopped ;
+	if (test_stopped && !test_host_register) exit(EXIT_FAILURE) ;
+}
 
 #endif /* ifndef __GNUC__ */
 
@@ -0,0 +1,163 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_test_host.c source file
+ * Run the test sets of many test suites in one process
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Usage: lil_test_host [OPTION]... SUITE.so...
+ *
+ * A suite is a test program built with -fPIC -shared instead of as an
+ * executable (see make host). Loading it runs no tests: its TEST_SETs find
+ * test_host_register() here and register themselves. Once every suite is
+ * loaded they run one after another, suite by suite, and a merged report
+ * follows. The options are those of any lil_test program and apply to
+ * every suite.
+ *
+ * A suite named twice, by any path, is loaded and run once.
+ *
+ * Exits nonzero if a suite couldn't be loaded. Like any test program,
+ * failing cases are reported rather than exited on, except that under
+ * --fail-fast the first set with a failure ends the run. The merged report
+ * still follows, and the exit status is nonzero.
+ */
+
+#include "lil_test.h"
+#include <dlfcn.h>
+
+// Every test set registered so far, and which suite it came from
+static struct {
+	test_registration_t ** sets ;
+	const char ** suites ;
+	size_t count, capacity ;
+
+	// The suite being loaded, while its constructors run
+	const char * loading ;
+} test_host = { 0 } ;
+
+void test_host_register(test_registration_t * set)
+{
+	if (test_host.count >= test_host.capacity) {
+		test_host.capacity = test_host.capacity
+				     ? test_host.capacity * 2 : 64 ;
+		REALLOCATE_OR_DIE(test_host.sets, test_host.capacity) ;
+		REALLOCATE_OR_DIE(test_host.suites, test_host.capacity) ;
+	}
+
+	test_host.sets[test_host.count] = set ;
+	test_host.suites[test_host.count++] = test_host.loading ;
+}
+
+// Skip an option and, if it takes one, its value. Nonzero if it was one
+static int test_host_option(int argc, char ** argv, int * i)
+{
+	static const char * const valued[] = {
+		"--jobs", "--history", "--repeat", "--seed", "--case",
+		"--bench-cpu", "--bench-samples", "--trace"
+	} ;
+
+	if (strncmp(argv[*i], "--", 2)) return 0 ;
+
+	// Anything lil_test doesn't know about was ignored there, and here
+	for (size_t v = 0; v < sizeof(valued) / sizeof(*valued); ++v) {
+		if (test_option_value(argc, argv, i, valued[v])) break ;
+	}
+
+	return 1 ;
+}
+
+int main(int argc, char ** argv)
+{
+	void ** handles = NULL ;
+	char path[4096] ;
+	size_t suites = 0, passed = 0, total = 0, failed_sets = 0, ran = 0 ;
+	int failed = 0, stopped = 0, loaded ;
+
+	REALLOCATE_OR_DIE(handles, (argc > 1 ? argc : 1)) ;
+
+	// Load them all first, so nothing runs while a suite is missing
+	for (int i = 1; i < argc; ++i) {
+		if (test_host_option(argc, argv, &i)) continue ;
+
+		// dlopen() searches the library path for a bare name
+		snprintf(path, sizeof(path), "%s%s",
+			 strchr(argv[i], '/') ? "" : "./", argv[i]) ;
+		test_host.loading = argv[i] ;
+		if (!(handles[suites] = dlopen(path, RTLD_NOW | RTLD_LOCAL))) {
+			fprintf(stderr, "lil_test_host: %s\n", dlerror()) ;
+			failed = 1 ;
+			continue ;
+		}
+
+		// Case: Already loaded, by this name or another. Its sets
+		// registered the first time, so just give back the reference
+		for (loaded = 0; (size_t)loaded < suites
+		     && handles[loaded] != handles[suites]; ++loaded) ;
+		if ((size_t)loaded < suites) {
+			dlclose(handles[suites]) ;
+			continue ;
+		}
+		suites++ ;
+	}
+	test_host.loading = NULL ;
+
+	if (!suites) {
+		fprintf(stderr, "Usage: %s [OPTION]... SUITE.so...\n", argv[0]) ;
+		free(handles) ;
+		return 1 ;
+	}
+
+	// Under --fail-fast a set with a failure says so rather than exiting,
+	// so the report below still gets printed
+	for (; ran < test_host.count && !stopped; ++ran) {
+		test_registration_t * set = test_host.sets[ran] ;
+
+		set->run() ;
+		passed += set->passed ;
+		total += set->total ;
+		failed_sets += set->passed != set->total ;
+		stopped = set->stopped ;
+	}
+
+	// The merged report, failing sets first named again so they're easy
+	// to find at the bottom of a long log
+	for (size_t i = 0; i < ran; ++i) {
+		test_registration_t * set = test_host.sets[i] ;
+
+		if (set->passed != set->total)
+			fprintf(stdout, "FAILED TEST_SET: %s (%s) %lu/%lu\n",
+				set->name, test_host.suites[i], set->passed,
+				set->total) ;
+	}
+	if (stopped)
+		fprintf(stdout, "STOPPED by --fail-fast, %lu TEST_SETs not "
+			"run.\n", test_host.count - ran) ;
+	fprintf(stdout, "\nFINISHED %lu TEST_SETs from %lu suites, "
+		"%lu with failures\n\tPassed %lu/%lu test cases.\n\n",
+		ran, suites, failed_sets, passed, total) ;
+	fflush(stdout) ;
+
+	// Their destructors save what they kept, like history
+	while (suites--) dlclose(handles[suites]) ;
+	free(handles) ;
+	free(test_host.sets) ;
+	free(test_host.suites) ;
+
+	return failed || stopped ;
+}
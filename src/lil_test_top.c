@@ -0,0 +1,181 @@
+/*
+ *  Extremely lightweight testing framework for GNU C
+ *  Copyright (C) 2019 Joel Savitz
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lil_test_top.c source file
+ * Watch a test program run --telemetry from outside it
+ * By Joel Savitz <jsavitz@redhat.com>
+ *
+ * Usage: lil_test_top [--once] [--interval MS] [PID]
+ *
+ * Shows the sets done, the cases passed and failed, what each worker is
+ * running and for how long, redrawn every --interval milliseconds (100 by
+ * default) until the run ends. With no PID it watches the newest run. The
+ * test program only ever writes to its segment: reading it here takes no
+ * lock and makes no syscall there, however often it's done.
+ *
+ * Exits nonzero if there's no run to watch.
+ */
+
+#include "lil_test.h"
+#include <dirent.h>
+#include <signal.h>
+
+// The pid of the newest segment in /dev/shm, or 0 if there are none
+static int lil_test_top_newest(void)
+{
+	struct dirent * entry ;
+	struct stat st ;
+	char path[300] ;
+	time_t newest = 0 ;
+	int pid = 0, candidate ;
+	DIR * dir = opendir("/dev/shm") ;
+
+	if (!dir) return 0 ;
+
+	while ((entry = readdir(dir))) {
+		if (sscanf(entry->d_name, "lil_test.%d", &candidate) != 1)
+			continue ;
+		snprintf(path, sizeof(path), TEST_TELEMETRY_PATH, candidate) ;
+		if (stat(path, &st) || (pid && st.st_mtime < newest)) continue ;
+		newest = st.st_mtime ;
+		pid = candidate ;
+	}
+	closedir(dir) ;
+
+	return pid ;
+}
+
+// Copy what seq guards, retrying while the writer is in the middle of it
+static void lil_test_top_read(const unsigned long long * seq, void * copy,
+			      const void * fields, size_t size)
+{
+	unsigned long long before, after ;
+
+	do {
+		while ((before = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) ;
+		memcpy(copy, fields, size) ;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE) ;
+		after = __atomic_load_n(seq, __ATOMIC_RELAXED) ;
+	} while (before != after) ;
+}
+
+// Draw one frame. Nonzero once the run is over
+static int lil_test_top_show(const test_telemetry_t * telemetry, int clear)
+{
+	test_telemetry_progress_t progress ;
+	test_telemetry_worker_t worker ;
+	unsigned long long now = test_timing_now(),
+		finished = __atomic_load_n(&telemetry->finished,
+					   __ATOMIC_ACQUIRE),
+		elapsed = (finished ? finished : now) - telemetry->started ;
+	int gone = kill(telemetry->pid, 0) && errno == ESRCH ;
+
+	lil_test_top_read(&telemetry->seq, &progress, &telemetry->progress,
+			  sizeof(progress)) ;
+
+	if (clear) fputs("\033[H\033[2J", stdout) ;
+	fprintf(stdout, "lil_test %d, %s %llu:%02llu:%02llu\n"
+		"sets\t%lu/%lu done%s%s\n"
+		"cases\t%llu passed, %llu failed\n\n"
+		"worker\tpid\tfor\tcase\n",
+		telemetry->pid, finished ? "finished after" : gone
+		? "gone after" : "running for", elapsed / 3600000000000ULL,
+		elapsed / 60000000000ULL % 60, elapsed / 1000000000ULL % 60,
+		progress.sets_done, progress.sets_total,
+		*progress.set ? ", running " : "", progress.set,
+		__atomic_load_n(&telemetry->passed, __ATOMIC_RELAXED),
+		__atomic_load_n(&telemetry->failed, __ATOMIC_RELAXED)) ;
+
+	for (unsigned int w = 0; w < telemetry->workers
+	     && w < TEST_TELEMETRY_WORKERS; ++w) {
+		lil_test_top_read(&telemetry->worker[w].seq, &worker,
+				  &telemetry->worker[w], sizeof(worker)) ;
+		if (!worker.pid || !worker.since) continue ;
+		fprintf(stdout, "%u\t%d\t%.1fs\t%.*s\n", w, worker.pid,
+			(now - worker.since) / 1e9,
+			TEST_TELEMETRY_NAME_SIZE, worker.name) ;
+	}
+	fflush(stdout) ;
+
+	return finished || gone ;
+}
+
+int main(int argc, char ** argv)
+{
+	const test_telemetry_t * telemetry ;
+	struct stat st ;
+	struct timespec interval = { 0, 100000000 } ;
+	const char * value ;
+	char path[64] ;
+	int pid = 0, once = 0, fd, tty = isatty(STDOUT_FILENO) ;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--once"))
+			once = 1 ;
+		else if ((value = test_option_value(argc, argv, &i,
+						    "--interval"))) {
+			interval.tv_sec = strtoul(value, NULL, 10) / 1000 ;
+			interval.tv_nsec = strtoul(value, NULL, 10) % 1000
+					   * 1000000 ;
+		} else
+			pid = atoi(argv[i]) ;
+	}
+
+	if (!pid && !(pid = lil_test_top_newest())) {
+		fprintf(stderr, "lil_test_top: no test program is running "
+			"with --telemetry\n") ;
+		return 1 ;
+	}
+
+	snprintf(path, sizeof(path), TEST_TELEMETRY_PATH, pid) ;
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		perror(path) ;
+		return 1 ;
+	}
+
+	// Opened between its creation and its growing to size, reading it
+	// would be a SIGBUS
+	while (!fstat(fd, &st) && (size_t)st.st_size < sizeof(*telemetry)) {
+		if (kill(pid, 0) && errno == ESRCH) {
+			fprintf(stderr, "lil_test_top: %d is gone\n", pid) ;
+			return 1 ;
+		}
+		nanosleep(&interval, NULL) ;
+	}
+
+	telemetry = mmap(NULL, sizeof(*telemetry), PROT_READ, MAP_SHARED, fd,
+			 0) ;
+	close(fd) ;
+	if (telemetry == MAP_FAILED) {
+		perror(path) ;
+		return 1 ;
+	}
+
+	// Or before the rest of it was filled in
+	while (__atomic_load_n(&telemetry->magic, __ATOMIC_ACQUIRE)
+	       != TEST_TELEMETRY_MAGIC)
+		nanosleep(&interval, NULL) ;
+
+	while (!lil_test_top_show(telemetry, tty && !once) && !once)
+		nanosleep(&interval, NULL) ;
+
+	munmap((void *)telemetry, sizeof(*telemetry)) ;
+
+	return 0 ;
+}